@@ -0,0 +1,317 @@
+/*
+ * Runs the library out of an arena on gpio_sim and the cdev mock with
+ * malloc and friends interposed. After init every path, pooled and fresh
+ * opens, sets, values, edges through the loop inline and on the worker
+ * pool, error reporting and DS1302 reads, must not reach the heap at all,
+ * and must give back every arena block it takes. Built with -DGPIO_STATS
+ * that covers the latency counters too: each thread attaches its block
+ * during init, so a record never allocates one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "gpio_arena.h"
+#include "gpio_cdev.h"
+#include "gpio_loop.h"
+#include "gpio_sim.h"
+#include "gpio_stats.h"
+#include "gpio_workq.h"
+#include "rtc.h"
+
+#define BENCH_ROUNDS 1000
+#define BENCH_ARENA (4u << 20)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+static int counting;
+static uint64_t heap_calls;
+
+static void heap_count(void)
+{
+    if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+        (void)__atomic_fetch_add(&heap_calls, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size)
+{
+    heap_count();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    heap_count();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    heap_count();
+    return __libc_realloc(p, size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    heap_count();
+    return __libc_memalign(align, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    heap_count();
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size)
+{
+    heap_count();
+    *out = __libc_memalign(align, size);
+    return *out == NULL ? 12 : 0;
+}
+
+void free(void *p)
+{
+    if (p != NULL) {
+        heap_count();
+    }
+    __libc_free(p);
+}
+
+static char arena_buf[BENCH_ARENA];
+static struct gpio_arena arena;
+static uint64_t handled;
+
+static int count_edge(enum gpio_value value, void *data)
+{
+    (void)value;
+    (void)__atomic_fetch_add((uint64_t *)data, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* arena blocks taken and not given back */
+static int64_t bench_held(void)
+{
+    struct gpio_arena_stats stats;
+    gpio_arena_stats(&arena, &stats);
+    return (int64_t)(stats.allocs - stats.frees);
+}
+
+/* runs a phase with counting on, prints what reached the heap and what the arena kept */
+static int bench_phase(const char *name, int (*phase)(void *), void *data)
+{
+    int64_t held = bench_held();
+    __atomic_store_n(&heap_calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counting, 1, __ATOMIC_RELAXED);
+    int ret = phase(data);
+    __atomic_store_n(&counting, 0, __ATOMIC_RELAXED);
+    uint64_t calls = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+    held = bench_held() - held;
+    printf("%-12s %8llu heap calls %4lld blocks kept%s\n", name, (unsigned long long)calls, (long long)held,
+           ret != 0 ? ", phase failed" : "");
+    return ret != 0 || calls != 0 || held != 0 ? -1 : 0;
+}
+
+static int phase_open(void *data)
+{
+    (void)data;
+    struct gpio_ops *ops = get_gpio_ops();
+    const unsigned int nrs[4] = { 5, 6, 7, 8 };
+    for (int i = 0; i < BENCH_ROUNDS; ++i) {
+        /* a line past the pool's idle limit comes back fresh now and then */
+        gpio *io = ops->open(26 + i % 32);
+        if (io == NULL) {
+            return -1;
+        }
+        ops->close(io);
+        gpio_set *set = ops->set_open(nrs, 4);
+        if (set == NULL) {
+            return -1;
+        }
+        ops->set_close(set);
+    }
+    return 0;
+}
+
+static int phase_values(void *data)
+{
+    (void)data;
+    enum gpio_value value;
+    uint64_t bits;
+    struct gpio_ops *ops = get_gpio_ops();
+    const unsigned int nrs[4] = { 5, 6, 7, 8 };
+    gpio_set *set = ops->set_open(nrs, 4);
+    if (set == NULL) {
+        return -1;
+    }
+    int ret = ops->set_directions(set, 0xf, 0xf);
+    for (int i = 0; i < BENCH_ROUNDS && ret == 0; ++i) {
+        ret = ops->set_value(set->lines[0], i & 1 ? GPIO_LOW : GPIO_HIGH);
+        ret = ret != 0 ? ret : ops->get_value(set->lines[0], &value);
+        ret = ret != 0 ? ret : ops->set_values(set, 0xf, (uint64_t)i);
+        ret = ret != 0 ? ret : ops->get_values(set, &bits);
+    }
+    ops->set_close(set);
+    return ret;
+}
+
+/* handlers on the pool finish on their own time */
+static bool bench_catch_up(uint64_t want)
+{
+    for (int spin = 0; spin < 100000 && __atomic_load_n(&handled, __ATOMIC_RELAXED) < want; ++spin) {
+        struct timespec ts = { 0, 10000 };
+        (void)nanosleep(&ts, NULL);
+    }
+    return __atomic_load_n(&handled, __ATOMIC_RELAXED) >= want;
+}
+
+static int phase_edges(void *data)
+{
+    struct gpio_loop *loop = (struct gpio_loop *)data;
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(22);
+    if (io == NULL) {
+        return -1;
+    }
+    uint64_t want = __atomic_load_n(&handled, __ATOMIC_RELAXED);
+    int ret = ops->set_direction(io, GPIO_IN);
+    ret = ret != 0 ? ret : gpio_loop_add(loop, io, GPIO_BOTH, count_edge, &handled);
+    for (int i = 0; i < BENCH_ROUNDS && ret == 0; ++i) {
+        (void)gpio_sim_set_input(22, i & 1 ? GPIO_LOW : GPIO_HIGH);
+        ret = gpio_loop_wait(loop, 100);
+        ++want;
+        /* on a single cpu the toggling could outrun the workers and fill a strand */
+        if (i % 32 == 31 && !bench_catch_up(want)) {
+            ret = -1;
+        }
+    }
+    if (!bench_catch_up(want) || __atomic_load_n(&handled, __ATOMIC_RELAXED) != want) {
+        ret = -1;
+    }
+    (void)gpio_loop_remove(loop, io);
+    ops->close(io);
+    return ret;
+}
+
+static int phase_errors(void *data)
+{
+    (void)data;
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(GPIO_SIM_LINES + 7);
+    if (io != NULL) {
+        ops->close(io);
+        return -1;
+    }
+    io = ops->open(9);
+    if (io == NULL) {
+        return -1;
+    }
+    int ret = ops->set_value(io, (enum gpio_value)7) != 0 ? 0 : -1;
+    ret = ret != 0 || ops->set_edge(io, (enum gpio_edge)9) != 0 ? ret : -1;
+    ops->close(io);
+    return ret;
+}
+
+static int phase_rtc(void *data)
+{
+    struct rtc_time got;
+    for (int i = 0; i < 20; ++i) {
+        if (rtc_read_timer((struct rtc_gpio *)data, &got) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int phase_cdev(void *data)
+{
+    (void)data;
+    struct gpio_ops *ops = get_gpio_ops();
+    const unsigned int nrs[3] = { 1, 2, 3 };
+    for (int i = 0; i < BENCH_ROUNDS; ++i) {
+        gpio *io = ops->open(10);
+        if (io == NULL) {
+            return -1;
+        }
+        int ret = ops->set_direction(io, GPIO_OUT);
+        ret = ret != 0 ? ret : ops->set_value(io, GPIO_HIGH);
+        ops->close(io);
+        gpio_set *set = ops->set_open(nrs, 3);
+        if (ret != 0 || set == NULL) {
+            return -1;
+        }
+        ops->set_close(set);
+    }
+    return 0;
+}
+
+/* the same open and set once each, so every block kind is in the arena already */
+static void bench_warm(void)
+{
+    (void)phase_open(NULL);
+    (void)phase_values(NULL);
+}
+
+int main(void)
+{
+    int ret = -1;
+    struct gpio_arena_stats stats;
+    if (gpio_arena_init(&arena, arena_buf, sizeof(arena_buf)) != 0) {
+        return 1;
+    }
+    gpio_set_arena(&arena);
+    if (gpio_stats_attach() != 0 || gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    (void)gpio_sim_ds1302_attach(23, 24, 25, time(NULL));
+    struct gpio_loop *loop = gpio_loop_create();
+    struct gpio_workq *wq = gpio_workq_create(2);
+    struct rtc_gpio *rtc = rtc_init(18, 23, 24, 25);
+    if (loop == NULL || wq == NULL || rtc == NULL || phase_rtc(rtc) != 0) {
+        fprintf(stderr, "init failed\n");
+        goto end;
+    }
+    bench_warm();
+    ret = bench_phase("open", phase_open, NULL);
+    ret |= bench_phase("values", phase_values, NULL);
+    ret |= bench_phase("edges", phase_edges, loop);
+    gpio_loop_set_workq(loop, wq);
+    ret |= bench_phase("edges/workq", phase_edges, loop);
+    gpio_loop_set_workq(loop, NULL);
+    ret |= bench_phase("errors", phase_errors, NULL);
+    ret |= bench_phase("rtc_read", phase_rtc, rtc);
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    (void)phase_cdev(NULL);
+    ret |= bench_phase("cdev", phase_cdev, NULL);
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    gpio_cdev_mock_uninstall();
+    gpio_arena_stats(&arena, &stats);
+    printf("%-12s %8llu allocs %llu reused %zu of %zu bytes used\n", "arena",
+           (unsigned long long)stats.allocs, (unsigned long long)stats.reused, stats.used, stats.size);
+end:
+    if (rtc != NULL) {
+        rtc_finalize(rtc);
+    }
+    if (wq != NULL) {
+        gpio_workq_destroy(wq);
+    }
+    if (loop != NULL) {
+        gpio_loop_destroy(loop);
+    }
+    gpio_sim_ds1302_detach();
+    gpio_sim_uninstall();
+    gpio_set_arena(NULL);
+    if (ret != 0) {
+        fprintf(stderr, "alloc bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
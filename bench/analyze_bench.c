@@ -0,0 +1,415 @@
+/*
+ * Writes captures of eight PWM lines with drifting duty and injected
+ * glitches, once as raw bit planes and once as rle records, and times
+ * gpio_analyze_lines on them over one to four threads against walking
+ * the same file a sample at a time with the capture cursor, which also
+ * gives the results every run has to match. Then decodes a synthetic
+ * DS1302 write and clock burst read and checks every byte and timing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gpio_analyze.h"
+#include "gpio_timing.h"
+
+#define BENCH_LINES 8
+#define BENCH_RAW_BLOCKS 16384
+#define BENCH_GLITCH 3
+#define BENCH_FILE "/tmp/analyze_bench.gcap"
+
+/* samples a raw block holds for BENCH_LINES planes */
+#define BENCH_WORDS (GPIO_CAPTURE_PAYLOAD / 8 / BENCH_LINES)
+#define BENCH_BLOCK_SAMPLES (BENCH_WORDS * 64)
+#define BENCH_SAMPLES ((uint64_t)BENCH_RAW_BLOCKS * BENCH_BLOCK_SAMPLES)
+
+/* line i runs at its own period, the duty steps through 10..90 % and a one sample pulse shows up now and then */
+static bool bench_level(unsigned int line, uint64_t s)
+{
+    uint64_t period = 50 + 13 * line;
+    uint64_t high = period * ((s / period / 64) % 9 + 1) / 10;
+    bool level = s % period < high;
+    return s % 10007 == 100 + line * 5 ? !level : level;
+}
+
+struct bench_writer {
+    int fd;
+    unsigned int lines;
+    uint32_t period_ns;
+    uint64_t blocks;
+    uint8_t buf[GPIO_CAPTURE_BLOCK];
+    struct gpio_capture_block *block;
+    uint8_t *pos;
+    uint64_t mark;
+    uint64_t state;
+};
+
+static int bench_open(struct bench_writer *w, unsigned int lines, uint32_t period_ns, uint64_t state)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    w->lines = lines;
+    w->period_ns = period_ns;
+    w->state = state;
+    w->block = (struct gpio_capture_block *)w->buf;
+    return w->fd == -1 ? -1 : 0;
+}
+
+static void bench_put_block(struct bench_writer *w, uint64_t first, uint64_t last, uint64_t state)
+{
+    w->block->magic = GPIO_CAPTURE_BLOCK_MAGIC;
+    w->block->first_tick = first;
+    w->block->last_tick = last;
+    w->block->state = state;
+    (void)pwrite(w->fd, w->buf, GPIO_CAPTURE_BLOCK, (off_t)((w->blocks + 1) * GPIO_CAPTURE_BLOCK));
+    ++w->blocks;
+    memset(w->buf, 0, sizeof(w->buf));
+}
+
+static void bench_close(struct bench_writer *w, uint64_t last)
+{
+    struct gpio_capture_header header;
+    memset(&header, 0, sizeof(header));
+    if (w->pos != NULL) {
+        bench_put_block(w, w->block->first_tick, last, w->block->state);
+    }
+    header.magic = GPIO_CAPTURE_MAGIC;
+    header.version = GPIO_CAPTURE_VERSION;
+    header.lines = (uint16_t)w->lines;
+    header.block_size = GPIO_CAPTURE_BLOCK;
+    header.period_ns = w->period_ns;
+    header.blocks = w->blocks;
+    for (unsigned int i = 0; i < w->lines; ++i) {
+        header.gpio_nr[i] = 20 + i;
+    }
+    (void)pwrite(w->fd, &header, sizeof(header), 0);
+    close(w->fd);
+}
+
+static unsigned int bench_varint(uint8_t *out, uint64_t v)
+{
+    unsigned int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static void bench_begin(struct bench_writer *w, uint64_t tick)
+{
+    w->block->first_tick = tick;
+    w->block->state = w->state;
+    w->pos = (uint8_t *)(w->block + 1);
+    w->mark = tick;
+}
+
+/* the capture writer's rle layout, a full block ends right before the record that did not fit */
+static void bench_record(struct bench_writer *w, uint64_t tick, uint64_t flipped)
+{
+    uint8_t rec[20];
+    unsigned int len = bench_varint(rec, tick - w->mark);
+    len += bench_varint(rec + len, flipped);
+    if (w->pos + len > w->buf + GPIO_CAPTURE_BLOCK) {
+        bench_put_block(w, w->block->first_tick, tick - 1, w->block->state);
+        bench_begin(w, tick);
+        len = bench_varint(rec, 0);
+        len += bench_varint(rec + len, flipped);
+    }
+    memcpy(w->pos, rec, len);
+    w->pos += len;
+    w->mark = tick;
+    w->state ^= flipped;
+    ++w->block->records;
+    w->block->bytes = (uint32_t)(w->pos - (uint8_t *)(w->block + 1));
+}
+
+static uint64_t bench_levels(uint64_t s)
+{
+    uint64_t bits = 0;
+    for (unsigned int i = 0; i < BENCH_LINES; ++i) {
+        bits |= (uint64_t)bench_level(i, s) << i;
+    }
+    return bits;
+}
+
+static int bench_write_raw(void)
+{
+    static uint64_t planes[BENCH_LINES][BENCH_WORDS];
+    struct bench_writer w;
+    if (bench_open(&w, BENCH_LINES, 1000, 0) != 0) {
+        return -1;
+    }
+    for (uint64_t b = 0; b < BENCH_RAW_BLOCKS; ++b) {
+        uint64_t first = b * BENCH_BLOCK_SAMPLES;
+        memset(planes, 0, sizeof(planes));
+        for (uint64_t s = 0; s < BENCH_BLOCK_SAMPLES; ++s) {
+            uint64_t bits = bench_levels(first + s);
+            for (unsigned int i = 0; i < BENCH_LINES; ++i) {
+                planes[i][s / 64] |= ((bits >> i) & 1) << (s % 64);
+            }
+        }
+        w.block->kind = GPIO_CAPTURE_RAW;
+        w.block->bytes = sizeof(planes);
+        memcpy(w.block + 1, planes, sizeof(planes));
+        /* like the writer, a block starts from the levels before its first sample */
+        bench_put_block(&w, first, first + BENCH_BLOCK_SAMPLES - 1, bench_levels(first == 0 ? 0 : first - 1));
+    }
+    bench_close(&w, 0);
+    return 0;
+}
+
+static int bench_write_rle(void)
+{
+    struct bench_writer w;
+    uint64_t bits = bench_levels(0);
+    if (bench_open(&w, BENCH_LINES, 1000, bits) != 0) {
+        return -1;
+    }
+    bench_begin(&w, 0);
+    for (uint64_t s = 1; s < BENCH_SAMPLES; ++s) {
+        uint64_t now = bench_levels(s);
+        if (now != bits) {
+            bench_record(&w, s, now ^ bits);
+            bits = now;
+        }
+    }
+    bench_close(&w, BENCH_SAMPLES - 1);
+    return 0;
+}
+
+struct bench_ref {
+    bool started;
+    uint64_t last;
+    bool last_high;
+    bool have_high;
+    uint64_t high_width;
+};
+
+static void bench_pulses(struct gpio_analyze_pulses *p, uint64_t width)
+{
+    p->min = p->count == 0 || width < p->min ? width : p->min;
+    p->max = width > p->max ? width : p->max;
+    p->sum += width;
+    ++p->count;
+}
+
+/* one sample at a time through the cursor, straight from the definitions in gpio_analyze.h */
+static void bench_reference(const struct gpio_capture_file *file, struct gpio_analyze_result *res)
+{
+    struct bench_ref ref[BENCH_LINES];
+    struct gpio_capture_cursor cur;
+    uint64_t since[BENCH_LINES] = { 0 };
+    uint64_t state = 0;
+    uint64_t end = 0;
+    memset(ref, 0, sizeof(ref));
+    memset(res, 0, sizeof(*res));
+    for (uint64_t b = 0; b < file->blocks; ++b) {
+        const struct gpio_capture_block *block = gpio_capture_block_at(file, b);
+        gpio_capture_cursor_init(&cur, file, block);
+        if (b == 0) {
+            state = block->state;
+        }
+        while (gpio_capture_next(&cur)) {
+            for (unsigned int i = 0; i < BENCH_LINES; ++i) {
+                if (((cur.flipped >> i) & 1) == 0) {
+                    continue;
+                }
+                struct gpio_analyze_line *l = &res->line[i];
+                struct bench_ref *r = &ref[i];
+                bool high = ((cur.state >> i) & 1) != 0;
+                *(high ? &l->low_ticks : &l->high_ticks) += cur.tick - since[i];
+                since[i] = cur.tick;
+                ++*(high ? &l->rising : &l->falling);
+                ++res->transitions;
+                if (r->started) {
+                    uint64_t width = cur.tick - r->last;
+                    bench_pulses(r->last_high ? &l->high : &l->low, width);
+                    l->glitches += width < BENCH_GLITCH ? 1 : 0;
+                    if (!r->last_high && r->have_high) {
+                        uint64_t bin = r->high_width * GPIO_ANALYZE_DUTY_BINS / (r->high_width + width);
+                        bench_pulses(&l->period, r->high_width + width);
+                        ++l->duty[bin < GPIO_ANALYZE_DUTY_BINS ? bin : GPIO_ANALYZE_DUTY_BINS - 1];
+                    }
+                    r->have_high = r->last_high;
+                    r->high_width = width;
+                }
+                r->started = true;
+                r->last = cur.tick;
+                r->last_high = high;
+            }
+            state = cur.state;
+        }
+        end = block->last_tick + 1;
+    }
+    for (unsigned int i = 0; i < BENCH_LINES; ++i) {
+        *(((state >> i) & 1) ? &res->line[i].high_ticks : &res->line[i].low_ticks) += end - since[i];
+    }
+}
+
+static int bench_compare(const char *name, const struct gpio_analyze_result *got,
+                         const struct gpio_analyze_result *want)
+{
+    for (unsigned int i = 0; i < BENCH_LINES; ++i) {
+        const struct gpio_analyze_line *a = &got->line[i];
+        const struct gpio_analyze_line *b = &want->line[i];
+        if (a->rising != b->rising || a->falling != b->falling || a->high_ticks != b->high_ticks ||
+            a->low_ticks != b->low_ticks || a->glitches != b->glitches ||
+            memcmp(&a->high, &b->high, sizeof(a->high)) != 0 || memcmp(&a->low, &b->low, sizeof(a->low)) != 0 ||
+            memcmp(&a->period, &b->period, sizeof(a->period)) != 0 || memcmp(a->duty, b->duty, sizeof(a->duty)) != 0) {
+            fprintf(stderr, "%s: line %u differs from the sample walk\n", name, i);
+            return -1;
+        }
+    }
+    return got->transitions == want->transitions ? 0 : -1;
+}
+
+static int bench_file(const char *name)
+{
+    static struct gpio_analyze_result want;
+    static struct gpio_analyze_result got;
+    struct gpio_capture_file file;
+    if (gpio_capture_map(BENCH_FILE, &file) != 0) {
+        return -1;
+    }
+    int ret = 0;
+    uint64_t t0 = gpio_timing_now();
+    bench_reference(&file, &want);
+    double walk = (gpio_timing_now() - t0) / 1e9;
+    printf("%-4s %6llu blocks %8.1f MiB  sample walk %8.1f ms %8.1f Msample/s\n", name,
+           (unsigned long long)file.blocks, file.size / 1048576.0, walk * 1e3, BENCH_SAMPLES / walk / 1e6);
+    for (unsigned int threads = 1; threads <= 4 && ret == 0; threads *= 2) {
+        t0 = gpio_timing_now();
+        ret = gpio_analyze_lines(&file, threads, BENCH_GLITCH * 1000, &got);
+        double took = (gpio_timing_now() - t0) / 1e9;
+        ret = ret != 0 ? ret : bench_compare(name, &got, &want);
+        printf("     %u threads %26.1f ms %8.1f Msample/s %6.1fx %8.1f MiB/s\n", threads, took * 1e3,
+               BENCH_SAMPLES / took / 1e6, walk / took, file.size / took / 1048576.0);
+    }
+    const struct gpio_analyze_line *l = &got.line[0];
+    if (ret == 0) {
+        printf("     gpio %u: %llu periods of %.1f us, %llu glitches, duty", l->gpio_nr,
+               (unsigned long long)l->period.count, (double)l->period.sum / l->period.count,
+               (unsigned long long)l->glitches);
+        for (unsigned int b = 0; b < GPIO_ANALYZE_DUTY_BINS; ++b) {
+            printf(" %llu", (unsigned long long)l->duty[b]);
+        }
+        printf("\n");
+    }
+    gpio_capture_unmap(&file);
+    return ret;
+}
+
+/* a DS1302 on lines 0..2 clocked the way rtc.c does it, ticks are ns */
+enum { DS_CLK, DS_DAT, DS_RST };
+
+#define DS_HALF 50000
+
+struct bench_ds {
+    struct bench_writer w;
+    uint64_t tick;
+    uint64_t levels;
+};
+
+static void bench_ds_set(struct bench_ds *ds, unsigned int line, bool high)
+{
+    if ((((ds->levels >> line) & 1) != 0) != high) {
+        bench_record(&ds->w, ds->tick, 1ull << line);
+        ds->levels ^= 1ull << line;
+    }
+}
+
+static void bench_ds_xfer(struct bench_ds *ds, const uint8_t *out, unsigned int out_len, const uint8_t *in,
+                          unsigned int in_len, uint64_t setup)
+{
+    ds->tick += 1000000;
+    bench_ds_set(ds, DS_RST, true);
+    ds->tick += setup;
+    for (unsigned int bit = 0; bit < 8 * out_len; ++bit) {
+        bench_ds_set(ds, DS_CLK, false);
+        bench_ds_set(ds, DS_DAT, (out[bit / 8] >> (bit % 8)) & 1);
+        ds->tick += DS_HALF;
+        bench_ds_set(ds, DS_CLK, true);
+        ds->tick += DS_HALF;
+    }
+    for (unsigned int bit = 0; bit < 8 * in_len; ++bit) {
+        bench_ds_set(ds, DS_CLK, false);
+        ds->tick += 300;
+        bench_ds_set(ds, DS_DAT, (in[bit / 8] >> (bit % 8)) & 1);
+        ds->tick += DS_HALF - 300;
+        bench_ds_set(ds, DS_CLK, true);
+        ds->tick += DS_HALF;
+    }
+    bench_ds_set(ds, DS_CLK, false);
+    ds->tick += DS_HALF;
+    bench_ds_set(ds, DS_RST, false);
+}
+
+static const uint8_t ds_wp[2] = { 0x8e, 0x00 };
+static const uint8_t ds_burst_cmd = 0xbf;
+static const uint8_t ds_burst[8] = { 0x45, 0x59, 0x23, 0x31, 0x12, 0x04, 0x99, 0x80 };
+
+struct bench_ds_check {
+    unsigned int count;
+    int bad;
+};
+
+static int bench_ds_got(const struct gpio_analyze_ds1302 *xfer, void *data)
+{
+    struct bench_ds_check *check = (struct bench_ds_check *)data;
+    const uint8_t *want = check->count == 0 ? ds_wp + 1 : ds_burst;
+    unsigned int bytes = check->count == 0 ? 1 : 8;
+    uint8_t cmd = check->count == 0 ? ds_wp[0] : ds_burst_cmd;
+    uint64_t setup = check->count == 0 ? DS_HALF : 2000;
+    printf("     cmd %02x %u bytes setup %.1f us clk %.1f/%.1f us\n", xfer->cmd, xfer->bytes,
+           xfer->setup_ticks / 1e3, xfer->clk_high_ticks / 1e3, xfer->clk_low_ticks / 1e3);
+    if (xfer->cmd != cmd || xfer->bytes != bytes || xfer->bits != 8 * (1 + bytes) ||
+        memcmp(xfer->data, want, bytes) != 0 || xfer->setup_ticks != setup + DS_HALF ||
+        xfer->clk_high_ticks != DS_HALF || xfer->clk_low_ticks != DS_HALF) {
+        check->bad = -1;
+    }
+    ++check->count;
+    return 0;
+}
+
+static int bench_ds1302(void)
+{
+    struct bench_ds ds;
+    struct gpio_capture_file file;
+    struct bench_ds_check check = { 0, 0 };
+    memset(&ds, 0, sizeof(ds));
+    if (bench_open(&ds.w, 3, 0, 0) != 0) {
+        return -1;
+    }
+    bench_begin(&ds.w, 0);
+    bench_ds_xfer(&ds, ds_wp, 2, NULL, 0, DS_HALF);
+    /* the burst read comes after a shorter setup, which has to show in its timing */
+    bench_ds_xfer(&ds, &ds_burst_cmd, 1, ds_burst, 8, 2000);
+    bench_close(&ds.w, ds.tick);
+    if (gpio_capture_map(BENCH_FILE, &file) != 0) {
+        return -1;
+    }
+    printf("ds1302\n");
+    int ret = gpio_analyze_ds1302(&file, 20, 21, 22, bench_ds_got, &check);
+    gpio_capture_unmap(&file);
+    return ret != 0 || check.bad != 0 || check.count != 2 ? -1 : 0;
+}
+
+int main(void)
+{
+    int ret;
+    printf("%d lines, %llu samples each\n", BENCH_LINES, (unsigned long long)BENCH_SAMPLES);
+    ret = bench_write_raw();
+    ret = ret != 0 ? ret : bench_file("raw");
+    ret = ret != 0 ? ret : bench_write_rle();
+    ret = ret != 0 ? ret : bench_file("rle");
+    ret = ret != 0 ? ret : bench_ds1302();
+    (void)remove(BENCH_FILE);
+    if (ret != 0) {
+        fprintf(stderr, "analyze bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+/*
+ * Plays scripted input changes on three gpio_sim lines while capturing
+ * them sampled and from edges, then decodes the file back and checks every
+ * change came out in order with its timing. A slow script stays in rle
+ * blocks, a fast one fills blocks that are rewritten as bit planes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "gpio.h"
+#include "gpio_capture.h"
+#include "gpio_loop.h"
+#include "gpio_sim.h"
+
+#define BENCH_LINES 3
+#define BENCH_STEPS 240
+#define BENCH_FILE "/tmp/capture_bench.gcap"
+
+static const unsigned int nrs[BENCH_LINES] = { 20, 21, 22 };
+static struct gpio_sim_step steps[BENCH_STEPS];
+static uint64_t due_ns[BENCH_STEPS];
+
+/* every step flips one line, the lines take turns with a gap of gap_us */
+static void bench_script(uint32_t gap_us)
+{
+    bool high[BENCH_LINES] = { false };
+    uint64_t at = 0;
+    for (unsigned int i = 0; i < BENCH_STEPS; ++i) {
+        unsigned int l = i % BENCH_LINES;
+        high[l] = !high[l];
+        steps[i].delay_us = gap_us + (i % 5) * gap_us / 4;
+        steps[i].gpio_nr = nrs[l];
+        steps[i].value = high[l] ? GPIO_HIGH : GPIO_LOW;
+        at += (uint64_t)steps[i].delay_us * 1000;
+        due_ns[i] = at;
+    }
+}
+
+struct bench_result {
+    uint64_t payload;       /* block bytes in use, headers and slack left out */
+    uint64_t records;
+    unsigned int lost;      /* changes a late sample never saw, they go in pairs */
+    uint64_t err_sum_ns;
+    uint64_t err_max_ns;
+};
+
+#define BENCH_ROUNDS_MAX 16
+
+/*
+ * decodes every block and matches each line's changes against its steps
+ * of the script, lines flipping within one sample have no order among
+ * them. Script deadlines run from when the player started, so a change is
+ * timed against the earliest offset of its round, and only when nothing
+ * was lost since a lost pair shifts every later match.
+ */
+static int bench_verify(const char *name, unsigned int rounds, const struct gpio_capture_stats *stats,
+                        struct bench_result *res)
+{
+    static int64_t offset[BENCH_ROUNDS_MAX * BENCH_STEPS];
+    struct gpio_capture_file file;
+    struct gpio_capture_cursor cur;
+    int64_t origin[BENCH_ROUNDS_MAX];
+    unsigned int seen[BENCH_LINES] = { 0 };
+    unsigned int per_line = BENCH_STEPS / BENCH_LINES;
+    if (rounds > BENCH_ROUNDS_MAX || gpio_capture_map(BENCH_FILE, &file) != 0) {
+        return -1;
+    }
+    uint64_t tick_ns = file.header->period_ns == 0 ? 1 : file.header->period_ns;
+    int ret = 0;
+    memset(res, 0, sizeof(*res));
+    for (unsigned int r = 0; r < BENCH_ROUNDS_MAX; ++r) {
+        origin[r] = INT64_MAX;
+    }
+    for (uint64_t b = 0; b < file.blocks && ret == 0; ++b) {
+        res->payload += gpio_capture_block_at(&file, b)->bytes;
+        gpio_capture_cursor_init(&cur, &file, gpio_capture_block_at(&file, b));
+        while (ret == 0 && gpio_capture_next(&cur)) {
+            ++res->records;
+            for (unsigned int l = 0; l < BENCH_LINES; ++l) {
+                if (((cur.flipped >> l) & 1) == 0) {
+                    continue;
+                }
+                unsigned int round = seen[l] / per_line;
+                unsigned int k = seen[l] % per_line * BENCH_LINES + l;
+                if (round == rounds || ((cur.state >> l) & 1) != (steps[k].value == GPIO_HIGH)) {
+                    fprintf(stderr, "%s: change %u of gpio %u does not match the script\n", name, seen[l], nrs[l]);
+                    ret = -1;
+                    break;
+                }
+                int64_t off = (int64_t)(cur.tick * tick_ns) - (int64_t)due_ns[k];
+                offset[round * BENCH_STEPS + k] = off;
+                origin[round] = off < origin[round] ? off : origin[round];
+                ++seen[l];
+            }
+        }
+    }
+    gpio_capture_unmap(&file);
+    if (ret == 0 && res->records != stats->transitions) {
+        fprintf(stderr, "%s: %llu of %llu transitions decoded\n", name, (unsigned long long)res->records,
+                (unsigned long long)stats->transitions);
+        ret = -1;
+    }
+    for (unsigned int l = 0; l < BENCH_LINES && ret == 0; ++l) {
+        res->lost += per_line * rounds - seen[l];
+    }
+    for (unsigned int i = 0; i < rounds * BENCH_STEPS && ret == 0 && res->lost == 0; ++i) {
+        uint64_t err = (uint64_t)(offset[i] - origin[i / BENCH_STEPS]);
+        res->err_sum_ns += err;
+        res->err_max_ns = err > res->err_max_ns ? err : res->err_max_ns;
+    }
+    return ret;
+}
+
+static void bench_report(const char *name, uint32_t gap_us, unsigned int rounds,
+                         const struct gpio_capture_stats *stats, const struct bench_result *res)
+{
+    unsigned int changes = BENCH_STEPS * rounds;
+    printf("%-8s %6u %8u %5u %6llu %4llu %8llu %6.2f", name, gap_us, changes, res->lost,
+           (unsigned long long)stats->blocks, (unsigned long long)stats->raw_blocks,
+           (unsigned long long)stats->bytes, (double)res->payload / res->records);
+    if (res->lost == 0) {
+        printf(" %8.1f %8.1f\n", res->err_sum_ns / 1e3 / changes, res->err_max_ns / 1e3);
+    } else {
+        printf(" %8s %8s\n", "-", "-");
+    }
+}
+
+static int bench_sampled(gpio_set *set, uint32_t gap_us, unsigned int rounds, uint32_t period_ns)
+{
+    struct gpio_capture_stats stats;
+    struct bench_result res;
+    bench_script(gap_us);
+    struct gpio_capture *cap = gpio_capture_sample(set, period_ns, BENCH_FILE);
+    if (cap == NULL) {
+        return -1;
+    }
+    for (unsigned int r = 0; r < rounds; ++r) {
+        (void)gpio_sim_play(steps, BENCH_STEPS);
+        gpio_sim_join();
+    }
+    if (gpio_capture_stop(cap, &stats) != 0 || bench_verify("sampled", rounds, &stats, &res) != 0) {
+        return -1;
+    }
+    bench_report("sampled", gap_us, rounds, &stats, &res);
+    return 0;
+}
+
+static void *bench_loop_main(void *arg)
+{
+    (void)gpio_loop_run((struct gpio_loop *)arg);
+    return NULL;
+}
+
+static int bench_edges(gpio_set *set, uint32_t gap_us)
+{
+    int ret = -1;
+    pthread_t thread;
+    struct gpio_capture_stats stats;
+    struct bench_result res;
+    bench_script(gap_us);
+    struct gpio_loop *loop = gpio_loop_create();
+    if (loop == NULL) {
+        return -1;
+    }
+    struct gpio_capture *cap = gpio_capture_edges(loop, set, BENCH_FILE);
+    if (cap == NULL) {
+        goto destroy;
+    }
+    pthread_create(&thread, NULL, bench_loop_main, loop);
+    (void)gpio_sim_play(steps, BENCH_STEPS);
+    gpio_sim_join();
+    (void)gpio_loop_stop(loop);
+    pthread_join(thread, NULL);
+    /*
+     * the ring has to keep up, but sysfs folds edges together that come
+     * before the loop read the last one, those show up as lost pairs
+     */
+    if (gpio_capture_stop(cap, &stats) != 0 || bench_verify("edges", 1, &stats, &res) != 0) {
+        goto destroy;
+    }
+    if (stats.dropped != 0) {
+        fprintf(stderr, "edges: %llu edges dropped\n", (unsigned long long)stats.dropped);
+        goto destroy;
+    }
+    bench_report("edges", gap_us, 1, &stats, &res);
+    ret = 0;
+destroy:
+    gpio_loop_destroy(loop);
+    return ret;
+}
+
+/* a slow signal sampled at 1 ms, what ten hours of 1 Hz toggling would take at the same cost */
+static int bench_idle(gpio_set *set)
+{
+    struct gpio_capture_stats stats;
+    struct gpio_capture_file file;
+    struct gpio_capture *cap = gpio_capture_sample(set, 1000000, BENCH_FILE);
+    if (cap == NULL) {
+        return -1;
+    }
+    struct gpio_sim_step idle[4] = {
+        { .delay_us = 100000, .gpio_nr = nrs[0], .value = GPIO_HIGH },
+        { .delay_us = 100000, .gpio_nr = nrs[0], .value = GPIO_LOW },
+        { .delay_us = 100000, .gpio_nr = nrs[0], .value = GPIO_HIGH },
+        { .delay_us = 100000, .gpio_nr = nrs[0], .value = GPIO_LOW },
+    };
+    (void)gpio_sim_play(idle, 4);
+    gpio_sim_join();
+    if (gpio_capture_stop(cap, &stats) != 0 || gpio_capture_map(BENCH_FILE, &file) != 0) {
+        return -1;
+    }
+    double per = (double)gpio_capture_block_at(&file, 0)->bytes / stats.transitions;
+    gpio_capture_unmap(&file);
+    double hours = 36000.0 * 2 * per * GPIO_CAPTURE_BLOCK / GPIO_CAPTURE_PAYLOAD;
+    printf("%-8s %llu samples %llu transitions %.1f B each, 10 h of 1 Hz toggling ~ %.0f KiB\n", "idle",
+           (unsigned long long)stats.samples, (unsigned long long)stats.transitions, per, hours / 1024);
+    return 0;
+}
+
+int main(void)
+{
+    int ret;
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio_set *set = ops->set_open(nrs, BENCH_LINES);
+    if (set == NULL || ops->set_directions(set, (1ull << BENCH_LINES) - 1, 0) != 0) {
+        gpio_sim_uninstall();
+        return 1;
+    }
+    printf("%d lines, %d changes per run, slow script sampled every 200 us, fast every 10 us\n", BENCH_LINES,
+           BENCH_STEPS);
+    printf("mode     gap us  changes  lost blocks  raw    bytes  B/rec  late us worst us\n");
+    ret = bench_sampled(set, 2000, 1, 200000);
+    /* player and sampler both spin at this gap, sharing one cpu the sampler only runs in bursts */
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+        ret = ret != 0 ? ret : bench_sampled(set, 20, 12, 10000);
+    } else {
+        printf("%-8s %6u skipped, needs a second cpu\n", "sampled", 20);
+    }
+    ret = ret != 0 ? ret : bench_edges(set, 2000);
+    ret = ret != 0 ? ret : bench_edges(set, 100);
+    ret = ret != 0 ? ret : bench_idle(set);
+    ops->set_close(set);
+    gpio_sim_uninstall();
+    (void)remove(BENCH_FILE);
+    if (ret != 0) {
+        fprintf(stderr, "capture bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
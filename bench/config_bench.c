@@ -0,0 +1,156 @@
+/*
+ * Reconfigures one line of a shared cdev request, direction, edge and
+ * debounce, while the other lines of the request drive outputs. The mock
+ * resets every output of a request on a config change the way the kernel
+ * does, so the siblings have to keep their levels through each change and
+ * a later set_value has to reach them. A driven line opened again has to
+ * stay driven. Then the cost of a direction change, with the sibling
+ * levels known and with them read back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_timing.h"
+
+#define BENCH_ROUNDS 20000
+#define BENCH_LINES 4
+/* line 3 of the set is reconfigured, lines 0 and 2 are driven high */
+#define BENCH_LINE 3
+#define BENCH_HIGH 0x5ull
+#define BENCH_REOPEN 6
+
+static const unsigned int nrs[BENCH_LINES] = { 2, 3, 4, 5 };
+
+static int bench_siblings(const char *step, uint64_t high)
+{
+    for (unsigned int i = 0; i < BENCH_LINE; ++i) {
+        enum gpio_value value;
+        enum gpio_value want = (high >> i) & 1 ? GPIO_HIGH : GPIO_LOW;
+        if (gpio_cdev_mock_get_output(nrs[i], &value) != 0 || value != want) {
+            fprintf(stderr, "%s: gpio %u went %s\n", step, nrs[i], want == GPIO_HIGH ? "low" : "high");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* the shadow must match the mock, a stale one skips the write below */
+static int bench_reach(struct gpio_ops *ops, gpio_set *set, const char *step)
+{
+    int ret = ops->set_value(set->lines[0], GPIO_LOW);
+    ret = ret != 0 ? ret : bench_siblings(step, BENCH_HIGH & ~1ull);
+    ret = ret != 0 ? ret : ops->set_value(set->lines[0], GPIO_HIGH);
+    return ret != 0 ? ret : bench_siblings(step, BENCH_HIGH);
+}
+
+static int bench_steps(struct gpio_ops *ops, gpio_set *set)
+{
+    const struct gpio_debounce settle = { .mode = GPIO_DEBOUNCE_SETTLE, .period_us = 1000 };
+    gpio *io = set->lines[BENCH_LINE];
+    enum gpio_value value;
+    int ret = ops->set_direction(io, GPIO_IN);
+    ret = ret != 0 ? ret : bench_reach(ops, set, "direction in");
+    ret = ret != 0 ? ret : ops->set_edge(io, GPIO_BOTH);
+    ret = ret != 0 ? ret : bench_reach(ops, set, "edge both");
+    ret = ret != 0 ? ret : ops->set_debounce(io, &settle);
+    ret = ret != 0 ? ret : bench_reach(ops, set, "debounce");
+    ret = ret != 0 ? ret : ops->set_edge(io, GPIO_NONE);
+    ret = ret != 0 ? ret : bench_reach(ops, set, "edge none");
+    /* unknown levels are read back before the config goes out */
+    for (unsigned int i = 0; ret == 0 && i < BENCH_LINE; ++i) {
+        ops->invalidate(set->lines[i]);
+    }
+    ret = ret != 0 ? ret : ops->set_direction(io, GPIO_OUT);
+    ret = ret != 0 ? ret : bench_reach(ops, set, "direction out");
+    /* a line that just became an output starts low */
+    ret = ret != 0 ? ret : gpio_cdev_mock_get_output(nrs[BENCH_LINE], &value);
+    if (ret == 0 && value != GPIO_LOW) {
+        fprintf(stderr, "fresh output gpio %u started high\n", nrs[BENCH_LINE]);
+        ret = -1;
+    }
+    /* clearing edges on an output leaves it an output */
+    ret = ret != 0 ? ret : ops->set_edge(set->lines[0], GPIO_NONE);
+    return ret != 0 ? ret : bench_reach(ops, set, "edge none on output");
+}
+
+/* opening a line takes it as it is, an output is not turned into an input */
+static int bench_reopen(struct gpio_ops *ops)
+{
+    enum gpio_value value;
+    gpio *io = ops->open(BENCH_REOPEN);
+    int ret = io == NULL ? -1 : ops->set_direction(io, GPIO_OUT);
+    ret = ret != 0 ? ret : ops->set_value(io, GPIO_HIGH);
+    if (io != NULL) {
+        ops->close(io);
+    }
+    io = ret != 0 ? NULL : ops->open(BENCH_REOPEN);
+    ret = io == NULL ? -1 : gpio_cdev_mock_get_output(BENCH_REOPEN, &value);
+    if (ret == 0 && value != GPIO_HIGH) {
+        fprintf(stderr, "opening gpio %u again let it go low\n", BENCH_REOPEN);
+        ret = -1;
+    }
+    /* without a set_direction, so only works when the open saw an output */
+    ret = ret != 0 ? ret : ops->set_value(io, GPIO_LOW);
+    ret = ret != 0 ? ret : gpio_cdev_mock_get_output(BENCH_REOPEN, &value);
+    if (ret == 0 && value != GPIO_LOW) {
+        fprintf(stderr, "gpio %u opened again took no value\n", BENCH_REOPEN);
+        ret = -1;
+    }
+    if (io != NULL) {
+        ops->close(io);
+    }
+    printf("reopen %s\n", ret == 0 ? "kept the output driven" : "lost the output");
+    return ret;
+}
+
+static int bench_cost(struct gpio_ops *ops, gpio_set *set, bool known)
+{
+    int ret = 0;
+    struct gpio_cdev_mock_stats stats;
+    gpio *io = set->lines[BENCH_LINE];
+    gpio_cdev_mock_reset_stats();
+    uint64_t start = gpio_timing_now();
+    for (int r = 0; r < BENCH_ROUNDS && ret == 0; ++r) {
+        for (unsigned int i = 0; !known && i < BENCH_LINE; ++i) {
+            ops->invalidate(set->lines[i]);
+        }
+        ret = ops->set_direction(io, r % 2 == 0 ? GPIO_IN : GPIO_OUT);
+    }
+    uint64_t elapsed = gpio_timing_now() - start;
+    gpio_cdev_mock_stats(&stats);
+    printf("%-16s %10.0f %12.2f\n", known ? "levels known" : "levels read back", (double)elapsed / BENCH_ROUNDS,
+           (double)stats.ioctl / BENCH_ROUNDS);
+    return ret != 0 ? ret : bench_siblings("direction rounds", BENCH_HIGH);
+}
+
+int main(void)
+{
+    int ret;
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio_set *set = ops->set_open(nrs, BENCH_LINES);
+    if (set == NULL) {
+        fprintf(stderr, "open lines failed\n");
+        gpio_cdev_mock_uninstall();
+        return 1;
+    }
+    uint64_t all = (1ull << BENCH_LINES) - 1;
+    ret = ops->set_directions(set, all, all);
+    ret = ret != 0 ? ret : ops->set_values(set, all, BENCH_HIGH);
+    ret = ret != 0 ? ret : bench_steps(ops, set);
+    printf("siblings %s\n", ret == 0 ? "kept their levels" : "lost their levels");
+    ret = ret != 0 ? ret : bench_reopen(ops);
+    printf("%-16s %10s %12s\n", "direction", "ns/change", "ioctl/change");
+    ret = ret != 0 ? ret : bench_cost(ops, set, true);
+    ret = ret != 0 ? ret : bench_cost(ops, set, false);
+    ops->set_close(set);
+    gpio_cdev_mock_uninstall();
+    if (ret != 0) {
+        fprintf(stderr, "config bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/*
+ * Plays a waveform of eight lines on gpio_sim through sysfs, on the cdev
+ * mock and on the mmio backend over a plain file: events 200 us apart for
+ * timing error per event, then events 1 ns apart looped for how many
+ * writes a second playback sustains. The lines have to end where the last
+ * event left them. A capture holding a line the set lacks is played too,
+ * the line must drop out of every event. An event driving no line is
+ * refused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_mmio.h"
+#include "gpio_play.h"
+#include "gpio_sim.h"
+
+#define BENCH_LINES 8
+#define BENCH_EVENTS 1000
+#define BENCH_GAP_NS 200000
+#define BENCH_FAST_EVENTS 10000
+#define BENCH_FAST_LOOPS 5
+#define BENCH_REGS "/tmp/play_bench_regs"
+#define BENCH_FILE "/tmp/play_bench.gcap"
+
+static const unsigned int nrs[BENCH_LINES] = { 5, 6, 7, 8, 9, 10, 11, 12 };
+static uint32_t late[BENCH_FAST_EVENTS];
+
+static int bench_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* a few lines change on each event, picked by a xorshift so runs repeat */
+static struct gpio_play *bench_waveform(struct gpio_ops *ops, gpio_set *set, unsigned int events,
+                                        uint64_t gap_ns, uint64_t *last)
+{
+    uint64_t x = 88172645463325252ull;
+    uint64_t levels = 0;
+    struct gpio_play *play = gpio_play_create(ops, set, events);
+    for (unsigned int i = 0; play != NULL && i < events; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        uint64_t mask = i == 0 ? 0xff : (x & 0xff) | (1ull << (i % BENCH_LINES));
+        levels ^= mask;
+        if (gpio_play_add(play, i * gap_ns, mask, levels) != 0) {
+            gpio_play_destroy(play);
+            play = NULL;
+        }
+    }
+    *last = levels;
+    return play;
+}
+
+static int bench_levels(struct gpio_ops *ops, gpio_set *set, uint64_t want)
+{
+    uint64_t bits;
+    if (ops->get_values(set, &bits) != 0 || (bits & 0xff) != want) {
+        fprintf(stderr, "lines read %02llx, the last event left %02llx\n", (unsigned long long)bits,
+                (unsigned long long)want);
+        return -1;
+    }
+    return 0;
+}
+
+static int bench(const char *name)
+{
+    int ret = -1;
+    uint64_t last;
+    struct gpio_play_stats stats;
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio_set *set = ops->set_open(nrs, BENCH_LINES);
+    if (set == NULL || ops->set_directions(set, 0xff, 0xff) != 0) {
+        fprintf(stderr, "%s: open lines failed\n", name);
+        goto close;
+    }
+    struct gpio_play *play = gpio_play_create(ops, set, 1);
+    if (play == NULL || gpio_play_add(play, 0, 0, 0) != EINVAL) {
+        fprintf(stderr, "%s: an event driving no line was taken\n", name);
+        goto destroy;
+    }
+    gpio_play_destroy(play);
+    play = bench_waveform(ops, set, BENCH_EVENTS, BENCH_GAP_NS, &last);
+    if (play == NULL || gpio_play_run(play, 3, late, &stats) != 0 || bench_levels(ops, set, last) != 0) {
+        goto destroy;
+    }
+    qsort(late, BENCH_EVENTS, sizeof(late[0]), bench_cmp);
+    printf("%-6s %8llu %10.1f %10.1f %10.1f", name, (unsigned long long)stats.events,
+           stats.late_sum_ns / 1e3 / stats.events, late[BENCH_EVENTS * 99 / 100] / 1e3, stats.late_max_ns / 1e3);
+    gpio_play_destroy(play);
+    play = bench_waveform(ops, set, BENCH_FAST_EVENTS, 1, &last);
+    if (play == NULL || gpio_play_run(play, BENCH_FAST_LOOPS, NULL, &stats) != 0 ||
+        bench_levels(ops, set, last) != 0) {
+        printf("\n");
+        goto destroy;
+    }
+    printf(" %12.0f\n", stats.events * 1e9 / stats.elapsed_ns);
+    ret = 0;
+destroy:
+    if (play != NULL) {
+        gpio_play_destroy(play);
+    }
+close:
+    if (set != NULL) {
+        ops->set_close(set);
+    }
+    return ret;
+}
+
+/* lines 0 and 2 of a three line capture are gpio 5 and 7, line 1 is a gpio the set does not have */
+static int bench_capture(void)
+{
+    static uint8_t buf[2 * GPIO_CAPTURE_BLOCK];
+    static const uint8_t recs[] = { 10, 1, 5, 2, 5, 4, 0xc8, 0x01, 1, 5, 5 };
+    struct gpio_capture_header *header = (struct gpio_capture_header *)buf;
+    struct gpio_capture_block *block = (struct gpio_capture_block *)(buf + GPIO_CAPTURE_BLOCK);
+    struct gpio_capture_file file;
+    unsigned int count;
+    header->magic = GPIO_CAPTURE_MAGIC;
+    header->version = GPIO_CAPTURE_VERSION;
+    header->lines = 3;
+    header->block_size = GPIO_CAPTURE_BLOCK;
+    header->period_ns = 1000;
+    header->blocks = 1;
+    header->gpio_nr[0] = 5;
+    header->gpio_nr[1] = 99;
+    header->gpio_nr[2] = 7;
+    block->magic = GPIO_CAPTURE_BLOCK_MAGIC;
+    block->bytes = sizeof(recs);
+    block->records = 5;
+    block->first_tick = 100;
+    block->last_tick = 499;
+    block->state = 0x4;
+    memcpy(block + 1, recs, sizeof(recs));
+    int fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+        return -1;
+    }
+    close(fd);
+    if (gpio_capture_map(BENCH_FILE, &file) != 0) {
+        return -1;
+    }
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio_set *set = ops->set_open(nrs, 3);
+    struct gpio_play *play = set == NULL ? NULL : gpio_play_from_capture(ops, set, &file);
+    gpio_capture_unmap(&file);
+    (void)remove(BENCH_FILE);
+    /* the record flipping only gpio 99 is gone, the others keep their time, 200 ticks is a two byte varint */
+    static const struct gpio_play_event want[] = {
+        { 0, 0x5, 0x4 }, { 10000, 0x1, 0x1 }, { 20000, 0x4, 0x0 }, { 220000, 0x1, 0x0 }, { 225000, 0x5, 0x5 },
+    };
+    const struct gpio_play_event *events = play == NULL ? NULL : gpio_play_events(play, &count);
+    int ret = events != NULL && count == sizeof(want) / sizeof(want[0]) ? 0 : -1;
+    for (unsigned int i = 0; ret == 0 && i < count; ++i) {
+        ret = memcmp(&events[i], &want[i], sizeof(want[i])) == 0 ? 0 : -1;
+    }
+    printf("capture %u events, %s\n", events == NULL ? 0 : count, ret == 0 ? "as recorded" : "wrong");
+    if (play != NULL) {
+        gpio_play_destroy(play);
+    }
+    if (set != NULL) {
+        ops->set_close(set);
+    }
+    return ret;
+}
+
+int main(void)
+{
+    int ret;
+    printf("%d lines, %d events %d us apart three times, then %d events back to back %d times\n", BENCH_LINES,
+           BENCH_EVENTS, BENCH_GAP_NS / 1000, BENCH_FAST_EVENTS, BENCH_FAST_LOOPS);
+    printf("%-6s %8s %10s %10s %10s %12s\n", "ops", "events", "late us", "p99 us", "worst us", "events/s");
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    ret = bench("sysfs");
+    ret = ret != 0 ? ret : bench_capture();
+    gpio_sim_uninstall();
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    ret = ret != 0 ? ret : bench("cdev");
+    gpio_cdev_mock_uninstall();
+    struct gpio_mmio_layout layout = GPIO_MMIO_BCM2711;
+    layout.path = BENCH_REGS;
+    layout.emulate_level = true;
+    FILE *regs = fopen(BENCH_REGS, "w");
+    if (regs == NULL || ftruncate(fileno(regs), layout.length) != 0) {
+        fprintf(stderr, "create %s failed\n", BENCH_REGS);
+        return 1;
+    }
+    fclose(regs);
+    gpio_mmio_configure(&layout);
+    gpio_set_backend(GPIO_BACKEND_MMIO);
+    ret = ret != 0 ? ret : bench("mmio");
+    unlink(BENCH_REGS);
+    if (ret != 0) {
+        fprintf(stderr, "play bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
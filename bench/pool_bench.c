@@ -0,0 +1,150 @@
+/*
+ * Open, drive and close cycles on the sysfs backend over gpio_sim, the way
+ * led_flash() and rtc_init() use a line, with the handle pool off and on.
+ * Counts syscalls per cycle through the accounting hooks and the pool's
+ * hits and evictions, then checks a pooled line comes back in the state it
+ * was left in while each open of it gets a handle of its own.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gpio.h"
+#include "gpio_pool.h"
+#include "gpio_sim.h"
+#include "gpio_sysfs.h"
+#include "gpio_timing.h"
+
+#define BENCH_CYCLES 5000
+#define BENCH_LINES 4
+
+struct bench_case {
+    const char *name;
+    struct gpio_pool_policy policy;
+};
+
+static const struct bench_case cases[] = {
+    { "no pool", { .max_idle = 0, .idle_ms = 0 } },
+    { "pool", GPIO_POOL_POLICY_DEFAULT },
+    /* fewer slots than lines in rotation, every open misses */
+    { "pool thrash", { .max_idle = BENCH_LINES - 2, .idle_ms = 10000 } },
+};
+
+static uint64_t bench_syscalls(void)
+{
+    struct gpio_io_stats stats;
+    uint64_t total = 0;
+    gpio_io_stats(&stats);
+    for (int op = 0; op < GPIO_OP_MAX; ++op) {
+        total += stats.ops[op].syscalls;
+    }
+    return total;
+}
+
+static int bench_cycles(const struct bench_case *c)
+{
+    struct gpio_ops *ops = get_gpio_ops();
+    struct gpio_pool *pool = gpio_sysfs_pool();
+    struct gpio_pool_stats before;
+    struct gpio_pool_stats after;
+    gpio_pool_set_policy(pool, &c->policy);
+    gpio_pool_stats(pool, &before);
+    gpio_io_reset_stats();
+    uint64_t start = gpio_timing_now();
+    for (int i = 0; i < BENCH_CYCLES; ++i) {
+        gpio *io = ops->open(5 + i % BENCH_LINES);
+        if (io == NULL || ops->set_direction(io, GPIO_OUT) != 0 ||
+            ops->set_value(io, (i / BENCH_LINES) & 1 ? GPIO_HIGH : GPIO_LOW) != 0) {
+            fprintf(stderr, "%s: cycle %d failed\n", c->name, i);
+            return -1;
+        }
+        ops->close(io);
+    }
+    uint64_t elapsed = gpio_timing_now() - start;
+    uint64_t syscalls = bench_syscalls();
+    gpio_pool_stats(pool, &after);
+    printf("%-12s %10.0f ns/cycle %6.2f syscalls/cycle %8llu hits %8llu evictions\n", c->name,
+           (double)elapsed / BENCH_CYCLES, (double)syscalls / BENCH_CYCLES,
+           (unsigned long long)(after.hits - before.hits),
+           (unsigned long long)(after.evictions - before.evictions));
+    gpio_pool_flush(pool);
+    return 0;
+}
+
+/*
+ * a reused line keeps its export and level, yet every open gets its own
+ * handle: a second open of a held line neither shares the first one's
+ * shadow nor inherits its software filter
+ */
+static int bench_reuse(void)
+{
+    int ret = -1;
+    enum gpio_value value;
+    struct gpio_event event;
+    struct gpio_ops *ops = get_gpio_ops();
+    const struct gpio_pool_policy policy = GPIO_POOL_POLICY_DEFAULT;
+    const struct gpio_debounce debounce = { .mode = GPIO_DEBOUNCE_SETTLE, .period_us = 1000 };
+    struct gpio_pool_stats before;
+    struct gpio_pool_stats after;
+    gpio_pool_set_policy(gpio_sysfs_pool(), &policy);
+    gpio *io = ops->open(12);
+    if (io == NULL) {
+        return -1;
+    }
+    if (ops->set_direction(io, GPIO_OUT) != 0 || ops->set_value(io, GPIO_HIGH) != 0) {
+        ops->close(io);
+        return -1;
+    }
+    ops->close(io);
+    gpio_pool_stats(gpio_sysfs_pool(), &before);
+    gpio *again = ops->open(12);
+    if (again == NULL || ops->set_debounce(again, &debounce) != 0) {
+        goto close;
+    }
+    gpio *other = ops->open(12);
+    gpio_pool_stats(gpio_sysfs_pool(), &after);
+    if (other == NULL || after.hits - before.hits != 2 || after.misses != before.misses) {
+        fprintf(stderr, "line 12 was set up again\n");
+    } else if (other == again || other->shadow.direction != GPIO_SHADOW_UNKNOWN ||
+               other->debounce.mode != GPIO_DEBOUNCE_NONE) {
+        fprintf(stderr, "second open of line 12 shares the first one's handle\n");
+    } else if (ops->wait_event(other, &event, 0) == ENOTSUP || ops->wait_event(again, &event, 0) != ENOTSUP) {
+        fprintf(stderr, "software debounce leaked between opens of line 12\n");
+    } else if (gpio_sim_get_output(12, &value) != 0 || value != GPIO_HIGH ||
+               ops->resync(other) != 0 || other->shadow.direction != GPIO_OUT) {
+        fprintf(stderr, "line 12 lost its state in the pool\n");
+    } else {
+        printf("%-12s line state kept across close and open, one handle per open\n", "reuse");
+        ret = 0;
+    }
+    if (other != NULL) {
+        ops->close(other);
+    }
+close:
+    if (again != NULL) {
+        ops->close(again);
+    }
+    gpio_pool_flush(gpio_sysfs_pool());
+    return ret;
+}
+
+int main(void)
+{
+    int ret = 0;
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    gpio_timing_calibrate();
+    gpio_accounting(true);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]) && ret == 0; ++i) {
+        ret = bench_cycles(&cases[i]);
+    }
+    ret = ret != 0 ? ret : bench_reuse();
+    gpio_accounting(false);
+    gpio_sim_uninstall();
+    if (ret != 0) {
+        fprintf(stderr, "pool bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
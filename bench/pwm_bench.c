@@ -0,0 +1,169 @@
+/*
+ * Drives a growing number of PWM channels from one gpio_pwm thread and
+ * reports, per channel, how far the frequency and duty measured on the
+ * writes land from the ones asked for. Channels get staggered frequencies
+ * and duties so their edges rarely line up. Runs on the mmio backend over
+ * a plain file, so the numbers are the engine's, not a driver's.
+ * Pass -v to print every channel instead of the summary line. Before that
+ * the limits: periods past 32 bits of ns are taken, past
+ * GPIO_PWM_PERIOD_MAX refused, and channels never added answer ENOENT.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "gpio.h"
+#include "gpio_mmio.h"
+#include "gpio_pwm.h"
+#include "gpio_timing.h"
+
+#define BENCH_SECONDS 1
+#define BENCH_REGS "/tmp/pwm_bench_regs"
+#define BENCH_MAX 48
+
+static const unsigned int counts[] = { 1, 4, 16, BENCH_MAX };
+
+static uint32_t bench_hz(unsigned int i)
+{
+    return 500 + 37 * i;
+}
+
+static uint32_t bench_duty(unsigned int i)
+{
+    return GPIO_PWM_DUTY_MAX / 10 + (i * 170000u) % (GPIO_PWM_DUTY_MAX * 8 / 10);
+}
+
+static int bench(gpio **lines, unsigned int count, int verbose)
+{
+    int ret = 0;
+    unsigned int channel[BENCH_MAX];
+    struct gpio_pwm *pwm = gpio_pwm_create();
+    if (pwm == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < count && ret == 0; ++i) {
+        ret = gpio_pwm_add(pwm, lines[i], 1000000000u / bench_hz(i), bench_duty(i), &channel[i]);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "add channels failed\n");
+        goto destroy;
+    }
+    gpio_timing_wait_until(gpio_timing_now() + BENCH_SECONDS * 1000000000ull);
+    double hz_sum = 0, hz_max = 0, duty_sum = 0, duty_max = 0;
+    uint64_t late_max = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        struct gpio_pwm_stats stats;
+        (void)gpio_pwm_stats(pwm, channel[i], &stats);
+        if (stats.periods == 0) {
+            fprintf(stderr, "channel %u never completed a period\n", i);
+            ret = -1;
+            goto destroy;
+        }
+        double hz = stats.periods * 1e9 / stats.period_ns;
+        double duty = (double)stats.high_ns / stats.period_ns;
+        /* frequency error relative, duty error in percentage points */
+        double hz_err = fabs(hz - bench_hz(i)) / bench_hz(i) * 100;
+        double duty_err = fabs(duty - (double)bench_duty(i) / GPIO_PWM_DUTY_MAX) * 100;
+        if (verbose) {
+            printf("%5u %5u %10u %10.2f %9.4f %7.1f %9.4f %10.1f\n", count, i, bench_hz(i), hz, hz_err,
+                   bench_duty(i) / 1e4, duty_err, stats.late_max_ns / 1e3);
+        }
+        hz_sum += hz_err;
+        duty_sum += duty_err;
+        hz_max = hz_err > hz_max ? hz_err : hz_max;
+        duty_max = duty_err > duty_max ? duty_err : duty_max;
+        late_max = stats.late_max_ns > late_max ? stats.late_max_ns : late_max;
+    }
+    if (!verbose) {
+        printf("%5u %11.4f %11.4f %11.4f %11.4f %10.1f\n", count, hz_sum / count, hz_max,
+               duty_sum / count, duty_max, late_max / 1e3);
+    }
+destroy:
+    gpio_pwm_destroy(pwm);
+    return ret;
+}
+
+static int bench_limits(gpio *io)
+{
+    int ret = -1;
+    unsigned int channel;
+    struct gpio_pwm *pwm = gpio_pwm_create();
+    if (pwm == NULL) {
+        return -1;
+    }
+    if (gpio_pwm_set(pwm, 0, 1000000, 0) != ENOENT || gpio_pwm_set_duty(pwm, 0, 0) != ENOENT) {
+        fprintf(stderr, "a channel never added took a config\n");
+        goto destroy;
+    }
+    /* 10 s, more than 32 bits of ns */
+    if (gpio_pwm_add(pwm, io, 10000000000ull, GPIO_PWM_DUTY_MAX / 2, &channel) != 0 ||
+        gpio_pwm_set_duty(pwm, channel, GPIO_PWM_DUTY_MAX / 4) != 0 ||
+        gpio_pwm_set(pwm, channel, GPIO_PWM_PERIOD_MAX, GPIO_PWM_DUTY_MAX) != 0) {
+        fprintf(stderr, "a period past 32 bits of ns was refused\n");
+        goto destroy;
+    }
+    if (gpio_pwm_set(pwm, channel, GPIO_PWM_PERIOD_MAX + 1, 0) != EINVAL) {
+        fprintf(stderr, "a period past GPIO_PWM_PERIOD_MAX was taken\n");
+        goto destroy;
+    }
+    printf("periods up to %.1f h taken, past that refused, unknown channels ENOENT\n",
+           GPIO_PWM_PERIOD_MAX / 3.6e12);
+    ret = 0;
+destroy:
+    gpio_pwm_destroy(pwm);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    gpio *lines[BENCH_MAX];
+    unsigned int opened = 0;
+    struct gpio_mmio_layout layout = GPIO_MMIO_BCM2711;
+    layout.path = BENCH_REGS;
+    layout.emulate_level = true;
+    FILE *regs = fopen(BENCH_REGS, "w");
+    if (regs == NULL || ftruncate(fileno(regs), layout.length) != 0) {
+        fprintf(stderr, "create %s failed\n", BENCH_REGS);
+        return 1;
+    }
+    fclose(regs);
+    gpio_mmio_configure(&layout);
+    gpio_set_backend(GPIO_BACKEND_MMIO);
+    struct gpio_ops *ops = get_gpio_ops();
+    for (opened = 0; opened < BENCH_MAX; ++opened) {
+        lines[opened] = ops->open(opened);
+        if (lines[opened] == NULL || ops->set_direction(lines[opened], GPIO_OUT) != 0) {
+            fprintf(stderr, "open line %u failed\n", opened);
+            ret = 1;
+            goto close;
+        }
+    }
+    gpio_timing_calibrate();
+    if (bench_limits(lines[0]) != 0) {
+        ret = 1;
+        goto close;
+    }
+    if (verbose) {
+        printf("%5s %5s %10s %10s %9s %7s %9s %10s\n", "chans", "chan", "want_hz", "got_hz", "hz_err%",
+               "duty%", "duty_err", "late_us");
+    } else {
+        printf("%5s %11s %11s %11s %11s %10s\n", "chans", "hz_err%avg", "hz_err%max", "duty_errAvg",
+               "duty_errMax", "late_us");
+    }
+    for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]) && ret == 0; ++c) {
+        ret = bench(lines, counts[c], verbose) == 0 ? 0 : 1;
+    }
+close:
+    while (opened-- > 0) {
+        if (lines[opened] != NULL) {
+            ops->close(lines[opened]);
+        }
+    }
+    unlink(BENCH_REGS);
+    return ret;
+}
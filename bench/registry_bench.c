@@ -0,0 +1,191 @@
+/*
+ * Lines spread over several gpiochips on gpio_sim, numbered the way newer
+ * kernels do with bases in the hundreds. Checks three digit lines export
+ * and drive, lines between chips are refused, then times pooled open and
+ * close with a handful of lines in use against nearly a thousand, which
+ * should cost the same since every lookup is one table index. Then the
+ * cdev backend on the two chips of its mock: a line of the second chip
+ * opens, drives and reports edges by its own number, a set across both
+ * chips is refused. Built with -DGPIO_STATS, line 517 has to get a
+ * latency row of its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_pool.h"
+#include "gpio_registry.h"
+#include "gpio_sim.h"
+#include "gpio_stats.h"
+#include "gpio_sysfs.h"
+#include "gpio_timing.h"
+
+#define BENCH_CYCLES 200000
+
+static unsigned int lines[GPIO_SIM_LINES];
+static unsigned int line_count;
+
+static int bench_chips(void)
+{
+    const struct gpio_registry *reg = gpio_sysfs_registry();
+    if (reg == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < reg->chips; ++i) {
+        const struct gpio_chip_info *chip = &reg->chip[i];
+        printf("%-12s base %4u ngpio %4u %s\n", "chip", chip->base, chip->ngpio, chip->label);
+        for (unsigned int l = 0; l < chip->ngpio; ++l) {
+            lines[line_count++] = chip->base + l;
+        }
+    }
+    return 0;
+}
+
+static int bench_wide(void)
+{
+    enum gpio_value value;
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(517);
+    if (io == NULL) {
+        fprintf(stderr, "line 517 did not open\n");
+        return -1;
+    }
+    int ret = ops->set_direction(io, GPIO_OUT);
+    ret = ret != 0 ? ret : ops->set_value(io, GPIO_HIGH);
+    ret = ret != 0 ? ret : gpio_sim_get_output(517, &value);
+    ops->close(io);
+    if (ret != 0 || value != GPIO_HIGH) {
+        fprintf(stderr, "line 517 was not driven\n");
+        return -1;
+    }
+    io = ops->open(80);
+    if (io != NULL) {
+        fprintf(stderr, "line 80 is on no chip yet opened\n");
+        ops->close(io);
+        return -1;
+    }
+    printf("%-12s line 517 driven, line 80 between chips refused\n", "wide");
+#ifdef GPIO_STATS
+    static struct gpio_stats_snapshot snap;
+    uint64_t count = 0;
+    gpio_stats_snapshot(&snap);
+    unsigned int row = 0;
+    while (row < snap.rows && snap.gpio_nr[row] != 517) {
+        ++row;
+    }
+    for (unsigned int b = 0; row < snap.rows && b < GPIO_STATS_BUCKETS; ++b) {
+        count += snap.hist[row][GPIO_STATS_SET_VALUE][b];
+    }
+    if (count == 0) {
+        fprintf(stderr, "line 517 has no latency row of its own\n");
+        return -1;
+    }
+    printf("%-12s line 517 timed in row %u\n", "stats", row);
+#endif
+    return 0;
+}
+
+/* every line is opened once so the pool holds it, then random lines cycle through the pool */
+static int bench_cycles(unsigned int span)
+{
+    struct gpio_ops *ops = get_gpio_ops();
+    const struct gpio_pool_policy policy = { .max_idle = GPIO_SIM_LINES, .idle_ms = 60000 };
+    gpio_pool_set_policy(gpio_sysfs_pool(), &policy);
+    uint64_t start = gpio_timing_now();
+    for (unsigned int i = 0; i < span; ++i) {
+        gpio *io = ops->open(lines[i]);
+        if (io == NULL) {
+            return -1;
+        }
+        ops->close(io);
+    }
+    double cold = (double)(gpio_timing_now() - start) / span;
+    unsigned int seed = 1;
+    start = gpio_timing_now();
+    for (int i = 0; i < BENCH_CYCLES; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        gpio *io = ops->open(lines[(seed >> 8) % span]);
+        if (io == NULL) {
+            return -1;
+        }
+        ops->close(io);
+    }
+    double warm = (double)(gpio_timing_now() - start) / BENCH_CYCLES;
+    printf("%-12s %4u lines %10.0f ns cold open %8.0f ns pooled open+close\n", "cycle", span, cold, warm);
+    gpio_pool_flush(gpio_sysfs_pool());
+    return 0;
+}
+
+/* gpio 70 and 71 are offsets 6 and 7 of the mock's second chip */
+static int bench_cdev(void)
+{
+    static const unsigned int across[] = { 10, 70 };
+    static const unsigned int second[] = { 70, 71 };
+    enum gpio_value value;
+    struct gpio_event event;
+    const struct gpio_registry *reg = gpio_cdev_registry();
+    if (reg == NULL || reg->chips != 2) {
+        fprintf(stderr, "cdev found %u gpiochips, the mock has 2\n", reg == NULL ? 0 : reg->chips);
+        return -1;
+    }
+    for (unsigned int i = 0; i < reg->chips; ++i) {
+        const struct gpio_chip_info *chip = &reg->chip[i];
+        printf("%-12s base %4u ngpio %4u %s\n", "cdev chip", chip->base, chip->ngpio, chip->label);
+    }
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio_set *set = ops->set_open(across, 2);
+    if (set != NULL) {
+        fprintf(stderr, "a set across two gpiochips opened\n");
+        ops->set_close(set);
+        return -1;
+    }
+    set = ops->set_open(second, 2);
+    if (set == NULL) {
+        fprintf(stderr, "lines 70 and 71 did not open\n");
+        return -1;
+    }
+    int ret = ops->set_directions(set, 0x3, 0x1);
+    ret = ret != 0 ? ret : ops->set_value(set->lines[0], GPIO_HIGH);
+    ret = ret != 0 ? ret : gpio_cdev_mock_get_output(70, &value);
+    if (ret != 0 || value != GPIO_HIGH) {
+        fprintf(stderr, "line 70 was not driven\n");
+        ret = -1;
+    }
+    ret = ret != 0 ? ret : ops->set_edge(set->lines[1], GPIO_RISING);
+    ret = ret != 0 ? ret : gpio_cdev_mock_set_input(71, GPIO_HIGH);
+    ret = ret != 0 ? ret : ops->read_event(set->lines[1], &event);
+    if (ret == 0 && event.gpio_nr != 71) {
+        fprintf(stderr, "edge of line 71 reported as line %u\n", event.gpio_nr);
+        ret = -1;
+    }
+    ops->set_close(set);
+    if (ret == 0) {
+        printf("%-12s line 70 driven, line 71 edge seen, lines 10 and 70 refused\n", "cdev");
+    }
+    return ret;
+}
+
+int main(void)
+{
+    int ret;
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    ret = gpio_sim_add_chip(100, 300, "expander");
+    ret = ret != 0 ? ret : gpio_sim_add_chip(512, 512, "soc");
+    ret = ret != 0 ? ret : bench_chips();
+    ret = ret != 0 ? ret : bench_wide();
+    ret = ret != 0 ? ret : bench_cycles(16);
+    ret = ret != 0 ? ret : bench_cycles(line_count);
+    gpio_sim_uninstall();
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    ret = ret != 0 ? ret : bench_cdev();
+    gpio_cdev_mock_uninstall();
+    if (ret != 0) {
+        fprintf(stderr, "registry bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
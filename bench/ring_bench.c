@@ -0,0 +1,153 @@
+/*
+ * Bursts edges on a cdev mock line captured by gpio_loop into a ring far
+ * smaller than the burst. A consumer that keeps up has to see every edge;
+ * a slow one, draining a few records at a time, has to lose edges only as
+ * counted overflow: captured equals drained plus overflow, and the gaps in
+ * the drained sequence numbers add up to the overflow.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_loop.h"
+#include "gpio_ring.h"
+
+#define BENCH_LINE 40
+#define BENCH_RING 256
+#define BENCH_EDGES 8192
+/* under what the mock queues per request, so no edge is lost before the ring */
+#define BENCH_BURST 32
+#define BENCH_SLOW_DRAIN 8
+#define BENCH_SLOW_US 200
+
+struct bench_consumer {
+    struct gpio_ring *ring;
+    bool done;
+    uint64_t drained;
+    uint64_t next;          /* sequence expected next */
+    uint64_t gaps;
+};
+
+static void bench_take(struct bench_consumer *c, const struct gpio_record *records, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; ++i) {
+        c->gaps += records[i].sequence - c->next;
+        c->next = records[i].sequence + 1;
+    }
+    c->drained += n;
+}
+
+static void *bench_slow(void *arg)
+{
+    struct bench_consumer *c = (struct bench_consumer *)arg;
+    struct gpio_record records[BENCH_SLOW_DRAIN];
+    for (;;) {
+        bool done = __atomic_load_n(&c->done, __ATOMIC_ACQUIRE);
+        unsigned int n = gpio_ring_drain(c->ring, records, BENCH_SLOW_DRAIN);
+        bench_take(c, records, n);
+        if (n == 0 && done) {
+            break;
+        }
+        usleep(BENCH_SLOW_US);
+    }
+    return NULL;
+}
+
+/* one burst of edges into the mock, then the loop moves them into the ring */
+static int bench_burst(struct gpio_loop *loop, unsigned int first)
+{
+    int ret = 0;
+    for (unsigned int e = first; e < first + BENCH_BURST && ret == 0; ++e) {
+        ret = gpio_cdev_mock_set_input(BENCH_LINE, e % 2 == 0 ? GPIO_HIGH : GPIO_LOW);
+    }
+    while (ret == 0) {
+        ret = gpio_loop_wait(loop, 0);
+    }
+    return ret == ETIMEDOUT ? 0 : ret;
+}
+
+static int bench(struct gpio_loop *loop, bool slow)
+{
+    static struct gpio_record records[BENCH_RING];
+    int ret = 0;
+    pthread_t thread;
+    struct gpio_ring_stats stats;
+    struct bench_consumer c;
+    memset(&c, 0, sizeof(c));
+    c.ring = gpio_ring_create(BENCH_RING);
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(BENCH_LINE);
+    if (c.ring == NULL || io == NULL) {
+        ret = -1;
+        goto close;
+    }
+    /* the line rests low, the first edge of every run rises */
+    ret = gpio_cdev_mock_set_input(BENCH_LINE, GPIO_LOW);
+    ret = ret != 0 ? ret : gpio_loop_capture(loop, io, GPIO_BOTH, c.ring);
+    if (ret != 0) {
+        goto close;
+    }
+    if (slow && pthread_create(&thread, NULL, bench_slow, &c) != 0) {
+        ret = -1;
+        goto remove;
+    }
+    for (unsigned int e = 0; e < BENCH_EDGES && ret == 0; e += BENCH_BURST) {
+        ret = bench_burst(loop, e);
+        /* the consumer that keeps up drains after every burst */
+        for (unsigned int n = 1; !slow && n != 0;) {
+            n = gpio_ring_drain(c.ring, records, BENCH_RING);
+            bench_take(&c, records, n);
+        }
+    }
+    if (slow) {
+        __atomic_store_n(&c.done, true, __ATOMIC_RELEASE);
+        pthread_join(thread, NULL);
+    }
+    gpio_ring_stats(c.ring, &stats);
+    c.gaps += stats.captured - c.next;
+    printf("%-6s %8d %8llu %8llu %8llu %8llu\n", slow ? "slow" : "keeps", BENCH_EDGES,
+           (unsigned long long)stats.captured, (unsigned long long)c.drained, (unsigned long long)stats.overflow,
+           (unsigned long long)c.gaps);
+    if (ret == 0 && (stats.captured != BENCH_EDGES || stats.captured != c.drained + stats.overflow ||
+                     c.gaps != stats.overflow || (slow ? stats.overflow == 0 : stats.overflow != 0))) {
+        fprintf(stderr, "%s consumer: edges went missing without being counted\n", slow ? "slow" : "fast");
+        ret = -1;
+    }
+remove:
+    (void)gpio_loop_remove(loop, io);
+close:
+    if (io != NULL) {
+        ops->close(io);
+    }
+    if (c.ring != NULL) {
+        gpio_ring_destroy(c.ring);
+    }
+    return ret;
+}
+
+int main(void)
+{
+    int ret;
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    struct gpio_loop *loop = gpio_loop_create();
+    if (loop == NULL) {
+        gpio_cdev_mock_uninstall();
+        return 1;
+    }
+    printf("ring of %d records, edges in bursts of %d\n", BENCH_RING, BENCH_BURST);
+    printf("%-6s %8s %8s %8s %8s %8s\n", "reader", "edges", "captured", "drained", "overflow", "gaps");
+    ret = bench(loop, false);
+    ret = ret != 0 ? ret : bench(loop, true);
+    gpio_loop_destroy(loop);
+    gpio_cdev_mock_uninstall();
+    if (ret != 0) {
+        fprintf(stderr, "ring bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+/*
+ * Cost of one DS1302 style transaction (command byte plus one data byte,
+ * clock and data on two lines) driven the old way, one ops call per edge
+ * through a per-bit callback, against the same transaction compiled into
+ * a gpio_seq. Waits are left out so only the dispatch overhead is measured.
+ * Runs on the cdev mock and on the mmio backend over a plain file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_mmio.h"
+#include "gpio_seq.h"
+#include "gpio_timing.h"
+
+#define BENCH_ROUNDS 20000
+#define BENCH_BYTES 2
+#define BENCH_REGS "/tmp/seq_bench_regs"
+
+enum { LINE_CLK, LINE_DAT, LINE_RST, LINE_MAX };
+
+static int send_bit(gpio_set *set, const unsigned char *data, int t)
+{
+    enum gpio_value val = ((*data >> t) & 1) == 0 ? GPIO_LOW : GPIO_HIGH;
+    return get_gpio_ops()->set_value(set->lines[LINE_DAT], val);
+}
+
+/* shaped like the driver before sequences: lookup and callback per bit */
+static int per_bit(gpio_set *set, int (*func)(gpio_set *, const unsigned char *, int), const unsigned char *bytes)
+{
+    int ret = get_gpio_ops()->set_value(set->lines[LINE_RST], GPIO_HIGH);
+    for (int b = 0; b < BENCH_BYTES && ret == 0; ++b) {
+        for (int i = 0; i < 8 && ret == 0; ++i) {
+            ret = get_gpio_ops()->set_value(set->lines[LINE_CLK], GPIO_LOW);
+            ret = ret != 0 ? ret : func(set, &bytes[b], i);
+            ret = ret != 0 ? ret : get_gpio_ops()->set_value(set->lines[LINE_CLK], GPIO_HIGH);
+        }
+    }
+    return ret != 0 ? ret : get_gpio_ops()->set_value(set->lines[LINE_RST], GPIO_LOW);
+}
+
+static struct gpio_seq *build(struct gpio_ops *ops, gpio_set *set)
+{
+    struct gpio_seq *seq = gpio_seq_create(ops, set, 2 + 3 * 8 * BENCH_BYTES);
+    if (seq == NULL) {
+        return NULL;
+    }
+    (void)gpio_seq_add(seq, GPIO_SEQ_SET, LINE_RST, 0);
+    for (unsigned int bit = 0; bit < 8 * BENCH_BYTES; ++bit) {
+        (void)gpio_seq_add(seq, GPIO_SEQ_CLR, LINE_CLK, 0);
+        (void)gpio_seq_add(seq, GPIO_SEQ_PUT, LINE_DAT, bit);
+        (void)gpio_seq_add(seq, GPIO_SEQ_SET, LINE_CLK, 0);
+    }
+    (void)gpio_seq_add(seq, GPIO_SEQ_CLR, LINE_RST, 0);
+    if (gpio_seq_compile(seq) != 0) {
+        gpio_seq_destroy(seq);
+        return NULL;
+    }
+    return seq;
+}
+
+static uint64_t syscalls(void)
+{
+    struct gpio_io_stats stats;
+    uint64_t n = 0;
+    gpio_io_stats(&stats);
+    for (int op = 0; op < GPIO_OP_MAX; ++op) {
+        n += stats.ops[op].syscalls;
+    }
+    return n;
+}
+
+static int bench(const char *name)
+{
+    int ret = 0;
+    const unsigned int nrs[LINE_MAX] = { 2, 3, 4 };
+    const unsigned char bytes[BENCH_BYTES] = { 0x81, 0x5a };
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio_set *set = ops->set_open(nrs, LINE_MAX);
+    if (set == NULL || ops->set_directions(set, 0x7, 0x7) != 0) {
+        fprintf(stderr, "open lines on %s failed\n", name);
+        return -1;
+    }
+    struct gpio_seq *seq = build(ops, set);
+    if (seq == NULL) {
+        ops->set_close(set);
+        return -1;
+    }
+    for (int mode = 0; mode < 2 && ret == 0; ++mode) {
+        gpio_io_reset_stats();
+        uint64_t start = gpio_timing_now();
+        for (int r = 0; r < BENCH_ROUNDS && ret == 0; ++r) {
+            ret = mode == 0 ? per_bit(set, send_bit, bytes) : gpio_seq_run(seq, bytes, NULL);
+        }
+        uint64_t elapsed = gpio_timing_now() - start;
+        printf("%-6s %-8s %10.0f %12.1f %8u\n", name, mode == 0 ? "per-bit" : "seq",
+               (double)elapsed / BENCH_ROUNDS, (double)syscalls() / BENCH_ROUNDS,
+               mode == 0 ? 2 + 3 * 8 * BENCH_BYTES : gpio_seq_steps(seq));
+    }
+    gpio_seq_destroy(seq);
+    ops->set_close(set);
+    return ret;
+}
+
+int main(void)
+{
+    int ret;
+    gpio_accounting(true);
+    printf("%-6s %-8s %10s %12s %8s\n", "ops", "mode", "ns/xfer", "syscall/xfer", "calls");
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    ret = bench("cdev");
+    gpio_cdev_mock_uninstall();
+    if (ret != 0) {
+        return 1;
+    }
+    struct gpio_mmio_layout layout = GPIO_MMIO_BCM2711;
+    layout.path = BENCH_REGS;
+    layout.emulate_level = true;
+    FILE *regs = fopen(BENCH_REGS, "w");
+    if (regs == NULL || ftruncate(fileno(regs), layout.length) != 0) {
+        fprintf(stderr, "create %s failed\n", BENCH_REGS);
+        return 1;
+    }
+    fclose(regs);
+    gpio_mmio_configure(&layout);
+    gpio_set_backend(GPIO_BACKEND_MMIO);
+    ret = bench("mmio");
+    unlink(BENCH_REGS);
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+/*
+ * Reads the DS1302 with rtc_read_timer on gpio_sim through sysfs and on
+ * the cdev mock, with the shadow state on and then off, and reports per
+ * read what the shadow skipped, what it issued and the syscalls the
+ * backend made. Both runs have to read the same clock back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_sim.h"
+#include "gpio_timing.h"
+#include "rtc.h"
+
+#define BENCH_READS 50
+
+static uint64_t bench_syscalls(void)
+{
+    uint64_t total = 0;
+    struct gpio_io_stats stats;
+    gpio_io_stats(&stats);
+    for (int op = 0; op < GPIO_OP_MAX; ++op) {
+        total += stats.ops[op].syscalls;
+    }
+    return total;
+}
+
+static int bench(const char *name, int (*attach)(unsigned int, unsigned int, unsigned int, time_t), bool shadow)
+{
+    int ret = -1;
+    struct rtc_time got;
+    struct tm tm;
+    struct gpio_cache_stats cache;
+    time_t now = time(NULL);
+    (void)gmtime_r(&now, &tm);
+    (void)attach(23, 24, 25, now);
+    gpio_cache(shadow);
+    struct rtc_gpio *rtc = rtc_init(18, 23, 24, 25);
+    if (rtc == NULL) {
+        goto detach;
+    }
+    gpio_cache_reset_stats();
+    gpio_io_reset_stats();
+    uint64_t start = gpio_timing_now();
+    for (int i = 0; i < BENCH_READS; ++i) {
+        if (rtc_read_timer(rtc, &got) != 0) {
+            goto finalize;
+        }
+    }
+    uint64_t elapsed = gpio_timing_now() - start;
+    gpio_cache_stats(&cache);
+    printf("%-6s %-6s %10.1f %10.1f %10.1f %10.1f\n", name, shadow ? "on" : "off",
+           (double)cache.elided / BENCH_READS, (double)cache.issued / BENCH_READS,
+           (double)bench_syscalls() / BENCH_READS, elapsed / 1e3 / BENCH_READS);
+    if (got.year != (unsigned int)tm.tm_year + 1900 || got.month != (unsigned int)tm.tm_mon + 1 ||
+        got.date != (unsigned int)tm.tm_mday) {
+        fprintf(stderr, "%s: rtc read %04u-%02u-%02u, host is %04d-%02d-%02d\n", name, got.year, got.month,
+                got.date, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+        goto finalize;
+    }
+    ret = 0;
+finalize:
+    rtc_finalize(rtc);
+detach:
+    gpio_cache(true);
+    gpio_sim_ds1302_detach();
+    return ret;
+}
+
+int main(void)
+{
+    int ret;
+    printf("rtc_read_timer, per read\n");
+    printf("%-6s %-6s %10s %10s %10s %10s\n", "ops", "shadow", "elided", "issued", "syscalls", "us");
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_accounting(true);
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    ret = bench("sysfs", gpio_sim_ds1302_attach, true);
+    ret = ret != 0 ? ret : bench("sysfs", gpio_sim_ds1302_attach, false);
+    gpio_sim_uninstall();
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    ret = ret != 0 ? ret : bench("cdev", gpio_sim_ds1302_attach_cdev, true);
+    ret = ret != 0 ? ret : bench("cdev", gpio_sim_ds1302_attach_cdev, false);
+    gpio_cdev_mock_uninstall();
+    gpio_accounting(false);
+    if (ret != 0) {
+        fprintf(stderr, "shadow bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
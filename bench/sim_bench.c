@@ -0,0 +1,188 @@
+/*
+ * Runs the sysfs backend and the code above it against gpio_sim on the
+ * build host: raw attribute writes, led_flash on its pin, the edge path
+ * touch() sits on (input change to handler through the loop), and the
+ * DS1302 driver against the simulated chip, checking what it reads back.
+ * The driver runs once more with the chip on the cdev mock, where turning
+ * dat around mid transaction reconfigures the request rst and clk are on.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_loop.h"
+#include "gpio_sim.h"
+#include "gpio_timing.h"
+#include "led_flash.h"
+#include "rtc.h"
+
+#define BENCH_WRITES 20000
+#define BENCH_EDGES 2000
+#define BENCH_RTC_READS 20
+#define BENCH_FLASHES 10
+#define BENCH_FLASH_HZ 50
+
+static int bench_writes(void)
+{
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(5);
+    if (io == NULL || ops->set_direction(io, GPIO_OUT) != 0) {
+        return -1;
+    }
+    uint64_t start = gpio_timing_now();
+    for (int i = 0; i < BENCH_WRITES; ++i) {
+        (void)ops->set_value(io, i & 1 ? GPIO_HIGH : GPIO_LOW);
+    }
+    uint64_t elapsed = gpio_timing_now() - start;
+    ops->close(io);
+    printf("%-12s %10.0f ns/write\n", "set_value", (double)elapsed / BENCH_WRITES);
+    return 0;
+}
+
+static int bench_flash(void)
+{
+    struct gpio_io_stats io;
+    /* no flashes asked for, the line is not even opened */
+    gpio_io_reset_stats();
+    gpio_accounting(true);
+    int ret = led_flash(0, BENCH_FLASH_HZ);
+    gpio_accounting(false);
+    gpio_io_stats(&io);
+    if (ret != 0 || io.ops[GPIO_OP_OPEN].calls != 0) {
+        fprintf(stderr, "led_flash of no flashes touched the line\n");
+        return -1;
+    }
+    uint64_t start = gpio_timing_now();
+    if (led_flash(BENCH_FLASHES, BENCH_FLASH_HZ) != 0) {
+        return -1;
+    }
+    double want = (double)BENCH_FLASHES / BENCH_FLASH_HZ * 1e3;
+    double got = (gpio_timing_now() - start) / 1e6;
+    printf("%-12s %10.2f ms for %.2f ms of flashes\n", "led_flash", got, want);
+    return 0;
+}
+
+static int record(enum gpio_value signal, void *data)
+{
+    (void)signal;
+    *(uint64_t *)data = gpio_timing_now();
+    return 0;
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* what touch() waits on, without its debounce so every edge is timed */
+static int bench_edges(void)
+{
+    int ret = -1;
+    uint64_t seen = 0;
+    static uint64_t lat[BENCH_EDGES];
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(22);
+    if (io == NULL) {
+        return -1;
+    }
+    struct gpio_loop *loop = gpio_loop_create();
+    if (loop == NULL || ops->set_direction(io, GPIO_IN) != 0 ||
+        gpio_loop_add(loop, io, GPIO_BOTH, record, &seen) != 0) {
+        goto close;
+    }
+    for (int i = 0; i < BENCH_EDGES; ++i) {
+        uint64_t start = gpio_timing_now();
+        (void)gpio_sim_set_input(22, i & 1 ? GPIO_LOW : GPIO_HIGH);
+        if (gpio_loop_wait(loop, 100) != 0) {
+            fprintf(stderr, "edge %d never arrived\n", i);
+            goto remove;
+        }
+        lat[i] = seen - start;
+    }
+    qsort(lat, BENCH_EDGES, sizeof(lat[0]), compare);
+    printf("%-12s %10.0f ns p50 %10.0f ns p99\n", "edge", (double)lat[BENCH_EDGES / 2],
+           (double)lat[BENCH_EDGES * 99 / 100]);
+    ret = 0;
+remove:
+    (void)gpio_loop_remove(loop, io);
+close:
+    if (loop != NULL) {
+        gpio_loop_destroy(loop);
+    }
+    ops->close(io);
+    return ret;
+}
+
+static int bench_rtc(const char *name, int (*attach)(unsigned int, unsigned int, unsigned int, time_t))
+{
+    int ret = -1;
+    struct rtc_time got;
+    struct tm tm;
+    struct gpio_sim_ds1302_stats stats;
+    time_t now = time(NULL);
+    (void)gmtime_r(&now, &tm);
+    (void)attach(23, 24, 25, now);
+    struct rtc_gpio *rtc = rtc_init(18, 23, 24, 25);
+    if (rtc == NULL) {
+        goto detach;
+    }
+    uint64_t start = gpio_timing_now();
+    for (int i = 0; i < BENCH_RTC_READS; ++i) {
+        if (rtc_read_timer(rtc, &got) != 0) {
+            goto finalize;
+        }
+    }
+    uint64_t elapsed = gpio_timing_now() - start;
+    gpio_sim_ds1302_stats(&stats);
+    printf("%-12s %-5s %10.0f us/read, %llu commands %llu bytes out\n", "rtc_read", name,
+           elapsed / 1e3 / BENCH_RTC_READS, (unsigned long long)stats.commands, (unsigned long long)stats.bytes_out);
+    if (got.year != (unsigned int)tm.tm_year + 1900 || got.month != (unsigned int)tm.tm_mon + 1 ||
+        got.date != (unsigned int)tm.tm_mday || got.hour != (unsigned int)tm.tm_hour) {
+        fprintf(stderr, "rtc read %04u-%02u-%02u %02u, host is %04d-%02d-%02d %02d\n", got.year, got.month,
+                got.date, got.hour, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
+        goto finalize;
+    }
+    if (rtc_reset_timer(rtc) != 0 || rtc_read_timer(rtc, &got) != 0) {
+        goto finalize;
+    }
+    if (got.year != RTC_YEAR_BASE + 26 || got.month != 1 || got.date != 13 || got.day != 3 || got.minute != 0) {
+        fprintf(stderr, "rtc reset read back %04u-%02u-%02u day %u\n", got.year, got.month, got.date, got.day);
+        goto finalize;
+    }
+    printf("%-12s %-5s %04u-%02u-%02u %02u:%02u:%02u day %u\n", "rtc_reset", name, got.year, got.month,
+           got.date, got.hour, got.minute, got.second, got.day);
+    ret = 0;
+finalize:
+    rtc_finalize(rtc);
+detach:
+    gpio_sim_ds1302_detach();
+    return ret;
+}
+
+int main(void)
+{
+    int ret;
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    gpio_timing_calibrate();
+    ret = bench_writes();
+    ret = ret != 0 ? ret : bench_flash();
+    ret = ret != 0 ? ret : bench_edges();
+    ret = ret != 0 ? ret : bench_rtc("sysfs", gpio_sim_ds1302_attach);
+    gpio_sim_uninstall();
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    ret = ret != 0 ? ret : bench_rtc("cdev", gpio_sim_ds1302_attach_cdev);
+    gpio_cdev_mock_uninstall();
+    if (ret != 0) {
+        fprintf(stderr, "sim bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
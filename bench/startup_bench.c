@@ -0,0 +1,88 @@
+/*
+ * Board bring-up on the sysfs backend over gpio_sim with udev lagging
+ * behind every export: opening the lines one after another waits out the
+ * lag once per line, one set_open exports them all and waits on inotify
+ * for the lot together. Runs with the pool off so every open exports.
+ */
+#include <stdio.h>
+
+#include "gpio.h"
+#include "gpio_pool.h"
+#include "gpio_sim.h"
+#include "gpio_sysfs.h"
+#include "gpio_timing.h"
+
+#define BENCH_LINES 32
+#define BENCH_ROUNDS 5
+
+static const uint32_t delays_us[] = { 0, 500, 2000 };
+
+static double bench_sequential(struct gpio_ops *ops, const unsigned int *nrs)
+{
+    gpio *lines[BENCH_LINES];
+    unsigned int opened = 0;
+    uint64_t start = gpio_timing_now();
+    for (; opened < BENCH_LINES; ++opened) {
+        lines[opened] = ops->open(nrs[opened]);
+        if (lines[opened] == NULL) {
+            break;
+        }
+    }
+    uint64_t elapsed = gpio_timing_now() - start;
+    for (unsigned int i = 0; i < opened; ++i) {
+        ops->close(lines[i]);
+    }
+    return opened == BENCH_LINES ? elapsed / 1e6 : -1;
+}
+
+static double bench_bulk(struct gpio_ops *ops, const unsigned int *nrs)
+{
+    uint64_t start = gpio_timing_now();
+    gpio_set *set = ops->set_open(nrs, BENCH_LINES);
+    uint64_t elapsed = gpio_timing_now() - start;
+    if (set == NULL) {
+        return -1;
+    }
+    ops->set_close(set);
+    return elapsed / 1e6;
+}
+
+int main(void)
+{
+    int ret = 0;
+    unsigned int nrs[BENCH_LINES];
+    const struct gpio_pool_policy off = { .max_idle = 0, .idle_ms = 0 };
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    gpio_pool_set_policy(gpio_sysfs_pool(), &off);
+    struct gpio_ops *ops = get_gpio_ops();
+    for (unsigned int i = 0; i < BENCH_LINES; ++i) {
+        nrs[i] = i;
+    }
+    printf("%d lines, best of %d\n", BENCH_LINES, BENCH_ROUNDS);
+    printf("%-10s %14s %14s\n", "udev us", "sequential ms", "set_open ms");
+    for (size_t d = 0; d < sizeof(delays_us) / sizeof(delays_us[0]) && ret == 0; ++d) {
+        double seq = -1;
+        double bulk = -1;
+        (void)gpio_sim_set_udev_delay(delays_us[d]);
+        for (int r = 0; r < BENCH_ROUNDS; ++r) {
+            double s = bench_sequential(ops, nrs);
+            double b = bench_bulk(ops, nrs);
+            if (s < 0 || b < 0) {
+                fprintf(stderr, "opening with udev %u us failed\n", delays_us[d]);
+                ret = -1;
+                break;
+            }
+            seq = seq < 0 || s < seq ? s : seq;
+            bulk = bulk < 0 || b < bulk ? b : bulk;
+        }
+        printf("%-10u %14.2f %14.2f\n", delays_us[d], seq, bulk);
+    }
+    gpio_sim_uninstall();
+    if (ret != 0) {
+        fprintf(stderr, "startup bench failed\n");
+    }
+    return ret == 0 ? 0 : 1;
+}
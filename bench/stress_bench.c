@@ -0,0 +1,153 @@
+/*
+ * Threads each own a few lines and, round after round, open them, toggle
+ * them, check every line reads back what was last written and close them
+ * again, all at the same time. Any cross-talk between threads (a shared
+ * path buffer, a lost read-modify-write) shows up as a failed open or a
+ * wrong read back. Throughput is reported against one thread times the
+ * thread count. The cdev mock and gpio_sim serialize inside the model
+ * under one lock, so only mmio can show the library's own scaling there.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_mmio.h"
+#include "gpio_sim.h"
+#include "gpio_timing.h"
+
+#define STRESS_MAX_THREADS 8
+#define STRESS_LINES 4
+#define STRESS_ROUNDS 100
+#define STRESS_TOGGLES 500
+#define STRESS_REGS "/tmp/stress_bench_regs"
+
+struct stress_worker {
+    pthread_t thread;
+    unsigned int id;
+    pthread_barrier_t *start;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    uint64_t ops;
+    uint64_t failures;
+};
+
+static void *stress_main(void *arg)
+{
+    struct stress_worker *w = (struct stress_worker *)arg;
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *lines[STRESS_LINES];
+    enum gpio_value value;
+    pthread_barrier_wait(w->start);
+    w->begin_ns = gpio_timing_now();
+    for (unsigned int r = 0; r < STRESS_ROUNDS; ++r) {
+        unsigned int opened;
+        for (opened = 0; opened < STRESS_LINES; ++opened) {
+            lines[opened] = ops->open(w->id * STRESS_LINES + opened);
+            if (lines[opened] == NULL || ops->set_direction(lines[opened], GPIO_OUT) != 0) {
+                ++w->failures;
+                break;
+            }
+        }
+        for (unsigned int t = 0; opened == STRESS_LINES && t < STRESS_TOGGLES; ++t) {
+            enum gpio_value want = (t + w->id) & 1 ? GPIO_HIGH : GPIO_LOW;
+            for (unsigned int i = 0; i < STRESS_LINES; ++i) {
+                if (ops->set_value(lines[i], want) != 0 || ops->get_value(lines[i], &value) != 0 ||
+                    value != want) {
+                    ++w->failures;
+                }
+                w->ops += 2;
+            }
+        }
+        while (opened-- > 0) {
+            if (lines[opened] != NULL) {
+                ops->close(lines[opened]);
+            }
+        }
+        w->ops += 2 * STRESS_LINES;
+    }
+    w->end_ns = gpio_timing_now();
+    return NULL;
+}
+
+/* ops per second over all threads, and how many failed */
+static int stress(unsigned int threads, double *rate, uint64_t *failures)
+{
+    struct stress_worker workers[STRESS_MAX_THREADS];
+    pthread_barrier_t start;
+    uint64_t ops = 0;
+    pthread_barrier_init(&start, NULL, threads + 1);
+    memset(workers, 0, sizeof(workers));
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers[i].id = i;
+        workers[i].start = &start;
+        if (pthread_create(&workers[i].thread, NULL, stress_main, &workers[i]) != 0) {
+            fprintf(stderr, "start worker %u failed\n", i);
+            exit(1);
+        }
+    }
+    pthread_barrier_wait(&start);
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    *failures = 0;
+    /* from the first worker starting to the last one finishing */
+    for (unsigned int i = 0; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        *failures += workers[i].failures;
+        begin = workers[i].begin_ns < begin ? workers[i].begin_ns : begin;
+        end = workers[i].end_ns > end ? workers[i].end_ns : end;
+    }
+    *rate = ops * 1e9 / (end - begin);
+    pthread_barrier_destroy(&start);
+    return *failures == 0 ? 0 : -1;
+}
+
+static int run(const char *name)
+{
+    int ret = 0;
+    double base = 0;
+    for (unsigned int threads = 1; threads <= STRESS_MAX_THREADS; threads *= 2) {
+        double rate;
+        uint64_t failures;
+        ret |= stress(threads, &rate, &failures);
+        base = threads == 1 ? rate : base;
+        printf("%-10s %7u %14.0f %9.2f %9llu\n", name, threads, rate, rate / (base * threads),
+               (unsigned long long)failures);
+    }
+    return ret;
+}
+
+int main(void)
+{
+    int ret = 0;
+    printf("%ld cpus online\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %7s %14s %9s %9s\n", "ops", "threads", "ops/s", "scaling", "failures");
+    struct gpio_mmio_layout layout = GPIO_MMIO_BCM2711;
+    layout.path = STRESS_REGS;
+    layout.emulate_level = true;
+    FILE *regs = fopen(STRESS_REGS, "w");
+    if (regs == NULL || ftruncate(fileno(regs), layout.length) != 0) {
+        fprintf(stderr, "create %s failed\n", STRESS_REGS);
+        return 1;
+    }
+    fclose(regs);
+    gpio_mmio_configure(&layout);
+    gpio_set_backend(GPIO_BACKEND_MMIO);
+    ret |= run("mmio-file");
+    unlink(STRESS_REGS);
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    ret |= run("cdev-mock");
+    gpio_cdev_mock_uninstall();
+    if (gpio_sim_install() != 0) {
+        return 1;
+    }
+    gpio_set_backend(GPIO_BACKEND_SYSFS);
+    ret |= run("sysfs-sim");
+    gpio_sim_uninstall();
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,282 @@
+/*
+ * Regression suite, one JSON document on stdout (or the file given as the
+ * first argument) so results can be diffed between releases. Every case
+ * runs on each backend that can host it without hardware: sysfs over
+ * gpio_sim, cdev over its mock and mmio over a plain file.
+ * Cheap operations are timed in batches of BENCH_BATCH and reported per
+ * operation, so the clock reads do not dominate what is measured.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "gpio_mmio.h"
+#include "gpio_loop.h"
+#include "gpio_sim.h"
+#include "gpio_timing.h"
+#include "rtc.h"
+
+#define BENCH_SAMPLES 2000
+#define BENCH_BATCH 64
+#define BENCH_OPENS 500
+#define BENCH_RTC_READS 20
+#define BENCH_REGS "/tmp/suite_bench_regs"
+
+#define LINE_OUT 5
+#define LINE_IN 6
+#define LINE_IRQ 22
+
+struct bench_backend {
+    const char *name;
+    enum gpio_backend backend;
+    int (*setup)(void);
+    void (*teardown)(void);
+    /* drive an input from the outside, NULL when the backend has no edges to offer */
+    int (*poke)(unsigned int gpio_nr, enum gpio_value value);
+    bool rtc;
+};
+
+static FILE *out;
+static bool first = true;
+static uint64_t samples[BENCH_SAMPLES];
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank on the sorted samples */
+static double percentile(const uint64_t *sorted, unsigned int n, unsigned int p)
+{
+    unsigned int rank = (n * p + 99) / 100;
+    return (double)sorted[rank == 0 ? 0 : rank - 1];
+}
+
+/* samples hold nanoseconds for per ops each */
+static void report(const char *name, const char *backend, unsigned int n, unsigned int per)
+{
+    double sum = 0;
+    qsort(samples, n, sizeof(samples[0]), compare);
+    for (unsigned int i = 0; i < n; ++i) {
+        sum += samples[i];
+    }
+    double mean = sum / n / per;
+    fprintf(out, "%s\n    {\"case\": \"%s\", \"backend\": \"%s\", \"samples\": %u, \"batch\": %u, \"unit\": \"ns\", "
+            "\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f, \"ops_per_sec\": %.0f}",
+            first ? "" : ",", name, backend, n, per, mean, percentile(samples, n, 50) / per,
+            percentile(samples, n, 90) / per, percentile(samples, n, 99) / per, (double)samples[n - 1] / per,
+            1e9 / mean);
+    first = false;
+}
+
+static int bench_toggle(const struct bench_backend *b)
+{
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(LINE_OUT);
+    if (io == NULL || ops->set_direction(io, GPIO_OUT) != 0) {
+        return -1;
+    }
+    for (unsigned int s = 0; s < BENCH_SAMPLES; ++s) {
+        uint64_t start = gpio_timing_now();
+        for (unsigned int i = 0; i < BENCH_BATCH; ++i) {
+            (void)ops->set_value(io, i & 1 ? GPIO_LOW : GPIO_HIGH);
+        }
+        samples[s] = gpio_timing_now() - start;
+    }
+    ops->close(io);
+    report("toggle", b->name, BENCH_SAMPLES, BENCH_BATCH);
+    return 0;
+}
+
+static int bench_get_value(const struct bench_backend *b)
+{
+    enum gpio_value value;
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(LINE_IN);
+    if (io == NULL || ops->set_direction(io, GPIO_IN) != 0) {
+        return -1;
+    }
+    for (unsigned int s = 0; s < BENCH_SAMPLES; ++s) {
+        uint64_t start = gpio_timing_now();
+        for (unsigned int i = 0; i < BENCH_BATCH; ++i) {
+            (void)ops->get_value(io, &value);
+        }
+        samples[s] = gpio_timing_now() - start;
+    }
+    ops->close(io);
+    report("get_value", b->name, BENCH_SAMPLES, BENCH_BATCH);
+    return 0;
+}
+
+static int bench_open_close(const struct bench_backend *b)
+{
+    struct gpio_ops *ops = get_gpio_ops();
+    for (unsigned int s = 0; s < BENCH_OPENS; ++s) {
+        uint64_t start = gpio_timing_now();
+        gpio *io = ops->open(LINE_OUT);
+        if (io == NULL) {
+            return -1;
+        }
+        ops->close(io);
+        samples[s] = gpio_timing_now() - start;
+    }
+    report("open_close", b->name, BENCH_OPENS, 1);
+    return 0;
+}
+
+static int stamp(enum gpio_value signal, void *data)
+{
+    (void)signal;
+    *(uint64_t *)data = gpio_timing_now();
+    return 0;
+}
+
+/* from the input changing to the handler running on the loop */
+static int bench_irq(const struct bench_backend *b)
+{
+    int ret = -1;
+    uint64_t seen = 0;
+    if (b->poke == NULL) {
+        return 0;
+    }
+    struct gpio_ops *ops = get_gpio_ops();
+    gpio *io = ops->open(LINE_IRQ);
+    if (io == NULL) {
+        return -1;
+    }
+    struct gpio_loop *loop = gpio_loop_create();
+    if (loop == NULL || ops->set_direction(io, GPIO_IN) != 0 ||
+        gpio_loop_add(loop, io, GPIO_BOTH, stamp, &seen) != 0) {
+        goto close;
+    }
+    for (unsigned int s = 0; s < BENCH_SAMPLES; ++s) {
+        uint64_t start = gpio_timing_now();
+        if (b->poke(LINE_IRQ, s & 1 ? GPIO_LOW : GPIO_HIGH) != 0 || gpio_loop_wait(loop, 100) != 0) {
+            fprintf(stderr, "edge %u on %s never arrived\n", s, b->name);
+            goto remove;
+        }
+        samples[s] = seen - start;
+    }
+    report("irq_latency", b->name, BENCH_SAMPLES, 1);
+    ret = 0;
+remove:
+    (void)gpio_loop_remove(loop, io);
+close:
+    if (loop != NULL) {
+        gpio_loop_destroy(loop);
+    }
+    ops->close(io);
+    return ret;
+}
+
+/* a whole clock burst read, so mostly the driver's own clk half periods */
+static int bench_rtc(const struct bench_backend *b)
+{
+    int ret = -1;
+    struct rtc_time time;
+    if (!b->rtc) {
+        return 0;
+    }
+    (void)gpio_sim_ds1302_attach(23, 24, 25, (time_t)0);
+    struct rtc_gpio *rtc = rtc_init(18, 23, 24, 25);
+    if (rtc == NULL) {
+        goto detach;
+    }
+    for (unsigned int s = 0; s < BENCH_RTC_READS; ++s) {
+        uint64_t start = gpio_timing_now();
+        if (rtc_read_timer(rtc, &time) != 0) {
+            goto finalize;
+        }
+        samples[s] = gpio_timing_now() - start;
+    }
+    report("rtc_read_timer", b->name, BENCH_RTC_READS, 1);
+    ret = 0;
+finalize:
+    rtc_finalize(rtc);
+detach:
+    gpio_sim_ds1302_detach();
+    return ret;
+}
+
+static int sim_setup(void)
+{
+    return gpio_sim_install();
+}
+
+static int mock_setup(void)
+{
+    gpio_cdev_mock_install();
+    return 0;
+}
+
+static int mmio_setup(void)
+{
+    struct gpio_mmio_layout layout = GPIO_MMIO_BCM2711;
+    layout.path = BENCH_REGS;
+    layout.emulate_level = true;
+    FILE *regs = fopen(BENCH_REGS, "w");
+    if (regs == NULL || ftruncate(fileno(regs), layout.length) != 0) {
+        fprintf(stderr, "create %s failed\n", BENCH_REGS);
+        return -1;
+    }
+    fclose(regs);
+    return gpio_mmio_configure(&layout);
+}
+
+static void mmio_teardown(void)
+{
+    unlink(BENCH_REGS);
+}
+
+static const struct bench_backend backends[] = {
+    { "sysfs-sim", GPIO_BACKEND_SYSFS, sim_setup, gpio_sim_uninstall, gpio_sim_set_input, true },
+    { "cdev-mock", GPIO_BACKEND_CDEV, mock_setup, gpio_cdev_mock_uninstall, gpio_cdev_mock_set_input, false },
+    { "mmio-file", GPIO_BACKEND_MMIO, mmio_setup, mmio_teardown, NULL, false },
+};
+
+static int (*const cases[])(const struct bench_backend *b) = {
+    bench_toggle,
+    bench_get_value,
+    bench_open_close,
+    bench_irq,
+    bench_rtc,
+};
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    out = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "open %s failed\n", argv[1]);
+        return 1;
+    }
+    gpio_timing_calibrate();
+    fprintf(out, "{\n  \"suite\": \"gpio\",\n  \"timestamp\": %ld,\n  \"cases\": [", (long)time(NULL));
+    for (unsigned int i = 0; i < sizeof(backends) / sizeof(backends[0]) && ret == 0; ++i) {
+        const struct bench_backend *b = &backends[i];
+        if (b->setup() != 0) {
+            fprintf(stderr, "set up %s failed\n", b->name);
+            ret = -1;
+            break;
+        }
+        gpio_set_backend(b->backend);
+        for (unsigned int c = 0; c < sizeof(cases) / sizeof(cases[0]) && ret == 0; ++c) {
+            ret = cases[c](b);
+            if (ret != 0) {
+                fprintf(stderr, "case %u on %s failed\n", c, b->name);
+            }
+        }
+        b->teardown();
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return ret == 0 ? 0 : 1;
+}
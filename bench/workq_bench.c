@@ -0,0 +1,213 @@
+/*
+ * Handler throughput and dispatch latency of gpio_workq as the worker count
+ * grows. One thread plays the irq loop and submits edges round-robin over
+ * BENCH_LINES lines, every handler burns BENCH_WORK_NS of cpu. Then a
+ * line is removed from a gpio_loop on the cdev mock while its edges still
+ * wait on the pool, and another line takes its slot: the removed line's
+ * handlers must all have run by the time remove returns, none afterwards.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpio_cdev.h"
+#include "gpio_loop.h"
+#include "gpio_workq.h"
+
+#define BENCH_LINES 32
+#define BENCH_EVENTS 200000
+#define BENCH_WORK_NS 2000
+/* edges left in flight on the pool when the line is removed */
+#define BENCH_INFLIGHT 32
+#define BENCH_SLOW_US 200
+
+static uint64_t latency[BENCH_EVENTS];
+static uint64_t done;
+static uint32_t last_seqno[BENCH_LINES];
+static uint64_t misordered;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int handler(const struct gpio_event *event, void *data)
+{
+    (void)data;
+    uint64_t start = now_ns();
+    uint64_t slot = __atomic_fetch_add(&done, 1, __ATOMIC_RELAXED);
+    latency[slot] = start - event->timestamp_ns;
+    /* strands guarantee this line is not running anywhere else */
+    if (event->seqno != last_seqno[event->gpio_nr] + 1) {
+        __atomic_fetch_add(&misordered, 1, __ATOMIC_RELAXED);
+    }
+    last_seqno[event->gpio_nr] = event->seqno;
+    while (now_ns() - start < BENCH_WORK_NS) {
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench(unsigned int workers)
+{
+    struct gpio_workq *wq = gpio_workq_create(workers);
+    if (wq == NULL) {
+        return -1;
+    }
+    done = 0;
+    misordered = 0;
+    for (int i = 0; i < BENCH_LINES; ++i) {
+        last_seqno[i] = 0;
+    }
+    uint64_t retries = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < BENCH_EVENTS; ++i) {
+        struct gpio_event event = {
+            .gpio_nr = i % BENCH_LINES,
+            .value = (i / BENCH_LINES) & 1 ? GPIO_LOW : GPIO_HIGH,
+            .seqno = i / BENCH_LINES + 1,
+        };
+        event.timestamp_ns = now_ns();
+        while (gpio_workq_submit(wq, &event, handler, NULL) == EAGAIN) {
+            ++retries;
+            sched_yield();
+        }
+    }
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) < BENCH_EVENTS) {
+        sched_yield();
+    }
+    uint64_t elapsed = now_ns() - start;
+    struct gpio_workq_stats stats;
+    gpio_workq_stats(wq, &stats);
+    gpio_workq_destroy(wq);
+    qsort(latency, BENCH_EVENTS, sizeof(latency[0]), cmp_u64);
+    printf("%7u %12.0f %9.1f %9.1f %9.1f %9llu %9llu %10llu\n", workers,
+           BENCH_EVENTS / (elapsed / 1e9),
+           latency[BENCH_EVENTS / 2] / 1e3,
+           latency[BENCH_EVENTS * 99 / 100] / 1e3,
+           latency[BENCH_EVENTS * 999 / 1000] / 1e3,
+           (unsigned long long)stats.stolen,
+           (unsigned long long)retries,
+           (unsigned long long)misordered);
+    return 0;
+}
+
+struct bench_line {
+    unsigned int gpio_nr;
+    unsigned int runs;
+    unsigned int late;      /* runs after the line was removed */
+    bool removed;
+};
+
+static int slow_handler(enum gpio_value value, void *data)
+{
+    (void)value;
+    struct bench_line *line = (struct bench_line *)data;
+    usleep(BENCH_SLOW_US);
+    __atomic_fetch_add(&line->runs, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&line->removed, __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&line->late, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/* edges on gpio_nr into the mock, then the loop hands them to the pool */
+static int bench_edges(struct gpio_loop *loop, unsigned int gpio_nr, unsigned int edges)
+{
+    int ret = 0;
+    for (unsigned int e = 0; e < edges && ret == 0; ++e) {
+        ret = gpio_cdev_mock_set_input(gpio_nr, e % 2 == 0 ? GPIO_HIGH : GPIO_LOW);
+    }
+    while (ret == 0) {
+        ret = gpio_loop_wait(loop, 0);
+    }
+    return ret == ETIMEDOUT ? 0 : ret;
+}
+
+static int bench_remove(void)
+{
+    int ret = -1;
+    struct bench_line first = { .gpio_nr = 20 };
+    struct bench_line second = { .gpio_nr = 21 };
+    gpio_cdev_mock_install();
+    gpio_set_backend(GPIO_BACKEND_CDEV);
+    struct gpio_ops *ops = get_gpio_ops();
+    struct gpio_loop *loop = gpio_loop_create();
+    struct gpio_workq *wq = gpio_workq_create(2);
+    gpio *a = ops->open(first.gpio_nr);
+    gpio *b = ops->open(second.gpio_nr);
+    if (loop == NULL || wq == NULL || a == NULL || b == NULL) {
+        goto end;
+    }
+    gpio_loop_set_workq(loop, wq);
+    if (gpio_loop_add(loop, a, GPIO_BOTH, slow_handler, &first) != 0 ||
+        bench_edges(loop, first.gpio_nr, BENCH_INFLIGHT) != 0) {
+        goto end;
+    }
+    unsigned int queued = __atomic_load_n(&first.runs, __ATOMIC_RELAXED);
+    if (gpio_loop_remove(loop, a) != 0) {
+        goto end;
+    }
+    __atomic_store_n(&first.removed, true, __ATOMIC_RELEASE);
+    unsigned int at_remove = __atomic_load_n(&first.runs, __ATOMIC_RELAXED);
+    /* the freed slot goes to the next line */
+    if (gpio_loop_add(loop, b, GPIO_BOTH, slow_handler, &second) != 0 ||
+        bench_edges(loop, second.gpio_nr, BENCH_INFLIGHT) != 0) {
+        goto end;
+    }
+    gpio_workq_destroy(wq);
+    wq = NULL;
+    printf("remove with %u of %u handlers still queued: %u ran before it returned, %u after, next line ran %u\n",
+           BENCH_INFLIGHT - queued, BENCH_INFLIGHT, at_remove, first.late, second.runs);
+    if (at_remove != BENCH_INFLIGHT || first.late != 0 || first.runs != BENCH_INFLIGHT ||
+        second.runs != BENCH_INFLIGHT) {
+        fprintf(stderr, "handlers of a removed line ran late or went to the wrong line\n");
+        goto end;
+    }
+    ret = 0;
+end:
+    if (wq != NULL) {
+        gpio_workq_destroy(wq);
+    }
+    if (loop != NULL) {
+        gpio_loop_destroy(loop);
+    }
+    if (b != NULL) {
+        ops->close(b);
+    }
+    if (a != NULL) {
+        ops->close(a);
+    }
+    gpio_cdev_mock_uninstall();
+    return ret;
+}
+
+int main(void)
+{
+    static const unsigned int workers[] = { 1, 2, 4, 8 };
+    printf("%u lines, %u events, %u ns per handler\n", BENCH_LINES, BENCH_EVENTS, BENCH_WORK_NS);
+    printf("%7s %12s %9s %9s %9s %9s %9s %10s\n",
+           "workers", "events/s", "p50 us", "p99 us", "p99.9 us", "stolen", "full", "misordered");
+    for (unsigned int i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i) {
+        if (bench(workers[i]) != 0) {
+            fprintf(stderr, "bench with %u workers failed\n", workers[i]);
+            return 1;
+        }
+    }
+    if (bench_remove() != 0) {
+        fprintf(stderr, "remove bench failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -2,11 +2,84 @@
 RASP_HOST=192.168.0.9
 CROSS_COMPILE=/root/toolchain/gcc-arm-11.2-2022.02-x86_64-aarch64-none-linux-gnu/bin/aarch64-none-linux-gnu-
 
+LIB="${LIB} gpio.c"
+LIB="${LIB} gpio_cdev.c"
+LIB="${LIB} gpio_mmio.c"
+LIB="${LIB} gpio_loop.c"
+LIB="${LIB} gpio_ring.c"
+LIB="${LIB} gpio_workq.c"
+LIB="${LIB} gpio_wheel.c"
+LIB="${LIB} gpio_debounce.c"
+LIB="${LIB} gpio_timing.c"
+LIB="${LIB} gpio_seq.c"
+LIB="${LIB} gpio_pwm.c"
+LIB="${LIB} gpio_stats.c"
+LIB="${LIB} gpio_pool.c"
+LIB="${LIB} gpio_registry.c"
+LIB="${LIB} gpio_arena.c"
+LIB="${LIB} gpio_capture.c"
+LIB="${LIB} gpio_analyze.c"
+LIB="${LIB} gpio_play.c"
+
+# test doubles for the benches, never part of iotest
+MOCK="${MOCK} gpio_cdev_mock.c"
+MOCK="${MOCK} gpio_sim.c"
+
 SRC="${SRC} main.c"
-SRC="${SRC} gpio.c"
 SRC="${SRC} touch.c"
 SRC="${SRC} led_flash.c"
+SRC="${SRC} rtc.c"
+SRC="${SRC} rtc_clock.c"
+
+# GPIO_STATS=1 ./build.sh ... records latency histograms, see gpio_stats.h
+CFLAGS="${CFLAGS} ${GPIO_STATS:+-DGPIO_STATS}"
+
+BENCH="${BENCH} bench/workq_bench.c"
+BENCH="${BENCH} bench/seq_bench.c"
+BENCH="${BENCH} bench/pwm_bench.c"
+BENCH="${BENCH} bench/sim_bench.c"
+BENCH="${BENCH} bench/suite_bench.c"
+BENCH="${BENCH} bench/stress_bench.c"
+BENCH="${BENCH} bench/pool_bench.c"
+BENCH="${BENCH} bench/startup_bench.c"
+BENCH="${BENCH} bench/registry_bench.c"
+BENCH="${BENCH} bench/alloc_bench.c"
+BENCH="${BENCH} bench/capture_bench.c"
+BENCH="${BENCH} bench/analyze_bench.c"
+BENCH="${BENCH} bench/play_bench.c"
+BENCH="${BENCH} bench/config_bench.c"
+BENCH="${BENCH} bench/shadow_bench.c"
+BENCH="${BENCH} bench/ring_bench.c"
 
-${CROSS_COMPILE}gcc -o iotest ${SRC} && \
-scp iotest root@${RASP_HOST}:/root/ || \
-echo "build failed"
+case "$1" in
+    bench)
+        # runs on the build host, no hardware needed, one binary per file,
+        # the application sources come along for benches driving them on gpio_sim
+        for b in ${BENCH}; do
+            gcc -O2 ${CFLAGS} -I. -o $(basename ${b%.c}) ${b} ${LIB} ${MOCK} ${SRC/main.c/} -lpthread -lm || \
+            echo "build ${b} failed"
+        done
+        ;;
+    suite)
+        # host run of the regression suite, results as json for comparing releases
+        gcc -O2 ${CFLAGS} -I. -o suite_bench bench/suite_bench.c ${LIB} ${MOCK} ${SRC/main.c/} -lpthread -lm && \
+        ./suite_bench ${2:-bench.json} || \
+        echo "suite failed"
+        ;;
+    analyze)
+        # host tool for capture files, see gpio_capture.h
+        gcc -O2 ${CFLAGS} -I. -o gpioanalyze tools/gpioanalyze.c ${LIB} -lpthread -lm || \
+        echo "build gpioanalyze failed"
+        ;;
+    play)
+        # plays capture files back onto the lines they came from
+        ${CROSS_COMPILE}gcc -O2 ${CFLAGS} -I. -o gpioplay tools/gpioplay.c ${LIB} -lpthread -lm && \
+        scp gpioplay root@${RASP_HOST}:/root/ || \
+        echo "build gpioplay failed"
+        ;;
+    *)
+        ${CROSS_COMPILE}gcc ${CFLAGS} -o iotest ${SRC} ${LIB} -lpthread -lm && \
+        scp iotest root@${RASP_HOST}:/root/ || \
+        echo "build failed"
+        ;;
+esac
@@ -3,6 +3,15 @@
  * Implemented based on https://docs.kernel.org/admin-guide/gpio/sysfs.html
  */
 #include "gpio.h"
+#include "gpio_priv.h"
+#include "gpio_debounce.h"
+#include "gpio_cdev.h"
+#include "gpio_mmio.h"
+#include "gpio_sysfs.h"
+#include "gpio_stats.h"
+#include "gpio_pool.h"
+#include "gpio_registry.h"
+#include "gpio_arena.h"
 
 #include <stdlib.h>
 #include <sys/types.h>
@@ -15,31 +24,114 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <poll.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <time.h>
+
+static struct gpio_sysfs_layout layout = GPIO_SYSFS_BCM2711;
+static const struct gpio_sysfs_hooks *hooks = NULL;
+static unsigned int users = 0;
+static void gpio_release(gpio *io);
+static struct gpio_pool pool = GPIO_POOL_INIT(gpio_release);
+/* scanned on the first open after configure, read without the lock once ready */
+static struct gpio_registry registry;
+static bool registry_ready = false;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int gpio_sysfs_configure(const struct gpio_sysfs_layout *l)
+{
+    /* idle handles belong to the old tree */
+    gpio_pool_flush(&pool);
+    if (__atomic_load_n(&users, __ATOMIC_RELAXED) != 0) {
+        gpio_err("gpio sysfs in use\n");
+        return EBUSY;
+    }
+    pthread_mutex_lock(&registry_lock);
+    __atomic_store_n(&registry_ready, false, __ATOMIC_RELAXED);
+    gpio_registry_clear(&registry);
+    layout = *l;
+    pthread_mutex_unlock(&registry_lock);
+    return 0;
+}
+
+static int gpio_registry_load(void)
+{
+    int ret = 0;
+    if (__atomic_load_n(&registry_ready, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    pthread_mutex_lock(&registry_lock);
+    if (registry_ready) {
+        goto unlock;
+    }
+    ret = gpio_registry_scan(&registry, layout.class_root, layout.line_root);
+    if (ret != 0) {
+        goto unlock;
+    }
+    ret = gpio_pool_reserve(&pool, registry.lines);
+    if (ret != 0) {
+        gpio_registry_clear(&registry);
+        goto unlock;
+    }
+    __atomic_store_n(&registry_ready, true, __ATOMIC_RELEASE);
+unlock:
+    pthread_mutex_unlock(&registry_lock);
+    return ret;
+}
+
+const struct gpio_registry *gpio_sysfs_registry(void)
+{
+    return gpio_registry_load() == 0 ? &registry : NULL;
+}
+
+void gpio_sysfs_set_hooks(const struct gpio_sysfs_hooks *h)
+{
+    hooks = h;
+}
+
+struct gpio_pool *gpio_sysfs_pool(void)
+{
+    return &pool;
+}
+
+static void gpio_notify(unsigned int gpio_nr, const char *attr, const char *buf, size_t len)
+{
+    if (hooks != NULL && hooks->written != NULL) {
+        hooks->written(gpio_nr, attr, buf, len);
+    }
+}
 
-#define MAX_GPIO 100
 static int gpio_export(unsigned int gpio_nr, bool export)
 {
     int ret = 0;
-    if (gpio_nr > MAX_GPIO) {
-        gpio_err("gpio number is beyond range\n");
-        ret - 1;
+    char path[PATH_MAX];
+    char buf[16];
+    if (gpio_registry_lookup(&registry, gpio_nr) == NULL) {
+        gpio_err("gpio %u is on no chip\n", gpio_nr);
+        ret = EINVAL;
         goto end;
     }
-    int fd = open(export ? "/sys/class/gpio/export" : "/sys/class/gpio/unexport", O_WRONLY);
+    enum gpio_op op = export ? GPIO_OP_OPEN : GPIO_OP_CLOSE;
+    const char *attr = export ? "export" : "unexport";
+    (void)snprintf(path, sizeof(path), "%s/%s", layout.class_root, attr);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    gpio_account_sys(op, 0);
     if (fd == -1) {
-        gpio_err("open export file failed: %s\n", strerror(errno));
         ret = errno;
+        gpio_err("open export file failed: %s\n", strerror(ret));
         goto end;
     }
-    char buf[3];
-    (void)snprintf(buf, sizeof(buf), "%d", gpio_nr); 
-    if (write(fd, buf, sizeof(buf)) == -1) {
-        gpio_err("write file failed: %s\n", strerror(errno)); 
+    size_t len = (size_t)snprintf(buf, sizeof(buf), "%u", gpio_nr);
+    gpio_account_sys(op, len);
+    if (write(fd, buf, len) == -1) {
         ret = errno;
+        gpio_err("write file failed: %s\n", strerror(ret));
         goto close_export;
     }
+    gpio_notify(gpio_nr, attr, buf, len);
 close_export:
-    close(fd); 
+    close(fd);
+    gpio_account_sys(op, 0);
 end:
     return ret;
 }
@@ -50,131 +142,589 @@ enum gpio_attr {
     ATTR_EDGE = 3,
 };
 
-static char *gpio_attr_path(unsigned int gpio_nr, enum gpio_attr attr)
+static const char *attr_names[] = {
+    [ATTR_VALUE] = "value",
+    [ATTR_DIRECTION] = "direction",
+    [ATTR_EDGE] = "edge",
+};
+
+/* into the caller's buffer, so opens on different threads never share one */
+static char *gpio_attr_path(char *path, size_t len, unsigned int gpio_nr, enum gpio_attr attr)
 {
-    static const char *template = "/sys/devices/platform/soc/fe200000.gpio/gpiochip0/gpio/gpio%u/%s";
-    static char path[PATH_MAX];
+    const struct gpio_chip_info *chip = gpio_registry_lookup(&registry, gpio_nr);
     switch (attr) {
         case ATTR_VALUE:
-            snprintf(path, PATH_MAX, template, gpio_nr, "value");
-            break;
         case ATTR_DIRECTION:
-            snprintf(path, PATH_MAX, template, gpio_nr, "direction");
-            break;
         case ATTR_EDGE:
-            snprintf(path, PATH_MAX, template, gpio_nr, "edge");
+            snprintf(path, len, "%s/gpio%u/%s", chip != NULL ? chip->line_root : layout.class_root,
+                     gpio_nr, attr_names[attr]);
             break;
         default:
-            memset(path, 0, PATH_MAX);
+            memset(path, 0, len);
             break;
     }
     return path; 
 }
 
-static gpio *gpio_open(unsigned int gpio_nr)
+static int gpio_attr_open(unsigned int gpio_nr, enum gpio_attr attr)
 {
-    gpio *io = NULL;
-    if (gpio_export(gpio_nr, true) != 0) {
-        gpio_err("export gpio failed\n");
-        goto end;
+    char path[PATH_MAX];
+    int fd = open(gpio_attr_path(path, sizeof(path), gpio_nr, attr), O_RDWR | O_CLOEXEC);
+    gpio_account_sys(GPIO_OP_OPEN, 0);
+    return fd;
+}
+
+static void gpio_attr_close(int fd)
+{
+    close(fd);
+    gpio_account_sys(GPIO_OP_CLOSE, 0);
+}
+
+static int *gpio_attr_slot(gpio *io, enum gpio_attr attr)
+{
+    return attr == ATTR_VALUE ? &io->fds.value : attr == ATTR_DIRECTION ? &io->fds.direction : &io->fds.edge;
+}
+
+/* opened on first use, a handle that only ever writes value never opens the other two */
+static int gpio_attr_fd(gpio *io, enum gpio_attr attr)
+{
+    int *slot = gpio_attr_slot(io, attr);
+    int fd = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (fd != -1) {
+        return fd;
     }
-    io = (gpio *)malloc(sizeof(gpio));
-    if (io == NULL) {
-        gpio_err("alloc gpio failed\n");
-        goto unexport_io;
+    fd = gpio_attr_open(io->gpio_nr, attr);
+    if (fd == -1) {
+        int err = errno;
+        gpio_err("open %s failed: %s\n", attr_names[attr], strerror(err));
+        errno = err;
+        return -1;
     }
-    io->fds.value = open(gpio_attr_path(gpio_nr, ATTR_VALUE), O_RDWR);
-    if (io->fds.value == -1) {
-        gpio_err("open value failed: %s\n", strerror(errno));
-        goto free_io;
+    int none = -1;
+    if (!__atomic_compare_exchange_n(slot, &none, fd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* the slot was filled in meanwhile, keep that fd */
+        gpio_attr_close(fd);
+        fd = none;
     }
-    io->fds.direction = open(gpio_attr_path(gpio_nr, ATTR_DIRECTION), O_RDWR);
-    if (io->fds.direction == -1) {
-        gpio_err("open direction failed: %s\n", strerror(errno));
-        goto close_value;
+    return fd;
+}
+
+/* a simulator hands its own irq fd out at open, the kernel signals on value */
+static int gpio_irq_fd(gpio *io)
+{
+    int fd = __atomic_load_n(&io->fds.irq, __ATOMIC_ACQUIRE);
+    if (fd == -1) {
+        fd = gpio_attr_fd(io, ATTR_VALUE);
+        __atomic_store_n(&io->fds.irq, fd, __ATOMIC_RELEASE);
+    }
+    return fd;
+}
+
+/* into zeroed storage from the caller */
+static int gpio_setup(gpio *io, unsigned int gpio_nr)
+{
+    int ret = gpio_export(gpio_nr, true);
+    if (ret != 0) {
+        gpio_err("export gpio failed\n");
+        return ret;
     }
-    io->fds.edge = open(gpio_attr_path(gpio_nr, ATTR_EDGE), O_RDWR);
-    if (io->fds.edge == -1) {
-        gpio_err("open edge failed: %s\n", strerror(errno));
-        goto close_direction;
+    io->fds.value = -1;
+    io->fds.direction = -1;
+    io->fds.edge = -1;
+    io->fds.irq = -1;
+    if (hooks != NULL && hooks->irq_fd != NULL) {
+        io->fds.irq = hooks->irq_fd(gpio_nr);
     }
     io->gpio_nr = gpio_nr;
+    gpio_shadow_invalidate(&io->shadow);
+    (void)__atomic_fetch_add(&users, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void gpio_discard(gpio *io)
+{
+    if (io->fds.edge != -1) {
+        gpio_attr_close(io->fds.edge);
+    }
+    if (io->fds.direction != -1) {
+        gpio_attr_close(io->fds.direction);
+    }
+    if (io->fds.value != -1) {
+        gpio_attr_close(io->fds.value);
+    }
+    (void)__atomic_fetch_sub(&users, 1, __ATOMIC_RELAXED);
+    gpio_free(io, sizeof(gpio));
+}
+
+/* tears the line down for good, called by the pool once a line is neither open nor kept */
+static void gpio_release(gpio *io)
+{
+    unsigned int gpio_nr = io->gpio_nr;
+    gpio_discard(io);
+    if (gpio_export(gpio_nr, false) != 0) {
+        gpio_err("unexport gpio failed: %u\n", gpio_nr);
+    }
+}
+
+/* every user touches value and direction, edge only exists on lines that can interrupt */
+static const enum gpio_attr settle_attrs[] = { ATTR_VALUE, ATTR_DIRECTION };
+
+/* 0 once the files open, EAGAIN while udev has not created or chmodded them yet */
+static int gpio_settle_line(gpio *io)
+{
+    for (unsigned int i = 0; i < sizeof(settle_attrs) / sizeof(settle_attrs[0]); ++i) {
+        int *slot = gpio_attr_slot(io, settle_attrs[i]);
+        if (*slot != -1) {
+            continue;
+        }
+        *slot = gpio_attr_open(io->gpio_nr, settle_attrs[i]);
+        if (*slot == -1) {
+            return errno == ENOENT || errno == EACCES || errno == EPERM ? EAGAIN : errno;
+        }
+    }
+    return 0;
+}
+
+static uint64_t gpio_now(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * closing an inotify fd waits out an srcu grace period, milliseconds, so one
+ * is kept for the backend's life; waits on it take turns since each drains
+ * the events the other would be woken by
+ */
+static int settle_fd = -1;
+static pthread_mutex_t settle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * fresh exports are waited for together instead of sleeping per line, every
+ * event looks at all lines still pending again: a gpioN directory appearing
+ * in the root, files created in it, or udev changing their owner and mode
+ */
+static int gpio_settle(gpio **lines, unsigned int count)
+{
+    int ret = 0;
+    unsigned int pending = 0;
+    char path[PATH_MAX];
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    gpio *wait[GPIO_SET_MAX];
+    for (unsigned int i = 0; i < count; ++i) {
+        ret = gpio_settle_line(lines[i]);
+        if (ret == EAGAIN) {
+            wait[pending++] = lines[i];
+        } else if (ret != 0) {
+            gpio_err("open gpio %u failed: %s\n", lines[i]->gpio_nr, strerror(ret));
+            return ret;
+        }
+    }
+    if (pending == 0) {
+        return 0;
+    }
+    uint64_t deadline = gpio_now() + (uint64_t)layout.settle_ms * 1000000ull;
+    pthread_mutex_lock(&settle_lock);
+    if (settle_fd == -1) {
+        settle_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        gpio_account_sys(GPIO_OP_OPEN, 0);
+        if (settle_fd == -1) {
+            ret = errno;
+            gpio_err("create inotify failed: %s\n", strerror(ret));
+            goto unlock;
+        }
+    }
+    int fd = settle_fd;
+    /* a gpioN directory that is not there yet shows up as a create in its chip's root */
+    const char *roots[] = { registry.chip[0].line_root, registry.chips > 1 ? layout.class_root : NULL };
+    for (unsigned int i = 0; i < sizeof(roots) / sizeof(roots[0]); ++i) {
+        if (roots[i] != NULL && inotify_add_watch(fd, roots[i], IN_CREATE | IN_MOVED_TO) == -1) {
+            ret = errno;
+            gpio_err("watch %s failed: %s\n", roots[i], strerror(ret));
+            goto unlock;
+        }
+    }
+    while (true) {
+        /* watch before looking again, so nothing lands in between unseen */
+        for (unsigned int i = 0; i < pending; ++i) {
+            (void)snprintf(path, sizeof(path), "%s/gpio%u", gpio_registry_lookup(&registry, wait[i]->gpio_nr)->line_root,
+                           wait[i]->gpio_nr);
+            (void)inotify_add_watch(fd, path, IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+            gpio_account_sys(GPIO_OP_OPEN, 0);
+        }
+        unsigned int left = 0;
+        for (unsigned int i = 0; i < pending; ++i) {
+            ret = gpio_settle_line(wait[i]);
+            if (ret == EAGAIN) {
+                wait[left++] = wait[i];
+            } else if (ret != 0) {
+                gpio_err("open gpio %u failed: %s\n", wait[i]->gpio_nr, strerror(ret));
+                goto unlock;
+            }
+        }
+        ret = 0;
+        pending = left;
+        if (pending == 0) {
+            break;
+        }
+        uint64_t now = gpio_now();
+        if (now >= deadline) {
+            ret = ETIMEDOUT;
+            gpio_err("gpio %u not ready after %u ms\n", wait[0]->gpio_nr, layout.settle_ms);
+            goto unlock;
+        }
+        struct pollfd poll_fd = { .fd = fd, .events = POLLIN };
+        int n = poll(&poll_fd, 1, (int)((deadline - now + 999999) / 1000000));
+        gpio_account_sys(GPIO_OP_OPEN, 0);
+        if (n < 0 && errno != EINTR) {
+            ret = errno;
+            gpio_err("poll inotify failed: %s\n", strerror(ret));
+            goto unlock;
+        }
+        while (read(fd, events, sizeof(events)) > 0) {
+            gpio_account_sys(GPIO_OP_OPEN, 0);
+        }
+    }
+unlock:
+    pthread_mutex_unlock(&settle_lock);
+    return ret;
+}
+
+/*
+ * what an open hands out: shadow state and filter of its own over the
+ * pooled line, which only carries the export and the attribute fds
+ * between opens, so two opens of one line never see each other's state
+ */
+struct gpio_handle {
+    gpio io;
+    gpio *line;
+};
+
+static gpio *gpio_handle_init(struct gpio_handle *h, gpio *line)
+{
+    memset(h, 0, sizeof(*h));
+    h->line = line;
+    h->io.gpio_nr = line->gpio_nr;
+    /* a closing handle may be handing a lazily opened fd over to the line */
+    h->io.fds.value = __atomic_load_n(&line->fds.value, __ATOMIC_ACQUIRE);
+    h->io.fds.direction = __atomic_load_n(&line->fds.direction, __ATOMIC_ACQUIRE);
+    h->io.fds.edge = __atomic_load_n(&line->fds.edge, __ATOMIC_ACQUIRE);
+    h->io.fds.irq = line->fds.irq;
+    gpio_shadow_invalidate(&h->io.shadow);
+    return &h->io;
+}
+
+/* fds the handle opened itself go to the line for the next open, or are closed if it has its own */
+static void gpio_handle_drop(struct gpio_handle *h)
+{
+    static const enum gpio_attr attrs[] = { ATTR_VALUE, ATTR_DIRECTION, ATTR_EDGE };
+    for (unsigned int i = 0; i < sizeof(attrs) / sizeof(attrs[0]); ++i) {
+        int fd = *gpio_attr_slot(&h->io, attrs[i]);
+        int none = -1;
+        if (fd == -1 || fd == __atomic_load_n(gpio_attr_slot(h->line, attrs[i]), __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (!__atomic_compare_exchange_n(gpio_attr_slot(h->line, attrs[i]), &none, fd, false, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            gpio_attr_close(fd);
+        }
+    }
+    gpio_pool_put(&pool, h->line);
+    gpio_free(h, sizeof(*h));
+}
+
+/*
+ * lines already held come from the pool, the rest are exported first and
+ * then settled together; every open then gets a handle of its own
+ */
+static int gpio_open_lines(const unsigned int *gpio_nr, unsigned int count, gpio **lines)
+{
+    int ret = 0;
+    unsigned int i;
+    unsigned int fresh = 0;
+    unsigned int used = 0;
+    uint64_t fresh_mask = 0;
+    void *storage[GPIO_SET_MAX];
+    void *handles[GPIO_SET_MAX];
+    gpio *setup[GPIO_SET_MAX];
+    gpio *line[GPIO_SET_MAX];
+    ret = gpio_registry_load();
+    if (ret != 0) {
+        return ret;
+    }
+    for (i = 0; i < count; ++i) {
+        if (gpio_registry_lookup(&registry, gpio_nr[i]) == NULL) {
+            gpio_err("gpio %u is on no chip\n", gpio_nr[i]);
+            return EINVAL;
+        }
+        for (unsigned int j = 0; j < i; ++j) {
+            if (gpio_nr[j] == gpio_nr[i]) {
+                gpio_err("gpio %u listed twice\n", gpio_nr[i]);
+                return EINVAL;
+            }
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        gpio_account_call(GPIO_OP_OPEN);
+        line[i] = gpio_pool_get(&pool, gpio_nr[i]);
+        if (line[i] == NULL) {
+            fresh_mask |= 1ull << i;
+            ++fresh;
+        }
+    }
+    /* the set's new lines sit next to each other */
+    ret = gpio_alloc_array(sizeof(gpio), fresh, storage);
+    if (ret != 0) {
+        gpio_err("alloc %u gpios failed\n", fresh);
+        fresh = 0;
+        goto release;
+    }
+    for (i = 0; i < count; ++i) {
+        if ((fresh_mask & (1ull << i)) == 0) {
+            continue;
+        }
+        ret = gpio_setup((gpio *)storage[used], gpio_nr[i]);
+        if (ret != 0) {
+            goto release;
+        }
+        line[i] = (gpio *)storage[used];
+        setup[used++] = line[i];
+    }
+    ret = gpio_settle(setup, used);
+    if (ret != 0) {
+        goto release;
+    }
+    for (i = 0; i < count; ++i) {
+        if ((fresh_mask & (1ull << i)) == 0) {
+            continue;
+        }
+        gpio *won = gpio_pool_add(&pool, line[i]);
+        if (won != line[i]) {
+            /* another open of the line got there first, its export is the one in use */
+            gpio_discard(line[i]);
+            line[i] = won;
+        }
+    }
+    /* one by one, handles come and go with every open and recycle through their size class */
+    for (i = 0; i < count; ++i) {
+        handles[i] = gpio_alloc(sizeof(struct gpio_handle));
+        if (handles[i] == NULL) {
+            ret = ENOMEM;
+            gpio_err("alloc gpio handle failed\n");
+            goto put;
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        lines[i] = gpio_handle_init((struct gpio_handle *)handles[i], line[i]);
+    }
     goto end;
-close_direction:
-    close(io->fds.direction);
-close_value:
-    close(io->fds.value);
-free_io:
-    free(io);
-    io = NULL;
-unexport_io:
-    gpio_export(gpio_nr, false);
+put:
+    while (i-- > 0) {
+        gpio_free(handles[i], sizeof(struct gpio_handle));
+    }
+    for (i = 0; i < count; ++i) {
+        gpio_pool_put(&pool, line[i]);
+    }
+    goto end;
+release:
+    for (i = 0; i < count; ++i) {
+        if (line[i] == NULL) {
+            continue;
+        }
+        if (fresh_mask & (1ull << i)) {
+            gpio_release(line[i]);
+        } else {
+            gpio_pool_put(&pool, line[i]);
+        }
+    }
+    while (used < fresh) {
+        gpio_free(storage[used++], sizeof(gpio));
+    }
 end:
+    return ret;
+}
+
+static gpio *gpio_open(unsigned int gpio_nr)
+{
+    gpio *io = NULL;
+    if (gpio_open_lines(&gpio_nr, 1, &io) != 0) {
+        gpio_err("open gpio %u failed\n", gpio_nr);
+    }
     return io;
 }
 
 static void gpio_close(gpio *io)
 {
-    close(io->fds.edge);
-    close(io->fds.direction);
-    close(io->fds.value);
-    if (gpio_export(io->gpio_nr, false) != 0) {
-        gpio_err("unexport gpio failed: %u\n", io->gpio_nr);
-    }
-    free(io);
+    gpio_account_call(GPIO_OP_CLOSE);
+    gpio_handle_drop((struct gpio_handle *)io);
 }
 
-static int gpio_attr_write(int fd, const void *buf, size_t len)
+/* attribute payloads are fixed strings, lengths are resolved at compile time */
+struct gpio_payload {
+    const char *buf;
+    size_t len;
+};
+
+#define GPIO_PAYLOAD(str) { .buf = str, .len = sizeof(str) - 1 }
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const struct gpio_payload value_payloads[] = {
+    [GPIO_HIGH] = GPIO_PAYLOAD("1"),
+    [GPIO_LOW] = GPIO_PAYLOAD("0"),
+};
+
+static const struct gpio_payload direction_payloads[] = {
+    [GPIO_IN] = GPIO_PAYLOAD("in"),
+    [GPIO_OUT] = GPIO_PAYLOAD("out"),
+};
+
+static const struct gpio_payload edge_payloads[] = {
+    [GPIO_RISING] = GPIO_PAYLOAD("rising"),
+    [GPIO_FALLING] = GPIO_PAYLOAD("falling"),
+    [GPIO_BOTH] = GPIO_PAYLOAD("both"),
+    [GPIO_NONE] = GPIO_PAYLOAD("none"),
+};
+
+/* sysfs attributes always restart at offset 0, so one positional syscall does it */
+static int gpio_attr_write(enum gpio_op op, gpio *io, enum gpio_attr attr, const struct gpio_payload *payload)
 {
     int ret = 0;
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        gpio_err("lseed failed\n");
+    int fd = gpio_attr_fd(io, attr);
+    if (fd == -1) {
         ret = errno;
         goto end;
     }
-    if (write(fd, buf, len) == -1) {
-        gpio_err("write failed: %s\n", strerror(errno));
+    ssize_t len = pwrite(fd, payload->buf, payload->len, 0);
+    gpio_account_sys(op, len > 0 ? len : 0);
+    if (len == -1) {
         ret = errno;
+        gpio_err("write failed: %s\n", strerror(ret));
         goto end;
     }
+    gpio_notify(io->gpio_nr, attr_names[attr], payload->buf, payload->len);
 end:
     return ret;
 }
 
-static int gpio_attr_read(int fd, void *buf, size_t len)
+static int gpio_attr_read(enum gpio_op op, gpio *io, enum gpio_attr attr, void *buf, size_t len)
 {
     int ret = 0;
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        ret = errno;
-        gpio_err("lseed failed\n");
-        goto end;
+    int fd = gpio_attr_fd(io, attr);
+    if (fd == -1) {
+        return errno;
     }
-    if (read(fd, buf, len) == -1) {
+    ssize_t got = pread(fd, buf, len, 0);
+    gpio_account_sys(op, got > 0 ? got : 0);
+    if (got == -1) {
         ret = errno;
-        gpio_err("read failed\n");
-        goto end;
+        gpio_err("read failed: %s\n", strerror(ret));
     }
-end:
     return ret;
 }
 
+bool gpio_accounting_on = false;
+static struct gpio_io_stats io_stats;
+
+void gpio_account_add(enum gpio_op op, uint64_t calls, uint64_t syscalls, uint64_t bytes)
+{
+    struct gpio_op_stats *stats = &io_stats.ops[op];
+    (void)__atomic_fetch_add(&stats->calls, calls, __ATOMIC_RELAXED);
+    (void)__atomic_fetch_add(&stats->syscalls, syscalls, __ATOMIC_RELAXED);
+    (void)__atomic_fetch_add(&stats->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void gpio_accounting(bool enable)
+{
+    __atomic_store_n(&gpio_accounting_on, enable, __ATOMIC_RELAXED);
+}
+
+void gpio_io_stats(struct gpio_io_stats *stats)
+{
+    for (int op = 0; op < GPIO_OP_MAX; ++op) {
+        stats->ops[op].calls = __atomic_load_n(&io_stats.ops[op].calls, __ATOMIC_RELAXED);
+        stats->ops[op].syscalls = __atomic_load_n(&io_stats.ops[op].syscalls, __ATOMIC_RELAXED);
+        stats->ops[op].bytes = __atomic_load_n(&io_stats.ops[op].bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void gpio_io_reset_stats(void)
+{
+    for (int op = 0; op < GPIO_OP_MAX; ++op) {
+        __atomic_store_n(&io_stats.ops[op].calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&io_stats.ops[op].syscalls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&io_stats.ops[op].bytes, 0, __ATOMIC_RELAXED);
+    }
+}
+
+const char *gpio_op_name(enum gpio_op op)
+{
+    static const char *names[GPIO_OP_MAX] = {
+        [GPIO_OP_OPEN] = "open",
+        [GPIO_OP_CLOSE] = "close",
+        [GPIO_OP_SET_DIRECTION] = "set_direction",
+        [GPIO_OP_SET_VALUE] = "set_value",
+        [GPIO_OP_GET_VALUE] = "get_value",
+        [GPIO_OP_SET_EDGE] = "set_edge",
+        [GPIO_OP_IRQ] = "irq",
+    };
+    return op < GPIO_OP_MAX ? names[op] : "unknown";
+}
+
+void gpio_io_stats_print(FILE *out, const struct gpio_io_stats *stats)
+{
+    fprintf(out, "%-14s %10s %10s %10s %12s\n", "op", "calls", "syscalls", "bytes", "syscall/call");
+    for (int op = 0; op < GPIO_OP_MAX; ++op) {
+        const struct gpio_op_stats *s = &stats->ops[op];
+        if (s->calls == 0 && s->syscalls == 0) {
+            continue;
+        }
+        fprintf(out, "%-14s %10llu %10llu %10llu %12.2f\n", gpio_op_name(op),
+                (unsigned long long)s->calls, (unsigned long long)s->syscalls,
+                (unsigned long long)s->bytes, s->calls == 0 ? 0.0 : (double)s->syscalls / s->calls);
+    }
+}
+
+bool gpio_cache_on = true;
+static struct gpio_cache_stats cache_stats;
+
+void gpio_cache(bool enable)
+{
+    __atomic_store_n(&gpio_cache_on, enable, __ATOMIC_RELAXED);
+}
+
+void gpio_cache_count(bool elided)
+{
+    (void)__atomic_fetch_add(elided ? &cache_stats.elided : &cache_stats.issued, 1, __ATOMIC_RELAXED);
+}
+
+void gpio_cache_stats(struct gpio_cache_stats *stats)
+{
+    stats->elided = __atomic_load_n(&cache_stats.elided, __ATOMIC_RELAXED);
+    stats->issued = __atomic_load_n(&cache_stats.issued, __ATOMIC_RELAXED);
+}
+
+void gpio_cache_reset_stats(void)
+{
+    __atomic_store_n(&cache_stats.elided, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache_stats.issued, 0, __ATOMIC_RELAXED);
+}
+
 static int gpio_set_value(gpio *io, enum gpio_value value)
 {
-    int ret;
-    static const char *high = "1";
-    static const char *low = "0";
-    switch(value) {
-        case GPIO_HIGH:
-            ret = gpio_attr_write(io->fds.value, high, strlen(high)); 
-            break;
-        case GPIO_LOW:
-            ret = gpio_attr_write(io->fds.value, low, strlen(low));
-            break;
-        default:
-            ret = -1;
-            gpio_err("unsupport value\n");
-            break;
+    int ret = 0;
+    gpio_account_call(GPIO_OP_SET_VALUE);
+    if ((unsigned int)value >= ARRAY_SIZE(value_payloads)) {
+        ret = -1;
+        gpio_err("unsupport value\n");
+        goto end;
     }
+    if (gpio_shadow_hit(&io->shadow.value, value)) {
+        goto end;
+    }
+    ret = gpio_attr_write(GPIO_OP_SET_VALUE, io, ATTR_VALUE, &value_payloads[value]);
+    gpio_shadow_store(&io->shadow.value, value, ret);
+end:
     return ret;
 }
 
@@ -182,7 +732,8 @@ static int gpio_get_value(gpio *io, enum gpio_value *value)
 {
     int ret;
     char buf[2];
-    ret = gpio_attr_read(io->fds.value, buf, sizeof(buf));
+    gpio_account_call(GPIO_OP_GET_VALUE);
+    ret = gpio_attr_read(GPIO_OP_GET_VALUE, io, ATTR_VALUE, buf, sizeof(buf));
     if (ret != 0) {
         gpio_err("read gpio value failed\n");
         goto end;
@@ -194,69 +745,117 @@ end:
 
 static int gpio_set_direction(gpio *io, enum gpio_direction dir)
 {
-    static const char *out = "out";
-    static const char *in = "in";
-    int ret;
-    int fd = io->fds.direction;
-    switch (dir) {
-        case GPIO_IN:
-            ret = gpio_attr_write(fd, in, strlen(in));
-            break;
-        case GPIO_OUT:
-            ret = gpio_attr_write(fd, out, strlen(out));
-            break;
-        default:
-            ret = -1;
-            gpio_err("unknown direction\n");
-            goto end;
+    int ret = 0;
+    gpio_account_call(GPIO_OP_SET_DIRECTION);
+    if ((unsigned int)dir >= ARRAY_SIZE(direction_payloads)) {
+        ret = -1;
+        gpio_err("unknown direction\n");
+        goto end;
+    }
+    if (gpio_shadow_hit(&io->shadow.direction, dir)) {
+        goto end;
     }
+    ret = gpio_attr_write(GPIO_OP_SET_DIRECTION, io, ATTR_DIRECTION, &direction_payloads[dir]);
+    gpio_shadow_store(&io->shadow.direction, dir, ret);
+    /* the kernel decides what an output starts at */
+    io->shadow.value = GPIO_SHADOW_UNKNOWN;
 end:
     return ret;
 }
 
 static int gpio_set_edge(gpio *io, enum gpio_edge edge)
 {
-    static const char *rising = "rising";
-    static const char *falling = "falling";
-    static const char *both = "both";
-    static const char *none = "none";
+    int ret = 0;
+    gpio_account_call(GPIO_OP_SET_EDGE);
+    if ((unsigned int)edge >= ARRAY_SIZE(edge_payloads)) {
+        gpio_err("unsupport edge\n"); 
+        ret = -1;
+        goto end;
+    }
+    if (gpio_shadow_hit(&io->shadow.edge, edge)) {
+        goto end;
+    }
+    ret = gpio_attr_write(GPIO_OP_SET_EDGE, io, ATTR_EDGE, &edge_payloads[edge]);
+    gpio_shadow_store(&io->shadow.edge, edge, ret);
+end:
+    return ret; 
+}
+
+static void gpio_invalidate(gpio *io)
+{
+    gpio_shadow_invalidate(&io->shadow);
+}
+
+static int gpio_resync(gpio *io)
+{
     int ret;
-    int fd = io->fds.edge;
-    switch (edge) {
-        case GPIO_RISING:
-            ret = gpio_attr_write(fd, rising, strlen(rising));
-            break;
-        case GPIO_FALLING:
-            ret = gpio_attr_write(fd, falling, strlen(falling));
-            break;
+    char buf[8];
+    gpio_shadow_invalidate(&io->shadow);
+    memset(buf, 0, sizeof(buf));
+    ret = gpio_attr_read(GPIO_OP_SET_DIRECTION, io, ATTR_DIRECTION, buf, sizeof(buf) - 1);
+    if (ret != 0) {
+        gpio_err("read direction failed\n");
+        goto end;
+    }
+    io->shadow.direction = strncmp(buf, "out", 3) == 0 ? GPIO_OUT : GPIO_IN;
+    memset(buf, 0, sizeof(buf));
+    ret = gpio_attr_read(GPIO_OP_SET_EDGE, io, ATTR_EDGE, buf, sizeof(buf) - 1);
+    if (ret != 0) {
+        gpio_err("read edge failed\n");
+        goto end;
+    }
+    if (strncmp(buf, "rising", 6) == 0) {
+        io->shadow.edge = GPIO_RISING;
+    } else if (strncmp(buf, "falling", 7) == 0) {
+        io->shadow.edge = GPIO_FALLING;
+    } else if (strncmp(buf, "both", 4) == 0) {
+        io->shadow.edge = GPIO_BOTH;
+    } else {
+        io->shadow.edge = GPIO_NONE;
+    }
+    if (io->shadow.direction == GPIO_OUT) {
+        enum gpio_value value;
+        ret = gpio_get_value(io, &value);
+        if (ret != 0) {
+            goto end;
+        }
+        io->shadow.value = value;
+    }
+end:
+    return ret;
+}
 
-        case GPIO_BOTH:
-            ret = gpio_attr_write(fd, both, strlen(both));
-            break;
-        case GPIO_NONE:
-            ret = gpio_attr_write(fd, none, strlen(none));
-            break;
-        default:
-            gpio_err("unsupport edge\n"); 
-            ret = -1;
-            break;
+/* sysfs signals an edge as POLLPRI on the value attribute, a simulator's shim as POLLIN */
+static short gpio_irq_events(gpio *io)
+{
+    return io->fds.irq == io->fds.value ? POLLPRI | POLLERR : POLLIN;
+}
+
+static void gpio_irq_ack(gpio *io)
+{
+    uint64_t drain;
+    int fd = gpio_irq_fd(io);
+    if (fd != io->fds.value) {
+        (void)read(fd, &drain, sizeof(drain));
     }
-    return ret; 
 }
 
 static int gpio_handle_irq(gpio *io, irq_handler handler, void *data)
 {
-    int ret;
+    int ret = gpio_debounce_direct(io);
     unsigned char irq[2];
-    int fd = io->fds.value; 
-    struct pollfd poll_fd = { .fd = fd, .events = POLLPRI | POLLERR };
-    while (true) {
-        if (poll(&poll_fd, 1, -1) < 0) {
+    struct pollfd poll_fd = { .fd = gpio_irq_fd(io), .events = gpio_irq_events(io) };
+    while (ret == 0) {
+        int n = poll(&poll_fd, 1, -1);
+        gpio_account_sys(GPIO_OP_IRQ, 0);
+        if (n < 0) {
             gpio_err("poll failed %s\n", strerror(errno));
             ret = errno;
             goto end;
         }
-        ret = gpio_attr_read(fd, irq, sizeof(irq));
+        gpio_account_call(GPIO_OP_IRQ);
+        gpio_irq_ack(io);
+        ret = gpio_attr_read(GPIO_OP_IRQ, io, ATTR_VALUE, irq, sizeof(irq));
         if (ret != 0) {
             gpio_err("read irq value failed\n");
             goto end;
@@ -271,7 +870,197 @@ end:
     return ret;
 }
 
-static struct gpio_ops ops = {
+static int gpio_read_event(gpio *io, struct gpio_event *event)
+{
+    int ret;
+    unsigned char irq[2];
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    gpio_account_call(GPIO_OP_IRQ);
+    gpio_irq_ack(io);
+    ret = gpio_attr_read(GPIO_OP_IRQ, io, ATTR_VALUE, irq, sizeof(irq));
+    if (ret != 0) {
+        gpio_err("read irq value failed\n");
+        goto end;
+    }
+    event->gpio_nr = io->gpio_nr;
+    event->value = irq[0] == '1' ? GPIO_HIGH : GPIO_LOW;
+    event->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    event->seqno = 0;
+end:
+    return ret;
+}
+
+static int gpio_wait_event(gpio *io, struct gpio_event *event, int timeout_ms)
+{
+    int ret = gpio_debounce_direct(io);
+    struct pollfd poll_fd = { .fd = gpio_irq_fd(io), .events = gpio_irq_events(io) };
+    if (ret != 0) {
+        goto end;
+    }
+    ret = poll(&poll_fd, 1, timeout_ms);
+    gpio_account_sys(GPIO_OP_IRQ, 0);
+    if (ret < 0) {
+        ret = errno;
+        gpio_err("poll failed %s\n", strerror(ret));
+        goto end;
+    }
+    if (ret == 0) {
+        ret = ETIMEDOUT;
+        goto end;
+    }
+    ret = gpio_read_event(io, event);
+end:
+    return ret;
+}
+
+static int gpio_event_fd(gpio *io, uint32_t *events)
+{
+    int fd = gpio_irq_fd(io);
+    *events = (uint16_t)gpio_irq_events(io);
+    return fd;
+}
+
+gpio_set *gpio_set_open_lines(struct gpio_ops *ops, const unsigned int *gpio_nr, unsigned int count)
+{
+    unsigned int i;
+    gpio_set *set = NULL;
+    if (count == 0 || count > GPIO_SET_MAX) {
+        gpio_err("line count %u is beyond range\n", count);
+        goto end;
+    }
+    set = (gpio_set *)gpio_alloc(sizeof(gpio_set));
+    if (set == NULL) {
+        gpio_err("alloc gpio set failed\n");
+        goto end;
+    }
+    for (i = 0; i < count; ++i) {
+        set->lines[i] = ops->open(gpio_nr[i]);
+        if (set->lines[i] == NULL) {
+            gpio_err("open gpio %u failed\n", gpio_nr[i]);
+            goto close_lines;
+        }
+    }
+    set->count = count;
+    goto end;
+close_lines:
+    while (i-- > 0) {
+        ops->close(set->lines[i]);
+    }
+    gpio_free(set, sizeof(gpio_set));
+    set = NULL;
+end:
+    return set;
+}
+
+void gpio_set_close_lines(struct gpio_ops *ops, gpio_set *set)
+{
+    for (unsigned int i = 0; i < set->count; ++i) {
+        ops->close(set->lines[i]);
+    }
+    gpio_free(set, sizeof(gpio_set));
+}
+
+int gpio_set_values_lines(struct gpio_ops *ops, gpio_set *set, uint64_t mask, uint64_t bits)
+{
+    int ret = 0;
+    unsigned int i;
+    gpio_for_each_bit(i, mask) {
+        if (i >= set->count) {
+            break;
+        }
+        ret = ops->set_value(set->lines[i], (bits >> i) & 1 ? GPIO_HIGH : GPIO_LOW);
+        if (ret != 0) {
+            gpio_err("set value of line %u failed\n", i);
+            break;
+        }
+    }
+    return ret;
+}
+
+int gpio_get_values_lines(struct gpio_ops *ops, gpio_set *set, uint64_t *bits)
+{
+    int ret = 0;
+    enum gpio_value value;
+    uint64_t out = 0;
+    for (unsigned int i = 0; i < set->count; ++i) {
+        ret = ops->get_value(set->lines[i], &value);
+        if (ret != 0) {
+            gpio_err("get value of line %u failed\n", i);
+            goto end;
+        }
+        out |= value == GPIO_HIGH ? 1ull << i : 0;
+    }
+    *bits = out;
+end:
+    return ret;
+}
+
+int gpio_set_directions_lines(struct gpio_ops *ops, gpio_set *set, uint64_t mask, uint64_t out)
+{
+    int ret = 0;
+    unsigned int i;
+    gpio_for_each_bit(i, mask) {
+        if (i >= set->count) {
+            break;
+        }
+        ret = ops->set_direction(set->lines[i], (out >> i) & 1 ? GPIO_OUT : GPIO_IN);
+        if (ret != 0) {
+            gpio_err("set direction of line %u failed\n", i);
+            break;
+        }
+    }
+    return ret;
+}
+
+static struct gpio_ops sysfs_ops;
+
+/* one settle wait for the whole set, a board's worth of lines comes up in about one udev delay */
+static gpio_set *gpio_set_open(const unsigned int *gpio_nr, unsigned int count)
+{
+    gpio_set *set = NULL;
+    if (count == 0 || count > GPIO_SET_MAX) {
+        gpio_err("line count %u is beyond range\n", count);
+        goto end;
+    }
+    set = (gpio_set *)gpio_alloc(sizeof(gpio_set));
+    if (set == NULL) {
+        gpio_err("alloc gpio set failed\n");
+        goto end;
+    }
+    if (gpio_open_lines(gpio_nr, count, set->lines) != 0) {
+        gpio_err("open gpio set failed\n");
+        gpio_free(set, sizeof(gpio_set));
+        set = NULL;
+        goto end;
+    }
+    set->count = count;
+end:
+    return set;
+}
+
+static void gpio_set_close(gpio_set *set)
+{
+    gpio_set_close_lines(&sysfs_ops, set);
+}
+
+/* sysfs has no multi-line attribute, one write per line in the mask */
+static int gpio_set_values(gpio_set *set, uint64_t mask, uint64_t bits)
+{
+    return gpio_set_values_lines(&sysfs_ops, set, mask, bits);
+}
+
+static int gpio_get_values(gpio_set *set, uint64_t *bits)
+{
+    return gpio_get_values_lines(&sysfs_ops, set, bits);
+}
+
+static int gpio_set_directions(gpio_set *set, uint64_t mask, uint64_t out)
+{
+    return gpio_set_directions_lines(&sysfs_ops, set, mask, out);
+}
+
+static struct gpio_ops sysfs_ops = {
     .open = gpio_open,
     .close = gpio_close,
     .set_value = gpio_set_value,
@@ -279,9 +1068,54 @@ static struct gpio_ops ops = {
     .set_direction = gpio_set_direction,
     .set_edge = gpio_set_edge,
     .handle_irq = gpio_handle_irq,
+    .wait_event = gpio_wait_event,
+    .set_open = gpio_set_open,
+    .set_close = gpio_set_close,
+    .set_values = gpio_set_values,
+    .get_values = gpio_get_values,
+    .set_directions = gpio_set_directions,
+    .invalidate = gpio_invalidate,
+    .resync = gpio_resync,
+    .event_fd = gpio_event_fd,
+    .read_event = gpio_read_event,
+    .set_debounce = gpio_debounce_store,
 };
 
+static enum gpio_backend backend = GPIO_BACKEND_SYSFS;
+
+int gpio_set_backend(enum gpio_backend b)
+{
+    if (b < 0 || b >= GPIO_BACKEND_MAX) {
+        gpio_err("unknown backend %d\n", b);
+        return -1;
+    }
+    backend = b;
+    return 0;
+}
+
+enum gpio_backend gpio_get_backend(void)
+{
+    return backend;
+}
+
+static struct gpio_ops *gpio_backend_ops(void)
+{
+    switch (backend) {
+        case GPIO_BACKEND_CDEV:
+            return gpio_cdev_get_ops();
+        case GPIO_BACKEND_MMIO:
+            return gpio_mmio_get_ops();
+        case GPIO_BACKEND_SYSFS:
+        default:
+            return &sysfs_ops;
+    }
+}
+
 struct gpio_ops *get_gpio_ops()
 {
-    return &ops;
+#ifdef GPIO_STATS
+    return gpio_stats_wrap(backend, gpio_backend_ops());
+#else
+    return gpio_backend_ops();
+#endif
 }
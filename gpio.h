@@ -2,23 +2,92 @@
 #define GPIO_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #define gpio_err(str, ...) \
     do { \
-        fprintf(stderr, "[%s+%d: %s] "str, __func__, __FILE__, __LINE__, ##__VA_ARGS__); \
+        fprintf(stderr, "[%s+%d: %s] "str, __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
     } while(0)
 
 struct gpio_fd {
     int value;
     int direction;
     int edge;
+    int irq;    /* polled for edges, the value fd unless a simulator stands in */
+};
+
+struct tag_gpio_set;
+
+/* line request on /dev/gpiochipN, see gpio_cdev.c */
+struct gpio_line_req {
+    int fd;
+    unsigned int index;         /* bit of this line inside the request */
+    unsigned int offset;        /* on the gpiochip the line belongs to */
+    uint64_t flags;
+    uint32_t debounce_us;       /* done by the kernel, 0 when off */
+    struct tag_gpio_set *set;   /* request shared by a gpio_set, NULL when owned */
+};
+
+/* precomputed register pointers for one line, see gpio_mmio.c */
+struct gpio_reg {
+    volatile uint32_t *fsel;
+    volatile uint32_t *set;
+    volatile uint32_t *clr;
+    volatile uint32_t *lev;
+    unsigned int fsel_shift;
+    uint32_t bit;
+    int edge;
+};
+
+/* last state written through a handle, writes repeating it are skipped */
+#define GPIO_SHADOW_UNKNOWN -1
+
+struct gpio_shadow {
+    int direction;
+    int edge;
+    int value;
+};
+
+/*
+ * input filter applied before edges reach a handler, see gpio_debounce.c
+ * settle: a level counts once it held for period_us with no further edge
+ * majority: after an edge the line is sampled samples times across period_us
+ */
+enum gpio_debounce_mode {
+    GPIO_DEBOUNCE_NONE = 0,
+    GPIO_DEBOUNCE_SETTLE = 1,
+    GPIO_DEBOUNCE_MAJORITY = 2,
+};
+
+struct gpio_debounce {
+    enum gpio_debounce_mode mode;
+    uint32_t period_us;
+    unsigned int samples;
 };
 
 typedef struct tag_gpio {
     unsigned int gpio_nr;
-    struct gpio_fd fds;
+    struct gpio_shadow shadow;
+    struct gpio_debounce debounce;  /* what is left to filter in software */
+    union {
+        struct gpio_fd fds;
+        struct gpio_line_req req;
+        struct gpio_reg reg;
+    };
 } gpio;
 
+/*
+ * group of lines driven together, bit i of every mask stands for lines[i],
+ * a set bit is GPIO_HIGH for values and GPIO_OUT for directions
+ */
+#define GPIO_SET_MAX 64
+
+typedef struct tag_gpio_set {
+    unsigned int count;
+    gpio *lines[GPIO_SET_MAX];
+} gpio_set;
+
 enum gpio_value {
     GPIO_HIGH = 0,
     GPIO_LOW = 1,
@@ -36,8 +105,23 @@ enum gpio_edge {
     GPIO_NONE = 3,
 };
 
+struct gpio_event {
+    unsigned int gpio_nr;
+    enum gpio_value value;
+    uint64_t timestamp_ns;  /* CLOCK_MONOTONIC */
+    uint32_t seqno;
+};
+
 typedef int (*irq_handler)(enum gpio_value signal, void *data);
 
+/*
+ * every backend is reentrant: calls on distinct handles may run on any
+ * threads at once and do not serialize against each other on the hot path,
+ * a handle, or the lines of one gpio_set, is used by one thread at a time
+ * since its shadow state and request are not locked, and every open returns
+ * a handle of its own, never one another open holds; backend selection,
+ * configure calls and installing mocks or hooks happen before lines are opened
+ */
 struct gpio_ops {
     gpio *(*open)(unsigned int gpio_nr);
     void (*close)(gpio *io);
@@ -46,8 +130,84 @@ struct gpio_ops {
     int (*get_value)(gpio *io, enum gpio_value *value);
     int (*set_edge)(gpio *io, enum gpio_edge);
     int (*handle_irq)(gpio *io, irq_handler handler, void *data);
+    /* wait for one edge, timeout_ms < 0 waits forever, returns ETIMEDOUT on timeout */
+    int (*wait_event)(gpio *io, struct gpio_event *event, int timeout_ms);
+    /* members of a set are closed by set_close only */
+    gpio_set *(*set_open)(const unsigned int *gpio_nr, unsigned int count);
+    void (*set_close)(gpio_set *set);
+    int (*set_values)(gpio_set *set, uint64_t mask, uint64_t bits);
+    int (*get_values)(gpio_set *set, uint64_t *bits);
+    int (*set_directions)(gpio_set *set, uint64_t mask, uint64_t out);
+    /* forget the shadow state, or reload it from the line after someone else touched it */
+    void (*invalidate)(gpio *io);
+    int (*resync)(gpio *io);
+    /* fd and poll events signalling an edge, -1 when the backend has none */
+    int (*event_fd)(gpio *io, uint32_t *events);
+    /* consume the raw edge pending on event_fd, does not block after readiness */
+    int (*read_event)(gpio *io, struct gpio_event *event);
+    /*
+     * filter edges of an input, backends with a native debounce take over
+     * what they can. The rest is filtered in software by gpio_loop only:
+     * handle_irq and wait_event fail with ENOTSUP on such a line and
+     * read_event hands out raw edges. mmio has no event fd, so no loop
+     * either, and refuses any filter with ENOTSUP.
+     */
+    int (*set_debounce)(gpio *io, const struct gpio_debounce *debounce);
 };
 
+enum gpio_backend {
+    GPIO_BACKEND_SYSFS = 0,
+    GPIO_BACKEND_CDEV = 1,
+    GPIO_BACKEND_MMIO = 2,
+    GPIO_BACKEND_MAX,
+};
+
+/*
+ * select the implementation returned by get_gpio_ops(),
+ * handles must be closed by the ops that opened them
+ */
+int gpio_set_backend(enum gpio_backend backend);
+enum gpio_backend gpio_get_backend(void);
+
 struct gpio_ops *get_gpio_ops();
 
+/* attribute writes skipped by the shadow state vs. really issued */
+struct gpio_cache_stats {
+    uint64_t elided;
+    uint64_t issued;
+};
+
+void gpio_cache_stats(struct gpio_cache_stats *stats);
+void gpio_cache_reset_stats(void);
+/* on by default, off every write is issued, for measuring what the shadow saves */
+void gpio_cache(bool enable);
+
+/* syscall accounting per operation type, off by default */
+enum gpio_op {
+    GPIO_OP_OPEN = 0,
+    GPIO_OP_CLOSE = 1,
+    GPIO_OP_SET_DIRECTION = 2,
+    GPIO_OP_SET_VALUE = 3,
+    GPIO_OP_GET_VALUE = 4,
+    GPIO_OP_SET_EDGE = 5,
+    GPIO_OP_IRQ = 6,
+    GPIO_OP_MAX,
+};
+
+struct gpio_op_stats {
+    uint64_t calls;
+    uint64_t syscalls;
+    uint64_t bytes;
+};
+
+struct gpio_io_stats {
+    struct gpio_op_stats ops[GPIO_OP_MAX];
+};
+
+void gpio_accounting(bool enable);
+void gpio_io_stats(struct gpio_io_stats *stats);
+void gpio_io_reset_stats(void);
+const char *gpio_op_name(enum gpio_op op);
+void gpio_io_stats_print(FILE *out, const struct gpio_io_stats *stats);
+
 #endif
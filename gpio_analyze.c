@@ -0,0 +1,466 @@
+/*
+ * Offline statistics over a mapped capture. Every block starts from its
+ * own tick and levels, so the blocks are cut into one run per thread and
+ * each thread folds the edges of its run into a summary per line: the
+ * complete pulses, plus the first and last edge and the pulses next to
+ * them, which is all that is needed to join the pulse straddling two runs
+ * when the summaries are merged in file order. Rle blocks are walked with
+ * the capture cursor. Raw blocks go a plane at a time through a kernel
+ * that xors every word with itself shifted by one sample, several words
+ * per vector, so a quiet stretch is a handful of vector ops per 256
+ * samples and only words holding an edge are looked at bit by bit. The
+ * vectors are gcc's generic ones, NEON on the Pi and SSE2 on a build host
+ * without any intrinsics.
+ */
+#include "gpio_analyze.h"
+#include "gpio_arena.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef uint64_t analyze_vec __attribute__((vector_size(32)));
+
+#define ANALYZE_LANES (sizeof(analyze_vec) / sizeof(uint64_t))
+
+/* what a run of blocks did on one line */
+struct analyze_seg {
+    struct gpio_analyze_line line;
+    uint64_t edges;
+    uint64_t pulses;
+    uint64_t first_tick;        /* first and last edge */
+    uint64_t last_tick;
+    bool first_high;            /* level after the first and after the last edge */
+    bool last_high;
+    uint64_t head;              /* first and last complete pulse */
+    uint64_t tail;
+};
+
+struct analyze_run {
+    const struct gpio_capture_file *file;
+    uint64_t from;              /* blocks [from, to) */
+    uint64_t to;
+    uint64_t glitch;
+    uint64_t raw_blocks;
+    struct analyze_seg seg[GPIO_SET_MAX];
+    pthread_t thread;
+};
+
+static void analyze_pulses_add(struct gpio_analyze_pulses *p, uint64_t width)
+{
+    p->min = p->count == 0 || width < p->min ? width : p->min;
+    p->max = width > p->max ? width : p->max;
+    p->sum += width;
+    ++p->count;
+}
+
+static void analyze_pulses_merge(struct gpio_analyze_pulses *p, const struct gpio_analyze_pulses *q)
+{
+    if (q->count == 0) {
+        return;
+    }
+    p->min = p->count == 0 || q->min < p->min ? q->min : p->min;
+    p->max = q->max > p->max ? q->max : p->max;
+    p->sum += q->sum;
+    p->count += q->count;
+}
+
+static void analyze_period(struct analyze_seg *seg, uint64_t high, uint64_t low)
+{
+    uint64_t bin = high * GPIO_ANALYZE_DUTY_BINS / (high + low);
+    analyze_pulses_add(&seg->line.period, high + low);
+    ++seg->line.duty[bin < GPIO_ANALYZE_DUTY_BINS ? bin : GPIO_ANALYZE_DUTY_BINS - 1];
+}
+
+/* levels alternate, so a low pulse after any pulse closes a period */
+static void analyze_pulse(struct analyze_seg *seg, bool high, uint64_t width, uint64_t glitch)
+{
+    analyze_pulses_add(high ? &seg->line.high : &seg->line.low, width);
+    if (width < glitch) {
+        ++seg->line.glitches;
+    }
+    if (seg->pulses == 0) {
+        seg->head = width;
+    } else if (!high) {
+        analyze_period(seg, seg->tail, width);
+    }
+    seg->tail = width;
+    ++seg->pulses;
+}
+
+static void analyze_edge(struct analyze_seg *seg, uint64_t tick, bool high, uint64_t glitch)
+{
+    if (high) {
+        ++seg->line.rising;
+    } else {
+        ++seg->line.falling;
+    }
+    if (seg->edges == 0) {
+        seg->first_tick = tick;
+        seg->first_high = high;
+    } else {
+        analyze_pulse(seg, !high, tick - seg->last_tick, glitch);
+    }
+    seg->last_tick = tick;
+    seg->last_high = high;
+    ++seg->edges;
+}
+
+/* appends the later run b to a, the pulse between them is the one neither saw whole */
+static void analyze_merge(struct analyze_seg *a, const struct analyze_seg *b, uint64_t glitch)
+{
+    a->line.high_ticks += b->line.high_ticks;
+    a->line.low_ticks += b->line.low_ticks;
+    if (b->edges == 0) {
+        return;
+    }
+    if (a->edges == 0) {
+        struct gpio_analyze_line line = a->line;
+        *a = *b;
+        a->line.high_ticks = line.high_ticks;
+        a->line.low_ticks = line.low_ticks;
+        return;
+    }
+    bool high = a->last_high;
+    uint64_t width = b->first_tick - a->last_tick;
+    analyze_pulse(a, high, width, glitch);
+    if (high && b->pulses != 0 && !b->first_high) {
+        analyze_period(a, width, b->head);
+    }
+    a->line.rising += b->line.rising;
+    a->line.falling += b->line.falling;
+    a->line.glitches += b->line.glitches;
+    analyze_pulses_merge(&a->line.high, &b->line.high);
+    analyze_pulses_merge(&a->line.low, &b->line.low);
+    analyze_pulses_merge(&a->line.period, &b->line.period);
+    for (unsigned int i = 0; i < GPIO_ANALYZE_DUTY_BINS; ++i) {
+        a->line.duty[i] += b->line.duty[i];
+    }
+    if (b->pulses != 0) {
+        a->tail = b->tail;
+    }
+    a->pulses += b->pulses;
+    a->edges += b->edges;
+    a->last_tick = b->last_tick;
+    a->last_high = b->last_high;
+}
+
+/* the tick a block hands over at, the next one may start on its last tick */
+static uint64_t analyze_block_end(const struct gpio_capture_file *file, uint64_t index)
+{
+    const struct gpio_capture_block *block = gpio_capture_block_at(file, index);
+    uint64_t end = block->last_tick + 1;
+    if (index + 1 < file->blocks) {
+        uint64_t next = gpio_capture_block_at(file, index + 1)->first_tick;
+        end = next >= block->first_tick && next < end ? next : end;
+    }
+    return end;
+}
+
+static void analyze_rle(struct analyze_run *run, const struct gpio_capture_block *block, uint64_t end)
+{
+    struct gpio_capture_cursor cur;
+    uint64_t since[GPIO_SET_MAX];
+    unsigned int lines = run->file->header->lines;
+    uint64_t mask = lines == 64 ? ~0ull : (1ull << lines) - 1;
+    gpio_capture_cursor_init(&cur, run->file, block);
+    for (unsigned int i = 0; i < lines; ++i) {
+        since[i] = block->first_tick;
+    }
+    while (gpio_capture_next(&cur) && cur.tick < end) {
+        uint64_t flipped = cur.flipped & mask;
+        while (flipped != 0) {
+            unsigned int i = (unsigned int)__builtin_ctzll(flipped);
+            struct analyze_seg *seg = &run->seg[i];
+            bool high = ((cur.state >> i) & 1) != 0;
+            if (high) {
+                seg->line.low_ticks += cur.tick - since[i];
+            } else {
+                seg->line.high_ticks += cur.tick - since[i];
+            }
+            since[i] = cur.tick;
+            analyze_edge(seg, cur.tick, high, run->glitch);
+            flipped &= flipped - 1;
+        }
+    }
+    for (unsigned int i = 0; i < lines; ++i) {
+        if ((cur.state >> i) & 1) {
+            run->seg[i].line.high_ticks += end - since[i];
+        } else {
+            run->seg[i].line.low_ticks += end - since[i];
+        }
+    }
+}
+
+/*
+ * adds the bits set in each lane of v to count, by halving sums so it
+ * stays in plain vector shifts and adds. Vectors go by pointer, passing
+ * them by value ties the calling convention to the isa flags.
+ */
+static void analyze_popcount(analyze_vec *count, const analyze_vec *v)
+{
+    analyze_vec c = *v - ((*v >> 1) & 0x5555555555555555ull);
+    c = (c & 0x3333333333333333ull) + ((c >> 2) & 0x3333333333333333ull);
+    c = (c + (c >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    c = c + (c >> 8);
+    c = c + (c >> 16);
+    c = c + (c >> 32);
+    *count += c & 0x7f;
+}
+
+/* every set bit of diff is an edge to the level that sample holds in word */
+static void analyze_word(struct analyze_seg *seg, uint64_t diff, uint64_t word, uint64_t tick, uint64_t glitch)
+{
+    while (diff != 0) {
+        unsigned int bit = (unsigned int)__builtin_ctzll(diff);
+        analyze_edge(seg, tick + bit, ((word >> bit) & 1) != 0, glitch);
+        diff &= diff - 1;
+    }
+}
+
+/*
+ * one line of a raw block. Word 0 and the last word are done alone, the
+ * first follows the level the block starts from rather than a word before
+ * it, the last is cut at the end of the block.
+ */
+static void analyze_plane(struct analyze_seg *seg, const uint64_t *plane, uint64_t samples, uint64_t tick,
+                          uint64_t level, uint64_t glitch)
+{
+    uint64_t words = (samples + 63) / 64;
+    uint64_t last = words - 1;
+    uint64_t keep = samples % 64 == 0 ? ~0ull : (1ull << (samples % 64)) - 1;
+    uint64_t high = 0;
+    analyze_vec count = { 0 };
+    uint64_t word = last == 0 ? plane[0] & keep : plane[0];
+    uint64_t diff = word ^ ((word << 1) | level);
+    high += (uint64_t)__builtin_popcountll(word);
+    analyze_word(seg, last == 0 ? diff & keep : diff, word, tick, glitch);
+    uint64_t w = 1;
+    for (; w + ANALYZE_LANES <= last; w += ANALYZE_LANES) {
+        analyze_vec cur;
+        analyze_vec prev;
+        memcpy(&cur, plane + w, sizeof(cur));
+        memcpy(&prev, plane + w - 1, sizeof(prev));
+        analyze_vec flips = cur ^ ((cur << 1) | (prev >> 63));
+        analyze_popcount(&count, &cur);
+        uint64_t any = 0;
+        for (unsigned int l = 0; l < ANALYZE_LANES; ++l) {
+            any |= flips[l];
+        }
+        if (any == 0) {
+            continue;
+        }
+        for (unsigned int l = 0; l < ANALYZE_LANES; ++l) {
+            analyze_word(seg, flips[l], cur[l], tick + (w + l) * 64, glitch);
+        }
+    }
+    for (; w <= last && last != 0; ++w) {
+        word = w == last ? plane[w] & keep : plane[w];
+        diff = word ^ ((word << 1) | (plane[w - 1] >> 63));
+        high += (uint64_t)__builtin_popcountll(word);
+        analyze_word(seg, w == last ? diff & keep : diff, word, tick + w * 64, glitch);
+    }
+    for (unsigned int l = 0; l < ANALYZE_LANES; ++l) {
+        high += count[l];
+    }
+    seg->line.high_ticks += high;
+    seg->line.low_ticks += samples - high;
+}
+
+static void analyze_raw(struct analyze_run *run, const struct gpio_capture_block *block)
+{
+    unsigned int lines = run->file->header->lines;
+    uint64_t samples = block->last_tick - block->first_tick + 1;
+    uint64_t words = (samples + 63) / 64;
+    const uint64_t *planes = (const uint64_t *)(block + 1);
+    if (words * 8 * lines > block->bytes || block->bytes > GPIO_CAPTURE_PAYLOAD) {
+        gpio_err("raw capture block at tick %llu is cut short\n", (unsigned long long)block->first_tick);
+        return;
+    }
+    for (unsigned int i = 0; i < lines; ++i) {
+        analyze_plane(&run->seg[i], planes + words * i, samples, block->first_tick, (block->state >> i) & 1,
+                      run->glitch);
+    }
+    ++run->raw_blocks;
+}
+
+static void *analyze_run_main(void *arg)
+{
+    struct analyze_run *run = (struct analyze_run *)arg;
+    for (uint64_t b = run->from; b < run->to; ++b) {
+        const struct gpio_capture_block *block = gpio_capture_block_at(run->file, b);
+        if (block->kind == GPIO_CAPTURE_RAW) {
+            analyze_raw(run, block);
+        } else {
+            analyze_rle(run, block, analyze_block_end(run->file, b));
+        }
+    }
+    return NULL;
+}
+
+static unsigned int analyze_threads(unsigned int threads, uint64_t blocks)
+{
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    threads = threads < GPIO_ANALYZE_THREADS_MAX ? threads : GPIO_ANALYZE_THREADS_MAX;
+    return blocks < threads ? (blocks == 0 ? 1 : (unsigned int)blocks) : threads;
+}
+
+int gpio_analyze_lines(const struct gpio_capture_file *file, unsigned int threads, uint64_t glitch_ns,
+                       struct gpio_analyze_result *res)
+{
+    int ret = 0;
+    unsigned int started = 0;
+    struct analyze_run *runs;
+    memset(res, 0, sizeof(*res));
+    res->lines = file->header->lines;
+    res->tick_ns = file->header->period_ns == 0 ? 1 : file->header->period_ns;
+    res->blocks = file->blocks;
+    res->threads = analyze_threads(threads, file->blocks);
+    runs = (struct analyze_run *)gpio_alloc(sizeof(*runs) * res->threads);
+    if (runs == NULL) {
+        gpio_err("malloc analyze runs failed\n");
+        return ENOMEM;
+    }
+    for (unsigned int t = 0; t < res->threads; ++t) {
+        runs[t].file = file;
+        runs[t].from = file->blocks * t / res->threads;
+        runs[t].to = file->blocks * (t + 1) / res->threads;
+        runs[t].glitch = (glitch_ns + res->tick_ns - 1) / res->tick_ns;
+    }
+    /* the caller's thread takes the first run */
+    for (started = 1; started < res->threads; ++started) {
+        if (pthread_create(&runs[started].thread, NULL, analyze_run_main, &runs[started]) != 0) {
+            ret = EAGAIN;
+            gpio_err("start analyze thread failed\n");
+            break;
+        }
+    }
+    (void)analyze_run_main(&runs[0]);
+    for (unsigned int t = 1; t < started; ++t) {
+        pthread_join(runs[t].thread, NULL);
+    }
+    if (ret != 0) {
+        goto free_runs;
+    }
+    res->raw_blocks = runs[0].raw_blocks;
+    for (unsigned int t = 1; t < res->threads; ++t) {
+        for (unsigned int i = 0; i < res->lines; ++i) {
+            analyze_merge(&runs[0].seg[i], &runs[t].seg[i], runs[0].glitch);
+        }
+        res->raw_blocks += runs[t].raw_blocks;
+    }
+    for (unsigned int i = 0; i < res->lines; ++i) {
+        res->line[i] = runs[0].seg[i].line;
+        res->line[i].gpio_nr = file->header->gpio_nr[i];
+        res->transitions += runs[0].seg[i].edges;
+    }
+    if (file->blocks != 0) {
+        res->first_tick = gpio_capture_block_at(file, 0)->first_tick;
+        res->last_tick = gpio_capture_block_at(file, file->blocks - 1)->last_tick;
+    }
+free_runs:
+    gpio_free(runs, sizeof(*runs) * res->threads);
+    return ret;
+}
+
+static int analyze_line_index(const struct gpio_capture_file *file, unsigned int gpio_nr, unsigned int *index)
+{
+    for (unsigned int i = 0; i < file->header->lines; ++i) {
+        if (file->header->gpio_nr[i] == gpio_nr) {
+            *index = i;
+            return 0;
+        }
+    }
+    gpio_err("gpio %u is not in the capture\n", gpio_nr);
+    return ENOENT;
+}
+
+struct analyze_ds1302 {
+    unsigned int clk;
+    unsigned int dat;
+    unsigned int rst;
+    bool selected;
+    uint8_t shift;
+    uint64_t clk_tick;          /* last clk edge of this transaction, 0 before the first */
+    struct gpio_analyze_ds1302 xfer;
+};
+
+static void analyze_ds1302_clk(struct analyze_ds1302 *ds, uint64_t tick, bool high, bool dat)
+{
+    struct gpio_analyze_ds1302 *xfer = &ds->xfer;
+    if (ds->clk_tick != 0) {
+        uint64_t *shortest = high ? &xfer->clk_low_ticks : &xfer->clk_high_ticks;
+        uint64_t width = tick - ds->clk_tick;
+        *shortest = *shortest == 0 || width < *shortest ? width : *shortest;
+    }
+    ds->clk_tick = tick;
+    if (!high) {
+        return;
+    }
+    if (xfer->bits == 0) {
+        xfer->setup_ticks = tick - xfer->start_tick;
+    }
+    /* lsb first, written bits are latched and read ones driven out around this edge */
+    ds->shift |= (uint8_t)((dat ? 1 : 0) << (xfer->bits % 8));
+    if (++xfer->bits % 8 != 0) {
+        return;
+    }
+    if (xfer->bits == 8) {
+        xfer->cmd = ds->shift;
+    } else {
+        if (xfer->bytes < GPIO_ANALYZE_DS1302_DATA) {
+            xfer->data[xfer->bytes] = ds->shift;
+        }
+        ++xfer->bytes;
+    }
+    ds->shift = 0;
+}
+
+int gpio_analyze_ds1302(const struct gpio_capture_file *file, unsigned int clk_nr, unsigned int dat_nr,
+                        unsigned int rst_nr, gpio_analyze_ds1302_fn fn, void *data)
+{
+    int ret;
+    struct analyze_ds1302 ds;
+    struct gpio_capture_cursor cur;
+    memset(&ds, 0, sizeof(ds));
+    ret = analyze_line_index(file, clk_nr, &ds.clk);
+    ret = ret != 0 ? ret : analyze_line_index(file, dat_nr, &ds.dat);
+    ret = ret != 0 ? ret : analyze_line_index(file, rst_nr, &ds.rst);
+    if (ret != 0) {
+        return ret;
+    }
+    /* a capture that starts mid transaction has lost the command, it waits for the next rst rising */
+    for (uint64_t b = 0; b < file->blocks; ++b) {
+        const struct gpio_capture_block *block = gpio_capture_block_at(file, b);
+        uint64_t end = analyze_block_end(file, b);
+        gpio_capture_cursor_init(&cur, file, block);
+        while (gpio_capture_next(&cur) && cur.tick < end) {
+            bool rst = ((cur.state >> ds.rst) & 1) != 0;
+            if (((cur.flipped >> ds.rst) & 1) && rst) {
+                memset(&ds.xfer, 0, sizeof(ds.xfer));
+                ds.xfer.start_tick = cur.tick;
+                ds.selected = true;
+                ds.shift = 0;
+                ds.clk_tick = 0;
+                continue;
+            }
+            if (ds.selected && ((cur.flipped >> ds.clk) & 1)) {
+                analyze_ds1302_clk(&ds, cur.tick, ((cur.state >> ds.clk) & 1) != 0,
+                                   ((cur.state >> ds.dat) & 1) != 0);
+            }
+            if (ds.selected && ((cur.flipped >> ds.rst) & 1)) {
+                ds.selected = false;
+                ds.xfer.end_tick = cur.tick;
+                ret = fn(&ds.xfer, data);
+                if (ret != 0) {
+                    return ret;
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef GPIO_ANALYZE_H
+#define GPIO_ANALYZE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpio_capture.h"
+
+/* duty cycle histogram buckets, each 100 / GPIO_ANALYZE_DUTY_BINS percent wide */
+#define GPIO_ANALYZE_DUTY_BINS 10
+/* upper bound for worker threads, 0 asks for one per online cpu */
+#define GPIO_ANALYZE_THREADS_MAX 64
+/* data bytes kept per DS1302 transaction, a ram burst is the longest */
+#define GPIO_ANALYZE_DS1302_DATA 31
+
+/* all widths are in capture ticks, tick_ns of the result converts them */
+struct gpio_analyze_pulses {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+struct gpio_analyze_line {
+    unsigned int gpio_nr;
+    uint64_t rising;
+    uint64_t falling;
+    uint64_t high_ticks;                /* time spent high, partial pulses at either end included */
+    uint64_t low_ticks;
+    struct gpio_analyze_pulses high;    /* complete pulses, both edges inside the capture */
+    struct gpio_analyze_pulses low;
+    struct gpio_analyze_pulses period;  /* rising edge to rising edge */
+    uint64_t glitches;                  /* pulses of either level shorter than the glitch width */
+    uint64_t duty[GPIO_ANALYZE_DUTY_BINS];
+};
+
+struct gpio_analyze_result {
+    unsigned int lines;
+    unsigned int threads;
+    uint64_t tick_ns;
+    uint64_t first_tick;
+    uint64_t last_tick;
+    uint64_t blocks;
+    uint64_t raw_blocks;
+    uint64_t transitions;               /* line edges, a record flipping two lines counts twice */
+    struct gpio_analyze_line line[GPIO_SET_MAX];
+};
+
+/*
+ * per line statistics of a mapped capture. Blocks are split in runs over
+ * threads, pulses that straddle two runs are joined when the runs merge.
+ */
+int gpio_analyze_lines(const struct gpio_capture_file *file, unsigned int threads, uint64_t glitch_ns,
+                       struct gpio_analyze_result *res);
+
+/* one chip select cycle, bits are taken on clk rising edges while rst is high */
+struct gpio_analyze_ds1302 {
+    uint64_t start_tick;                /* rst rising */
+    uint64_t end_tick;                  /* rst falling */
+    uint8_t cmd;
+    unsigned int bits;                  /* clocked in total, command included */
+    unsigned int bytes;                 /* whole data bytes after the command, not all are kept */
+    uint8_t data[GPIO_ANALYZE_DS1302_DATA];
+    uint64_t setup_ticks;               /* rst rising to the first clk rising, 0 without clocks */
+    uint64_t clk_high_ticks;            /* shortest clk high and low phase, 0 without clocks */
+    uint64_t clk_low_ticks;
+};
+
+/* a non-zero return ends the decode and is passed back */
+typedef int (*gpio_analyze_ds1302_fn)(const struct gpio_analyze_ds1302 *xfer, void *data);
+
+/*
+ * walks the capture in order and hands every transaction that ended
+ * inside it to fn, lines are given by gpio number and must all be captured
+ */
+int gpio_analyze_ds1302(const struct gpio_capture_file *file, unsigned int clk_nr, unsigned int dat_nr,
+                        unsigned int rst_nr, gpio_analyze_ds1302_fn fn, void *data);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Bump allocator over caller memory with exact size free lists, and the
+ * switch that sends the library's allocations there instead of the heap.
+ * Sizes are rounded to GPIO_ARENA_ALIGN, a block of a run handed out by
+ * gpio_alloc_array goes back onto the list of its own rounded size.
+ */
+#include "gpio_arena.h"
+#include "gpio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static struct gpio_arena *arena_in_use = NULL;
+
+static size_t gpio_arena_round(size_t size)
+{
+    return (size + GPIO_ARENA_ALIGN - 1) & ~(size_t)(GPIO_ARENA_ALIGN - 1);
+}
+
+int gpio_arena_init(struct gpio_arena *arena, void *buf, size_t size)
+{
+    memset(arena, 0, sizeof(*arena));
+    pthread_mutex_init(&arena->lock, NULL);
+    uintptr_t start = ((uintptr_t)buf + GPIO_ARENA_ALIGN - 1) & ~(uintptr_t)(GPIO_ARENA_ALIGN - 1);
+    if (buf == NULL || start - (uintptr_t)buf >= size) {
+        gpio_err("arena of %zu bytes is too small\n", size);
+        return EINVAL;
+    }
+    arena->base = (char *)start;
+    arena->size = size - (start - (uintptr_t)buf);
+    arena->stats.size = arena->size;
+    return 0;
+}
+
+void *gpio_arena_alloc(struct gpio_arena *arena, size_t size)
+{
+    void *p = NULL;
+    size = gpio_arena_round(size == 0 ? 1 : size);
+    pthread_mutex_lock(&arena->lock);
+    ++arena->stats.allocs;
+    for (unsigned int i = 0; i < GPIO_ARENA_CLASSES; ++i) {
+        if (arena->free[i].size == size && arena->free[i].head != NULL) {
+            p = arena->free[i].head;
+            arena->free[i].head = *(void **)p;
+            ++arena->stats.reused;
+            goto unlock;
+        }
+    }
+    if (arena->size - arena->used < size) {
+        ++arena->stats.failed;
+        goto unlock;
+    }
+    p = arena->base + arena->used;
+    arena->used += size;
+    arena->stats.used = arena->used;
+unlock:
+    pthread_mutex_unlock(&arena->lock);
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void gpio_arena_free(struct gpio_arena *arena, void *p, size_t size)
+{
+    int slot = -1;
+    size = gpio_arena_round(size == 0 ? 1 : size);
+    pthread_mutex_lock(&arena->lock);
+    ++arena->stats.frees;
+    for (unsigned int i = 0; i < GPIO_ARENA_CLASSES; ++i) {
+        if (arena->free[i].size == size) {
+            slot = (int)i;
+            break;
+        }
+        if (slot == -1 && arena->free[i].size == 0) {
+            slot = (int)i;
+        }
+    }
+    if (slot == -1) {
+        /* more sizes than classes, the block is lost until the arena is reset */
+        gpio_err("arena has no class left for %zu bytes\n", size);
+        goto unlock;
+    }
+    arena->free[slot].size = size;
+    *(void **)p = arena->free[slot].head;
+    arena->free[slot].head = p;
+unlock:
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void gpio_arena_stats(struct gpio_arena *arena, struct gpio_arena_stats *stats)
+{
+    pthread_mutex_lock(&arena->lock);
+    *stats = arena->stats;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void gpio_set_arena(struct gpio_arena *arena)
+{
+    __atomic_store_n(&arena_in_use, arena, __ATOMIC_RELEASE);
+}
+
+static bool gpio_arena_owns(struct gpio_arena *arena, void *p)
+{
+    return arena != NULL && (char *)p >= arena->base && (char *)p < arena->base + arena->size;
+}
+
+void *gpio_alloc(size_t size)
+{
+    struct gpio_arena *arena = __atomic_load_n(&arena_in_use, __ATOMIC_ACQUIRE);
+    if (arena != NULL) {
+        void *p = gpio_arena_alloc(arena, size);
+        if (p == NULL) {
+            gpio_err("arena is out of room for %zu bytes\n", size);
+        }
+        return p;
+    }
+    size = gpio_arena_round(size == 0 ? 1 : size);
+    void *p = aligned_alloc(GPIO_ARENA_ALIGN, size);
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void gpio_free(void *p, size_t size)
+{
+    if (p == NULL) {
+        return;
+    }
+    struct gpio_arena *arena = __atomic_load_n(&arena_in_use, __ATOMIC_ACQUIRE);
+    if (gpio_arena_owns(arena, p)) {
+        gpio_arena_free(arena, p, size);
+    } else {
+        free(p);
+    }
+}
+
+int gpio_alloc_array(size_t size, unsigned int count, void **out)
+{
+    struct gpio_arena *arena = __atomic_load_n(&arena_in_use, __ATOMIC_ACQUIRE);
+    size = gpio_arena_round(size == 0 ? 1 : size);
+    if (count == 0) {
+        return 0;
+    }
+    if (arena != NULL) {
+        char *run = (char *)gpio_alloc(size * count);
+        if (run == NULL) {
+            return ENOMEM;
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+            out[i] = run + size * i;
+        }
+        return 0;
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        out[i] = gpio_alloc(size);
+        if (out[i] == NULL) {
+            while (i-- > 0) {
+                gpio_free(out[i], size);
+            }
+            return ENOMEM;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef GPIO_ARENA_H
+#define GPIO_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* every block starts on its own cache line, handles used by different threads never share one */
+#define GPIO_ARENA_ALIGN 64
+/* distinct rounded sizes given back blocks are kept for */
+#define GPIO_ARENA_CLASSES 16
+
+struct gpio_arena_stats {
+    uint64_t allocs;
+    uint64_t reused;        /* allocs served from a given back block */
+    uint64_t frees;
+    uint64_t failed;
+    size_t used;            /* high water mark of the bump pointer */
+    size_t size;
+};
+
+/*
+ * caller owned memory the library carves its handles, sets and devices
+ * from instead of the heap. Blocks are bumped off the front and come back
+ * onto a list per rounded size, so a close followed by an open of the same
+ * kind reuses the block and nothing ever reaches malloc.
+ */
+struct gpio_arena {
+    pthread_mutex_t lock;
+    char *base;
+    size_t size;
+    size_t used;
+    struct {
+        size_t size;
+        void *head;
+    } free[GPIO_ARENA_CLASSES];
+    struct gpio_arena_stats stats;
+};
+
+int gpio_arena_init(struct gpio_arena *arena, void *buf, size_t size);
+/* zeroed, NULL once the arena is spent */
+void *gpio_arena_alloc(struct gpio_arena *arena, size_t size);
+void gpio_arena_free(struct gpio_arena *arena, void *p, size_t size);
+void gpio_arena_stats(struct gpio_arena *arena, struct gpio_arena_stats *stats);
+
+/*
+ * where every allocation of the library goes from now on, NULL is the
+ * heap. Install before opening anything and keep it until all is closed,
+ * blocks from before are still handed back to the heap.
+ */
+void gpio_set_arena(struct gpio_arena *arena);
+
+/* zeroed and GPIO_ARENA_ALIGN aligned, freed with the size it was asked with */
+void *gpio_alloc(size_t size);
+void gpio_free(void *p, size_t size);
+/* count blocks of size back to back in one piece when an arena is in use, each freed on its own */
+int gpio_alloc_array(size_t size, unsigned int count, void **out);
+
+#endif
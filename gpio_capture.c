@@ -0,0 +1,611 @@
+/*
+ * Streams what input lines did into an append-only file, either by
+ * sampling a set at a fixed period with get_values or by draining the
+ * edges a gpio_loop timestamps in capture mode. Only transitions are kept,
+ * as a varint tick delta and a varint mask of the lines that flipped, so
+ * a line sitting still costs nothing however long the capture runs.
+ * Blocks restart from an absolute tick and level word, and a sampled block
+ * that filled up with fast toggling is rewritten as plain bit planes when
+ * those come out smaller. The writer maps one window of the file at a
+ * time and reserves it on disk before touching it, so memory stays at one
+ * window plus the edge ring and a full disk ends the capture instead of
+ * raising SIGBUS.
+ */
+#include "gpio_capture.h"
+#include "gpio_ring.h"
+#include "gpio_timing.h"
+#include "gpio_arena.h"
+#include "gpio_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_VARINT_MAX 10
+/* ring records taken per drain */
+#define CAPTURE_DRAIN_BATCH 256
+
+struct gpio_capture {
+    struct gpio_ops *ops;
+    gpio_set *set;
+    struct gpio_loop *loop;
+    struct gpio_ring *ring;
+    uint32_t period_ns;
+    unsigned int lines;
+    int fd;
+    struct gpio_capture_header *header;
+    uint8_t *window;
+    uint64_t window_off;
+    uint64_t reserved;          /* file bytes reserved on disk */
+    uint64_t index;             /* data block being filled */
+    struct gpio_capture_block *block;
+    uint8_t *pos;
+    uint8_t *end;
+    uint64_t mark;              /* tick of the last record or the block start */
+    uint64_t tick;              /* last tick accounted for */
+    uint64_t state;
+    pthread_t thread;
+    bool stopping;
+    int error;
+    struct gpio_capture_stats stats;
+};
+
+static uint64_t gpio_capture_offset(uint64_t index)
+{
+    return (index + 1) * GPIO_CAPTURE_BLOCK;
+}
+
+/* maps the window holding the data block at index, reserving it first */
+static int gpio_capture_window(struct gpio_capture *cap, uint64_t index)
+{
+    int ret = 0;
+    uint64_t off = gpio_capture_offset(index);
+    uint64_t window_off = off / GPIO_CAPTURE_WINDOW * GPIO_CAPTURE_WINDOW;
+    if (cap->window != NULL && window_off == cap->window_off) {
+        goto end;
+    }
+    if (cap->window != NULL) {
+        (void)munmap(cap->window, GPIO_CAPTURE_WINDOW);
+        cap->window = NULL;
+    }
+    if (window_off + GPIO_CAPTURE_WINDOW > cap->reserved) {
+        ret = posix_fallocate(cap->fd, (off_t)cap->reserved, (off_t)(window_off + GPIO_CAPTURE_WINDOW - cap->reserved));
+        if (ret != 0) {
+            gpio_err("reserve capture file failed: %s\n", strerror(ret));
+            goto end;
+        }
+        cap->reserved = window_off + GPIO_CAPTURE_WINDOW;
+    }
+    void *map = mmap(NULL, GPIO_CAPTURE_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, (off_t)window_off);
+    if (map == MAP_FAILED) {
+        ret = errno;
+        gpio_err("map capture window failed: %s\n", strerror(ret));
+        goto end;
+    }
+    cap->window = (uint8_t *)map;
+    cap->window_off = window_off;
+end:
+    return ret;
+}
+
+static int gpio_capture_block_open(struct gpio_capture *cap, uint64_t tick)
+{
+    int ret = gpio_capture_window(cap, cap->index);
+    if (ret != 0) {
+        return ret;
+    }
+    struct gpio_capture_block *block =
+        (struct gpio_capture_block *)(cap->window + gpio_capture_offset(cap->index) - cap->window_off);
+    memset(block, 0, sizeof(*block));
+    block->kind = GPIO_CAPTURE_RLE;
+    block->first_tick = tick;
+    block->last_tick = tick;
+    block->state = cap->state;
+    /* magic last, a reader of the live file never sees a half made header */
+    __atomic_store_n(&block->magic, GPIO_CAPTURE_BLOCK_MAGIC, __ATOMIC_RELEASE);
+    cap->block = block;
+    cap->pos = (uint8_t *)(block + 1);
+    cap->end = cap->pos + GPIO_CAPTURE_PAYLOAD;
+    cap->mark = tick;
+    return 0;
+}
+
+static void gpio_capture_fill(uint64_t *plane, uint64_t from, uint64_t to)
+{
+    while (from < to) {
+        unsigned int bit = from % 64;
+        unsigned int n = to - from < 64 - bit ? (unsigned int)(to - from) : 64 - bit;
+        plane[from / 64] |= (n == 64 ? ~0ull : ((1ull << n) - 1)) << bit;
+        from += n;
+    }
+}
+
+/* bit planes beat the records once every line toggles every few samples */
+static void gpio_capture_rewrite_raw(struct gpio_capture *cap)
+{
+    struct gpio_capture_block *block = cap->block;
+    uint64_t samples = block->last_tick - block->first_tick + 1;
+    uint64_t words = (samples + 63) / 64;
+    uint64_t raw = words * 8 * cap->lines;
+    if (cap->period_ns == 0 || raw >= block->bytes) {
+        return;
+    }
+    uint64_t planes[GPIO_CAPTURE_PAYLOAD / 8];
+    struct gpio_capture_cursor cur;
+    struct gpio_capture_file file = { .header = cap->header };
+    memset(planes, 0, raw);
+    gpio_capture_cursor_init(&cur, &file, block);
+    uint64_t from = 0;
+    uint64_t state = block->state;
+    while (true) {
+        bool more = gpio_capture_next(&cur);
+        uint64_t to = more ? cur.tick - block->first_tick : samples;
+        for (unsigned int i = 0; i < cap->lines; ++i) {
+            if ((state >> i) & 1) {
+                gpio_capture_fill(planes + words * i, from, to);
+            }
+        }
+        if (!more) {
+            break;
+        }
+        from = to;
+        state = cur.state;
+    }
+    memcpy(block + 1, planes, raw);
+    block->bytes = (uint32_t)raw;
+    block->kind = GPIO_CAPTURE_RAW;
+    ++cap->stats.raw_blocks;
+}
+
+static void gpio_capture_block_close(struct gpio_capture *cap)
+{
+    cap->block->last_tick = cap->tick;
+    gpio_capture_rewrite_raw(cap);
+    ++cap->stats.blocks;
+    ++cap->index;
+    cap->block = NULL;
+}
+
+static unsigned int gpio_capture_varint(uint8_t *out, uint64_t v)
+{
+    unsigned int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static int gpio_capture_put(struct gpio_capture *cap, uint64_t tick, uint64_t flipped)
+{
+    int ret = 0;
+    uint8_t rec[CAPTURE_VARINT_MAX * 2];
+    if (tick < cap->mark) {
+        tick = cap->mark;
+    }
+    unsigned int len = gpio_capture_varint(rec, tick - cap->mark);
+    len += gpio_capture_varint(rec + len, flipped);
+    if (cap->pos + len > cap->end) {
+        /* the new block starts at the transition, the old one ends right before it */
+        cap->tick = tick > cap->mark ? tick - 1 : tick;
+        gpio_capture_block_close(cap);
+        ret = gpio_capture_block_open(cap, tick);
+        if (ret != 0) {
+            goto end;
+        }
+        len = gpio_capture_varint(rec, 0);
+        len += gpio_capture_varint(rec + len, flipped);
+    }
+    memcpy(cap->pos, rec, len);
+    cap->pos += len;
+    cap->mark = tick;
+    cap->tick = tick;
+    cap->state ^= flipped;
+    ++cap->block->records;
+    __atomic_store_n(&cap->block->bytes, (uint32_t)(cap->pos - (uint8_t *)(cap->block + 1)), __ATOMIC_RELEASE);
+    ++cap->stats.transitions;
+end:
+    return ret;
+}
+
+static bool gpio_capture_stopping(struct gpio_capture *cap)
+{
+    return __atomic_load_n(&cap->stopping, __ATOMIC_ACQUIRE);
+}
+
+static void *gpio_capture_sampler(void *arg)
+{
+    struct gpio_capture *cap = (struct gpio_capture *)arg;
+    struct gpio_period period;
+    uint64_t bits;
+    (void)gpio_stats_attach();
+    gpio_period_start(&period, cap->period_ns);
+    period.deadline_ns = cap->header->start_ns;
+    /* one more sample once stopping, the levels the lines were left at make it in */
+    for (bool last = false; !last;) {
+        last = gpio_capture_stopping(cap);
+        gpio_period_wait(&period);
+        if (cap->ops->get_values(cap->set, &bits) != 0) {
+            cap->error = EIO;
+            gpio_err("sample capture lines failed\n");
+            break;
+        }
+        ++cap->stats.samples;
+        /* an overrun moves the deadline off the grid, round back onto it */
+        uint64_t tick = (period.deadline_ns - cap->header->start_ns + cap->period_ns / 2) / cap->period_ns;
+        tick = tick > cap->tick ? tick : cap->tick + 1;
+        cap->stats.missed += tick - cap->tick - 1;
+        if (bits != cap->state) {
+            cap->error = gpio_capture_put(cap, tick, bits ^ cap->state);
+            if (cap->error != 0) {
+                break;
+            }
+        }
+        cap->tick = tick;
+    }
+    return NULL;
+}
+
+static int gpio_capture_line(struct gpio_capture *cap, unsigned int gpio_nr)
+{
+    for (unsigned int i = 0; i < cap->lines; ++i) {
+        if (cap->set->lines[i]->gpio_nr == gpio_nr) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static unsigned int gpio_capture_drain(struct gpio_capture *cap)
+{
+    struct gpio_record records[CAPTURE_DRAIN_BATCH];
+    struct gpio_ring_stats ring;
+    unsigned int n = gpio_ring_drain(cap->ring, records, CAPTURE_DRAIN_BATCH);
+    for (unsigned int r = 0; r < n && cap->error == 0; ++r) {
+        int i = gpio_capture_line(cap, records[r].line);
+        if (i < 0) {
+            continue;
+        }
+        ++cap->stats.edges;
+        uint64_t high = records[r].value == GPIO_HIGH;
+        uint64_t flipped = (((cap->state >> i) & 1) ^ high) << i;
+        /* after a drop the level can already be known, nothing changed then */
+        if (flipped == 0) {
+            continue;
+        }
+        uint64_t ts = records[r].timestamp_ns;
+        uint64_t tick = ts > cap->header->start_ns ? ts - cap->header->start_ns : 0;
+        cap->error = gpio_capture_put(cap, tick, flipped);
+    }
+    gpio_ring_stats(cap->ring, &ring);
+    cap->stats.dropped = ring.overflow;
+    return n;
+}
+
+static void *gpio_capture_writer(void *arg)
+{
+    struct gpio_capture *cap = (struct gpio_capture *)arg;
+    while (cap->error == 0) {
+        bool last = gpio_capture_stopping(cap);
+        if (gpio_capture_drain(cap) == CAPTURE_DRAIN_BATCH) {
+            continue;
+        }
+        if (last) {
+            break;
+        }
+        (void)usleep(GPIO_CAPTURE_DRAIN_US);
+    }
+    return NULL;
+}
+
+static uint64_t gpio_capture_realtime(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct gpio_capture *gpio_capture_create(gpio_set *set, uint32_t period_ns, const char *path)
+{
+    struct gpio_capture *cap = (struct gpio_capture *)gpio_alloc(sizeof(struct gpio_capture));
+    if (cap == NULL) {
+        gpio_err("alloc capture failed\n");
+        goto end;
+    }
+    cap->ops = get_gpio_ops();
+    cap->set = set;
+    cap->lines = set->count;
+    cap->period_ns = period_ns;
+    cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (cap->fd == -1) {
+        gpio_err("open %s failed: %s\n", path, strerror(errno));
+        goto free_cap;
+    }
+    /* the first window holds the header as well, it stays mapped on its own */
+    if (gpio_capture_window(cap, 0) != 0) {
+        goto close_fd;
+    }
+    void *map = mmap(NULL, GPIO_CAPTURE_BLOCK, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+    if (map == MAP_FAILED) {
+        gpio_err("map capture header failed: %s\n", strerror(errno));
+        goto unmap_window;
+    }
+    cap->header = (struct gpio_capture_header *)map;
+    cap->header->version = GPIO_CAPTURE_VERSION;
+    cap->header->lines = (uint16_t)set->count;
+    cap->header->block_size = GPIO_CAPTURE_BLOCK;
+    cap->header->period_ns = period_ns;
+    for (unsigned int i = 0; i < set->count; ++i) {
+        cap->header->gpio_nr[i] = set->lines[i]->gpio_nr;
+    }
+    goto end;
+unmap_window:
+    (void)munmap(cap->window, GPIO_CAPTURE_WINDOW);
+close_fd:
+    close(cap->fd);
+free_cap:
+    gpio_free(cap, sizeof(struct gpio_capture));
+    cap = NULL;
+end:
+    return cap;
+}
+
+/* levels and tick 0 are taken together, the first block starts from them */
+static int gpio_capture_begin(struct gpio_capture *cap, void *(*fn)(void *))
+{
+    int ret = cap->ops->get_values(cap->set, &cap->state);
+    if (ret != 0) {
+        gpio_err("read capture lines failed\n");
+        return ret;
+    }
+    cap->header->start_ns = gpio_timing_now();
+    cap->header->start_realtime_ns = gpio_capture_realtime();
+    __atomic_store_n(&cap->header->magic, GPIO_CAPTURE_MAGIC, __ATOMIC_RELEASE);
+    ret = gpio_capture_block_open(cap, 0);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = pthread_create(&cap->thread, NULL, fn, cap);
+    if (ret != 0) {
+        gpio_err("start capture thread failed\n");
+    }
+    return ret;
+}
+
+static void gpio_capture_destroy(struct gpio_capture *cap)
+{
+    if (cap->ring != NULL) {
+        gpio_ring_destroy(cap->ring);
+    }
+    (void)munmap(cap->header, GPIO_CAPTURE_BLOCK);
+    if (cap->window != NULL) {
+        (void)munmap(cap->window, GPIO_CAPTURE_WINDOW);
+    }
+    close(cap->fd);
+    gpio_free(cap, sizeof(struct gpio_capture));
+}
+
+struct gpio_capture *gpio_capture_sample(gpio_set *set, uint32_t period_ns, const char *path)
+{
+    if (period_ns == 0) {
+        gpio_err("sample period must not be 0\n");
+        return NULL;
+    }
+    struct gpio_capture *cap = gpio_capture_create(set, period_ns, path);
+    if (cap == NULL) {
+        return NULL;
+    }
+    /* calibrating sleeps for a while, done here it does not eat into the first ticks */
+    gpio_timing_calibrate();
+    if (gpio_capture_begin(cap, gpio_capture_sampler) != 0) {
+        gpio_capture_destroy(cap);
+        return NULL;
+    }
+    return cap;
+}
+
+struct gpio_capture *gpio_capture_edges(struct gpio_loop *loop, gpio_set *set, const char *path)
+{
+    unsigned int watched = 0;
+    struct gpio_capture *cap = gpio_capture_create(set, 0, path);
+    if (cap == NULL) {
+        goto end;
+    }
+    cap->loop = loop;
+    cap->ring = gpio_ring_create(GPIO_CAPTURE_RING);
+    if (cap->ring == NULL) {
+        goto destroy;
+    }
+    for (watched = 0; watched < set->count; ++watched) {
+        if (gpio_loop_capture(loop, set->lines[watched], GPIO_BOTH, cap->ring) != 0) {
+            gpio_err("capture gpio %u failed\n", set->lines[watched]->gpio_nr);
+            goto unwatch;
+        }
+    }
+    if (gpio_capture_begin(cap, gpio_capture_writer) != 0) {
+        goto unwatch;
+    }
+    goto end;
+unwatch:
+    while (watched-- > 0) {
+        (void)gpio_loop_remove(loop, set->lines[watched]);
+    }
+destroy:
+    gpio_capture_destroy(cap);
+    cap = NULL;
+end:
+    return cap;
+}
+
+int gpio_capture_stop(struct gpio_capture *cap, struct gpio_capture_stats *stats)
+{
+    if (cap->loop != NULL) {
+        for (unsigned int i = 0; i < cap->lines; ++i) {
+            (void)gpio_loop_remove(cap->loop, cap->set->lines[i]);
+        }
+    }
+    __atomic_store_n(&cap->stopping, true, __ATOMIC_RELEASE);
+    pthread_join(cap->thread, NULL);
+    int ret = cap->error;
+    if (cap->period_ns == 0) {
+        /* edges carry their own time, the capture lasted until now */
+        uint64_t now = gpio_timing_now() - cap->header->start_ns;
+        cap->tick = now > cap->tick ? now : cap->tick;
+    }
+    if (cap->block != NULL) {
+        gpio_capture_block_close(cap);
+    }
+    cap->header->blocks = cap->stats.blocks;
+    cap->stats.bytes = gpio_capture_offset(cap->stats.blocks);
+    /* give back what the last window reserved past the data */
+    if (ftruncate(cap->fd, (off_t)cap->stats.bytes) == -1) {
+        ret = ret != 0 ? ret : errno;
+        gpio_err("trim capture file failed: %s\n", strerror(errno));
+    }
+    if (stats != NULL) {
+        *stats = cap->stats;
+    }
+    gpio_capture_destroy(cap);
+    return ret;
+}
+
+int gpio_capture_map(const char *path, struct gpio_capture_file *file)
+{
+    int ret = 0;
+    struct stat st;
+    memset(file, 0, sizeof(*file));
+    file->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (file->fd == -1) {
+        ret = errno;
+        gpio_err("open %s failed: %s\n", path, strerror(ret));
+        goto end;
+    }
+    if (fstat(file->fd, &st) == -1) {
+        ret = errno;
+        goto close_fd;
+    }
+    if ((uint64_t)st.st_size < GPIO_CAPTURE_BLOCK) {
+        ret = EINVAL;
+        gpio_err("%s is no capture\n", path);
+        goto close_fd;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (map == MAP_FAILED) {
+        ret = errno;
+        gpio_err("map %s failed: %s\n", path, strerror(ret));
+        goto close_fd;
+    }
+    file->map = (const uint8_t *)map;
+    file->size = (uint64_t)st.st_size;
+    file->header = (const struct gpio_capture_header *)map;
+    if (file->header->magic != GPIO_CAPTURE_MAGIC || file->header->version != GPIO_CAPTURE_VERSION ||
+        file->header->block_size != GPIO_CAPTURE_BLOCK || file->header->lines > GPIO_SET_MAX) {
+        ret = EINVAL;
+        gpio_err("%s is no capture of this version\n", path);
+        goto unmap;
+    }
+    uint64_t room = file->size / GPIO_CAPTURE_BLOCK - 1;
+    file->blocks = file->header->blocks;
+    if (file->blocks == 0 || file->blocks > room) {
+        /* still being written or cut short */
+        file->blocks = 0;
+        while (file->blocks < room && gpio_capture_block_at(file, file->blocks)->magic == GPIO_CAPTURE_BLOCK_MAGIC) {
+            ++file->blocks;
+        }
+    }
+    goto end;
+unmap:
+    (void)munmap((void *)file->map, (size_t)file->size);
+close_fd:
+    close(file->fd);
+    file->fd = -1;
+end:
+    return ret;
+}
+
+void gpio_capture_unmap(struct gpio_capture_file *file)
+{
+    (void)munmap((void *)file->map, (size_t)file->size);
+    close(file->fd);
+    file->fd = -1;
+}
+
+void gpio_capture_cursor_init(struct gpio_capture_cursor *cur, const struct gpio_capture_file *file,
+                              const struct gpio_capture_block *block)
+{
+    uint32_t bytes = block->bytes < GPIO_CAPTURE_PAYLOAD ? block->bytes : GPIO_CAPTURE_PAYLOAD;
+    cur->block = block;
+    cur->pos = (const uint8_t *)(block + 1);
+    cur->end = cur->pos + bytes;
+    cur->lines = file->header->lines;
+    cur->index = 0;
+    cur->tick = block->first_tick;
+    cur->state = block->state;
+    cur->flipped = 0;
+}
+
+static bool gpio_capture_read_varint(struct gpio_capture_cursor *cur, uint64_t *v)
+{
+    uint64_t out = 0;
+    for (unsigned int shift = 0; shift < 64 && cur->pos < cur->end; shift += 7) {
+        uint8_t b = *cur->pos++;
+        out |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *v = out;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the next sample any plane differs from the one before it */
+static bool gpio_capture_next_raw(struct gpio_capture_cursor *cur)
+{
+    const uint64_t *planes = (const uint64_t *)(cur->block + 1);
+    uint64_t samples = cur->block->last_tick - cur->block->first_tick + 1;
+    uint64_t words = (samples + 63) / 64;
+    if (words * 8 * cur->lines > (uint64_t)(cur->end - (const uint8_t *)planes)) {
+        return false;
+    }
+    /* sample 0 is held against the levels the block starts from, a transition on first_tick shows there */
+    while (cur->index < samples) {
+        uint64_t s = cur->index++;
+        uint64_t flipped = 0;
+        for (unsigned int i = 0; i < cur->lines; ++i) {
+            const uint64_t *plane = planes + words * i;
+            uint64_t now = (plane[s / 64] >> (s % 64)) & 1;
+            uint64_t before = s == 0 ? (cur->block->state >> i) & 1 : (plane[(s - 1) / 64] >> ((s - 1) % 64)) & 1;
+            flipped |= (now ^ before) << i;
+        }
+        if (flipped != 0) {
+            cur->tick = cur->block->first_tick + s;
+            cur->state ^= flipped;
+            cur->flipped = flipped;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool gpio_capture_next(struct gpio_capture_cursor *cur)
+{
+    uint64_t delta;
+    uint64_t flipped;
+    if (cur->block->kind == GPIO_CAPTURE_RAW) {
+        return gpio_capture_next_raw(cur);
+    }
+    if (!gpio_capture_read_varint(cur, &delta) || !gpio_capture_read_varint(cur, &flipped)) {
+        return false;
+    }
+    cur->tick += delta;
+    cur->state ^= flipped;
+    cur->flipped = flipped;
+    return true;
+}
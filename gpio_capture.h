@@ -0,0 +1,127 @@
+#ifndef GPIO_CAPTURE_H
+#define GPIO_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpio.h"
+#include "gpio_loop.h"
+
+/*
+ * file layout: one header block, then data blocks of GPIO_CAPTURE_BLOCK
+ * bytes each. Every data block carries the tick and line levels it starts
+ * from, so any block decodes without the ones before it.
+ */
+#define GPIO_CAPTURE_MAGIC 0x50414347u          /* "GCAP" */
+#define GPIO_CAPTURE_BLOCK_MAGIC 0x4b4c4247u    /* "GBLK" */
+#define GPIO_CAPTURE_VERSION 1
+#define GPIO_CAPTURE_BLOCK 4096
+/* file bytes mapped at once while writing, the whole footprint besides the edge ring */
+#define GPIO_CAPTURE_WINDOW (1u << 20)
+/* edges buffered between the loop and the writer */
+#define GPIO_CAPTURE_RING 4096
+/* how often the writer drains the ring in edge mode */
+#define GPIO_CAPTURE_DRAIN_US 1000
+
+struct gpio_capture_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t lines;
+    uint32_t block_size;
+    uint32_t period_ns;         /* sample period, 0 when edges were recorded and a tick is 1 ns */
+    uint64_t start_ns;          /* CLOCK_MONOTONIC of tick 0 */
+    uint64_t start_realtime_ns;
+    uint64_t blocks;            /* data blocks, 0 until the capture stopped */
+    uint32_t gpio_nr[GPIO_SET_MAX];
+};
+
+/*
+ * rle: records of varint tick delta and varint mask of the lines that
+ * flipped. raw: a sampled block whose lines moved faster than records pay
+ * off, bit planes of one bit per sample, line after line, each
+ * (last_tick - first_tick + 1 + 63) / 64 words long.
+ */
+enum gpio_capture_kind {
+    GPIO_CAPTURE_RLE = 0,
+    GPIO_CAPTURE_RAW = 1,
+};
+
+struct gpio_capture_block {
+    uint32_t magic;
+    uint16_t kind;
+    uint16_t reserved;
+    uint32_t bytes;             /* payload used after this header */
+    uint32_t records;           /* transitions inside the block */
+    uint64_t first_tick;
+    uint64_t last_tick;         /* last tick the block accounts for */
+    uint64_t state;             /* levels the block starts from, bit i set when lines[i] is high */
+};
+
+#define GPIO_CAPTURE_PAYLOAD (GPIO_CAPTURE_BLOCK - sizeof(struct gpio_capture_block))
+
+struct gpio_capture_stats {
+    uint64_t samples;           /* sampled mode, reads of the lines */
+    uint64_t missed;            /* ticks the sampler was too late for */
+    uint64_t edges;             /* edge mode, events taken off the ring */
+    uint64_t dropped;           /* edges lost to a full ring */
+    uint64_t transitions;
+    uint64_t blocks;
+    uint64_t raw_blocks;
+    uint64_t bytes;             /* file size */
+};
+
+/* samples or edges of the lines of one set streamed into a file by a writer thread */
+struct gpio_capture;
+
+/*
+ * reads every line of set each period_ns and records the changes, the
+ * set has to stay open and its lines be inputs for the whole capture
+ */
+struct gpio_capture *gpio_capture_sample(gpio_set *set, uint32_t period_ns, const char *path);
+/*
+ * watches both edges of every line of set on loop in capture mode, the
+ * loop's thread only timestamps them into a ring that the writer drains
+ */
+struct gpio_capture *gpio_capture_edges(struct gpio_loop *loop, gpio_set *set, const char *path);
+/*
+ * flushes what is left and completes the file, in edge mode the lines
+ * leave the loop, so nobody may be waiting on it meanwhile
+ */
+int gpio_capture_stop(struct gpio_capture *cap, struct gpio_capture_stats *stats);
+
+/* reading side */
+struct gpio_capture_file {
+    int fd;
+    const uint8_t *map;
+    uint64_t size;
+    const struct gpio_capture_header *header;
+    uint64_t blocks;
+};
+
+/* a capture cut short is read up to its last intact block */
+int gpio_capture_map(const char *path, struct gpio_capture_file *file);
+void gpio_capture_unmap(struct gpio_capture_file *file);
+
+static inline const struct gpio_capture_block *gpio_capture_block_at(const struct gpio_capture_file *file,
+                                                                     uint64_t index)
+{
+    return (const struct gpio_capture_block *)(file->map + (index + 1) * file->header->block_size);
+}
+
+/* walks the transitions of one block, tick and state are those after the last one taken */
+struct gpio_capture_cursor {
+    const struct gpio_capture_block *block;
+    const uint8_t *pos;
+    const uint8_t *end;
+    unsigned int lines;
+    uint64_t index;             /* next sample to look at inside a raw block */
+    uint64_t tick;
+    uint64_t state;
+    uint64_t flipped;           /* lines the last transition changed */
+};
+
+void gpio_capture_cursor_init(struct gpio_capture_cursor *cur, const struct gpio_capture_file *file,
+                              const struct gpio_capture_block *block);
+bool gpio_capture_next(struct gpio_capture_cursor *cur);
+
+#endif
@@ -0,0 +1,788 @@
+/*
+ * Implemented based on https://docs.kernel.org/userspace-api/gpio/chardev.html
+ * Every line is a v2 line request, so there is no export/unexport and every
+ * value change is a single ioctl on the request fd.
+ */
+#include "gpio_cdev.h"
+#include "gpio_priv.h"
+#include "gpio_debounce.h"
+#include "gpio_arena.h"
+#include "gpio_registry.h"
+
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define GPIO_CDEV_CONSUMER "gpio"
+#define GPIO_CDEV_EVENT_BATCH 16
+
+#define GPIO_CDEV_DIR_FLAGS (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_OUTPUT)
+#define GPIO_CDEV_EDGE_FLAGS (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING)
+
+static int native_open(const char *path, int flags)
+{
+    return open(path, flags);
+}
+
+static int native_ioctl(int fd, unsigned long req, void *arg)
+{
+    return ioctl(fd, req, arg);
+}
+
+static const struct gpio_cdev_sys native_sys = {
+    .open = native_open,
+    .close = close,
+    .ioctl = native_ioctl,
+    .read = read,
+    .poll = poll,
+};
+
+static const struct gpio_cdev_sys *sys = &native_sys;
+/* the chips are scanned and their fds opened by whichever open comes first */
+static struct gpio_registry registry;
+static int chip_fds[GPIO_REGISTRY_CHIPS];
+static bool registry_ready = false;
+static pthread_mutex_t chip_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void gpio_cdev_forget(void)
+{
+    for (unsigned int i = 0; i < registry.chips; ++i) {
+        sys->close(chip_fds[i]);
+    }
+    gpio_registry_clear(&registry);
+    registry_ready = false;
+}
+
+void gpio_cdev_set_sys(const struct gpio_cdev_sys *s)
+{
+    pthread_mutex_lock(&chip_lock);
+    gpio_cdev_forget();
+    sys = s == NULL ? &native_sys : s;
+    pthread_mutex_unlock(&chip_lock);
+}
+
+/* with chip_lock held, every chip stays open from here on */
+static int gpio_cdev_scan(void)
+{
+    int ret = 0;
+    char path[32];
+    unsigned int base = 0;
+    struct gpiochip_info info;
+    memset(&registry, 0, sizeof(registry));
+    for (unsigned int n = 0; n < GPIO_REGISTRY_CHIPS; ++n) {
+        (void)snprintf(path, sizeof(path), GPIO_CDEV_CHIP_PATH, n);
+        gpio_account_sys(GPIO_OP_OPEN, 0);
+        int fd = sys->open(path, O_RDWR | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        memset(&info, 0, sizeof(info));
+        gpio_account_sys(GPIO_OP_OPEN, sizeof(info));
+        if (sys->ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) == -1) {
+            gpio_err("read %s info failed: %s\n", path, strerror(errno));
+            sys->close(fd);
+            continue;
+        }
+        if (info.lines == 0 || base + info.lines > GPIO_REGISTRY_LINES) {
+            gpio_err("%s has no lines or covers lines beyond %d\n", path, GPIO_REGISTRY_LINES);
+            sys->close(fd);
+            continue;
+        }
+        struct gpio_chip_info *chip = &registry.chip[registry.chips];
+        chip->base = base;
+        chip->ngpio = info.lines;
+        (void)snprintf(chip->label, sizeof(chip->label), "%.*s", (int)sizeof(info.label), info.label);
+        chip_fds[registry.chips++] = fd;
+        base += info.lines;
+    }
+    if (registry.chips == 0) {
+        ret = ENODEV;
+        gpio_err("no gpiochip in /dev\n");
+        goto end;
+    }
+    ret = gpio_registry_index(&registry);
+end:
+    if (ret != 0) {
+        gpio_cdev_forget();
+    }
+    return ret;
+}
+
+static int gpio_cdev_load(void)
+{
+    int ret = 0;
+    if (!registry_ready) {
+        ret = gpio_cdev_scan();
+        registry_ready = ret == 0;
+    }
+    return ret;
+}
+
+const struct gpio_registry *gpio_cdev_registry(void)
+{
+    pthread_mutex_lock(&chip_lock);
+    int ret = gpio_cdev_load();
+    pthread_mutex_unlock(&chip_lock);
+    return ret == 0 ? &registry : NULL;
+}
+
+/* the fd of the chip gpio_nr is on and its offset there, -1 when no chip has it */
+static int gpio_cdev_chip(unsigned int gpio_nr, unsigned int *offset)
+{
+    int fd = -1;
+    pthread_mutex_lock(&chip_lock);
+    if (gpio_cdev_load() != 0) {
+        goto unlock;
+    }
+    const struct gpio_chip_info *chip = gpio_registry_lookup(&registry, gpio_nr);
+    if (chip == NULL) {
+        gpio_err("gpio %u is on no gpiochip\n", gpio_nr);
+        goto unlock;
+    }
+    *offset = gpio_nr - chip->base;
+    fd = chip_fds[chip - registry.chip];
+unlock:
+    pthread_mutex_unlock(&chip_lock);
+    return fd;
+}
+
+/*
+ * lines are requested with no direction so the kernel takes them as they
+ * are, the direction they already had is read back into req.flags
+ */
+static int gpio_cdev_seed(int chip, gpio *io)
+{
+    int ret = 0;
+    struct gpio_v2_line_info info;
+    memset(&info, 0, sizeof(info));
+    info.offset = io->req.offset;
+    gpio_account_sys(GPIO_OP_OPEN, sizeof(info));
+    if (sys->ioctl(chip, GPIO_V2_GET_LINEINFO_IOCTL, &info) == -1) {
+        ret = errno;
+        gpio_err("read gpio %u info failed: %s\n", io->gpio_nr, strerror(ret));
+        goto end;
+    }
+    io->req.flags = info.flags & GPIO_CDEV_DIR_FLAGS;
+    gpio_shadow_invalidate(&io->shadow);
+    io->shadow.direction = (io->req.flags & GPIO_V2_LINE_FLAG_OUTPUT) != 0 ? GPIO_OUT : GPIO_IN;
+    io->shadow.edge = GPIO_NONE;
+end:
+    return ret;
+}
+
+static gpio *gpio_cdev_open(unsigned int gpio_nr)
+{
+    gpio *io = NULL;
+    unsigned int offset;
+    gpio_account_call(GPIO_OP_OPEN);
+    int chip = gpio_cdev_chip(gpio_nr, &offset);
+    if (chip == -1) {
+        goto end;
+    }
+    io = (gpio *)gpio_alloc(sizeof(gpio));
+    if (io == NULL) {
+        gpio_err("alloc gpio failed\n");
+        goto end;
+    }
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = offset;
+    req.num_lines = 1;
+    (void)strncpy(req.consumer, GPIO_CDEV_CONSUMER, sizeof(req.consumer) - 1);
+    gpio_account_sys(GPIO_OP_OPEN, sizeof(req));
+    if (sys->ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+        gpio_err("request line %u failed: %s\n", gpio_nr, strerror(errno));
+        goto free_io;
+    }
+    io->gpio_nr = gpio_nr;
+    io->req.fd = req.fd;
+    io->req.index = 0;
+    io->req.offset = offset;
+    io->req.debounce_us = 0;
+    io->req.set = NULL;
+    memset(&io->debounce, 0, sizeof(io->debounce));
+    if (gpio_cdev_seed(chip, io) != 0) {
+        goto release;
+    }
+    goto end;
+release:
+    sys->close(io->req.fd);
+free_io:
+    gpio_free(io, sizeof(gpio));
+    io = NULL;
+end:
+    return io;
+}
+
+static void gpio_cdev_close(gpio *io)
+{
+    gpio_account_call(GPIO_OP_CLOSE);
+    gpio_account_sys(GPIO_OP_CLOSE, 0);
+    if (sys->close(io->req.fd) == -1) {
+        gpio_err("release line %u failed: %s\n", io->gpio_nr, strerror(errno));
+    }
+    gpio_free(io, sizeof(gpio));
+}
+
+/*
+ * levels of the outputs in lines, from the shadow where it is known and
+ * read back otherwise, fresh outputs that were inputs until now start low
+ */
+static int gpio_cdev_out_levels(gpio *const *lines, unsigned int count, uint64_t fresh, uint64_t *levels)
+{
+    int ret = 0;
+    uint64_t unknown = 0;
+    *levels = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        uint64_t bit = 1ull << i;
+        if ((lines[i]->req.flags & GPIO_V2_LINE_FLAG_OUTPUT) == 0 || (fresh & bit) != 0) {
+            continue;
+        }
+        if (lines[i]->shadow.value == GPIO_SHADOW_UNKNOWN) {
+            unknown |= bit;
+        } else if (lines[i]->shadow.value == GPIO_HIGH) {
+            *levels |= bit;
+        }
+    }
+    if (unknown == 0) {
+        goto end;
+    }
+    struct gpio_v2_line_values values = { .bits = 0, .mask = unknown };
+    gpio_account_sys(GPIO_OP_GET_VALUE, sizeof(values));
+    if (sys->ioctl(lines[0]->req.fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == -1) {
+        ret = errno;
+        gpio_err("read back output levels failed: %s\n", strerror(ret));
+        goto end;
+    }
+    *levels |= values.bits & unknown;
+end:
+    return ret;
+}
+
+/*
+ * one config for the whole request, lines whose flags differ from lines[0]
+ * get an attribute, and so does every debounce period in use. The kernel
+ * drives every output of the request to the output values attribute, 0
+ * where it is missing, so the outputs go along at the levels they hold.
+ */
+static int gpio_cdev_set_config(enum gpio_op op, gpio *const *lines, unsigned int count, uint64_t fresh)
+{
+    int ret = 0;
+    uint64_t outputs = 0;
+    uint64_t levels;
+    struct gpio_v2_line_config config;
+    memset(&config, 0, sizeof(config));
+    config.flags = lines[0]->req.flags;
+    ret = gpio_cdev_out_levels(lines, count, fresh, &levels);
+    if (ret != 0) {
+        goto end;
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        uint64_t flags = lines[i]->req.flags;
+        uint32_t debounce = lines[i]->req.debounce_us;
+        unsigned int a;
+        if (flags != config.flags) {
+            for (a = 0; a < config.num_attrs; ++a) {
+                if (config.attrs[a].attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS && config.attrs[a].attr.flags == flags) {
+                    break;
+                }
+            }
+            if (a == config.num_attrs) {
+                if (a == GPIO_V2_LINE_NUM_ATTRS_MAX) {
+                    goto too_many;
+                }
+                config.attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+                config.attrs[a].attr.flags = flags;
+                ++config.num_attrs;
+            }
+            config.attrs[a].mask |= 1ull << i;
+        }
+        if (debounce != 0) {
+            for (a = 0; a < config.num_attrs; ++a) {
+                if (config.attrs[a].attr.id == GPIO_V2_LINE_ATTR_ID_DEBOUNCE &&
+                    config.attrs[a].attr.debounce_period_us == debounce) {
+                    break;
+                }
+            }
+            if (a == config.num_attrs) {
+                if (a == GPIO_V2_LINE_NUM_ATTRS_MAX) {
+                    goto too_many;
+                }
+                config.attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+                config.attrs[a].attr.debounce_period_us = debounce;
+                ++config.num_attrs;
+            }
+            config.attrs[a].mask |= 1ull << i;
+        }
+        if ((flags & GPIO_V2_LINE_FLAG_OUTPUT) != 0) {
+            outputs |= 1ull << i;
+        }
+    }
+    if (outputs != 0) {
+        if (config.num_attrs == GPIO_V2_LINE_NUM_ATTRS_MAX) {
+            goto too_many;
+        }
+        config.attrs[config.num_attrs].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        config.attrs[config.num_attrs].attr.values = levels;
+        config.attrs[config.num_attrs].mask = outputs;
+        ++config.num_attrs;
+    }
+    gpio_account_sys(op, sizeof(config));
+    if (sys->ioctl(lines[0]->req.fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) == -1) {
+        ret = errno;
+        gpio_err("set line config failed: %s\n", strerror(ret));
+        goto end;
+    }
+    /* every output now holds exactly what was sent */
+    for (unsigned int i = 0; i < count; ++i) {
+        if ((outputs >> i) & 1) {
+            lines[i]->shadow.value = (levels >> i) & 1 ? GPIO_HIGH : GPIO_LOW;
+        } else {
+            lines[i]->shadow.value = GPIO_SHADOW_UNKNOWN;
+        }
+    }
+    goto end;
+too_many:
+    ret = EINVAL;
+    gpio_err("too many distinct line configs\n");
+end:
+    return ret;
+}
+
+/* push the config of io, and of the lines sharing its request, fresh when io just became an output */
+static int gpio_cdev_apply(enum gpio_op op, gpio *io, bool fresh)
+{
+    uint64_t bit = fresh ? 1ull << io->req.index : 0;
+    if (io->req.set != NULL) {
+        return gpio_cdev_set_config(op, io->req.set->lines, io->req.set->count, bit);
+    }
+    return gpio_cdev_set_config(op, &io, 1, bit);
+}
+
+/* req.flags mirrors what the kernel holds, so it doubles as the direction/edge shadow */
+static int gpio_cdev_set_flags(enum gpio_op op, gpio *io, uint64_t flags)
+{
+    int ret = 0;
+    uint64_t old = io->req.flags;
+    if (flags == old && gpio_cache_on) {
+        gpio_cache_count(true);
+        goto end;
+    }
+    gpio_cache_count(false);
+    io->req.flags = flags;
+    ret = gpio_cdev_apply(op, io, (flags & ~old & GPIO_V2_LINE_FLAG_OUTPUT) != 0);
+    if (ret != 0) {
+        io->req.flags = old;
+    }
+end:
+    return ret;
+}
+
+static int gpio_cdev_set_direction(gpio *io, enum gpio_direction dir)
+{
+    int ret;
+    uint64_t flags = io->req.flags & ~GPIO_CDEV_DIR_FLAGS;
+    gpio_account_call(GPIO_OP_SET_DIRECTION);
+    switch (dir) {
+        case GPIO_IN:
+            ret = gpio_cdev_set_flags(GPIO_OP_SET_DIRECTION, io, flags | GPIO_V2_LINE_FLAG_INPUT);
+            break;
+        case GPIO_OUT:
+            /* edge detection is only valid on inputs */
+            ret = gpio_cdev_set_flags(GPIO_OP_SET_DIRECTION, io, (flags & ~GPIO_CDEV_EDGE_FLAGS) | GPIO_V2_LINE_FLAG_OUTPUT);
+            break;
+        default:
+            ret = -1;
+            gpio_err("unknown direction\n");
+            break;
+    }
+    return ret;
+}
+
+static int gpio_cdev_set_value(gpio *io, enum gpio_value value)
+{
+    int ret = 0;
+    uint64_t bit = 1ull << io->req.index;
+    struct gpio_v2_line_values values = { .bits = value == GPIO_HIGH ? bit : 0, .mask = bit };
+    gpio_account_call(GPIO_OP_SET_VALUE);
+    if (value != GPIO_HIGH && value != GPIO_LOW) {
+        ret = -1;
+        gpio_err("unsupport value\n");
+        goto end;
+    }
+    if (gpio_shadow_hit(&io->shadow.value, value)) {
+        goto end;
+    }
+    gpio_account_sys(GPIO_OP_SET_VALUE, sizeof(values));
+    if (sys->ioctl(io->req.fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) == -1) {
+        ret = errno;
+        gpio_err("set value failed: %s\n", strerror(ret));
+    }
+    gpio_shadow_store(&io->shadow.value, value, ret);
+end:
+    return ret;
+}
+
+static int gpio_cdev_get_value(gpio *io, enum gpio_value *value)
+{
+    int ret = 0;
+    uint64_t bit = 1ull << io->req.index;
+    struct gpio_v2_line_values values = { .bits = 0, .mask = bit };
+    gpio_account_call(GPIO_OP_GET_VALUE);
+    gpio_account_sys(GPIO_OP_GET_VALUE, sizeof(values));
+    if (sys->ioctl(io->req.fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == -1) {
+        ret = errno;
+        gpio_err("get value failed: %s\n", strerror(ret));
+        goto end;
+    }
+    *value = (values.bits & bit) != 0 ? GPIO_HIGH : GPIO_LOW;
+end:
+    return ret;
+}
+
+static int gpio_cdev_set_edge(gpio *io, enum gpio_edge edge)
+{
+    int ret;
+    uint64_t flags = io->req.flags & ~GPIO_CDEV_EDGE_FLAGS;
+    gpio_account_call(GPIO_OP_SET_EDGE);
+    switch (edge) {
+        case GPIO_RISING:
+            flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+            break;
+        case GPIO_FALLING:
+            flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+            break;
+        case GPIO_BOTH:
+            flags |= GPIO_CDEV_EDGE_FLAGS;
+            break;
+        case GPIO_NONE:
+            /* nothing to detect, the line keeps its direction */
+            ret = gpio_cdev_set_flags(GPIO_OP_SET_EDGE, io, flags);
+            goto end;
+        default:
+            gpio_err("unsupport edge\n");
+            ret = -1;
+            goto end;
+    }
+    /* edge detection implies input */
+    ret = gpio_cdev_set_flags(GPIO_OP_SET_EDGE, io, (flags & ~GPIO_CDEV_DIR_FLAGS) | GPIO_V2_LINE_FLAG_INPUT);
+end:
+    return ret;
+}
+
+static void gpio_cdev_to_event(gpio *io, const struct gpio_v2_line_event *raw, struct gpio_event *event)
+{
+    /* a shared request reports every line of the set, all on the chip of io */
+    event->gpio_nr = io->req.set == NULL ? io->gpio_nr : io->gpio_nr - io->req.offset + raw->offset;
+    event->value = raw->id == GPIO_V2_LINE_EVENT_RISING_EDGE ? GPIO_HIGH : GPIO_LOW;
+    event->timestamp_ns = raw->timestamp_ns;
+    event->seqno = raw->line_seqno;
+}
+
+static int gpio_cdev_read_event(gpio *io, struct gpio_event *event)
+{
+    int ret = 0;
+    struct gpio_v2_line_event raw;
+    gpio_account_call(GPIO_OP_IRQ);
+    gpio_account_sys(GPIO_OP_IRQ, sizeof(raw));
+    ssize_t len = sys->read(io->req.fd, &raw, sizeof(raw));
+    if (len != sizeof(raw)) {
+        /* a short read leaves errno alone */
+        ret = len < 0 ? errno : EIO;
+        gpio_err("read line event failed: %s\n", strerror(ret));
+        goto end;
+    }
+    gpio_cdev_to_event(io, &raw, event);
+end:
+    return ret;
+}
+
+static int gpio_cdev_wait_event(gpio *io, struct gpio_event *event, int timeout_ms)
+{
+    int ret = gpio_debounce_direct(io);
+    struct pollfd poll_fd = { .fd = io->req.fd, .events = POLLIN };
+    if (ret != 0) {
+        goto end;
+    }
+    gpio_account_sys(GPIO_OP_IRQ, 0);
+    ret = sys->poll(&poll_fd, 1, timeout_ms);
+    if (ret < 0) {
+        ret = errno;
+        gpio_err("poll failed %s\n", strerror(ret));
+        goto end;
+    }
+    if (ret == 0) {
+        ret = ETIMEDOUT;
+        goto end;
+    }
+    ret = gpio_cdev_read_event(io, event);
+end:
+    return ret;
+}
+
+static int gpio_cdev_event_fd(gpio *io, uint32_t *events)
+{
+    *events = POLLIN;
+    return io->req.fd;
+}
+
+static int gpio_cdev_handle_irq(gpio *io, irq_handler handler, void *data)
+{
+    int ret = gpio_debounce_direct(io);
+    struct gpio_v2_line_event raw[GPIO_CDEV_EVENT_BATCH];
+    struct pollfd poll_fd = { .fd = io->req.fd, .events = POLLIN };
+    while (ret == 0) {
+        gpio_account_sys(GPIO_OP_IRQ, 0);
+        if (sys->poll(&poll_fd, 1, -1) < 0) {
+            ret = errno;
+            gpio_err("poll failed %s\n", strerror(ret));
+            goto end;
+        }
+        /* the kernel hands back as many queued events as fit */
+        ssize_t len = sys->read(io->req.fd, raw, sizeof(raw));
+        gpio_account_sys(GPIO_OP_IRQ, len > 0 ? len : 0);
+        if (len < (ssize_t)sizeof(raw[0])) {
+            ret = len < 0 ? errno : EIO;
+            gpio_err("read line event failed: %s\n", strerror(ret));
+            goto end;
+        }
+        for (size_t i = 0; i < len / sizeof(raw[0]); ++i) {
+            gpio_account_call(GPIO_OP_IRQ);
+            ret = handler(raw[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE ? GPIO_HIGH : GPIO_LOW, data);
+            if (ret != 0) {
+                gpio_err("handle irq failed\n");
+                goto end;
+            }
+        }
+    }
+end:
+    return ret;
+}
+
+/* one request covers every line, so bulk get/set is a single ioctl and the lines share a chip */
+static gpio_set *gpio_cdev_set_open(const unsigned int *gpio_nr, unsigned int count)
+{
+    gpio_set *set = NULL;
+    int chip = -1;
+    unsigned int offsets[GPIO_V2_LINES_MAX];
+    gpio_account_call(GPIO_OP_OPEN);
+    if (count == 0 || count > GPIO_SET_MAX || count > GPIO_V2_LINES_MAX) {
+        gpio_err("line count %u is beyond range\n", count);
+        goto end;
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        int fd = gpio_cdev_chip(gpio_nr[i], &offsets[i]);
+        if (fd == -1) {
+            goto end;
+        }
+        if (i > 0 && fd != chip) {
+            gpio_err("gpio %u and %u are on different gpiochips\n", gpio_nr[0], gpio_nr[i]);
+            goto end;
+        }
+        chip = fd;
+    }
+    /* members live right behind the set */
+    set = (gpio_set *)gpio_alloc(sizeof(gpio_set) + sizeof(gpio) * count);
+    if (set == NULL) {
+        gpio_err("alloc gpio set failed\n");
+        goto end;
+    }
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    for (unsigned int i = 0; i < count; ++i) {
+        req.offsets[i] = offsets[i];
+    }
+    req.num_lines = count;
+    (void)strncpy(req.consumer, GPIO_CDEV_CONSUMER, sizeof(req.consumer) - 1);
+    gpio_account_sys(GPIO_OP_OPEN, sizeof(req));
+    if (sys->ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+        gpio_err("request %u lines failed: %s\n", count, strerror(errno));
+        goto free_set;
+    }
+    gpio *lines = (gpio *)(set + 1);
+    for (unsigned int i = 0; i < count; ++i) {
+        lines[i].gpio_nr = gpio_nr[i];
+        lines[i].req.fd = req.fd;
+        lines[i].req.index = i;
+        lines[i].req.offset = offsets[i];
+        lines[i].req.debounce_us = 0;
+        lines[i].req.set = set;
+        memset(&lines[i].debounce, 0, sizeof(lines[i].debounce));
+        set->lines[i] = &lines[i];
+        if (gpio_cdev_seed(chip, &lines[i]) != 0) {
+            goto release;
+        }
+    }
+    set->count = count;
+    goto end;
+release:
+    sys->close(req.fd);
+free_set:
+    gpio_free(set, sizeof(gpio_set) + sizeof(gpio) * count);
+    set = NULL;
+end:
+    return set;
+}
+
+static void gpio_cdev_set_close(gpio_set *set)
+{
+    gpio_account_call(GPIO_OP_CLOSE);
+    gpio_account_sys(GPIO_OP_CLOSE, 0);
+    if (sys->close(set->lines[0]->req.fd) == -1) {
+        gpio_err("release lines failed: %s\n", strerror(errno));
+    }
+    gpio_free(set, sizeof(gpio_set) + sizeof(gpio) * set->count);
+}
+
+static int gpio_cdev_set_values(gpio_set *set, uint64_t mask, uint64_t bits)
+{
+    int ret = 0;
+    unsigned int i;
+    struct gpio_v2_line_values values = { .bits = bits & mask, .mask = mask };
+    gpio_account_call(GPIO_OP_SET_VALUE);
+    gpio_account_sys(GPIO_OP_SET_VALUE, sizeof(values));
+    if (sys->ioctl(set->lines[0]->req.fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) == -1) {
+        ret = errno;
+        gpio_err("set values failed: %s\n", strerror(ret));
+    }
+    gpio_for_each_bit(i, mask) {
+        if (i >= set->count) {
+            break;
+        }
+        gpio_shadow_store(&set->lines[i]->shadow.value, (bits >> i) & 1 ? GPIO_HIGH : GPIO_LOW, ret);
+    }
+    return ret;
+}
+
+static int gpio_cdev_get_values(gpio_set *set, uint64_t *bits)
+{
+    int ret = 0;
+    uint64_t all = set->count == 64 ? UINT64_MAX : (1ull << set->count) - 1;
+    struct gpio_v2_line_values values = { .bits = 0, .mask = all };
+    gpio_account_call(GPIO_OP_GET_VALUE);
+    gpio_account_sys(GPIO_OP_GET_VALUE, sizeof(values));
+    if (sys->ioctl(set->lines[0]->req.fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == -1) {
+        ret = errno;
+        gpio_err("get values failed: %s\n", strerror(ret));
+        goto end;
+    }
+    *bits = values.bits;
+end:
+    return ret;
+}
+
+static int gpio_cdev_set_directions(gpio_set *set, uint64_t mask, uint64_t out)
+{
+    int ret;
+    unsigned int i;
+    uint64_t old[GPIO_SET_MAX];
+    uint64_t fresh = 0;
+    for (i = 0; i < set->count; ++i) {
+        old[i] = set->lines[i]->req.flags;
+    }
+    gpio_for_each_bit(i, mask) {
+        if (i >= set->count) {
+            break;
+        }
+        struct gpio_line_req *req = &set->lines[i]->req;
+        req->flags &= ~GPIO_CDEV_DIR_FLAGS;
+        if ((out >> i) & 1) {
+            req->flags = (req->flags & ~GPIO_CDEV_EDGE_FLAGS) | GPIO_V2_LINE_FLAG_OUTPUT;
+            fresh |= (old[i] & GPIO_V2_LINE_FLAG_OUTPUT) == 0 ? 1ull << i : 0;
+        } else {
+            req->flags |= GPIO_V2_LINE_FLAG_INPUT;
+        }
+    }
+    gpio_account_call(GPIO_OP_SET_DIRECTION);
+    ret = gpio_cdev_set_config(GPIO_OP_SET_DIRECTION, set->lines, set->count, fresh);
+    if (ret != 0) {
+        for (i = 0; i < set->count; ++i) {
+            set->lines[i]->req.flags = old[i];
+        }
+    }
+    return ret;
+}
+
+static void gpio_cdev_invalidate(gpio *io)
+{
+    io->shadow.value = GPIO_SHADOW_UNKNOWN;
+}
+
+/* the request is exclusive, only the driven value can go stale */
+static int gpio_cdev_resync(gpio *io)
+{
+    int ret = 0;
+    enum gpio_value value;
+    gpio_cdev_invalidate(io);
+    if ((io->req.flags & GPIO_V2_LINE_FLAG_OUTPUT) == 0) {
+        goto end;
+    }
+    ret = gpio_cdev_get_value(io, &value);
+    if (ret != 0) {
+        goto end;
+    }
+    io->shadow.value = value;
+end:
+    return ret;
+}
+
+/* the kernel debounces a settle period itself, majority voting stays in software */
+static int gpio_cdev_set_debounce(gpio *io, const struct gpio_debounce *debounce)
+{
+    int ret;
+    uint32_t old = io->req.debounce_us;
+    uint32_t native = debounce->mode == GPIO_DEBOUNCE_SETTLE ? debounce->period_us : 0;
+    gpio_account_call(GPIO_OP_SET_EDGE);
+    ret = gpio_debounce_store(io, debounce);
+    if (ret != 0) {
+        goto end;
+    }
+    if (native != 0) {
+        io->debounce.mode = GPIO_DEBOUNCE_NONE;
+    }
+    if (native == old && gpio_cache_on) {
+        gpio_cache_count(true);
+        goto end;
+    }
+    gpio_cache_count(false);
+    io->req.debounce_us = native;
+    ret = gpio_cdev_apply(GPIO_OP_SET_EDGE, io, false);
+    if (ret != 0) {
+        io->req.debounce_us = old;
+    }
+end:
+    return ret;
+}
+
+static struct gpio_ops cdev_ops = {
+    .open = gpio_cdev_open,
+    .close = gpio_cdev_close,
+    .set_value = gpio_cdev_set_value,
+    .get_value = gpio_cdev_get_value,
+    .set_direction = gpio_cdev_set_direction,
+    .set_edge = gpio_cdev_set_edge,
+    .handle_irq = gpio_cdev_handle_irq,
+    .wait_event = gpio_cdev_wait_event,
+    .set_open = gpio_cdev_set_open,
+    .set_close = gpio_cdev_set_close,
+    .set_values = gpio_cdev_set_values,
+    .get_values = gpio_cdev_get_values,
+    .set_directions = gpio_cdev_set_directions,
+    .invalidate = gpio_cdev_invalidate,
+    .resync = gpio_cdev_resync,
+    .event_fd = gpio_cdev_event_fd,
+    .read_event = gpio_cdev_read_event,
+    .set_debounce = gpio_cdev_set_debounce,
+};
+
+struct gpio_ops *gpio_cdev_get_ops(void)
+{
+    return &cdev_ops;
+}
@@ -0,0 +1,65 @@
+#ifndef GPIO_CDEV_H
+#define GPIO_CDEV_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "gpio.h"
+#include "gpio_registry.h"
+
+/*
+ * every chip found as GPIO_CDEV_CHIP_PATH, N from 0 up to
+ * GPIO_REGISTRY_CHIPS, numbered end to end in N order: line numbers of
+ * chip 0 are its offsets and the next chip starts where it ends
+ */
+#define GPIO_CDEV_CHIP_PATH "/dev/gpiochip%u"
+
+/* syscalls used by the character device backend, replaceable for testing */
+struct gpio_cdev_sys {
+    int (*open)(const char *path, int flags);
+    int (*close)(int fd);
+    int (*ioctl)(int fd, unsigned long req, void *arg);
+    ssize_t (*read)(int fd, void *buf, size_t len);
+    int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout);
+};
+
+struct gpio_ops *gpio_cdev_get_ops(void);
+/* the chips behind the numbering above, scanned on first use, NULL when there are none */
+const struct gpio_registry *gpio_cdev_registry(void);
+
+/* NULL restores the native syscalls */
+void gpio_cdev_set_sys(const struct gpio_cdev_sys *sys);
+
+/*
+ * in-process model of two gpiochips, 64 and 32 lines, behind struct
+ * gpio_cdev_sys, see gpio_cdev_mock.c. Its offsets are the line numbers the
+ * backend gives them, 64 and up on the second chip
+ */
+struct gpio_cdev_mock_stats {
+    unsigned long open;
+    unsigned long close;
+    unsigned long ioctl;
+    unsigned long read;
+    unsigned long poll;
+};
+
+void gpio_cdev_mock_install(void);
+void gpio_cdev_mock_uninstall(void);
+/* drive an input line, queues an edge event when the line requested one */
+int gpio_cdev_mock_set_input(unsigned int offset, enum gpio_value value);
+int gpio_cdev_mock_get_output(unsigned int offset, enum gpio_value *value);
+void gpio_cdev_mock_stats(struct gpio_cdev_mock_stats *stats);
+void gpio_cdev_mock_reset_stats(void);
+
+/*
+ * a device model wired to the mock's lines, told of every level an output
+ * takes with the mock locked. Only from inside that callback it may read
+ * a line and drive an input, NULL detaches.
+ */
+typedef void (*gpio_cdev_mock_device)(unsigned int offset, bool high, void *data);
+void gpio_cdev_mock_attach(gpio_cdev_mock_device device, void *data);
+bool gpio_cdev_mock_level(unsigned int offset);
+int gpio_cdev_mock_drive(unsigned int offset, bool high);
+
+#endif
@@ -0,0 +1,458 @@
+/*
+ * Models two gpiochips behind struct gpio_cdev_sys so the character device
+ * backend can be exercised and its syscalls counted without hardware.
+ * Request fds are eventfds, so poll() on them works unmodified. Lines are
+ * kept in one array numbered the way the backend numbers them, chip 1
+ * starting where chip 0 ends.
+ */
+#include "gpio_cdev.h"
+
+#include <linux/gpio.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MOCK_CHIPS 2
+#define MOCK_LINES 96
+#define MOCK_REQS 64
+#define MOCK_EVENTS 64
+#define MOCK_DIR_FLAGS (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_OUTPUT)
+
+struct mock_line {
+    bool value;
+    uint64_t flags;
+    int req;
+    uint32_t seqno;
+};
+
+static const unsigned int mock_chip_lines[MOCK_CHIPS] = { 64, 32 };
+
+struct mock_req {
+    int fd;
+    unsigned int num_lines;
+    unsigned int base;          /* first line of the chip the request is on */
+    unsigned int offsets[GPIO_V2_LINES_MAX];    /* the base included */
+    unsigned int head;
+    unsigned int count;
+    struct gpio_v2_line_event events[MOCK_EVENTS];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    int chip_fd[MOCK_CHIPS];
+    uint32_t seqno;
+    struct mock_line lines[MOCK_LINES];
+    struct mock_req reqs[MOCK_REQS];
+    struct gpio_cdev_mock_stats stats;
+    gpio_cdev_mock_device device;
+    void *device_data;
+} mock = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .chip_fd = { -1, -1 },
+};
+
+static struct mock_req *mock_find_req(int fd)
+{
+    for (int i = 0; i < MOCK_REQS; ++i) {
+        if (mock.reqs[i].fd == fd && fd != -1) {
+            return &mock.reqs[i];
+        }
+    }
+    return NULL;
+}
+
+/* an output changed level, the attached device sees it with the lock held */
+static void mock_output(unsigned int offset, bool high)
+{
+    struct mock_line *line = &mock.lines[offset];
+    if (line->value == high) {
+        return;
+    }
+    line->value = high;
+    if (mock.device != NULL) {
+        mock.device(offset, high, mock.device_data);
+    }
+}
+
+static void mock_apply_config(struct mock_req *req, const struct gpio_v2_line_config *config)
+{
+    for (unsigned int i = 0; i < req->num_lines; ++i) {
+        struct mock_line *line = &mock.lines[req->offsets[i]];
+        uint64_t flags = config->flags;
+        bool high = false;
+        for (unsigned int a = 0; a < config->num_attrs; ++a) {
+            const struct gpio_v2_line_config_attribute *attr = &config->attrs[a];
+            if ((attr->mask & (1ull << i)) == 0) {
+                continue;
+            }
+            if (attr->attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS) {
+                flags = attr->attr.flags;
+            } else if (attr->attr.id == GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES) {
+                high = (attr->attr.values & (1ull << i)) != 0;
+            }
+        }
+        /* a line given no direction keeps the one it had, and its level */
+        line->flags = (flags & MOCK_DIR_FLAGS) != 0 ? flags : flags | (line->flags & MOCK_DIR_FLAGS);
+        /* like the kernel, every output of the request is driven, low without a value */
+        if ((flags & GPIO_V2_LINE_FLAG_OUTPUT) != 0) {
+            mock_output(req->offsets[i], high);
+        }
+    }
+}
+
+static int mock_chip(int fd)
+{
+    for (int c = 0; c < MOCK_CHIPS; ++c) {
+        if (mock.chip_fd[c] == fd && fd != -1) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+static unsigned int mock_base(int chip)
+{
+    unsigned int base = 0;
+    for (int c = 0; c < chip; ++c) {
+        base += mock_chip_lines[c];
+    }
+    return base;
+}
+
+static int mock_chip_info(int chip, struct gpiochip_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    (void)snprintf(info->name, sizeof(info->name), "gpiochip%d", chip);
+    (void)snprintf(info->label, sizeof(info->label), "mock%d", chip);
+    info->lines = mock_chip_lines[chip];
+    return 0;
+}
+
+static int mock_line_info(int chip, struct gpio_v2_line_info *info)
+{
+    if (info->offset >= mock_chip_lines[chip]) {
+        errno = EINVAL;
+        return -1;
+    }
+    const struct mock_line *line = &mock.lines[mock_base(chip) + info->offset];
+    unsigned int offset = info->offset;
+    memset(info, 0, sizeof(*info));
+    info->offset = offset;
+    info->flags = line->flags | (line->req != -1 ? GPIO_V2_LINE_FLAG_USED : 0);
+    return 0;
+}
+
+static int mock_request(int chip, struct gpio_v2_line_request *lr)
+{
+    unsigned int base = mock_base(chip);
+    if (lr->num_lines == 0 || lr->num_lines > GPIO_V2_LINES_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (unsigned int i = 0; i < lr->num_lines; ++i) {
+        if (lr->offsets[i] >= mock_chip_lines[chip]) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (mock.lines[base + lr->offsets[i]].req != -1) {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    for (int r = 0; r < MOCK_REQS; ++r) {
+        struct mock_req *req = &mock.reqs[r];
+        if (req->fd != -1) {
+            continue;
+        }
+        req->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (req->fd == -1) {
+            return -1;
+        }
+        req->num_lines = lr->num_lines;
+        req->base = base;
+        req->head = 0;
+        req->count = 0;
+        for (unsigned int i = 0; i < lr->num_lines; ++i) {
+            req->offsets[i] = base + lr->offsets[i];
+            mock.lines[req->offsets[i]].req = r;
+            mock.lines[req->offsets[i]].seqno = 0;
+        }
+        mock_apply_config(req, &lr->config);
+        lr->fd = req->fd;
+        return 0;
+    }
+    errno = EMFILE;
+    return -1;
+}
+
+static int mock_open(const char *path, int flags)
+{
+    (void)flags;
+    int fd = -1;
+    unsigned int chip;
+    pthread_mutex_lock(&mock.lock);
+    ++mock.stats.open;
+    if (sscanf(path, GPIO_CDEV_CHIP_PATH, &chip) != 1 || chip >= MOCK_CHIPS) {
+        errno = ENOENT;
+        goto end;
+    }
+    if (mock.chip_fd[chip] == -1) {
+        mock.chip_fd[chip] = eventfd(0, EFD_CLOEXEC);
+    }
+    fd = mock.chip_fd[chip];
+end:
+    pthread_mutex_unlock(&mock.lock);
+    return fd;
+}
+
+static int mock_close(int fd)
+{
+    int ret = 0;
+    pthread_mutex_lock(&mock.lock);
+    ++mock.stats.close;
+    struct mock_req *req = mock_find_req(fd);
+    if (req != NULL) {
+        for (unsigned int i = 0; i < req->num_lines; ++i) {
+            /* released lines keep their direction and level, edge detection stops */
+            mock.lines[req->offsets[i]].req = -1;
+            mock.lines[req->offsets[i]].flags &= MOCK_DIR_FLAGS;
+        }
+        req->fd = -1;
+        ret = close(fd);
+    } else if (mock_chip(fd) != -1) {
+        mock.chip_fd[mock_chip(fd)] = -1;
+        ret = close(fd);
+    } else {
+        errno = EBADF;
+        ret = -1;
+    }
+    pthread_mutex_unlock(&mock.lock);
+    return ret;
+}
+
+static int mock_ioctl(int fd, unsigned long cmd, void *arg)
+{
+    int ret = 0;
+    pthread_mutex_lock(&mock.lock);
+    ++mock.stats.ioctl;
+    int chip = mock_chip(fd);
+    if (chip != -1 && cmd == GPIO_V2_GET_LINE_IOCTL) {
+        ret = mock_request(chip, (struct gpio_v2_line_request *)arg);
+        goto end;
+    }
+    if (chip != -1 && cmd == GPIO_GET_CHIPINFO_IOCTL) {
+        ret = mock_chip_info(chip, (struct gpiochip_info *)arg);
+        goto end;
+    }
+    if (chip != -1 && cmd == GPIO_V2_GET_LINEINFO_IOCTL) {
+        ret = mock_line_info(chip, (struct gpio_v2_line_info *)arg);
+        goto end;
+    }
+    struct mock_req *req = mock_find_req(fd);
+    if (req == NULL) {
+        errno = EBADF;
+        ret = -1;
+        goto end;
+    }
+    struct gpio_v2_line_values *values = (struct gpio_v2_line_values *)arg;
+    switch (cmd) {
+        case GPIO_V2_LINE_SET_CONFIG_IOCTL:
+            mock_apply_config(req, (struct gpio_v2_line_config *)arg);
+            break;
+        case GPIO_V2_LINE_SET_VALUES_IOCTL:
+            for (unsigned int i = 0; i < req->num_lines; ++i) {
+                struct mock_line *line = &mock.lines[req->offsets[i]];
+                if ((values->mask & (1ull << i)) == 0) {
+                    continue;
+                }
+                if ((line->flags & GPIO_V2_LINE_FLAG_OUTPUT) == 0) {
+                    errno = EPERM;
+                    ret = -1;
+                    goto end;
+                }
+                mock_output(req->offsets[i], (values->bits & (1ull << i)) != 0);
+            }
+            break;
+        case GPIO_V2_LINE_GET_VALUES_IOCTL:
+            values->bits = 0;
+            for (unsigned int i = 0; i < req->num_lines; ++i) {
+                if ((values->mask & (1ull << i)) != 0 && mock.lines[req->offsets[i]].value) {
+                    values->bits |= 1ull << i;
+                }
+            }
+            break;
+        default:
+            errno = ENOTTY;
+            ret = -1;
+            break;
+    }
+end:
+    pthread_mutex_unlock(&mock.lock);
+    return ret;
+}
+
+static ssize_t mock_read(int fd, void *buf, size_t len)
+{
+    ssize_t ret = 0;
+    pthread_mutex_lock(&mock.lock);
+    ++mock.stats.read;
+    struct mock_req *req = mock_find_req(fd);
+    if (req == NULL) {
+        errno = EBADF;
+        ret = -1;
+        goto end;
+    }
+    if (req->count == 0) {
+        errno = EAGAIN;
+        ret = -1;
+        goto end;
+    }
+    struct gpio_v2_line_event *out = (struct gpio_v2_line_event *)buf;
+    size_t n = len / sizeof(*out);
+    while (n > 0 && req->count > 0) {
+        *out++ = req->events[req->head];
+        req->head = (req->head + 1) % MOCK_EVENTS;
+        --req->count;
+        --n;
+        ret += sizeof(*out);
+    }
+    if (req->count == 0) {
+        uint64_t drain;
+        (void)read(req->fd, &drain, sizeof(drain));
+    }
+end:
+    pthread_mutex_unlock(&mock.lock);
+    return ret;
+}
+
+static int mock_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    pthread_mutex_lock(&mock.lock);
+    ++mock.stats.poll;
+    pthread_mutex_unlock(&mock.lock);
+    return poll(fds, nfds, timeout);
+}
+
+static const struct gpio_cdev_sys mock_sys = {
+    .open = mock_open,
+    .close = mock_close,
+    .ioctl = mock_ioctl,
+    .read = mock_read,
+    .poll = mock_poll,
+};
+
+void gpio_cdev_mock_install(void)
+{
+    pthread_mutex_lock(&mock.lock);
+    for (int i = 0; i < MOCK_LINES; ++i) {
+        memset(&mock.lines[i], 0, sizeof(mock.lines[i]));
+        mock.lines[i].flags = GPIO_V2_LINE_FLAG_INPUT;
+        mock.lines[i].req = -1;
+    }
+    for (int i = 0; i < MOCK_REQS; ++i) {
+        mock.reqs[i].fd = -1;
+    }
+    memset(&mock.stats, 0, sizeof(mock.stats));
+    pthread_mutex_unlock(&mock.lock);
+    gpio_cdev_set_sys(&mock_sys);
+}
+
+void gpio_cdev_mock_uninstall(void)
+{
+    gpio_cdev_set_sys(NULL);
+}
+
+/* an input changed level from outside, queues the edge when the line asked for it */
+static int mock_input(unsigned int offset, bool high)
+{
+    int ret = 0;
+    struct timespec ts;
+    struct mock_line *line = &mock.lines[offset];
+    bool changed = line->value != high;
+    line->value = high;
+    uint64_t want = high ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    if (!changed || line->req == -1 || (line->flags & want) == 0) {
+        goto end;
+    }
+    struct mock_req *req = &mock.reqs[line->req];
+    if (req->count == MOCK_EVENTS) {
+        /* the kernel drops the oldest event on overflow */
+        req->head = (req->head + 1) % MOCK_EVENTS;
+        --req->count;
+    }
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    struct gpio_v2_line_event *ev = &req->events[(req->head + req->count) % MOCK_EVENTS];
+    memset(ev, 0, sizeof(*ev));
+    ev->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    ev->id = high ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+    ev->offset = offset - req->base;
+    ev->seqno = ++mock.seqno;
+    ev->line_seqno = ++line->seqno;
+    ++req->count;
+    uint64_t one = 1;
+    if (write(req->fd, &one, sizeof(one)) != sizeof(one)) {
+        ret = errno;
+    }
+end:
+    return ret;
+}
+
+int gpio_cdev_mock_set_input(unsigned int offset, enum gpio_value value)
+{
+    int ret;
+    if (offset >= MOCK_LINES) {
+        return EINVAL;
+    }
+    pthread_mutex_lock(&mock.lock);
+    ret = mock_input(offset, value == GPIO_HIGH);
+    pthread_mutex_unlock(&mock.lock);
+    return ret;
+}
+
+int gpio_cdev_mock_get_output(unsigned int offset, enum gpio_value *value)
+{
+    if (offset >= MOCK_LINES) {
+        return EINVAL;
+    }
+    pthread_mutex_lock(&mock.lock);
+    *value = mock.lines[offset].value ? GPIO_HIGH : GPIO_LOW;
+    pthread_mutex_unlock(&mock.lock);
+    return 0;
+}
+
+void gpio_cdev_mock_stats(struct gpio_cdev_mock_stats *stats)
+{
+    pthread_mutex_lock(&mock.lock);
+    *stats = mock.stats;
+    pthread_mutex_unlock(&mock.lock);
+}
+
+void gpio_cdev_mock_reset_stats(void)
+{
+    pthread_mutex_lock(&mock.lock);
+    memset(&mock.stats, 0, sizeof(mock.stats));
+    pthread_mutex_unlock(&mock.lock);
+}
+
+void gpio_cdev_mock_attach(gpio_cdev_mock_device device, void *data)
+{
+    pthread_mutex_lock(&mock.lock);
+    mock.device = device;
+    mock.device_data = data;
+    pthread_mutex_unlock(&mock.lock);
+}
+
+bool gpio_cdev_mock_level(unsigned int offset)
+{
+    return offset < MOCK_LINES && mock.lines[offset].value;
+}
+
+int gpio_cdev_mock_drive(unsigned int offset, bool high)
+{
+    return offset < MOCK_LINES ? mock_input(offset, high) : EINVAL;
+}
@@ -0,0 +1,172 @@
+/*
+ * Software debounce on the input path. A raw edge only opens a window on
+ * the shared timer wheel: settle mode pushes the deadline out on every
+ * further edge and samples the line once it went quiet, majority mode
+ * samples the line at fixed intervals across the window and votes. Only a
+ * level different from the last settled one comes out as an edge.
+ */
+#include "gpio_debounce.h"
+
+#include <errno.h>
+#include <string.h>
+
+static struct gpio_debounce_stats debounce_stats;
+
+#define debounce_count(field) (void)__atomic_fetch_add(&debounce_stats.field, 1, __ATOMIC_RELAXED)
+
+void gpio_debounce_stats(struct gpio_debounce_stats *stats)
+{
+    stats->raw = __atomic_load_n(&debounce_stats.raw, __ATOMIC_RELAXED);
+    stats->suppressed = __atomic_load_n(&debounce_stats.suppressed, __ATOMIC_RELAXED);
+    stats->delivered = __atomic_load_n(&debounce_stats.delivered, __ATOMIC_RELAXED);
+}
+
+void gpio_debounce_reset_stats(void)
+{
+    __atomic_store_n(&debounce_stats.raw, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&debounce_stats.suppressed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&debounce_stats.delivered, 0, __ATOMIC_RELAXED);
+}
+
+int gpio_debounce_store(gpio *io, const struct gpio_debounce *debounce)
+{
+    int ret = 0;
+    switch (debounce->mode) {
+        case GPIO_DEBOUNCE_NONE:
+            break;
+        case GPIO_DEBOUNCE_SETTLE:
+            if (debounce->period_us == 0) {
+                ret = EINVAL;
+            }
+            break;
+        case GPIO_DEBOUNCE_MAJORITY:
+            /* an odd count never ties */
+            if (debounce->period_us == 0 || debounce->samples % 2 == 0) {
+                ret = EINVAL;
+            }
+            break;
+        default:
+            ret = EINVAL;
+            break;
+    }
+    if (ret != 0) {
+        gpio_err("invalid debounce for gpio %u\n", io->gpio_nr);
+        goto end;
+    }
+    io->debounce = *debounce;
+end:
+    return ret;
+}
+
+int gpio_debounce_direct(const gpio *io)
+{
+    if (io->debounce.mode == GPIO_DEBOUNCE_NONE) {
+        return 0;
+    }
+    gpio_err("gpio %u is filtered in software, wait for its edges in a gpio_loop\n", io->gpio_nr);
+    return ENOTSUP;
+}
+
+void gpio_filter_init(struct gpio_filter *filter, gpio *io, struct gpio_ops *ops, enum gpio_edge edge)
+{
+    enum gpio_value value;
+    memset(filter, 0, sizeof(*filter));
+    filter->io = io;
+    filter->ops = ops;
+    filter->edge = edge;
+    filter->stable = ops->get_value(io, &value) == 0 ? (int)value : GPIO_SHADOW_UNKNOWN;
+}
+
+void gpio_filter_cancel(struct gpio_filter *filter, struct gpio_wheel *wheel)
+{
+    gpio_timer_cancel(wheel, &filter->timer);
+}
+
+static uint64_t gpio_filter_interval(const struct gpio_debounce *debounce)
+{
+    uint64_t period = (uint64_t)debounce->period_us * 1000;
+    return debounce->mode == GPIO_DEBOUNCE_MAJORITY ? period / debounce->samples : period;
+}
+
+bool gpio_filter_edge(struct gpio_filter *filter, struct gpio_wheel *wheel,
+                      const struct gpio_event *raw, struct gpio_event *out)
+{
+    const struct gpio_debounce *debounce = &filter->io->debounce;
+    if (debounce->mode == GPIO_DEBOUNCE_NONE) {
+        *out = *raw;
+        return true;
+    }
+    debounce_count(raw);
+    if (gpio_timer_armed(&filter->timer)) {
+        debounce_count(suppressed);
+        /* a majority window runs to its end whatever happens inside */
+        if (debounce->mode == GPIO_DEBOUNCE_SETTLE) {
+            filter->since_ns = raw->timestamp_ns;
+            gpio_timer_arm(wheel, &filter->timer, raw->timestamp_ns + gpio_filter_interval(debounce));
+        }
+        return false;
+    }
+    filter->since_ns = raw->timestamp_ns;
+    filter->taken = 0;
+    filter->high = 0;
+    gpio_timer_arm(wheel, &filter->timer, raw->timestamp_ns + gpio_filter_interval(debounce));
+    return false;
+}
+
+static bool gpio_filter_pass(const struct gpio_filter *filter, enum gpio_value value)
+{
+    switch (filter->edge) {
+        case GPIO_RISING:
+            return value == GPIO_HIGH;
+        case GPIO_FALLING:
+            return value == GPIO_LOW;
+        case GPIO_BOTH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool gpio_filter_expire(struct gpio_filter *filter, struct gpio_wheel *wheel,
+                        uint64_t now_ns, struct gpio_event *out)
+{
+    enum gpio_value value;
+    const struct gpio_debounce *debounce = &filter->io->debounce;
+    /* the window was opened by one raw edge, it resolves to one delivery or suppression */
+    if (filter->ops->get_value(filter->io, &value) != 0) {
+        gpio_err("sample gpio %u failed\n", filter->io->gpio_nr);
+        goto suppress;
+    }
+    if (debounce->mode == GPIO_DEBOUNCE_MAJORITY) {
+        ++filter->taken;
+        filter->high += value == GPIO_HIGH;
+        if (filter->taken < debounce->samples) {
+            gpio_timer_arm(wheel, &filter->timer, now_ns + gpio_filter_interval(debounce));
+            return false;
+        }
+        enum gpio_value level = filter->high * 2 > debounce->samples ? GPIO_HIGH : GPIO_LOW;
+        /* still moving at the end of the window, vote again */
+        if (value != level) {
+            filter->taken = 0;
+            filter->high = 0;
+            gpio_timer_arm(wheel, &filter->timer, now_ns + gpio_filter_interval(debounce));
+            return false;
+        }
+    }
+    if ((int)value == filter->stable) {
+        goto suppress;
+    }
+    filter->stable = value;
+    if (!gpio_filter_pass(filter, value)) {
+        goto suppress;
+    }
+    debounce_count(delivered);
+    out->gpio_nr = filter->io->gpio_nr;
+    out->value = value;
+    out->timestamp_ns = filter->since_ns;
+    out->seqno = ++filter->seqno;
+    return true;
+suppress:
+    debounce_count(suppressed);
+    return false;
+}
@@ -0,0 +1,56 @@
+#ifndef GPIO_DEBOUNCE_H
+#define GPIO_DEBOUNCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpio.h"
+#include "gpio_wheel.h"
+
+/* raw edges seen by the software filter, and how they were resolved */
+struct gpio_debounce_stats {
+    uint64_t raw;
+    uint64_t suppressed;
+    uint64_t delivered;
+};
+
+void gpio_debounce_stats(struct gpio_debounce_stats *stats);
+void gpio_debounce_reset_stats(void);
+
+/* checks a config and records it as the software filter of io, for backends */
+int gpio_debounce_store(gpio *io, const struct gpio_debounce *debounce);
+/* ENOTSUP while io has a software filter, which only gpio_loop runs, for blocking waits of backends */
+int gpio_debounce_direct(const gpio *io);
+
+/* per line filter state, driven by one thread together with its wheel */
+struct gpio_filter {
+    struct gpio_timer timer;
+    gpio *io;
+    struct gpio_ops *ops;
+    enum gpio_edge edge;    /* transitions passed on, the line itself reports both */
+    int stable;             /* last settled level */
+    unsigned int taken;
+    unsigned int high;
+    uint64_t since_ns;
+    uint32_t seqno;
+};
+
+/*
+ * takes the current level of io as the stable one, a filtered line must
+ * report GPIO_BOTH so the filter sees it fall back as well
+ */
+void gpio_filter_init(struct gpio_filter *filter, gpio *io, struct gpio_ops *ops, enum gpio_edge edge);
+void gpio_filter_cancel(struct gpio_filter *filter, struct gpio_wheel *wheel);
+
+/*
+ * feed one raw edge, true when out holds an edge to deliver right away,
+ * lines without a software filter pass every edge through
+ */
+bool gpio_filter_edge(struct gpio_filter *filter, struct gpio_wheel *wheel,
+                      const struct gpio_event *raw, struct gpio_event *out);
+
+/* the filter's timer expired, true when out holds a stable transition */
+bool gpio_filter_expire(struct gpio_filter *filter, struct gpio_wheel *wheel,
+                        uint64_t now_ns, struct gpio_event *out);
+
+#endif
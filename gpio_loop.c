@@ -0,0 +1,349 @@
+/*
+ * One epoll set watching many lines, each with its own handler.
+ * Ready lines are dispatched in batches of up to GPIO_LOOP_BATCH per wakeup,
+ * an eventfd in the same set lets any thread stop the loop.
+ * Lines in capture mode are only timestamped into a ring here, and with a
+ * worker pool attached handlers run on the pool instead of this thread.
+ * Debounced lines go through their filter first, the filters of all lines
+ * share one timer wheel ticked by a timerfd that only runs while armed.
+ */
+#include "gpio_loop.h"
+#include "gpio_debounce.h"
+#include "gpio_stats.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+struct gpio_loop_line {
+    gpio *io;
+    struct gpio_ops *ops;
+    irq_handler handler;
+    void *data;
+    struct gpio_ring *ring;
+    struct gpio_filter filter;
+};
+
+struct gpio_loop {
+    int epoll_fd;
+    int stop_fd;
+    int tick_fd;
+    bool ticking;
+    unsigned int count;
+    struct gpio_workq *wq;
+    struct gpio_wheel wheel;
+    struct gpio_loop_line lines[GPIO_LOOP_MAX_LINES];
+};
+
+static uint64_t gpio_loop_now(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct gpio_loop *gpio_loop_create(void)
+{
+    struct gpio_loop *loop = (struct gpio_loop *)gpio_alloc(sizeof(struct gpio_loop));
+    if (loop == NULL) {
+        gpio_err("alloc gpio loop failed\n");
+        goto end;
+    }
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd == -1) {
+        gpio_err("create epoll failed: %s\n", strerror(errno));
+        goto free_loop;
+    }
+    loop->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->stop_fd == -1) {
+        gpio_err("create eventfd failed: %s\n", strerror(errno));
+        goto close_epoll;
+    }
+    /* the loop's own fds are told apart from lines by pointing at their member */
+    struct epoll_event ev = { .events = EPOLLIN, .data = { .ptr = &loop->stop_fd } };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &ev) == -1) {
+        gpio_err("watch eventfd failed: %s\n", strerror(errno));
+        goto close_stop;
+    }
+    loop->tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->tick_fd == -1) {
+        gpio_err("create timerfd failed: %s\n", strerror(errno));
+        goto close_stop;
+    }
+    ev.data.ptr = &loop->tick_fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->tick_fd, &ev) == -1) {
+        gpio_err("watch timerfd failed: %s\n", strerror(errno));
+        goto close_tick;
+    }
+    gpio_wheel_init(&loop->wheel, GPIO_LOOP_TICK_US * 1000ull, gpio_loop_now());
+    goto end;
+close_tick:
+    close(loop->tick_fd);
+close_stop:
+    close(loop->stop_fd);
+close_epoll:
+    close(loop->epoll_fd);
+free_loop:
+    gpio_free(loop, sizeof(struct gpio_loop));
+    loop = NULL;
+end:
+    return loop;
+}
+
+void gpio_loop_destroy(struct gpio_loop *loop)
+{
+    close(loop->tick_fd);
+    close(loop->stop_fd);
+    close(loop->epoll_fd);
+    gpio_free(loop, sizeof(struct gpio_loop));
+}
+
+static int gpio_loop_watch(struct gpio_loop *loop, gpio *io, enum gpio_edge edge,
+                           irq_handler handler, void *data, struct gpio_ring *ring)
+{
+    int ret;
+    uint32_t events;
+    struct gpio_ops *ops = get_gpio_ops();
+    struct gpio_loop_line *line = NULL;
+    for (unsigned int i = 0; i < GPIO_LOOP_MAX_LINES; ++i) {
+        if (loop->lines[i].io == NULL) {
+            line = &loop->lines[i];
+            break;
+        }
+    }
+    if (line == NULL) {
+        ret = ENOSPC;
+        gpio_err("gpio loop is full\n");
+        goto end;
+    }
+    int fd = ops->event_fd(io, &events);
+    if (fd == -1) {
+        ret = ENOTSUP;
+        gpio_err("gpio %u has no event fd\n", io->gpio_nr);
+        goto end;
+    }
+    /* the filter has to see the line fall back too, it picks the wanted edges itself */
+    ret = ops->set_edge(io, io->debounce.mode == GPIO_DEBOUNCE_NONE ? edge : GPIO_BOTH);
+    if (ret != 0) {
+        gpio_err("set edge of gpio %u failed\n", io->gpio_nr);
+        goto end;
+    }
+    struct epoll_event ev = { .events = events, .data = { .ptr = line } };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        ret = errno;
+        gpio_err("watch gpio %u failed: %s\n", io->gpio_nr, strerror(ret));
+        goto end;
+    }
+    line->io = io;
+    line->ops = ops;
+    line->handler = handler;
+    line->data = data;
+    line->ring = ring;
+    gpio_filter_init(&line->filter, io, ops, edge);
+    ++loop->count;
+end:
+    return ret;
+}
+
+int gpio_loop_add(struct gpio_loop *loop, gpio *io, enum gpio_edge edge, irq_handler handler, void *data)
+{
+    return gpio_loop_watch(loop, io, edge, handler, data, NULL);
+}
+
+int gpio_loop_capture(struct gpio_loop *loop, gpio *io, enum gpio_edge edge, struct gpio_ring *ring)
+{
+    return gpio_loop_watch(loop, io, edge, NULL, NULL, ring);
+}
+
+void gpio_loop_set_workq(struct gpio_loop *loop, struct gpio_workq *wq)
+{
+    loop->wq = wq;
+}
+
+static int gpio_loop_handle(struct gpio_loop_line *line, const struct gpio_event *event)
+{
+    GPIO_STATS_SINCE(event->timestamp_ns, GPIO_STATS_IRQ, event->gpio_nr);
+    GPIO_STATS_BEGIN(t);
+    int ret = line->handler(event->value, line->data);
+    GPIO_STATS_END(t, GPIO_STATS_DISPATCH, event->gpio_nr);
+    return ret;
+}
+
+/* runs on a pool worker, the slot stays put until gpio_loop_remove has fenced its strand */
+static int gpio_loop_call(const struct gpio_event *event, void *data)
+{
+    return gpio_loop_handle((struct gpio_loop_line *)data, event);
+}
+
+int gpio_loop_remove(struct gpio_loop *loop, gpio *io)
+{
+    int ret = ENOENT;
+    uint32_t events;
+    for (unsigned int i = 0; i < GPIO_LOOP_MAX_LINES; ++i) {
+        struct gpio_loop_line *line = &loop->lines[i];
+        if (line->io != io) {
+            continue;
+        }
+        ret = 0;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, line->ops->event_fd(io, &events), NULL) == -1) {
+            ret = errno;
+            gpio_err("unwatch gpio %u failed: %s\n", io->gpio_nr, strerror(ret));
+        }
+        gpio_filter_cancel(&line->filter, &loop->wheel);
+        /* queued handlers point at the slot, they have to run before it is reused */
+        if (loop->wq != NULL) {
+            gpio_workq_fence(loop->wq, io->gpio_nr);
+        }
+        memset(line, 0, sizeof(*line));
+        --loop->count;
+        break;
+    }
+    return ret;
+}
+
+static int gpio_loop_dispatch(struct gpio_loop *loop, struct gpio_loop_line *line, const struct gpio_event *event)
+{
+    int ret = 0;
+    if (line->ring != NULL) {
+        /* a full ring counts the edge as overflow, the loop keeps going */
+        (void)gpio_ring_push(line->ring, event);
+        goto end;
+    }
+    if (loop->wq != NULL) {
+        if (gpio_workq_submit(loop->wq, event, gpio_loop_call, line) != 0) {
+            gpio_err("queue event of gpio %u failed\n", event->gpio_nr);
+        }
+        goto end;
+    }
+    ret = gpio_loop_handle(line, event);
+    if (ret != 0) {
+        gpio_err("handle irq of gpio %u failed\n", event->gpio_nr);
+    }
+end:
+    return ret;
+}
+
+/* resolve every expired debounce window, the first handler failure is returned */
+static int gpio_loop_expire(struct gpio_loop *loop)
+{
+    int ret = 0;
+    uint64_t ticks;
+    struct gpio_event event;
+    (void)read(loop->tick_fd, &ticks, sizeof(ticks));
+    uint64_t now = gpio_loop_now();
+    struct gpio_timer *timer = gpio_wheel_expire(&loop->wheel, now);
+    while (timer != NULL) {
+        struct gpio_timer *next = timer->next;
+        struct gpio_loop_line *line = (struct gpio_loop_line *)((char *)timer -
+            offsetof(struct gpio_loop_line, filter.timer));
+        if (gpio_filter_expire(&line->filter, &loop->wheel, now, &event)) {
+            int err = gpio_loop_dispatch(loop, line, &event);
+            ret = ret != 0 ? ret : err;
+        }
+        timer = next;
+    }
+    return ret;
+}
+
+/* tick only while some filter waits */
+static void gpio_loop_tick(struct gpio_loop *loop)
+{
+    bool want = loop->wheel.armed != 0;
+    if (want == loop->ticking) {
+        return;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (want) {
+        its.it_value.tv_nsec = GPIO_LOOP_TICK_US * 1000;
+        its.it_interval.tv_nsec = GPIO_LOOP_TICK_US * 1000;
+    }
+    if (timerfd_settime(loop->tick_fd, 0, &its, NULL) == -1) {
+        gpio_err("arm timerfd failed: %s\n", strerror(errno));
+        return;
+    }
+    loop->ticking = want;
+}
+
+int gpio_loop_wait(struct gpio_loop *loop, int timeout_ms)
+{
+    int ret = 0;
+    bool stopped = false;
+    struct epoll_event ready[GPIO_LOOP_BATCH];
+    struct gpio_event event;
+    int n = epoll_wait(loop->epoll_fd, ready, GPIO_LOOP_BATCH, timeout_ms);
+    if (n < 0) {
+        ret = errno == EINTR ? 0 : errno;
+        if (ret != 0) {
+            gpio_err("epoll wait failed: %s\n", strerror(ret));
+        }
+        goto end;
+    }
+    if (n == 0) {
+        ret = ETIMEDOUT;
+        goto end;
+    }
+    for (int i = 0; i < n; ++i) {
+        if (ready[i].data.ptr == &loop->stop_fd) {
+            uint64_t drain;
+            (void)read(loop->stop_fd, &drain, sizeof(drain));
+            stopped = true;
+            continue;
+        }
+        if (ready[i].data.ptr == &loop->tick_fd) {
+            ret = gpio_loop_expire(loop);
+            if (ret != 0) {
+                goto end;
+            }
+            continue;
+        }
+        struct gpio_loop_line *line = (struct gpio_loop_line *)ready[i].data.ptr;
+        /* a handler earlier in the batch may have removed it */
+        if (line->io == NULL) {
+            continue;
+        }
+        ret = line->ops->read_event(line->io, &event);
+        if (ret != 0) {
+            gpio_err("read event of gpio %u failed\n", line->io->gpio_nr);
+            goto end;
+        }
+        if (!gpio_filter_edge(&line->filter, &loop->wheel, &event, &event)) {
+            continue;
+        }
+        ret = gpio_loop_dispatch(loop, line, &event);
+        if (ret != 0) {
+            goto end;
+        }
+    }
+    ret = stopped ? ECANCELED : 0;
+end:
+    gpio_loop_tick(loop);
+    return ret;
+}
+
+int gpio_loop_run(struct gpio_loop *loop)
+{
+    int ret;
+    do {
+        ret = gpio_loop_wait(loop, -1);
+    } while (ret == 0);
+    return ret == ECANCELED ? 0 : ret;
+}
+
+int gpio_loop_stop(struct gpio_loop *loop)
+{
+    uint64_t one = 1;
+    if (write(loop->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        gpio_err("signal stop failed: %s\n", strerror(errno));
+        return errno;
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef GPIO_LOOP_H
+#define GPIO_LOOP_H
+
+#include "gpio.h"
+#include "gpio_ring.h"
+#include "gpio_workq.h"
+
+/* most lines one loop watches, and most edges dispatched per wakeup */
+#define GPIO_LOOP_MAX_LINES 64
+#define GPIO_LOOP_BATCH 32
+/* resolution of the debounce timers */
+#define GPIO_LOOP_TICK_US 500
+
+struct gpio_loop;
+
+struct gpio_loop *gpio_loop_create(void);
+void gpio_loop_destroy(struct gpio_loop *loop);
+
+/*
+ * lines must stay open while registered, edge is applied through the line's ops,
+ * set_debounce before adding a line for only stable transitions to be dispatched.
+ * With a workq remove waits for the line's queued handlers, so once it returns
+ * none of them runs again; call it from the loop thread, never from a handler
+ */
+int gpio_loop_add(struct gpio_loop *loop, gpio *io, enum gpio_edge edge, irq_handler handler, void *data);
+int gpio_loop_remove(struct gpio_loop *loop, gpio *io);
+
+/*
+ * capture mode: the loop only records the line's edges into ring, handling
+ * happens on whichever thread drains it, the loop thread is the ring's producer
+ */
+int gpio_loop_capture(struct gpio_loop *loop, gpio *io, enum gpio_edge edge, struct gpio_ring *ring);
+
+/*
+ * hand handlers to a worker pool instead of running them on the loop thread,
+ * NULL goes back to inline dispatch, handler failures are then only counted by the pool.
+ * Detach only once the pool ran what it was handed, or lines removed after that race it
+ */
+void gpio_loop_set_workq(struct gpio_loop *loop, struct gpio_workq *wq);
+
+/*
+ * wait once and dispatch every ready line, timeout_ms < 0 waits forever,
+ * returns ETIMEDOUT on timeout, ECANCELED after gpio_loop_stop, or what a handler failed with
+ */
+int gpio_loop_wait(struct gpio_loop *loop, int timeout_ms);
+
+/* dispatch until gpio_loop_stop or a handler fails */
+int gpio_loop_run(struct gpio_loop *loop);
+
+/* safe from any thread and from handlers */
+int gpio_loop_stop(struct gpio_loop *loop);
+
+#endif
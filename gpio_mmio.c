@@ -0,0 +1,382 @@
+/*
+ * Drives lines through the memory mapped GPIO register block, set/clear/level
+ * are plain loads and stores with no syscall on the hot path.
+ * Register offsets come from struct gpio_mmio_layout so a plain file can
+ * stand in for /dev/gpiomem.
+ */
+#include "gpio_mmio.h"
+#include "gpio_priv.h"
+#include "gpio_debounce.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#define FSEL_BITS 3
+#define FSEL_PER_REG 10
+#define FSEL_MASK 0x7u
+#define FSEL_INPUT 0x0u
+#define FSEL_OUTPUT 0x1u
+#define MAX_WORDS 8
+
+static struct gpio_mmio_layout layout = GPIO_MMIO_BCM2711;
+static void *base = NULL;
+static unsigned int users = 0;
+/* mapping the window, and function select words shared by ten lines each */
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t fsel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile uint32_t *gpio_mmio_reg(uint32_t offset, unsigned int word)
+{
+    return (volatile uint32_t *)((char *)base + offset) + word;
+}
+
+static int gpio_mmio_map(void)
+{
+    int ret = 0;
+    pthread_mutex_lock(&map_lock);
+    if (base != NULL) {
+        goto end;
+    }
+    int fd = open(layout.path, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd == -1) {
+        ret = errno;
+        gpio_err("open %s failed: %s\n", layout.path, strerror(ret));
+        goto end;
+    }
+    void *map = mmap(NULL, layout.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, layout.offset);
+    if (map == MAP_FAILED) {
+        ret = errno;
+        gpio_err("mmap %s failed: %s\n", layout.path, strerror(ret));
+        goto close_fd;
+    }
+    base = map;
+close_fd:
+    close(fd);
+end:
+    pthread_mutex_unlock(&map_lock);
+    return ret;
+}
+
+int gpio_mmio_configure(const struct gpio_mmio_layout *l)
+{
+    int ret = 0;
+    pthread_mutex_lock(&map_lock);
+    if (__atomic_load_n(&users, __ATOMIC_RELAXED) != 0) {
+        gpio_err("gpio mmio in use\n");
+        ret = EBUSY;
+        goto unlock;
+    }
+    if (base != NULL) {
+        (void)munmap(base, layout.length);
+        base = NULL;
+    }
+    layout = *l;
+unlock:
+    pthread_mutex_unlock(&map_lock);
+    return ret;
+}
+
+static gpio *gpio_mmio_open(unsigned int gpio_nr)
+{
+    gpio *io = NULL;
+    if (gpio_nr >= layout.lines || gpio_nr >= MAX_WORDS * 32) {
+        gpio_err("gpio number is beyond range\n");
+        goto end;
+    }
+    if (gpio_mmio_map() != 0) {
+        goto end;
+    }
+    io = (gpio *)gpio_alloc(sizeof(gpio));
+    if (io == NULL) {
+        gpio_err("alloc gpio failed\n");
+        goto end;
+    }
+    io->gpio_nr = gpio_nr;
+    io->reg.fsel = gpio_mmio_reg(layout.fsel, gpio_nr / FSEL_PER_REG);
+    io->reg.fsel_shift = (gpio_nr % FSEL_PER_REG) * FSEL_BITS;
+    io->reg.set = gpio_mmio_reg(layout.set, gpio_nr / 32);
+    io->reg.clr = gpio_mmio_reg(layout.clr, gpio_nr / 32);
+    io->reg.lev = gpio_mmio_reg(layout.lev, gpio_nr / 32);
+    io->reg.bit = 1u << (gpio_nr % 32);
+    io->reg.edge = GPIO_NONE;
+    gpio_shadow_invalidate(&io->shadow);
+    (void)__atomic_fetch_add(&users, 1, __ATOMIC_RELAXED);
+end:
+    return io;
+}
+
+static void gpio_mmio_close(gpio *io)
+{
+    (void)__atomic_fetch_sub(&users, 1, __ATOMIC_RELAXED);
+    gpio_free(io, sizeof(gpio));
+}
+
+static int gpio_mmio_set_direction(gpio *io, enum gpio_direction dir)
+{
+    uint32_t fsel;
+    switch (dir) {
+        case GPIO_IN:
+            fsel = FSEL_INPUT;
+            break;
+        case GPIO_OUT:
+            fsel = FSEL_OUTPUT;
+            break;
+        default:
+            gpio_err("unknown direction\n");
+            return -1;
+    }
+    /* read-modify-write of a word other lines live in too, device memory takes no atomics */
+    pthread_mutex_lock(&fsel_lock);
+    uint32_t word = *io->reg.fsel;
+    word &= ~(FSEL_MASK << io->reg.fsel_shift);
+    *io->reg.fsel = word | (fsel << io->reg.fsel_shift);
+    pthread_mutex_unlock(&fsel_lock);
+    return 0;
+}
+
+static int gpio_mmio_set_value(gpio *io, enum gpio_value value)
+{
+    switch (value) {
+        case GPIO_HIGH:
+            *io->reg.set = io->reg.bit;
+            if (layout.emulate_level) {
+                (void)__atomic_fetch_or(io->reg.lev, io->reg.bit, __ATOMIC_RELAXED);
+            }
+            break;
+        case GPIO_LOW:
+            *io->reg.clr = io->reg.bit;
+            if (layout.emulate_level) {
+                (void)__atomic_fetch_and(io->reg.lev, ~io->reg.bit, __ATOMIC_RELAXED);
+            }
+            break;
+        default:
+            gpio_err("unsupport value\n");
+            return -1;
+    }
+    return 0;
+}
+
+static int gpio_mmio_get_value(gpio *io, enum gpio_value *value)
+{
+    *value = (*io->reg.lev & io->reg.bit) != 0 ? GPIO_HIGH : GPIO_LOW;
+    return 0;
+}
+
+static int gpio_mmio_set_edge(gpio *io, enum gpio_edge edge)
+{
+    if (edge < GPIO_RISING || edge > GPIO_NONE) {
+        gpio_err("unsupport edge\n");
+        return -1;
+    }
+    io->reg.edge = edge;
+    return 0;
+}
+
+static uint64_t gpio_mmio_now(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool gpio_mmio_edge_match(int edge, enum gpio_value value)
+{
+    switch (edge) {
+        case GPIO_RISING:
+            return value == GPIO_HIGH;
+        case GPIO_FALLING:
+            return value == GPIO_LOW;
+        case GPIO_BOTH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* the register block raises no interrupt to userspace, so sample the level */
+static int gpio_mmio_wait_event(gpio *io, struct gpio_event *event, int timeout_ms)
+{
+    enum gpio_value last;
+    enum gpio_value value;
+    uint64_t deadline = timeout_ms < 0 ? UINT64_MAX : gpio_mmio_now() + (uint64_t)timeout_ms * 1000000ull;
+    (void)gpio_mmio_get_value(io, &last);
+    while (true) {
+        (void)gpio_mmio_get_value(io, &value);
+        if (value != last) {
+            last = value;
+            if (gpio_mmio_edge_match(io->reg.edge, value)) {
+                break;
+            }
+        }
+        if (gpio_mmio_now() >= deadline) {
+            return ETIMEDOUT;
+        }
+        (void)usleep(GPIO_MMIO_POLL_USEC);
+    }
+    event->gpio_nr = io->gpio_nr;
+    event->value = value;
+    event->timestamp_ns = gpio_mmio_now();
+    event->seqno = 0;
+    return 0;
+}
+
+static int gpio_mmio_handle_irq(gpio *io, irq_handler handler, void *data)
+{
+    int ret;
+    struct gpio_event event;
+    while (true) {
+        ret = gpio_mmio_wait_event(io, &event, -1);
+        if (ret != 0) {
+            gpio_err("wait event failed\n");
+            goto end;
+        }
+        ret = handler(event.value, data);
+        if (ret != 0) {
+            gpio_err("handle irq failed\n");
+            goto end;
+        }
+    }
+end:
+    return ret;
+}
+
+static struct gpio_ops mmio_ops;
+
+static gpio_set *gpio_mmio_set_open(const unsigned int *gpio_nr, unsigned int count)
+{
+    return gpio_set_open_lines(&mmio_ops, gpio_nr, count);
+}
+
+static void gpio_mmio_set_close(gpio_set *set)
+{
+    gpio_set_close_lines(&mmio_ops, set);
+}
+
+/* fold the mask into one store per register word, so the lines switch together */
+static int gpio_mmio_set_values(gpio_set *set, uint64_t mask, uint64_t bits)
+{
+    uint32_t high[MAX_WORDS] = { 0 };
+    uint32_t low[MAX_WORDS] = { 0 };
+    unsigned int words = 0;
+    unsigned int i;
+    gpio_for_each_bit(i, mask) {
+        if (i >= set->count) {
+            break;
+        }
+        gpio *io = set->lines[i];
+        unsigned int w = io->gpio_nr / 32;
+        if ((bits >> i) & 1) {
+            high[w] |= io->reg.bit;
+        } else {
+            low[w] |= io->reg.bit;
+        }
+        words = w >= words ? w + 1 : words;
+    }
+    for (unsigned int w = 0; w < words; ++w) {
+        if (high[w] != 0) {
+            *gpio_mmio_reg(layout.set, w) = high[w];
+        }
+        if (low[w] != 0) {
+            *gpio_mmio_reg(layout.clr, w) = low[w];
+        }
+        if (layout.emulate_level && (high[w] | low[w]) != 0) {
+            volatile uint32_t *lev = gpio_mmio_reg(layout.lev, w);
+            (void)__atomic_fetch_and(lev, ~low[w], __ATOMIC_RELAXED);
+            (void)__atomic_fetch_or(lev, high[w], __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+/* one load per register word samples every line at the same instant */
+static int gpio_mmio_get_values(gpio_set *set, uint64_t *bits)
+{
+    uint32_t lev[MAX_WORDS];
+    unsigned int words = (layout.lines + 31) / 32;
+    uint64_t out = 0;
+    for (unsigned int w = 0; w < words && w < MAX_WORDS; ++w) {
+        lev[w] = *gpio_mmio_reg(layout.lev, w);
+    }
+    for (unsigned int i = 0; i < set->count; ++i) {
+        gpio *io = set->lines[i];
+        out |= (lev[io->gpio_nr / 32] & io->reg.bit) != 0 ? 1ull << i : 0;
+    }
+    *bits = out;
+    return 0;
+}
+
+static int gpio_mmio_set_directions(gpio_set *set, uint64_t mask, uint64_t out)
+{
+    return gpio_set_directions_lines(&mmio_ops, set, mask, out);
+}
+
+/* every access goes straight to the registers, there is nothing to go stale */
+static void gpio_mmio_invalidate(gpio *io)
+{
+    (void)io;
+}
+
+static int gpio_mmio_resync(gpio *io)
+{
+    (void)io;
+    return 0;
+}
+
+/* no fd to wait on, edges only come from wait_event sampling */
+static int gpio_mmio_event_fd(gpio *io, uint32_t *events)
+{
+    (void)io;
+    *events = 0;
+    return -1;
+}
+
+/* nothing is queued between two samples, so there is no pending edge to hand out */
+static int gpio_mmio_read_event(gpio *io, struct gpio_event *event)
+{
+    (void)event;
+    gpio_err("gpio %u has no event queue on mmio, use wait_event\n", io->gpio_nr);
+    return ENOTSUP;
+}
+
+/* without an event fd no gpio_loop can run the software filter */
+static int gpio_mmio_set_debounce(gpio *io, const struct gpio_debounce *debounce)
+{
+    if (debounce->mode != GPIO_DEBOUNCE_NONE) {
+        gpio_err("gpio %u cannot be debounced on mmio\n", io->gpio_nr);
+        return ENOTSUP;
+    }
+    return gpio_debounce_store(io, debounce);
+}
+
+static struct gpio_ops mmio_ops = {
+    .open = gpio_mmio_open,
+    .close = gpio_mmio_close,
+    .set_value = gpio_mmio_set_value,
+    .get_value = gpio_mmio_get_value,
+    .set_direction = gpio_mmio_set_direction,
+    .set_edge = gpio_mmio_set_edge,
+    .handle_irq = gpio_mmio_handle_irq,
+    .wait_event = gpio_mmio_wait_event,
+    .set_open = gpio_mmio_set_open,
+    .set_close = gpio_mmio_set_close,
+    .set_values = gpio_mmio_set_values,
+    .get_values = gpio_mmio_get_values,
+    .set_directions = gpio_mmio_set_directions,
+    .invalidate = gpio_mmio_invalidate,
+    .resync = gpio_mmio_resync,
+    .event_fd = gpio_mmio_event_fd,
+    .read_event = gpio_mmio_read_event,
+    .set_debounce = gpio_mmio_set_debounce,
+};
+
+struct gpio_ops *gpio_mmio_get_ops(void)
+{
+    return &mmio_ops;
+}
@@ -0,0 +1,45 @@
+#ifndef GPIO_MMIO_H
+#define GPIO_MMIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "gpio.h"
+
+/* byte offsets inside the mapped window */
+struct gpio_mmio_layout {
+    const char *path;
+    off_t offset;
+    size_t length;
+    uint32_t fsel;      /* function select, 3 bits per line, 10 lines per word */
+    uint32_t set;       /* write 1 to drive high */
+    uint32_t clr;       /* write 1 to drive low */
+    uint32_t lev;       /* pin level */
+    unsigned int lines;
+    bool emulate_level; /* mirror set/clr into lev, for a file standing in for hardware */
+};
+
+/* BCM2711 (raspberry pi 4) through /dev/gpiomem */
+#define GPIO_MMIO_BCM2711 { \
+    .path = "/dev/gpiomem", \
+    .offset = 0, \
+    .length = 0xf4, \
+    .fsel = 0x00, \
+    .set = 0x1c, \
+    .clr = 0x28, \
+    .lev = 0x34, \
+    .lines = 58, \
+    .emulate_level = false, \
+}
+
+/* how often wait_event samples the level register, there is no irq on this path */
+#define GPIO_MMIO_POLL_USEC 100
+
+/* remaps the register window, fails with EBUSY while handles are open */
+int gpio_mmio_configure(const struct gpio_mmio_layout *layout);
+
+struct gpio_ops *gpio_mmio_get_ops(void);
+
+#endif
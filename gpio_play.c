@@ -0,0 +1,225 @@
+/*
+ * Waveform playback. Everything that can be worked out before the first
+ * edge is: a capture is decoded once into events that are exactly the
+ * arguments of the set_values calls playing them, with capture lines
+ * already moved to their place in the set and ticks turned into ns, so a
+ * run only waits on absolute deadlines from gpio_timing and issues one
+ * bulk write per event. That write is a single store on mmio and a single
+ * ioctl on cdev, and an event touching one line goes through set_value,
+ * which is all sysfs can do anyway.
+ */
+#include "gpio_play.h"
+#include "gpio_timing.h"
+#include "gpio_arena.h"
+
+#include <string.h>
+#include <errno.h>
+
+struct gpio_play {
+    struct gpio_ops *ops;
+    gpio_set *set;
+    unsigned int capacity;
+    unsigned int count;
+    uint64_t length_ns;
+    struct gpio_play_event *events;
+};
+
+struct gpio_play *gpio_play_create(struct gpio_ops *ops, gpio_set *set, unsigned int capacity)
+{
+    struct gpio_play *play = (struct gpio_play *)gpio_alloc(sizeof(struct gpio_play));
+    if (play == NULL) {
+        gpio_err("alloc player failed\n");
+        goto end;
+    }
+    play->capacity = capacity;
+    play->events = (struct gpio_play_event *)gpio_alloc(sizeof(struct gpio_play_event) * capacity);
+    if (play->events == NULL) {
+        gpio_err("alloc %u play events failed\n", capacity);
+        goto free_play;
+    }
+    play->ops = ops;
+    play->set = set;
+    goto end;
+free_play:
+    gpio_play_destroy(play);
+    play = NULL;
+end:
+    return play;
+}
+
+void gpio_play_destroy(struct gpio_play *play)
+{
+    gpio_free(play->events, sizeof(struct gpio_play_event) * play->capacity);
+    gpio_free(play, sizeof(struct gpio_play));
+}
+
+int gpio_play_add(struct gpio_play *play, uint64_t at_ns, uint64_t mask, uint64_t bits)
+{
+    struct gpio_play_event *last = play->count == 0 ? NULL : &play->events[play->count - 1];
+    uint64_t lines = play->set->count == GPIO_SET_MAX ? ~0ull : (1ull << play->set->count) - 1;
+    if (mask == 0) {
+        gpio_err("play event drives no line\n");
+        return EINVAL;
+    }
+    if ((mask & ~lines) != 0) {
+        gpio_err("play event drives lines outside the set\n");
+        return EINVAL;
+    }
+    if (last != NULL && at_ns < last->at_ns) {
+        gpio_err("play event at %llu ns goes back in time\n", (unsigned long long)at_ns);
+        return EINVAL;
+    }
+    if (last != NULL && at_ns == last->at_ns) {
+        last->bits = (last->bits & ~mask) | (bits & mask);
+        last->mask |= mask;
+        return 0;
+    }
+    if (play->count == play->capacity) {
+        gpio_err("player is full\n");
+        return ENOSPC;
+    }
+    struct gpio_play_event *event = &play->events[play->count++];
+    event->at_ns = at_ns;
+    event->mask = mask;
+    event->bits = bits & mask;
+    return 0;
+}
+
+void gpio_play_set_length(struct gpio_play *play, uint64_t length_ns)
+{
+    play->length_ns = length_ns;
+}
+
+/* capture lines to set lines, -1 for the ones the set does not have */
+static int gpio_play_map(gpio_set *set, const struct gpio_capture_file *file, int *map)
+{
+    int found = 0;
+    for (unsigned int i = 0; i < file->header->lines; ++i) {
+        map[i] = -1;
+        for (unsigned int j = 0; j < set->count; ++j) {
+            if (set->lines[j]->gpio_nr == file->header->gpio_nr[i]) {
+                map[i] = (int)j;
+                ++found;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+static uint64_t gpio_play_remap(const int *map, unsigned int lines, uint64_t bits)
+{
+    uint64_t out = 0;
+    while (bits != 0) {
+        unsigned int i = (unsigned int)__builtin_ctzll(bits);
+        if (i < lines && map[i] >= 0) {
+            out |= 1ull << map[i];
+        }
+        bits &= bits - 1;
+    }
+    return out;
+}
+
+struct gpio_play *gpio_play_from_capture(struct gpio_ops *ops, gpio_set *set, const struct gpio_capture_file *file)
+{
+    int map[GPIO_SET_MAX];
+    struct gpio_capture_cursor cur;
+    unsigned int lines = file->header->lines;
+    uint64_t tick_ns = file->header->period_ns == 0 ? 1 : file->header->period_ns;
+    uint64_t records = 1;
+    if (file->blocks == 0 || gpio_play_map(set, file, map) == 0) {
+        gpio_err("capture has nothing to play on this set\n");
+        return NULL;
+    }
+    for (uint64_t b = 0; b < file->blocks; ++b) {
+        records += gpio_capture_block_at(file, b)->records;
+    }
+    if (records > UINT32_MAX) {
+        gpio_err("capture of %llu transitions is too long to play\n", (unsigned long long)records);
+        return NULL;
+    }
+    struct gpio_play *play = gpio_play_create(ops, set, (unsigned int)records);
+    if (play == NULL) {
+        return NULL;
+    }
+    const struct gpio_capture_block *block = gpio_capture_block_at(file, 0);
+    uint64_t first = block->first_tick;
+    uint64_t all = gpio_play_remap(map, lines, ~0ull);
+    int ret = gpio_play_add(play, 0, all, gpio_play_remap(map, lines, block->state));
+    for (uint64_t b = 0; b < file->blocks && ret == 0; ++b) {
+        block = gpio_capture_block_at(file, b);
+        gpio_capture_cursor_init(&cur, file, block);
+        while (ret == 0 && gpio_capture_next(&cur)) {
+            uint64_t mask = gpio_play_remap(map, lines, cur.flipped);
+            if (mask != 0) {
+                ret = gpio_play_add(play, (cur.tick - first) * tick_ns, mask, gpio_play_remap(map, lines, cur.state));
+            }
+        }
+    }
+    if (ret != 0) {
+        gpio_play_destroy(play);
+        return NULL;
+    }
+    play->length_ns = (block->last_tick + 1 - first) * tick_ns;
+    return play;
+}
+
+const struct gpio_play_event *gpio_play_events(const struct gpio_play *play, unsigned int *count)
+{
+    *count = play->count;
+    return play->events;
+}
+
+static int gpio_play_write(struct gpio_play *play, const struct gpio_play_event *event)
+{
+    if ((event->mask & (event->mask - 1)) == 0) {
+        unsigned int line = (unsigned int)__builtin_ctzll(event->mask);
+        return play->ops->set_value(play->set->lines[line], event->bits != 0 ? GPIO_HIGH : GPIO_LOW);
+    }
+    return play->ops->set_values(play->set, event->mask, event->bits);
+}
+
+int gpio_play_run(struct gpio_play *play, unsigned int loops, uint32_t *late_ns, struct gpio_play_stats *stats)
+{
+    int ret = 0;
+    struct gpio_play_stats run;
+    memset(&run, 0, sizeof(run));
+    if (late_ns != NULL) {
+        memset(late_ns, 0, sizeof(*late_ns) * play->count);
+    }
+    uint64_t length = play->length_ns;
+    if (play->count != 0 && play->events[play->count - 1].at_ns > length) {
+        length = play->events[play->count - 1].at_ns;
+    }
+    gpio_timing_calibrate();
+    uint64_t start = gpio_timing_now();
+    uint64_t now = start;
+    for (unsigned int loop = 0; loop < loops && ret == 0; ++loop) {
+        uint64_t base = start + length * loop;
+        for (unsigned int i = 0; i < play->count; ++i) {
+            const struct gpio_play_event *event = &play->events[i];
+            uint64_t deadline = base + event->at_ns;
+            gpio_timing_wait_until(deadline);
+            ret = gpio_play_write(play, event);
+            now = gpio_timing_now();
+            if (ret != 0) {
+                gpio_err("play event %u failed\n", i);
+                break;
+            }
+            uint64_t late = now - deadline;
+            run.late_sum_ns += late;
+            run.late_max_ns = late > run.late_max_ns ? late : run.late_max_ns;
+            if (late_ns != NULL) {
+                uint32_t l = late > UINT32_MAX ? UINT32_MAX : (uint32_t)late;
+                late_ns[i] = l > late_ns[i] ? l : late_ns[i];
+            }
+            ++run.events;
+        }
+        run.loops += ret == 0 ? 1 : 0;
+    }
+    run.elapsed_ns = now - start;
+    if (stats != NULL) {
+        *stats = run;
+    }
+    return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef GPIO_PLAY_H
+#define GPIO_PLAY_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+#include "gpio_capture.h"
+
+/* one bulk write of the set, mask and bits index its lines */
+struct gpio_play_event {
+    uint64_t at_ns;             /* from the start of a loop */
+    uint64_t mask;
+    uint64_t bits;
+};
+
+/* measured from the instants the writes returned */
+struct gpio_play_stats {
+    uint64_t events;            /* driven, over every loop */
+    uint64_t loops;
+    uint64_t late_sum_ns;
+    uint64_t late_max_ns;
+    uint64_t elapsed_ns;        /* first deadline to the last write */
+};
+
+/*
+ * a waveform decoded ahead into the set_values calls that play it, the
+ * set and the ops that opened it must outlive the player and its lines
+ * be outputs before a run
+ */
+struct gpio_play;
+
+struct gpio_play *gpio_play_create(struct gpio_ops *ops, gpio_set *set, unsigned int capacity);
+void gpio_play_destroy(struct gpio_play *play);
+
+/*
+ * at_ns may not go back, an event on the time of the one before is
+ * folded into it. ENOSPC past capacity, EINVAL for an empty mask or lines
+ * outside the set.
+ */
+int gpio_play_add(struct gpio_play *play, uint64_t at_ns, uint64_t mask, uint64_t bits);
+/* a loop lasts until its last event unless set longer */
+void gpio_play_set_length(struct gpio_play *play, uint64_t length_ns);
+
+/*
+ * a player holding every transition of the capture, lines are matched to
+ * the set by gpio number and the ones it lacks are left out. The first
+ * event drives the levels the capture started from, and a loop lasts as
+ * long as the capture did.
+ */
+struct gpio_play *gpio_play_from_capture(struct gpio_ops *ops, gpio_set *set, const struct gpio_capture_file *file);
+
+const struct gpio_play_event *gpio_play_events(const struct gpio_play *play, unsigned int *count);
+
+/*
+ * plays the events loops times back to back on absolute deadlines, an
+ * event that comes late goes out at once and the ones after keep their
+ * time. late_ns, when given, receives the worst lateness of each event
+ * over all loops.
+ */
+int gpio_play_run(struct gpio_play *play, unsigned int loops, uint32_t *late_ns, struct gpio_play_stats *stats);
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * Lines a backend keeps set up between close and the next open of the
+ * same line, so a caller cycling a pin pays for export and open once.
+ * An entry holds what the backend shares between opens of a line, every
+ * open still gets a handle of its own from the backend.
+ * Entries are indexed by line number. Idle ones sit on a list in the order
+ * they were parked, so every put and get only looks at its head: the oldest
+ * go when over max_idle and any past idle_ms. The backend's release runs
+ * outside the lock since it makes syscalls.
+ */
+#include "gpio_pool.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* evictions handed out of the lock per call, the rest wait for the next sweep */
+#define POOL_SWEEP_MAX 64
+
+static uint64_t gpio_pool_now(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int gpio_pool_reserve(struct gpio_pool *pool, unsigned int lines)
+{
+    int ret = 0;
+    pthread_mutex_lock(&pool->lock);
+    if (lines <= pool->lines) {
+        goto unlock;
+    }
+    struct gpio_pool_entry *entries = (struct gpio_pool_entry *)gpio_alloc(sizeof(*entries) * lines);
+    if (entries == NULL) {
+        ret = ENOMEM;
+        gpio_err("alloc pool of %u lines failed\n", lines);
+        goto unlock;
+    }
+    if (pool->entries != NULL) {
+        memcpy(entries, pool->entries, sizeof(*entries) * pool->lines);
+        gpio_free(pool->entries, sizeof(*entries) * pool->lines);
+    }
+    pool->entries = entries;
+    pool->lines = lines;
+unlock:
+    pthread_mutex_unlock(&pool->lock);
+    return ret;
+}
+
+static void gpio_pool_park(struct gpio_pool *pool, int idx, uint64_t now)
+{
+    struct gpio_pool_entry *e = &pool->entries[idx];
+    e->idle_since_ns = now;
+    e->prev = pool->newest;
+    e->next = -1;
+    if (pool->newest != -1) {
+        pool->entries[pool->newest].next = idx;
+    } else {
+        pool->oldest = idx;
+    }
+    pool->newest = idx;
+    ++pool->idle;
+}
+
+static void gpio_pool_unpark(struct gpio_pool *pool, int idx)
+{
+    struct gpio_pool_entry *e = &pool->entries[idx];
+    if (e->prev != -1) {
+        pool->entries[e->prev].next = e->next;
+    } else {
+        pool->oldest = e->next;
+    }
+    if (e->next != -1) {
+        pool->entries[e->next].prev = e->prev;
+    } else {
+        pool->newest = e->prev;
+    }
+    --pool->idle;
+}
+
+/* with the lock held, collects what has to go into out */
+static unsigned int gpio_pool_sweep(struct gpio_pool *pool, uint64_t now, bool all, gpio **out)
+{
+    unsigned int count = 0;
+    uint64_t ttl = (uint64_t)pool->policy.idle_ms * 1000000ull;
+    while (pool->oldest != -1 && count < POOL_SWEEP_MAX) {
+        int idx = pool->oldest;
+        struct gpio_pool_entry *e = &pool->entries[idx];
+        if (!all && pool->idle <= pool->policy.max_idle && now - e->idle_since_ns < ttl) {
+            break;
+        }
+        gpio_pool_unpark(pool, idx);
+        out[count++] = e->io;
+        e->io = NULL;
+        ++pool->stats.evictions;
+    }
+    return count;
+}
+
+static void gpio_pool_release(struct gpio_pool *pool, gpio **evicted, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i) {
+        pool->release(evicted[i]);
+    }
+}
+
+gpio *gpio_pool_get(struct gpio_pool *pool, unsigned int gpio_nr)
+{
+    gpio *io = NULL;
+    gpio *evicted[POOL_SWEEP_MAX];
+    pthread_mutex_lock(&pool->lock);
+    if (gpio_nr >= pool->lines) {
+        ++pool->stats.misses;
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+    struct gpio_pool_entry *e = &pool->entries[gpio_nr];
+    if (e->io != NULL) {
+        if (e->refs++ == 0) {
+            gpio_pool_unpark(pool, gpio_nr);
+        }
+        io = e->io;
+        ++pool->stats.hits;
+    } else {
+        ++pool->stats.misses;
+    }
+    unsigned int count = gpio_pool_sweep(pool, gpio_pool_now(), false, evicted);
+    pthread_mutex_unlock(&pool->lock);
+    gpio_pool_release(pool, evicted, count);
+    return io;
+}
+
+gpio *gpio_pool_add(struct gpio_pool *pool, gpio *io)
+{
+    gpio *ret = io;
+    pthread_mutex_lock(&pool->lock);
+    if (io->gpio_nr >= pool->lines) {
+        goto unlock;
+    }
+    struct gpio_pool_entry *e = &pool->entries[io->gpio_nr];
+    if (e->io == NULL) {
+        e->io = io;
+        e->refs = 1;
+    } else {
+        if (e->refs++ == 0) {
+            gpio_pool_unpark(pool, io->gpio_nr);
+        }
+        ret = e->io;
+    }
+unlock:
+    pthread_mutex_unlock(&pool->lock);
+    return ret;
+}
+
+void gpio_pool_put(struct gpio_pool *pool, gpio *io)
+{
+    gpio *evicted[POOL_SWEEP_MAX];
+    unsigned int count = 0;
+    pthread_mutex_lock(&pool->lock);
+    if (io->gpio_nr >= pool->lines || pool->entries[io->gpio_nr].io != io) {
+        /* never tracked */
+        pthread_mutex_unlock(&pool->lock);
+        pool->release(io);
+        return;
+    }
+    struct gpio_pool_entry *e = &pool->entries[io->gpio_nr];
+    if (e->refs == 0) {
+        pthread_mutex_unlock(&pool->lock);
+        gpio_err("gpio %u is not held\n", io->gpio_nr);
+        return;
+    }
+    if (--e->refs == 0) {
+        uint64_t now = gpio_pool_now();
+        gpio_pool_park(pool, io->gpio_nr, now);
+        count = gpio_pool_sweep(pool, now, false, evicted);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    gpio_pool_release(pool, evicted, count);
+}
+
+void gpio_pool_set_policy(struct gpio_pool *pool, const struct gpio_pool_policy *policy)
+{
+    gpio *evicted[POOL_SWEEP_MAX];
+    unsigned int count;
+    pthread_mutex_lock(&pool->lock);
+    pool->policy = *policy;
+    pthread_mutex_unlock(&pool->lock);
+    do {
+        pthread_mutex_lock(&pool->lock);
+        count = gpio_pool_sweep(pool, gpio_pool_now(), false, evicted);
+        pthread_mutex_unlock(&pool->lock);
+        gpio_pool_release(pool, evicted, count);
+    } while (count == POOL_SWEEP_MAX);
+}
+
+void gpio_pool_flush(struct gpio_pool *pool)
+{
+    gpio *evicted[POOL_SWEEP_MAX];
+    unsigned int count;
+    do {
+        pthread_mutex_lock(&pool->lock);
+        count = gpio_pool_sweep(pool, gpio_pool_now(), true, evicted);
+        pthread_mutex_unlock(&pool->lock);
+        gpio_pool_release(pool, evicted, count);
+    } while (count == POOL_SWEEP_MAX);
+}
+
+void gpio_pool_stats(struct gpio_pool *pool, struct gpio_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    stats->idle = pool->idle;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,80 @@
+#ifndef GPIO_POOL_H
+#define GPIO_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "gpio.h"
+
+/*
+ * closed lines are kept set up for the next open of the same line,
+ * at most max_idle of them and none longer than idle_ms, max_idle 0 turns pooling off
+ */
+struct gpio_pool_policy {
+    unsigned int max_idle;
+    uint32_t idle_ms;
+};
+
+#define GPIO_POOL_POLICY_DEFAULT { .max_idle = 16, .idle_ms = 10000 }
+
+struct gpio_pool_stats {
+    uint64_t hits;          /* opens of a line already set up, open or idle */
+    uint64_t misses;        /* opens that set a line up from scratch */
+    uint64_t evictions;     /* idle lines torn down */
+    unsigned int idle;
+};
+
+/* idle entries are chained oldest first, so sweeps never walk the whole table */
+struct gpio_pool_entry {
+    gpio *io;
+    unsigned int refs;      /* 0 while idle */
+    int prev;
+    int next;
+    uint64_t idle_since_ns;
+};
+
+/*
+ * one per backend, entries are the backend's per line state, export and
+ * fds, never a caller's handle; release tears a line down for good
+ */
+struct gpio_pool {
+    pthread_mutex_t lock;
+    struct gpio_pool_policy policy;
+    void (*release)(gpio *io);
+    unsigned int idle;
+    int oldest;
+    int newest;
+    struct gpio_pool_stats stats;
+    unsigned int lines;
+    struct gpio_pool_entry *entries;    /* indexed by line number */
+};
+
+#define GPIO_POOL_INIT(release_fn) { \
+    .lock = PTHREAD_MUTEX_INITIALIZER, \
+    .policy = GPIO_POOL_POLICY_DEFAULT, \
+    .release = release_fn, \
+    .oldest = -1, \
+    .newest = -1, \
+}
+
+/* grow the table to cover line numbers below lines, lines past it bypass the pool */
+int gpio_pool_reserve(struct gpio_pool *pool, unsigned int lines);
+
+/*
+ * the line already set up for gpio_nr with one more reference, or NULL;
+ * the backend wraps it in a fresh handle per open, so shadow state and
+ * filters never carry over from another user
+ */
+gpio *gpio_pool_get(struct gpio_pool *pool, unsigned int gpio_nr);
+/* track a freshly set up line, returns the one to use, io is left to the caller if another open won */
+gpio *gpio_pool_add(struct gpio_pool *pool, gpio *io);
+/* drop a reference, the last one parks the line or releases it per policy */
+void gpio_pool_put(struct gpio_pool *pool, gpio *io);
+
+void gpio_pool_set_policy(struct gpio_pool *pool, const struct gpio_pool_policy *policy);
+/* release every idle line now */
+void gpio_pool_flush(struct gpio_pool *pool);
+void gpio_pool_stats(struct gpio_pool *pool, struct gpio_pool_stats *stats);
+
+#endif
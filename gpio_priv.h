@@ -0,0 +1,61 @@
+#ifndef GPIO_PRIV_H
+#define GPIO_PRIV_H
+
+#include <stdbool.h>
+
+#include "gpio.h"
+
+/* line-by-line gpio_set helpers for backends without a native multi-line path */
+gpio_set *gpio_set_open_lines(struct gpio_ops *ops, const unsigned int *gpio_nr, unsigned int count);
+void gpio_set_close_lines(struct gpio_ops *ops, gpio_set *set);
+int gpio_set_values_lines(struct gpio_ops *ops, gpio_set *set, uint64_t mask, uint64_t bits);
+int gpio_get_values_lines(struct gpio_ops *ops, gpio_set *set, uint64_t *bits);
+int gpio_set_directions_lines(struct gpio_ops *ops, gpio_set *set, uint64_t mask, uint64_t out);
+
+extern bool gpio_cache_on;
+void gpio_cache_count(bool elided);
+
+extern bool gpio_accounting_on;
+void gpio_account_add(enum gpio_op op, uint64_t calls, uint64_t syscalls, uint64_t bytes);
+
+static inline void gpio_account_call(enum gpio_op op)
+{
+    if (__builtin_expect(gpio_accounting_on, 0)) {
+        gpio_account_add(op, 1, 0, 0);
+    }
+}
+
+static inline void gpio_account_sys(enum gpio_op op, uint64_t bytes)
+{
+    if (__builtin_expect(gpio_accounting_on, 0)) {
+        gpio_account_add(op, 0, 1, bytes);
+    }
+}
+
+static inline void gpio_shadow_invalidate(struct gpio_shadow *shadow)
+{
+    shadow->direction = GPIO_SHADOW_UNKNOWN;
+    shadow->edge = GPIO_SHADOW_UNKNOWN;
+    shadow->value = GPIO_SHADOW_UNKNOWN;
+}
+
+/* true when the write can be skipped */
+static inline bool gpio_shadow_hit(const int *slot, int want)
+{
+    if (*slot != want || !gpio_cache_on) {
+        return false;
+    }
+    gpio_cache_count(true);
+    return true;
+}
+
+static inline void gpio_shadow_store(int *slot, int val, int ret)
+{
+    gpio_cache_count(false);
+    *slot = ret == 0 ? val : GPIO_SHADOW_UNKNOWN;
+}
+
+#define gpio_for_each_bit(i, mask) \
+    for (uint64_t __m = (mask); __m != 0 && ((i) = __builtin_ctzll(__m), 1); __m &= __m - 1)
+
+#endif
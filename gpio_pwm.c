@@ -0,0 +1,331 @@
+/*
+ * Software PWM for many lines on one thread. Channels sit in a binary
+ * min-heap keyed by their next edge; the thread sleeps until the earliest
+ * one minus the timing slack, spins to it, then drives every edge due
+ * within GPIO_PWM_COALESCE_NS before sleeping again. Period and duty of a
+ * channel live packed in one 64 bit word, 44 bits of period over 20 bits
+ * of duty, so period * duty still fits 64 bits and a writer swaps both
+ * atomically and the thread picks them up at the next period start.
+ * Adding and removing channels takes the lock the thread holds while
+ * it reorders the heap.
+ */
+#include "gpio_pwm.h"
+#include "gpio_timing.h"
+#include "gpio_arena.h"
+#include "gpio_stats.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define NSEC_PER_SEC 1000000000ull
+
+#define PWM_DUTY_BITS 20
+#define PWM_CONFIG(period, duty) (((uint64_t)(period) << PWM_DUTY_BITS) | (duty))
+#define PWM_PERIOD(config) ((config) >> PWM_DUTY_BITS)
+#define PWM_DUTY(config) ((uint32_t)((config) & ((1u << PWM_DUTY_BITS) - 1)))
+
+struct gpio_pwm_channel {
+    gpio *io;
+    uint64_t config;        /* PWM_CONFIG, written by anyone, read by the thread */
+    unsigned int heap_pos;
+    bool high;              /* phase the channel is in */
+    uint64_t start_ns;      /* deadline the current period started at */
+    uint64_t end_ns;        /* where the current period ends */
+    uint64_t next_ns;       /* next edge */
+    uint64_t rise_ns;       /* when the last rising write returned, 0 before the first */
+    uint64_t fall_ns;
+    struct gpio_pwm_stats stats;
+};
+
+struct gpio_pwm {
+    struct gpio_ops *ops;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool stopping;
+    unsigned int count;
+    unsigned int heap[GPIO_PWM_MAX_CHANNELS];
+    struct gpio_pwm_channel channels[GPIO_PWM_MAX_CHANNELS];
+};
+
+static bool gpio_pwm_before(struct gpio_pwm *pwm, unsigned int a, unsigned int b)
+{
+    return pwm->channels[pwm->heap[a]].next_ns < pwm->channels[pwm->heap[b]].next_ns;
+}
+
+static void gpio_pwm_swap(struct gpio_pwm *pwm, unsigned int a, unsigned int b)
+{
+    unsigned int tmp = pwm->heap[a];
+    pwm->heap[a] = pwm->heap[b];
+    pwm->heap[b] = tmp;
+    pwm->channels[pwm->heap[a]].heap_pos = a;
+    pwm->channels[pwm->heap[b]].heap_pos = b;
+}
+
+static void gpio_pwm_up(struct gpio_pwm *pwm, unsigned int pos)
+{
+    while (pos > 0 && gpio_pwm_before(pwm, pos, (pos - 1) / 2)) {
+        gpio_pwm_swap(pwm, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void gpio_pwm_down(struct gpio_pwm *pwm, unsigned int pos)
+{
+    while (true) {
+        unsigned int min = pos;
+        unsigned int left = 2 * pos + 1;
+        unsigned int right = left + 1;
+        if (left < pwm->count && gpio_pwm_before(pwm, left, min)) {
+            min = left;
+        }
+        if (right < pwm->count && gpio_pwm_before(pwm, right, min)) {
+            min = right;
+        }
+        if (min == pos) {
+            break;
+        }
+        gpio_pwm_swap(pwm, pos, min);
+        pos = min;
+    }
+}
+
+/* a period starts high unless the duty is 0, and skips the fall at full duty */
+static void gpio_pwm_begin(struct gpio_pwm *pwm, struct gpio_pwm_channel *ch, uint64_t start)
+{
+    uint64_t config = __atomic_load_n(&ch->config, __ATOMIC_RELAXED);
+    uint64_t period = PWM_PERIOD(config);
+    uint64_t high = period * PWM_DUTY(config) / GPIO_PWM_DUTY_MAX;
+    ch->start_ns = start;
+    ch->end_ns = start + period;
+    ch->high = high != 0;
+    ch->next_ns = high != 0 && high != period ? start + high : ch->end_ns;
+    (void)pwm->ops->set_value(ch->io, ch->high ? GPIO_HIGH : GPIO_LOW);
+}
+
+static void gpio_pwm_edge(struct gpio_pwm *pwm, struct gpio_pwm_channel *ch)
+{
+    uint64_t deadline = ch->next_ns;
+    uint64_t now = gpio_timing_now();
+    uint64_t late = now > deadline ? now - deadline : 0;
+    if (late > ch->stats.late_max_ns) {
+        ch->stats.late_max_ns = late;
+    }
+    if (ch->high && deadline < ch->end_ns) {
+        ch->high = false;
+        ch->next_ns = ch->end_ns;
+        (void)pwm->ops->set_value(ch->io, GPIO_LOW);
+        ch->fall_ns = gpio_timing_now();
+        return;
+    }
+    /* whole periods behind are dropped rather than fired as a burst, the phase is kept */
+    uint64_t period = ch->end_ns - ch->start_ns;
+    uint64_t start = ch->end_ns;
+    if (now > start + period) {
+        start += (now - start) / period * period;
+    }
+    bool was_high = ch->high;
+    gpio_pwm_begin(pwm, ch, start);
+    now = gpio_timing_now();
+    if (ch->rise_ns != 0) {
+        uint64_t fall = was_high ? now : ch->fall_ns;
+        ch->stats.period_ns += now - ch->rise_ns;
+        ch->stats.high_ns += fall > ch->rise_ns ? fall - ch->rise_ns : 0;
+        ++ch->stats.periods;
+    }
+    ch->rise_ns = now;
+}
+
+static void *gpio_pwm_main(void *arg)
+{
+    struct gpio_pwm *pwm = (struct gpio_pwm *)arg;
+    uint64_t slack = gpio_timing_slack();
+    (void)gpio_stats_attach();
+    pthread_mutex_lock(&pwm->lock);
+    while (!pwm->stopping) {
+        if (pwm->count == 0) {
+            pthread_cond_wait(&pwm->wake, &pwm->lock);
+            continue;
+        }
+        uint64_t deadline = pwm->channels[pwm->heap[0]].next_ns;
+        uint64_t now = gpio_timing_now();
+        /* sleep where add/remove can still wake us, spin the tail unlocked */
+        if (deadline > now + slack + GPIO_TIMING_SPIN_NS) {
+            uint64_t until = deadline - slack;
+            struct timespec ts = { .tv_sec = until / NSEC_PER_SEC, .tv_nsec = until % NSEC_PER_SEC };
+            (void)pthread_cond_timedwait(&pwm->wake, &pwm->lock, &ts);
+            continue;
+        }
+        pthread_mutex_unlock(&pwm->lock);
+        gpio_timing_wait_until(deadline);
+        pthread_mutex_lock(&pwm->lock);
+        uint64_t horizon = gpio_timing_now() + GPIO_PWM_COALESCE_NS;
+        while (pwm->count != 0 && pwm->channels[pwm->heap[0]].next_ns <= horizon) {
+            gpio_pwm_edge(pwm, &pwm->channels[pwm->heap[0]]);
+            gpio_pwm_down(pwm, 0);
+        }
+    }
+    pthread_mutex_unlock(&pwm->lock);
+    return NULL;
+}
+
+struct gpio_pwm *gpio_pwm_create(void)
+{
+    pthread_condattr_t attr;
+    struct gpio_pwm *pwm = (struct gpio_pwm *)gpio_alloc(sizeof(struct gpio_pwm));
+    if (pwm == NULL) {
+        gpio_err("alloc pwm failed\n");
+        goto end;
+    }
+    pwm->ops = get_gpio_ops();
+    gpio_timing_calibrate();
+    pthread_mutex_init(&pwm->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pwm->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&pwm->thread, NULL, gpio_pwm_main, pwm) != 0) {
+        gpio_err("start pwm thread failed\n");
+        goto free_pwm;
+    }
+    goto end;
+free_pwm:
+    pthread_cond_destroy(&pwm->wake);
+    pthread_mutex_destroy(&pwm->lock);
+    gpio_free(pwm, sizeof(struct gpio_pwm));
+    pwm = NULL;
+end:
+    return pwm;
+}
+
+void gpio_pwm_destroy(struct gpio_pwm *pwm)
+{
+    pthread_mutex_lock(&pwm->lock);
+    pwm->stopping = true;
+    pthread_cond_signal(&pwm->wake);
+    pthread_mutex_unlock(&pwm->lock);
+    pthread_join(pwm->thread, NULL);
+    for (unsigned int i = 0; i < pwm->count; ++i) {
+        (void)pwm->ops->set_value(pwm->channels[pwm->heap[i]].io, GPIO_LOW);
+    }
+    pthread_cond_destroy(&pwm->wake);
+    pthread_mutex_destroy(&pwm->lock);
+    gpio_free(pwm, sizeof(struct gpio_pwm));
+}
+
+static int gpio_pwm_check(uint64_t period_ns, uint32_t duty)
+{
+    if (period_ns == 0 || period_ns > GPIO_PWM_PERIOD_MAX || duty > GPIO_PWM_DUTY_MAX) {
+        gpio_err("invalid pwm period %llu or duty %u\n", (unsigned long long)period_ns, duty);
+        return EINVAL;
+    }
+    return 0;
+}
+
+int gpio_pwm_add(struct gpio_pwm *pwm, gpio *io, uint64_t period_ns, uint32_t duty, unsigned int *channel)
+{
+    int ret = gpio_pwm_check(period_ns, duty);
+    if (ret != 0) {
+        goto end;
+    }
+    pthread_mutex_lock(&pwm->lock);
+    unsigned int id;
+    for (id = 0; id < GPIO_PWM_MAX_CHANNELS; ++id) {
+        if (pwm->channels[id].io == NULL) {
+            break;
+        }
+    }
+    if (id == GPIO_PWM_MAX_CHANNELS) {
+        ret = ENOSPC;
+        gpio_err("pwm channels are full\n");
+        goto unlock;
+    }
+    struct gpio_pwm_channel *ch = &pwm->channels[id];
+    memset(ch, 0, sizeof(*ch));
+    ch->config = PWM_CONFIG(period_ns, duty);
+    __atomic_store_n(&ch->io, io, __ATOMIC_RELEASE);
+    gpio_pwm_begin(pwm, ch, gpio_timing_now());
+    ch->heap_pos = pwm->count;
+    pwm->heap[pwm->count++] = id;
+    gpio_pwm_up(pwm, ch->heap_pos);
+    pthread_cond_signal(&pwm->wake);
+    *channel = id;
+unlock:
+    pthread_mutex_unlock(&pwm->lock);
+end:
+    return ret;
+}
+
+int gpio_pwm_remove(struct gpio_pwm *pwm, unsigned int channel)
+{
+    int ret = 0;
+    pthread_mutex_lock(&pwm->lock);
+    if (channel >= GPIO_PWM_MAX_CHANNELS || pwm->channels[channel].io == NULL) {
+        ret = ENOENT;
+        goto unlock;
+    }
+    struct gpio_pwm_channel *ch = &pwm->channels[channel];
+    unsigned int pos = ch->heap_pos;
+    --pwm->count;
+    if (pos != pwm->count) {
+        gpio_pwm_swap(pwm, pos, pwm->count);
+        gpio_pwm_down(pwm, pos);
+        gpio_pwm_up(pwm, pos);
+    }
+    (void)pwm->ops->set_value(ch->io, GPIO_LOW);
+    __atomic_store_n(&ch->io, NULL, __ATOMIC_RELEASE);
+unlock:
+    pthread_mutex_unlock(&pwm->lock);
+    return ret;
+}
+
+/* a channel removed right after the check just keeps a config nobody reads */
+static bool gpio_pwm_added(struct gpio_pwm *pwm, unsigned int channel)
+{
+    return channel < GPIO_PWM_MAX_CHANNELS && __atomic_load_n(&pwm->channels[channel].io, __ATOMIC_ACQUIRE) != NULL;
+}
+
+int gpio_pwm_set(struct gpio_pwm *pwm, unsigned int channel, uint64_t period_ns, uint32_t duty)
+{
+    int ret = gpio_pwm_check(period_ns, duty);
+    if (ret != 0) {
+        return ret;
+    }
+    if (!gpio_pwm_added(pwm, channel)) {
+        return ENOENT;
+    }
+    __atomic_store_n(&pwm->channels[channel].config, PWM_CONFIG(period_ns, duty), __ATOMIC_RELAXED);
+    return 0;
+}
+
+int gpio_pwm_set_duty(struct gpio_pwm *pwm, unsigned int channel, uint32_t duty)
+{
+    if (!gpio_pwm_added(pwm, channel)) {
+        return ENOENT;
+    }
+    uint64_t config = __atomic_load_n(&pwm->channels[channel].config, __ATOMIC_RELAXED);
+    uint64_t want;
+    do {
+        want = PWM_CONFIG(PWM_PERIOD(config), duty);
+        if (gpio_pwm_check(PWM_PERIOD(config), duty) != 0) {
+            return EINVAL;
+        }
+    } while (!__atomic_compare_exchange_n(&pwm->channels[channel].config, &config, want, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 0;
+}
+
+int gpio_pwm_stats(struct gpio_pwm *pwm, unsigned int channel, struct gpio_pwm_stats *stats)
+{
+    int ret = 0;
+    if (channel >= GPIO_PWM_MAX_CHANNELS) {
+        return ENOENT;
+    }
+    pthread_mutex_lock(&pwm->lock);
+    *stats = pwm->channels[channel].stats;
+    pthread_mutex_unlock(&pwm->lock);
+    return ret;
+}
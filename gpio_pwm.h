@@ -0,0 +1,41 @@
+#ifndef GPIO_PWM_H
+#define GPIO_PWM_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+#define GPIO_PWM_MAX_CHANNELS 64
+/* duty is given in parts per million of the period */
+#define GPIO_PWM_DUTY_MAX 1000000u
+/* period and duty share one 64 bit word, the duty takes 20 bits and the period the other 44 (~4.9 h) */
+#define GPIO_PWM_PERIOD_MAX ((1ull << 44) - 1)
+/* edges due this close together are driven on the same wakeup */
+#define GPIO_PWM_COALESCE_NS 2000
+
+/* measured on the lines, from the instants the writes returned */
+struct gpio_pwm_stats {
+    uint64_t periods;
+    uint64_t period_ns;     /* sum over all measured periods */
+    uint64_t high_ns;       /* sum of the high phases inside them */
+    uint64_t late_max_ns;   /* worst edge against its deadline */
+};
+
+/* one thread drives every channel, lines must be outputs and stay open */
+struct gpio_pwm;
+
+struct gpio_pwm *gpio_pwm_create(void);
+/* stops the thread and leaves every line low */
+void gpio_pwm_destroy(struct gpio_pwm *pwm);
+
+/* period_ns up to GPIO_PWM_PERIOD_MAX, channel receives the id for later calls */
+int gpio_pwm_add(struct gpio_pwm *pwm, gpio *io, uint64_t period_ns, uint32_t duty, unsigned int *channel);
+int gpio_pwm_remove(struct gpio_pwm *pwm, unsigned int channel);
+
+/* lock-free from any thread, the change takes effect at the next period start, ENOENT for a channel not added */
+int gpio_pwm_set(struct gpio_pwm *pwm, unsigned int channel, uint64_t period_ns, uint32_t duty);
+int gpio_pwm_set_duty(struct gpio_pwm *pwm, unsigned int channel, uint32_t duty);
+
+int gpio_pwm_stats(struct gpio_pwm *pwm, unsigned int channel, struct gpio_pwm_stats *stats);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Discovers the gpiochips behind the sysfs class directory once, and turns
+ * their base/ngpio ranges into a flat table indexed by global line number.
+ * Gaps between chips stay GPIO_REGISTRY_NONE, overlapping chips are refused.
+ */
+#include "gpio_registry.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <linux/limits.h>
+
+static int gpio_registry_read(const char *class_root, const char *chip, const char *attr, char *buf, size_t len)
+{
+    int ret = 0;
+    char path[PATH_MAX];
+    (void)snprintf(path, sizeof(path), "%s/%s/%s", class_root, chip, attr);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        ret = errno;
+        gpio_err("open %s failed: %s\n", path, strerror(ret));
+        goto end;
+    }
+    ssize_t got = read(fd, buf, len - 1);
+    if (got == -1) {
+        ret = errno;
+        gpio_err("read %s failed: %s\n", path, strerror(ret));
+        goto close_fd;
+    }
+    buf[got] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+close_fd:
+    close(fd);
+end:
+    return ret;
+}
+
+static int gpio_registry_chip(const char *class_root, const char *name, struct gpio_chip_info *chip)
+{
+    int ret;
+    char buf[64];
+    char *end;
+    ret = gpio_registry_read(class_root, name, "base", buf, sizeof(buf));
+    if (ret != 0) {
+        goto end;
+    }
+    chip->base = (unsigned int)strtoul(buf, &end, 10);
+    ret = gpio_registry_read(class_root, name, "ngpio", buf, sizeof(buf));
+    if (ret != 0) {
+        goto end;
+    }
+    chip->ngpio = (unsigned int)strtoul(buf, &end, 10);
+    /* label is informational, older trees lack it */
+    if (gpio_registry_read(class_root, name, "label", chip->label, sizeof(chip->label)) != 0) {
+        chip->label[0] = '\0';
+    }
+end:
+    return ret;
+}
+
+static int gpio_registry_compare(const void *a, const void *b)
+{
+    const struct gpio_chip_info *x = (const struct gpio_chip_info *)a;
+    const struct gpio_chip_info *y = (const struct gpio_chip_info *)b;
+    return x->base < y->base ? -1 : x->base > y->base;
+}
+
+int gpio_registry_index(struct gpio_registry *reg)
+{
+    int ret = 0;
+    qsort(reg->chip, reg->chips, sizeof(reg->chip[0]), gpio_registry_compare);
+    for (unsigned int i = 0; i < reg->chips; ++i) {
+        struct gpio_chip_info *chip = &reg->chip[i];
+        if (i > 0 && chip->base < reg->chip[i - 1].base + reg->chip[i - 1].ngpio) {
+            ret = EINVAL;
+            gpio_err("gpiochip at %u overlaps the one at %u\n", chip->base, reg->chip[i - 1].base);
+            goto end;
+        }
+        reg->lines = chip->base + chip->ngpio;
+    }
+    reg->chip_of = (uint8_t *)gpio_alloc(reg->lines);
+    if (reg->chip_of == NULL) {
+        ret = ENOMEM;
+        gpio_err("alloc line table failed\n");
+        goto end;
+    }
+    memset(reg->chip_of, GPIO_REGISTRY_NONE, reg->lines);
+    for (unsigned int i = 0; i < reg->chips; ++i) {
+        memset(reg->chip_of + reg->chip[i].base, (int)i, reg->chip[i].ngpio);
+    }
+end:
+    return ret;
+}
+
+int gpio_registry_scan(struct gpio_registry *reg, const char *class_root, const char *line_root)
+{
+    int ret = 0;
+    struct dirent *entry;
+    memset(reg, 0, sizeof(*reg));
+    DIR *dir = opendir(class_root);
+    if (dir == NULL) {
+        ret = errno;
+        gpio_err("open %s failed: %s\n", class_root, strerror(ret));
+        goto end;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "gpiochip", 8) != 0) {
+            continue;
+        }
+        if (reg->chips == GPIO_REGISTRY_CHIPS) {
+            gpio_err("more than %d gpiochips, %s ignored\n", GPIO_REGISTRY_CHIPS, entry->d_name);
+            continue;
+        }
+        struct gpio_chip_info *chip = &reg->chip[reg->chips];
+        if (gpio_registry_chip(class_root, entry->d_name, chip) != 0) {
+            continue;
+        }
+        if (chip->ngpio == 0 || chip->base + chip->ngpio > GPIO_REGISTRY_LINES) {
+            gpio_err("%s covers lines beyond %d\n", entry->d_name, GPIO_REGISTRY_LINES);
+            continue;
+        }
+        ++reg->chips;
+    }
+    closedir(dir);
+    if (reg->chips == 0) {
+        ret = ENODEV;
+        gpio_err("no gpiochip under %s\n", class_root);
+        goto end;
+    }
+    ret = gpio_registry_index(reg);
+    if (ret != 0) {
+        goto end;
+    }
+    for (unsigned int i = 0; i < reg->chips; ++i) {
+        reg->chip[i].line_root = i == 0 ? line_root : class_root;
+    }
+end:
+    if (ret != 0) {
+        gpio_registry_clear(reg);
+    }
+    return ret;
+}
+
+void gpio_registry_clear(struct gpio_registry *reg)
+{
+    gpio_free(reg->chip_of, reg->lines);
+    memset(reg, 0, sizeof(*reg));
+}
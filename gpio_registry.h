@@ -0,0 +1,50 @@
+#ifndef GPIO_REGISTRY_H
+#define GPIO_REGISTRY_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+#define GPIO_REGISTRY_CHIPS 32
+/* global line numbers at or past this are refused, it bounds the table */
+#define GPIO_REGISTRY_LINES 65536
+#define GPIO_REGISTRY_NONE 0xff
+
+struct gpio_chip_info {
+    unsigned int base;
+    unsigned int ngpio;
+    char label[32];
+    const char *line_root;      /* holds the chip's gpioN directories once exported, sysfs only */
+};
+
+/*
+ * every gpiochip under the class root, ordered by base, and one byte per
+ * global line naming its chip, so a lookup is a single index whatever the
+ * number of lines
+ */
+struct gpio_registry {
+    unsigned int chips;
+    unsigned int lines;         /* one past the highest line of any chip */
+    struct gpio_chip_info chip[GPIO_REGISTRY_CHIPS];
+    uint8_t *chip_of;
+};
+
+/*
+ * reads base, ngpio and label of each gpiochipN in class_root; line_root
+ * serves the lowest chip, the others are reached through the gpioN links
+ * sysfs keeps in class_root for every exported line
+ */
+int gpio_registry_scan(struct gpio_registry *reg, const char *class_root, const char *line_root);
+/* orders chip[0..chips) by base, refuses overlaps and builds the line table, for other scanners */
+int gpio_registry_index(struct gpio_registry *reg);
+void gpio_registry_clear(struct gpio_registry *reg);
+
+static inline const struct gpio_chip_info *gpio_registry_lookup(const struct gpio_registry *reg, unsigned int gpio_nr)
+{
+    if (gpio_nr >= reg->lines || reg->chip_of[gpio_nr] == GPIO_REGISTRY_NONE) {
+        return NULL;
+    }
+    return &reg->chip[reg->chip_of[gpio_nr]];
+}
+
+#endif
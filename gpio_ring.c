@@ -0,0 +1,94 @@
+/*
+ * Single producer/single consumer ring of edge records. head is only
+ * written by the producer and tail only by the consumer, each on its own
+ * cache line, and each side keeps a stale copy of the other index so the
+ * common case touches no shared line.
+ */
+#include "gpio_ring.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+
+#define RING_CACHE_LINE 64
+
+struct gpio_ring {
+    /* producer */
+    uint64_t head __attribute__((aligned(RING_CACHE_LINE)));
+    uint64_t tail_cache;
+    uint64_t sequence;
+    uint64_t overflow;
+    /* consumer */
+    uint64_t tail __attribute__((aligned(RING_CACHE_LINE)));
+    uint64_t head_cache;
+    /* shared, read only */
+    uint64_t mask __attribute__((aligned(RING_CACHE_LINE)));
+    struct gpio_record records[];
+};
+
+struct gpio_ring *gpio_ring_create(unsigned int capacity)
+{
+    uint64_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    struct gpio_ring *ring = (struct gpio_ring *)gpio_alloc(sizeof(struct gpio_ring) + sizeof(struct gpio_record) * size);
+    if (ring == NULL) {
+        gpio_err("alloc ring of %u records failed\n", capacity);
+        goto end;
+    }
+    ring->head = 0;
+    ring->tail_cache = 0;
+    ring->sequence = 0;
+    ring->overflow = 0;
+    ring->tail = 0;
+    ring->head_cache = 0;
+    ring->mask = size - 1;
+end:
+    return ring;
+}
+
+void gpio_ring_destroy(struct gpio_ring *ring)
+{
+    gpio_free(ring, sizeof(struct gpio_ring) + sizeof(struct gpio_record) * (ring->mask + 1));
+}
+
+bool gpio_ring_push(struct gpio_ring *ring, const struct gpio_event *event)
+{
+    uint64_t head = ring->head;
+    uint64_t sequence = ring->sequence++;
+    if (head - ring->tail_cache > ring->mask) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tail_cache > ring->mask) {
+            __atomic_store_n(&ring->overflow, ring->overflow + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+    struct gpio_record *record = &ring->records[head & ring->mask];
+    record->line = event->gpio_nr;
+    record->value = event->value;
+    record->timestamp_ns = event->timestamp_ns;
+    record->sequence = sequence;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+unsigned int gpio_ring_drain(struct gpio_ring *ring, struct gpio_record *out, unsigned int max)
+{
+    uint64_t tail = ring->tail;
+    if (ring->head_cache == tail) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+    uint64_t avail = ring->head_cache - tail;
+    unsigned int n = avail < max ? (unsigned int)avail : max;
+    for (unsigned int i = 0; i < n; ++i) {
+        out[i] = ring->records[(tail + i) & ring->mask];
+    }
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+void gpio_ring_stats(struct gpio_ring *ring, struct gpio_ring_stats *stats)
+{
+    stats->overflow = __atomic_load_n(&ring->overflow, __ATOMIC_RELAXED);
+    stats->captured = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) + stats->overflow;
+}
@@ -0,0 +1,37 @@
+#ifndef GPIO_RING_H
+#define GPIO_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpio.h"
+
+/* sequence counts every captured edge, dropped ones leave a gap */
+struct gpio_record {
+    uint32_t line;
+    uint32_t value;
+    uint64_t timestamp_ns;  /* CLOCK_MONOTONIC */
+    uint64_t sequence;
+};
+
+struct gpio_ring_stats {
+    uint64_t captured;
+    uint64_t overflow;
+};
+
+/* lock-free, one producer thread and one consumer thread */
+struct gpio_ring;
+
+/* capacity is rounded up to a power of two */
+struct gpio_ring *gpio_ring_create(unsigned int capacity);
+void gpio_ring_destroy(struct gpio_ring *ring);
+
+/* producer side, false when the ring is full and the edge was counted as overflow */
+bool gpio_ring_push(struct gpio_ring *ring, const struct gpio_event *event);
+
+/* consumer side, returns how many records were copied out */
+unsigned int gpio_ring_drain(struct gpio_ring *ring, struct gpio_record *out, unsigned int max);
+
+void gpio_ring_stats(struct gpio_ring *ring, struct gpio_ring_stats *stats);
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * Sequences are kept as the instruction list they were built from and as
+ * compiled steps. Compiling folds adjacent instructions of the same kind
+ * into one step, so a clock edge plus a data bit becomes one set_values,
+ * which is a single ioctl on cdev and a single store on mmio. Running
+ * walks the steps with the ops resolved once at create, and waits go
+ * through absolute deadlines from gpio_timing.
+ */
+#include "gpio_seq.h"
+#include "gpio_timing.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+
+enum gpio_seq_kind {
+    SEQ_WRITE,
+    SEQ_READ,
+    SEQ_WAIT,
+    SEQ_DIR,
+};
+
+struct gpio_seq_insn {
+    uint8_t op;
+    uint8_t line;
+    uint32_t arg;
+};
+
+struct gpio_seq_step {
+    uint8_t kind;
+    uint8_t nmap;
+    uint64_t mask;      /* lines touched */
+    uint64_t bits;      /* fixed levels, or directions */
+    uint32_t wait_ns;
+    struct {
+        uint8_t line;
+        uint32_t bit;
+    } map[GPIO_SEQ_MAP];    /* lines driven from or sampled into the buffers */
+};
+
+struct gpio_seq {
+    struct gpio_ops *ops;
+    gpio_set *set;
+    unsigned int capacity;
+    unsigned int count;
+    unsigned int steps;
+    int error;          /* first failed add, reported by compile */
+    bool compiled;
+    struct gpio_seq_insn *insns;
+    struct gpio_seq_step *step;
+};
+
+struct gpio_seq *gpio_seq_create(struct gpio_ops *ops, gpio_set *set, unsigned int capacity)
+{
+    struct gpio_seq *seq = (struct gpio_seq *)gpio_alloc(sizeof(struct gpio_seq));
+    if (seq == NULL) {
+        gpio_err("alloc sequence failed\n");
+        goto end;
+    }
+    /* a step never holds less than one instruction */
+    seq->capacity = capacity;
+    seq->insns = (struct gpio_seq_insn *)gpio_alloc(sizeof(struct gpio_seq_insn) * capacity);
+    seq->step = (struct gpio_seq_step *)gpio_alloc(sizeof(struct gpio_seq_step) * capacity);
+    if (seq->insns == NULL || seq->step == NULL) {
+        gpio_err("alloc %u instructions failed\n", capacity);
+        goto free_seq;
+    }
+    seq->ops = ops;
+    seq->set = set;
+    goto end;
+free_seq:
+    gpio_seq_destroy(seq);
+    seq = NULL;
+end:
+    return seq;
+}
+
+void gpio_seq_destroy(struct gpio_seq *seq)
+{
+    gpio_free(seq->step, sizeof(struct gpio_seq_step) * seq->capacity);
+    gpio_free(seq->insns, sizeof(struct gpio_seq_insn) * seq->capacity);
+    gpio_free(seq, sizeof(struct gpio_seq));
+}
+
+int gpio_seq_add(struct gpio_seq *seq, enum gpio_seq_op op, unsigned int line, uint32_t arg)
+{
+    int ret = 0;
+    if (seq->count == seq->capacity) {
+        ret = ENOSPC;
+        gpio_err("sequence is full\n");
+    } else if (op != GPIO_SEQ_WAIT && line >= seq->set->count) {
+        ret = EINVAL;
+        gpio_err("line %u is not in the set\n", line);
+    } else if (op > GPIO_SEQ_DIR) {
+        ret = EINVAL;
+        gpio_err("unknown sequence op\n");
+    }
+    if (ret != 0) {
+        seq->error = seq->error != 0 ? seq->error : ret;
+        return ret;
+    }
+    seq->insns[seq->count].op = op;
+    seq->insns[seq->count].line = op == GPIO_SEQ_WAIT ? 0 : line;
+    seq->insns[seq->count].arg = arg;
+    ++seq->count;
+    seq->compiled = false;
+    return 0;
+}
+
+static enum gpio_seq_kind gpio_seq_kind_of(const struct gpio_seq_insn *insn)
+{
+    switch (insn->op) {
+        case GPIO_SEQ_SAMPLE:
+            return SEQ_READ;
+        case GPIO_SEQ_WAIT:
+            return SEQ_WAIT;
+        case GPIO_SEQ_DIR:
+            return SEQ_DIR;
+        default:
+            return SEQ_WRITE;
+    }
+}
+
+/* an instruction joins the open step unless it needs a new map slot that is not there or hits a line twice */
+static bool gpio_seq_fits(const struct gpio_seq_step *step, const struct gpio_seq_insn *insn)
+{
+    enum gpio_seq_kind kind = gpio_seq_kind_of(insn);
+    uint64_t bit = 1ull << insn->line;
+    if (step->kind != kind || kind == SEQ_WAIT) {
+        return false;
+    }
+    if (kind == SEQ_READ) {
+        return step->nmap < GPIO_SEQ_MAP;
+    }
+    if ((step->mask & bit) != 0) {
+        return false;
+    }
+    return insn->op != GPIO_SEQ_PUT || step->nmap < GPIO_SEQ_MAP;
+}
+
+int gpio_seq_compile(struct gpio_seq *seq)
+{
+    struct gpio_seq_step *step = NULL;
+    if (seq->error != 0) {
+        return seq->error;
+    }
+    seq->steps = 0;
+    for (unsigned int i = 0; i < seq->count; ++i) {
+        const struct gpio_seq_insn *insn = &seq->insns[i];
+        if (step == NULL || !gpio_seq_fits(step, insn)) {
+            step = &seq->step[seq->steps++];
+            memset(step, 0, sizeof(*step));
+            step->kind = gpio_seq_kind_of(insn);
+        }
+        uint64_t bit = 1ull << insn->line;
+        switch (insn->op) {
+            case GPIO_SEQ_SET:
+                step->mask |= bit;
+                step->bits |= bit;
+                break;
+            case GPIO_SEQ_CLR:
+                step->mask |= bit;
+                break;
+            case GPIO_SEQ_DIR:
+                step->mask |= bit;
+                step->bits |= insn->arg == GPIO_OUT ? bit : 0;
+                break;
+            case GPIO_SEQ_WAIT:
+                step->wait_ns = insn->arg;
+                break;
+            case GPIO_SEQ_PUT:
+                step->mask |= bit;
+                /* fall through */
+            case GPIO_SEQ_SAMPLE:
+                step->map[step->nmap].line = insn->line;
+                step->map[step->nmap].bit = insn->arg;
+                ++step->nmap;
+                break;
+        }
+    }
+    seq->compiled = true;
+    return 0;
+}
+
+unsigned int gpio_seq_steps(const struct gpio_seq *seq)
+{
+    return seq->steps;
+}
+
+static inline bool gpio_seq_bit(const uint8_t *buf, uint32_t bit)
+{
+    return (buf[bit / 8] >> (bit % 8)) & 1;
+}
+
+static int gpio_seq_write(struct gpio_seq *seq, const struct gpio_seq_step *step, const uint8_t *in)
+{
+    uint64_t bits = step->bits;
+    for (unsigned int m = 0; m < step->nmap; ++m) {
+        if (gpio_seq_bit(in, step->map[m].bit)) {
+            bits |= 1ull << step->map[m].line;
+        }
+    }
+    /* single lines skip the set path, which is line by line on sysfs anyway */
+    if ((step->mask & (step->mask - 1)) == 0) {
+        unsigned int line = __builtin_ctzll(step->mask);
+        return seq->ops->set_value(seq->set->lines[line], (bits & step->mask) != 0 ? GPIO_HIGH : GPIO_LOW);
+    }
+    return seq->ops->set_values(seq->set, step->mask, bits);
+}
+
+static int gpio_seq_read(struct gpio_seq *seq, const struct gpio_seq_step *step, uint8_t *out)
+{
+    int ret;
+    uint64_t bits = 0;
+    if (step->nmap == 1) {
+        enum gpio_value value;
+        ret = seq->ops->get_value(seq->set->lines[step->map[0].line], &value);
+        bits = value == GPIO_HIGH ? 1ull << step->map[0].line : 0;
+    } else {
+        ret = seq->ops->get_values(seq->set, &bits);
+    }
+    if (ret != 0) {
+        goto end;
+    }
+    for (unsigned int m = 0; m < step->nmap; ++m) {
+        uint32_t bit = step->map[m].bit;
+        uint8_t flag = 1u << (bit % 8);
+        if ((bits >> step->map[m].line) & 1) {
+            out[bit / 8] |= flag;
+        } else {
+            out[bit / 8] &= ~flag;
+        }
+    }
+end:
+    return ret;
+}
+
+int gpio_seq_run(struct gpio_seq *seq, const uint8_t *in, uint8_t *out)
+{
+    int ret = 0;
+    if (!seq->compiled) {
+        ret = gpio_seq_compile(seq);
+        if (ret != 0) {
+            goto end;
+        }
+    }
+    uint64_t deadline = gpio_timing_now();
+    for (unsigned int i = 0; i < seq->steps; ++i) {
+        const struct gpio_seq_step *step = &seq->step[i];
+        switch (step->kind) {
+            case SEQ_WRITE:
+                ret = gpio_seq_write(seq, step, in);
+                break;
+            case SEQ_READ:
+                ret = gpio_seq_read(seq, step, out);
+                break;
+            case SEQ_WAIT:
+                deadline += step->wait_ns;
+                gpio_timing_wait_until(deadline);
+                break;
+            case SEQ_DIR:
+                ret = seq->ops->set_directions(seq->set, step->mask, step->bits);
+                break;
+        }
+        if (ret != 0) {
+            gpio_err("sequence step %u failed\n", i);
+            goto end;
+        }
+    }
+end:
+    return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef GPIO_SEQ_H
+#define GPIO_SEQ_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+/*
+ * one instruction of a bit-banged transaction, line is an index into the
+ * set the sequence was built for, bits are numbered lsb first from byte 0
+ */
+enum gpio_seq_op {
+    GPIO_SEQ_SET = 0,       /* drive line high */
+    GPIO_SEQ_CLR = 1,       /* drive line low */
+    GPIO_SEQ_PUT = 2,       /* drive line with bit arg of the input buffer */
+    GPIO_SEQ_SAMPLE = 3,    /* read line into bit arg of the output buffer */
+    GPIO_SEQ_WAIT = 4,      /* arg ns past the previous wait's deadline */
+    GPIO_SEQ_DIR = 5,       /* arg is the enum gpio_direction of line */
+};
+
+/* distinct lines one step may drive from or sample into the buffers */
+#define GPIO_SEQ_MAP 4
+
+struct gpio_seq;
+
+/* the set and the ops that opened it must outlive the sequence */
+struct gpio_seq *gpio_seq_create(struct gpio_ops *ops, gpio_set *set, unsigned int capacity);
+void gpio_seq_destroy(struct gpio_seq *seq);
+
+/*
+ * ENOSPC past capacity, EINVAL for a line outside the set, the first
+ * failure sticks and is returned again by compile and run
+ */
+int gpio_seq_add(struct gpio_seq *seq, enum gpio_seq_op op, unsigned int line, uint32_t arg);
+
+/*
+ * merge runs of writes, samples and direction changes into one bulk call
+ * each, done by the first run if not called, adding afterwards recompiles
+ */
+int gpio_seq_compile(struct gpio_seq *seq);
+/* bulk calls the compiled sequence issues per run */
+unsigned int gpio_seq_steps(const struct gpio_seq *seq);
+
+/* replay the whole sequence, waits are timed from the start of the run */
+int gpio_seq_run(struct gpio_seq *seq, const uint8_t *in, uint8_t *out);
+
+#endif
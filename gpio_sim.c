@@ -0,0 +1,868 @@
+/*
+ * Stands in for the kernel side of the sysfs interface so the sysfs
+ * backend, and everything above it, runs on any Linux host. The tree is
+ * plain files; the backend reports every write through gpio_sysfs_hooks,
+ * which is where exports grow their gpioN directory and where attached
+ * device models see the lines move. Plain files never raise POLLPRI, so
+ * each exported line also gets an eventfd the backend polls instead.
+ * With a udev delay set, an export only makes the directory and a helper
+ * thread creates the attribute files once the delay is up, the way a
+ * line is unusable until udev has set its permissions.
+ */
+#include "gpio_sim.h"
+#include "gpio_cdev.h"
+#include "gpio_sysfs.h"
+#include "gpio_timing.h"
+#include "rtc.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#define NSEC_PER_SEC 1000000000ull
+
+/* DS1302 register map, the clock burst covers the first eight */
+#define DS1302_CLOCK_REGS 8
+#define DS1302_REG_SEC 0
+#define DS1302_REG_HOUR 2
+#define DS1302_REG_DAY 5
+#define DS1302_REG_YEAR 6
+#define DS1302_REG_WP 7
+#define DS1302_REG_TRICKLE 8
+#define DS1302_RAM 31
+#define DS1302_BURST 31
+#define DS1302_HALT 0x80
+#define DS1302_WP 0x80
+#define DS1302_12H 0x80
+
+struct sim_line {
+    bool exported;
+    bool output;
+    bool high;
+    int edge;
+    int irq_fd;
+    bool settled;           /* attribute files exist */
+    uint64_t settle_ns;
+};
+
+struct sim_ds1302 {
+    bool attached;
+    bool cdev;                  /* on the cdev mock's lines instead of the simulated sysfs ones */
+    unsigned int clk;
+    unsigned int dat;
+    unsigned int rst;
+    bool selected;
+    bool has_cmd;
+    unsigned char cmd;
+    unsigned int bits_in;       /* since rst rose, command included */
+    unsigned int bits_out;
+    unsigned char shift;
+    unsigned char latch[DS1302_CLOCK_REGS];     /* clock as of the command */
+    time_t base;                /* clock reading at base_ns */
+    uint64_t base_ns;
+    unsigned int base_day;
+    bool halted;
+    unsigned char wp;
+    unsigned char trickle;
+    unsigned char ram[DS1302_RAM];
+    struct gpio_sim_ds1302_stats stats;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    bool installed;
+    char root[32];     /* mkdtemp template, always short */
+    struct sim_line lines[GPIO_SIM_LINES];
+    struct sim_ds1302 ds;
+    bool playing;
+    pthread_t player;
+    unsigned int steps_count;
+    struct gpio_sim_step steps[GPIO_SIM_SCRIPT_MAX];
+    uint32_t udev_us;
+    bool udev_running;
+    bool udev_stop;
+    pthread_t udev;
+    pthread_cond_t udev_wake;
+    unsigned int chips;
+    struct {
+        unsigned int base;
+        unsigned int ngpio;
+    } chip[GPIO_SIM_CHIPS];
+} sim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *sim_attrs[] = { "value", "direction", "edge" };
+
+static int sim_write_file(const char *path, const char *buf)
+{
+    int ret = 0;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        ret = errno;
+        gpio_err("create %s failed: %s\n", path, strerror(ret));
+        goto end;
+    }
+    if (write(fd, buf, strlen(buf)) == -1) {
+        ret = errno;
+        gpio_err("write %s failed: %s\n", path, strerror(ret));
+    }
+    close(fd);
+end:
+    return ret;
+}
+
+static void sim_attr_path(char *path, unsigned int gpio_nr, const char *attr)
+{
+    if (attr == NULL) {
+        (void)snprintf(path, PATH_MAX, "%s/gpio%u", sim.root, gpio_nr);
+    } else {
+        (void)snprintf(path, PATH_MAX, "%s/gpio%u/%s", sim.root, gpio_nr, attr);
+    }
+}
+
+/* what the kernel keeps in the value attribute */
+static void sim_store_level(unsigned int gpio_nr, bool high)
+{
+    char path[PATH_MAX];
+    if (!sim.lines[gpio_nr].settled) {
+        return;
+    }
+    sim_attr_path(path, gpio_nr, "value");
+    /* both levels are two bytes, rewritten in place a racing read sees one or the other, never an empty file */
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        gpio_err("create %s failed: %s\n", path, strerror(errno));
+        return;
+    }
+    if (pwrite(fd, high ? "1\n" : "0\n", 2, 0) == -1) {
+        gpio_err("write %s failed: %s\n", path, strerror(errno));
+    }
+    close(fd);
+}
+
+static bool sim_edge_match(int edge, bool high)
+{
+    switch (edge) {
+        case GPIO_RISING:
+            return high;
+        case GPIO_FALLING:
+            return !high;
+        case GPIO_BOTH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* called with the lock held, by outside drivers and by the models */
+static int sim_drive(unsigned int gpio_nr, bool high)
+{
+    struct sim_line *line = &sim.lines[gpio_nr];
+    uint64_t one = 1;
+    if (!line->exported) {
+        return ENOENT;
+    }
+    bool changed = line->high != high;
+    line->high = high;
+    sim_store_level(gpio_nr, high);
+    if (changed && sim_edge_match(line->edge, high) &&
+        write(line->irq_fd, &one, sizeof(one)) != sizeof(one)) {
+        return errno;
+    }
+    return 0;
+}
+
+/* what udev would leave behind, called with the lock held */
+static void sim_settle(unsigned int gpio_nr)
+{
+    char path[PATH_MAX];
+    struct sim_line *line = &sim.lines[gpio_nr];
+    sim_attr_path(path, gpio_nr, "direction");
+    (void)sim_write_file(path, "in\n");
+    sim_attr_path(path, gpio_nr, "edge");
+    (void)sim_write_file(path, "none\n");
+    line->settled = true;
+    sim_store_level(gpio_nr, line->high);
+}
+
+static void sim_export(unsigned int gpio_nr)
+{
+    char path[PATH_MAX];
+    struct sim_line *line = &sim.lines[gpio_nr];
+    if (line->exported) {
+        return;
+    }
+    sim_attr_path(path, gpio_nr, NULL);
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        gpio_err("create %s failed: %s\n", path, strerror(errno));
+        return;
+    }
+    line->irq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (line->irq_fd == -1) {
+        gpio_err("create irq shim failed: %s\n", strerror(errno));
+    }
+    line->output = false;
+    line->high = false;
+    line->edge = GPIO_NONE;
+    line->exported = true;
+    if (sim.udev_us == 0) {
+        sim_settle(gpio_nr);
+        return;
+    }
+    line->settle_ns = gpio_timing_now() + (uint64_t)sim.udev_us * 1000;
+    pthread_cond_signal(&sim.udev_wake);
+}
+
+static void sim_unexport(unsigned int gpio_nr)
+{
+    char path[PATH_MAX];
+    struct sim_line *line = &sim.lines[gpio_nr];
+    if (!line->exported) {
+        return;
+    }
+    for (unsigned int i = 0; i < sizeof(sim_attrs) / sizeof(sim_attrs[0]); ++i) {
+        sim_attr_path(path, gpio_nr, sim_attrs[i]);
+        (void)unlink(path);
+    }
+    sim_attr_path(path, gpio_nr, NULL);
+    (void)rmdir(path);
+    if (line->irq_fd != -1) {
+        close(line->irq_fd);
+    }
+    memset(line, 0, sizeof(*line));
+    line->irq_fd = -1;
+}
+
+static uint8_t sim_bcd(unsigned int v)
+{
+    return (uint8_t)(((v / 10) << 4) | (v % 10));
+}
+
+static unsigned int sim_unbcd(uint8_t v)
+{
+    return (v >> 4) * 10 + (v & 0xf);
+}
+
+/* the clock registers as the chip would show them now */
+static void sim_ds1302_clock(struct sim_ds1302 *ds, unsigned char *regs)
+{
+    struct tm tm;
+    uint64_t elapsed = ds->halted ? 0 : (gpio_timing_now() - ds->base_ns) / NSEC_PER_SEC;
+    time_t t = ds->base + (time_t)elapsed;
+    (void)gmtime_r(&t, &tm);
+    unsigned int days = (unsigned int)(t / 86400 - ds->base / 86400);
+    regs[DS1302_REG_SEC] = sim_bcd(tm.tm_sec) | (ds->halted ? DS1302_HALT : 0);
+    regs[1] = sim_bcd(tm.tm_min);
+    regs[DS1302_REG_HOUR] = sim_bcd(tm.tm_hour);
+    regs[3] = sim_bcd(tm.tm_mday);
+    regs[4] = sim_bcd(tm.tm_mon + 1);
+    regs[DS1302_REG_DAY] = (ds->base_day - 1 + days) % 7 + 1;
+    regs[DS1302_REG_YEAR] = sim_bcd((tm.tm_year + 1900 - RTC_YEAR_BASE) % 100);
+    regs[DS1302_REG_WP] = ds->wp;
+}
+
+/* a write to the seconds restarts the countdown chain, like the chip */
+static void sim_ds1302_set_clock(struct sim_ds1302 *ds, const unsigned char *regs)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    unsigned char hour = regs[DS1302_REG_HOUR];
+    tm.tm_sec = sim_unbcd(regs[DS1302_REG_SEC] & ~DS1302_HALT);
+    tm.tm_min = sim_unbcd(regs[1]);
+    if (hour & DS1302_12H) {
+        tm.tm_hour = sim_unbcd(hour & 0x1f) % 12 + ((hour & 0x20) ? 12 : 0);
+    } else {
+        tm.tm_hour = sim_unbcd(hour & 0x3f);
+    }
+    tm.tm_mday = sim_unbcd(regs[3]);
+    tm.tm_mon = sim_unbcd(regs[4]) - 1;
+    tm.tm_year = RTC_YEAR_BASE + sim_unbcd(regs[DS1302_REG_YEAR]) - 1900;
+    ds->base = timegm(&tm);
+    ds->base_ns = gpio_timing_now();
+    ds->base_day = regs[DS1302_REG_DAY] & 0x7;
+    ds->halted = (regs[DS1302_REG_SEC] & DS1302_HALT) != 0;
+    ds->wp = regs[DS1302_REG_WP] & DS1302_WP;
+    ++ds->stats.clock_sets;
+}
+
+static unsigned char sim_ds1302_out(struct sim_ds1302 *ds, unsigned int index)
+{
+    unsigned int addr = (ds->cmd >> 1) & 0x1f;
+    bool ram = (ds->cmd & 0x40) != 0;
+    if (ram) {
+        return addr == DS1302_BURST ? ds->ram[index % DS1302_RAM] : addr < DS1302_RAM ? ds->ram[addr] : 0;
+    }
+    if (addr == DS1302_BURST) {
+        return ds->latch[index % DS1302_CLOCK_REGS];
+    }
+    if (addr < DS1302_CLOCK_REGS) {
+        return ds->latch[addr];
+    }
+    return addr == DS1302_REG_TRICKLE ? ds->trickle : 0;
+}
+
+/* a clock burst write only latches once all eight bytes are in */
+static void sim_ds1302_in(struct sim_ds1302 *ds, unsigned int index, unsigned char byte)
+{
+    unsigned int addr = (ds->cmd >> 1) & 0x1f;
+    bool ram = (ds->cmd & 0x40) != 0;
+    ++ds->stats.bytes_in;
+    if (!ram && addr == DS1302_REG_WP) {
+        ds->wp = byte & DS1302_WP;
+        return;
+    }
+    if (ds->wp != 0) {
+        return;
+    }
+    if (ram) {
+        if (addr == DS1302_BURST) {
+            ds->ram[index % DS1302_RAM] = byte;
+        } else if (addr < DS1302_RAM) {
+            ds->ram[addr] = byte;
+        }
+        return;
+    }
+    if (addr == DS1302_BURST) {
+        if (index < DS1302_CLOCK_REGS) {
+            ds->latch[index] = byte;
+        }
+        if (index == DS1302_CLOCK_REGS - 1) {
+            sim_ds1302_set_clock(ds, ds->latch);
+        }
+    } else if (addr < DS1302_CLOCK_REGS) {
+        ds->latch[addr] = byte;
+        sim_ds1302_set_clock(ds, ds->latch);
+    } else if (addr == DS1302_REG_TRICKLE) {
+        ds->trickle = byte;
+    }
+}
+
+static void sim_ds1302_command(struct sim_ds1302 *ds)
+{
+    /* bit 7 low is no command, the chip ignores the rest of the cycle */
+    if ((ds->cmd & 0x80) == 0) {
+        ds->selected = false;
+        return;
+    }
+    ds->has_cmd = true;
+    ++ds->stats.commands;
+    sim_ds1302_clock(ds, ds->latch);
+}
+
+static bool sim_ds1302_level(const struct sim_ds1302 *ds, unsigned int gpio_nr)
+{
+    return ds->cdev ? gpio_cdev_mock_level(gpio_nr) : sim.lines[gpio_nr].high;
+}
+
+static void sim_ds1302_drive(const struct sim_ds1302 *ds, unsigned int gpio_nr, bool high)
+{
+    if (ds->cdev) {
+        (void)gpio_cdev_mock_drive(gpio_nr, high);
+    } else {
+        (void)sim_drive(gpio_nr, high);
+    }
+}
+
+/* called with the lock held whenever a line the model watches was written, cdev tells where from */
+static void sim_ds1302_observe(bool cdev, unsigned int gpio_nr, bool was, bool high)
+{
+    struct sim_ds1302 *ds = &sim.ds;
+    if (!ds->attached || ds->cdev != cdev || was == high) {
+        return;
+    }
+    if (gpio_nr == ds->rst) {
+        ds->selected = high;
+        ds->has_cmd = false;
+        ds->bits_in = 0;
+        ds->bits_out = 0;
+        ds->shift = 0;
+        return;
+    }
+    if (gpio_nr != ds->clk || !ds->selected) {
+        return;
+    }
+    bool reading = ds->has_cmd && (ds->cmd & 0x1) != 0;
+    if (high && !reading) {
+        ds->shift |= (sim_ds1302_level(ds, ds->dat) ? 1 : 0) << (ds->bits_in % 8);
+        ++ds->bits_in;
+        if (ds->bits_in % 8 != 0) {
+            return;
+        }
+        if (!ds->has_cmd) {
+            ds->cmd = ds->shift;
+            sim_ds1302_command(ds);
+        } else {
+            sim_ds1302_in(ds, ds->bits_in / 8 - 2, ds->shift);
+        }
+        ds->shift = 0;
+        return;
+    }
+    if (!high && reading) {
+        unsigned int index = ds->bits_out / 8;
+        unsigned char byte = sim_ds1302_out(ds, index);
+        sim_ds1302_drive(ds, ds->dat, ((byte >> (ds->bits_out % 8)) & 1) != 0);
+        if (++ds->bits_out % 8 == 0) {
+            ++ds->stats.bytes_out;
+        }
+    }
+}
+
+static void sim_written(unsigned int gpio_nr, const char *attr, const char *buf, size_t len)
+{
+    if (gpio_nr >= GPIO_SIM_LINES) {
+        return;
+    }
+    pthread_mutex_lock(&sim.lock);
+    struct sim_line *line = &sim.lines[gpio_nr];
+    if (strcmp(attr, "export") == 0) {
+        sim_export(gpio_nr);
+    } else if (strcmp(attr, "unexport") == 0) {
+        sim_unexport(gpio_nr);
+    } else if (!line->exported) {
+        goto unlock;
+    } else if (strcmp(attr, "direction") == 0) {
+        line->output = len >= 3 && strncmp(buf, "out", 3) == 0;
+        /* the kernel starts an output low */
+        if (line->output) {
+            bool was = line->high;
+            line->high = false;
+            sim_store_level(gpio_nr, false);
+            sim_ds1302_observe(false, gpio_nr, was, false);
+        }
+    } else if (strcmp(attr, "edge") == 0) {
+        if (strncmp(buf, "rising", len) == 0) {
+            line->edge = GPIO_RISING;
+        } else if (strncmp(buf, "falling", len) == 0) {
+            line->edge = GPIO_FALLING;
+        } else if (strncmp(buf, "both", len) == 0) {
+            line->edge = GPIO_BOTH;
+        } else {
+            line->edge = GPIO_NONE;
+        }
+    } else if (strcmp(attr, "value") == 0 && len > 0) {
+        bool was = line->high;
+        line->high = buf[0] == '1';
+        sim_ds1302_observe(false, gpio_nr, was, line->high);
+    }
+unlock:
+    pthread_mutex_unlock(&sim.lock);
+}
+
+static int sim_irq_fd(unsigned int gpio_nr)
+{
+    int fd = -1;
+    if (gpio_nr >= GPIO_SIM_LINES) {
+        return fd;
+    }
+    pthread_mutex_lock(&sim.lock);
+    if (sim.lines[gpio_nr].exported) {
+        fd = sim.lines[gpio_nr].irq_fd;
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return fd;
+}
+
+static const struct gpio_sysfs_hooks sim_hooks = {
+    .written = sim_written,
+    .irq_fd = sim_irq_fd,
+};
+
+/* settles exports in the order their delays run out */
+static void *sim_udev_main(void *arg)
+{
+    (void)arg;
+    struct timespec ts;
+    pthread_mutex_lock(&sim.lock);
+    while (!sim.udev_stop) {
+        uint64_t now = gpio_timing_now();
+        uint64_t next = UINT64_MAX;
+        for (unsigned int i = 0; i < GPIO_SIM_LINES; ++i) {
+            struct sim_line *line = &sim.lines[i];
+            if (!line->exported || line->settled) {
+                continue;
+            }
+            if (line->settle_ns <= now) {
+                sim_settle(i);
+            } else if (line->settle_ns < next) {
+                next = line->settle_ns;
+            }
+        }
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&sim.udev_wake, &sim.lock);
+            continue;
+        }
+        ts.tv_sec = next / NSEC_PER_SEC;
+        ts.tv_nsec = next % NSEC_PER_SEC;
+        (void)pthread_cond_timedwait(&sim.udev_wake, &sim.lock, &ts);
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return NULL;
+}
+
+int gpio_sim_set_udev_delay(uint32_t delay_us)
+{
+    int ret = 0;
+    pthread_condattr_t attr;
+    pthread_mutex_lock(&sim.lock);
+    if (!sim.installed) {
+        ret = EINVAL;
+        goto unlock;
+    }
+    sim.udev_us = delay_us;
+    if (delay_us == 0 || sim.udev_running) {
+        goto unlock;
+    }
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim.udev_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    sim.udev_stop = false;
+    if (pthread_create(&sim.udev, NULL, sim_udev_main, NULL) != 0) {
+        ret = EAGAIN;
+        gpio_err("start sim udev failed\n");
+        pthread_cond_destroy(&sim.udev_wake);
+        sim.udev_us = 0;
+        goto unlock;
+    }
+    sim.udev_running = true;
+unlock:
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+static void sim_udev_stop(void)
+{
+    pthread_mutex_lock(&sim.lock);
+    bool running = sim.udev_running;
+    sim.udev_running = false;
+    sim.udev_stop = true;
+    sim.udev_us = 0;
+    if (running) {
+        pthread_cond_signal(&sim.udev_wake);
+    }
+    pthread_mutex_unlock(&sim.lock);
+    if (running) {
+        pthread_join(sim.udev, NULL);
+        pthread_cond_destroy(&sim.udev_wake);
+    }
+}
+
+/* what a gpiochipN directory in the class root tells about the chip */
+static int sim_chip_create(unsigned int base, unsigned int ngpio, const char *label)
+{
+    int ret = 0;
+    char path[PATH_MAX];
+    char buf[16];
+    if (sim.chips == GPIO_SIM_CHIPS || ngpio == 0 || base + ngpio > GPIO_SIM_LINES) {
+        gpio_err("sim chip at %u with %u lines is beyond range\n", base, ngpio);
+        return EINVAL;
+    }
+    for (unsigned int i = 0; i < sim.chips; ++i) {
+        if (base < sim.chip[i].base + sim.chip[i].ngpio && sim.chip[i].base < base + ngpio) {
+            gpio_err("sim chip at %u overlaps the one at %u\n", base, sim.chip[i].base);
+            return EINVAL;
+        }
+    }
+    (void)snprintf(path, sizeof(path), "%s/gpiochip%u", sim.root, base);
+    if (mkdir(path, 0755) == -1) {
+        ret = errno;
+        gpio_err("create %s failed: %s\n", path, strerror(ret));
+        return ret;
+    }
+    (void)snprintf(path, sizeof(path), "%s/gpiochip%u/base", sim.root, base);
+    (void)snprintf(buf, sizeof(buf), "%u\n", base);
+    ret = ret != 0 ? ret : sim_write_file(path, buf);
+    (void)snprintf(path, sizeof(path), "%s/gpiochip%u/ngpio", sim.root, base);
+    (void)snprintf(buf, sizeof(buf), "%u\n", ngpio);
+    ret = ret != 0 ? ret : sim_write_file(path, buf);
+    (void)snprintf(path, sizeof(path), "%s/gpiochip%u/label", sim.root, base);
+    ret = ret != 0 ? ret : sim_write_file(path, label);
+    sim.chip[sim.chips].base = base;
+    sim.chip[sim.chips].ngpio = ngpio;
+    ++sim.chips;
+    return ret;
+}
+
+static void sim_chips_remove(void)
+{
+    static const char *attrs[] = { "base", "ngpio", "label" };
+    char path[PATH_MAX];
+    for (unsigned int i = 0; i < sim.chips; ++i) {
+        for (unsigned int a = 0; a < sizeof(attrs) / sizeof(attrs[0]); ++a) {
+            (void)snprintf(path, sizeof(path), "%s/gpiochip%u/%s", sim.root, sim.chip[i].base, attrs[a]);
+            (void)unlink(path);
+        }
+        (void)snprintf(path, sizeof(path), "%s/gpiochip%u", sim.root, sim.chip[i].base);
+        (void)rmdir(path);
+    }
+    sim.chips = 0;
+}
+
+static void sim_layout(struct gpio_sysfs_layout *layout)
+{
+    layout->class_root = sim.root;
+    layout->line_root = sim.root;
+    layout->settle_ms = 1000;
+}
+
+int gpio_sim_install(void)
+{
+    int ret = 0;
+    char path[PATH_MAX];
+    pthread_mutex_lock(&sim.lock);
+    if (sim.installed) {
+        ret = EBUSY;
+        goto unlock;
+    }
+    (void)snprintf(sim.root, sizeof(sim.root), "/tmp/gpio_sim.XXXXXX");
+    if (mkdtemp(sim.root) == NULL) {
+        ret = errno;
+        gpio_err("create sim root failed: %s\n", strerror(ret));
+        goto unlock;
+    }
+    (void)snprintf(path, sizeof(path), "%s/export", sim.root);
+    ret = sim_write_file(path, "");
+    if (ret != 0) {
+        goto remove_root;
+    }
+    (void)snprintf(path, sizeof(path), "%s/unexport", sim.root);
+    ret = sim_write_file(path, "");
+    if (ret != 0) {
+        goto remove_export;
+    }
+    sim.chips = 0;
+    ret = sim_chip_create(0, GPIO_SIM_CHIP_LINES, "gpio-sim\n");
+    if (ret != 0) {
+        goto remove_chips;
+    }
+    struct gpio_sysfs_layout layout;
+    sim_layout(&layout);
+    ret = gpio_sysfs_configure(&layout);
+    if (ret != 0) {
+        goto remove_chips;
+    }
+    for (unsigned int i = 0; i < GPIO_SIM_LINES; ++i) {
+        memset(&sim.lines[i], 0, sizeof(sim.lines[i]));
+        sim.lines[i].irq_fd = -1;
+    }
+    memset(&sim.ds, 0, sizeof(sim.ds));
+    gpio_sysfs_set_hooks(&sim_hooks);
+    sim.installed = true;
+    goto unlock;
+remove_chips:
+    sim_chips_remove();
+    (void)snprintf(path, sizeof(path), "%s/unexport", sim.root);
+    (void)unlink(path);
+remove_export:
+    (void)snprintf(path, sizeof(path), "%s/export", sim.root);
+    (void)unlink(path);
+remove_root:
+    (void)rmdir(sim.root);
+unlock:
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+void gpio_sim_uninstall(void)
+{
+    char path[PATH_MAX];
+    const struct gpio_sysfs_layout kernel = GPIO_SYSFS_BCM2711;
+    gpio_sim_join();
+    sim_udev_stop();
+    pthread_mutex_lock(&sim.lock);
+    if (!sim.installed) {
+        goto unlock;
+    }
+    gpio_sysfs_set_hooks(NULL);
+    if (gpio_sysfs_configure(&kernel) != 0) {
+        gpio_err("lines still open on the sim\n");
+    }
+    for (unsigned int i = 0; i < GPIO_SIM_LINES; ++i) {
+        sim_unexport(i);
+    }
+    (void)snprintf(path, sizeof(path), "%s/export", sim.root);
+    (void)unlink(path);
+    (void)snprintf(path, sizeof(path), "%s/unexport", sim.root);
+    (void)unlink(path);
+    sim_chips_remove();
+    (void)rmdir(sim.root);
+    sim.ds.attached = false;
+    sim.installed = false;
+unlock:
+    pthread_mutex_unlock(&sim.lock);
+}
+
+int gpio_sim_add_chip(unsigned int base, unsigned int ngpio, const char *label)
+{
+    int ret;
+    char buf[64];
+    struct gpio_sysfs_layout layout;
+    pthread_mutex_lock(&sim.lock);
+    if (!sim.installed) {
+        pthread_mutex_unlock(&sim.lock);
+        return EINVAL;
+    }
+    (void)snprintf(buf, sizeof(buf), "%s\n", label);
+    ret = sim_chip_create(base, ngpio, buf);
+    sim_layout(&layout);
+    pthread_mutex_unlock(&sim.lock);
+    /* the backend only scans chips once per layout, unexports of pooled lines come back into the sim */
+    return ret != 0 ? ret : gpio_sysfs_configure(&layout);
+}
+
+const char *gpio_sim_root(void)
+{
+    return sim.root;
+}
+
+int gpio_sim_set_input(unsigned int gpio_nr, enum gpio_value value)
+{
+    int ret;
+    if (gpio_nr >= GPIO_SIM_LINES) {
+        return EINVAL;
+    }
+    pthread_mutex_lock(&sim.lock);
+    ret = sim_drive(gpio_nr, value == GPIO_HIGH);
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+int gpio_sim_get_output(unsigned int gpio_nr, enum gpio_value *value)
+{
+    int ret = 0;
+    if (gpio_nr >= GPIO_SIM_LINES) {
+        return EINVAL;
+    }
+    pthread_mutex_lock(&sim.lock);
+    if (!sim.lines[gpio_nr].exported) {
+        ret = ENOENT;
+        goto unlock;
+    }
+    *value = sim.lines[gpio_nr].high ? GPIO_HIGH : GPIO_LOW;
+unlock:
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+/* delays add up from the start, so a slow step does not push the rest back */
+static void *sim_play_main(void *arg)
+{
+    (void)arg;
+    uint64_t deadline = gpio_timing_now();
+    for (unsigned int i = 0; i < sim.steps_count; ++i) {
+        const struct gpio_sim_step *step = &sim.steps[i];
+        deadline += (uint64_t)step->delay_us * 1000;
+        gpio_timing_wait_until(deadline);
+        if (gpio_sim_set_input(step->gpio_nr, step->value) != 0) {
+            gpio_err("sim step %u on gpio %u failed\n", i, step->gpio_nr);
+        }
+    }
+    return NULL;
+}
+
+int gpio_sim_play(const struct gpio_sim_step *steps, unsigned int count)
+{
+    int ret = 0;
+    if (count > GPIO_SIM_SCRIPT_MAX) {
+        gpio_err("sim script of %u steps is too long\n", count);
+        return EINVAL;
+    }
+    pthread_mutex_lock(&sim.lock);
+    if (sim.playing) {
+        ret = EBUSY;
+        goto unlock;
+    }
+    memcpy(sim.steps, steps, sizeof(*steps) * count);
+    sim.steps_count = count;
+    if (pthread_create(&sim.player, NULL, sim_play_main, NULL) != 0) {
+        ret = EAGAIN;
+        gpio_err("start sim player failed\n");
+        goto unlock;
+    }
+    sim.playing = true;
+unlock:
+    pthread_mutex_unlock(&sim.lock);
+    return ret;
+}
+
+void gpio_sim_join(void)
+{
+    pthread_mutex_lock(&sim.lock);
+    bool playing = sim.playing;
+    sim.playing = false;
+    pthread_mutex_unlock(&sim.lock);
+    if (playing) {
+        pthread_join(sim.player, NULL);
+    }
+}
+
+/* the cdev mock's lock is held, it is always taken before the simulator's */
+static void sim_ds1302_wire(unsigned int offset, bool high, void *data)
+{
+    (void)data;
+    pthread_mutex_lock(&sim.lock);
+    sim_ds1302_observe(true, offset, !high, high);
+    pthread_mutex_unlock(&sim.lock);
+}
+
+static int sim_ds1302_attach(bool cdev, unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr, time_t now)
+{
+    struct tm tm;
+    if (clk_nr >= GPIO_SIM_LINES || dat_nr >= GPIO_SIM_LINES || rst_nr >= GPIO_SIM_LINES) {
+        return EINVAL;
+    }
+    (void)gmtime_r(&now, &tm);
+    pthread_mutex_lock(&sim.lock);
+    struct sim_ds1302 *ds = &sim.ds;
+    memset(ds, 0, sizeof(*ds));
+    ds->cdev = cdev;
+    ds->clk = clk_nr;
+    ds->dat = dat_nr;
+    ds->rst = rst_nr;
+    ds->base = now;
+    ds->base_ns = gpio_timing_now();
+    ds->base_day = tm.tm_wday + 1;
+    ds->attached = true;
+    pthread_mutex_unlock(&sim.lock);
+    if (cdev) {
+        gpio_cdev_mock_attach(sim_ds1302_wire, NULL);
+    }
+    return 0;
+}
+
+int gpio_sim_ds1302_attach(unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr, time_t now)
+{
+    return sim_ds1302_attach(false, clk_nr, dat_nr, rst_nr, now);
+}
+
+int gpio_sim_ds1302_attach_cdev(unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr, time_t now)
+{
+    return sim_ds1302_attach(true, clk_nr, dat_nr, rst_nr, now);
+}
+
+void gpio_sim_ds1302_detach(void)
+{
+    pthread_mutex_lock(&sim.lock);
+    bool cdev = sim.ds.attached && sim.ds.cdev;
+    sim.ds.attached = false;
+    pthread_mutex_unlock(&sim.lock);
+    if (cdev) {
+        gpio_cdev_mock_attach(NULL, NULL);
+    }
+}
+
+void gpio_sim_ds1302_stats(struct gpio_sim_ds1302_stats *stats)
+{
+    pthread_mutex_lock(&sim.lock);
+    *stats = sim.ds.stats;
+    pthread_mutex_unlock(&sim.lock);
+}
@@ -0,0 +1,73 @@
+#ifndef GPIO_SIM_H
+#define GPIO_SIM_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "gpio.h"
+
+/* global line numbers the simulator can export, spread over up to GPIO_SIM_CHIPS chips */
+#define GPIO_SIM_LINES 1024
+#define GPIO_SIM_CHIPS 8
+/* the chip every install starts with, at base 0 */
+#define GPIO_SIM_CHIP_LINES 64
+/* scripted input changes queued at once */
+#define GPIO_SIM_SCRIPT_MAX 256
+
+/*
+ * builds a sysfs tree of plain files under a fresh directory in /tmp and
+ * points the sysfs backend at it, exports create the gpioN files, writes
+ * reach the models below and inputs raise edges through an eventfd shim
+ */
+int gpio_sim_install(void);
+/* all lines must be closed, removes the tree */
+void gpio_sim_uninstall(void);
+const char *gpio_sim_root(void);
+
+/* one more gpiochip in the class root, added while no line is open */
+int gpio_sim_add_chip(unsigned int base, unsigned int ngpio, const char *label);
+
+/*
+ * exports leave the attribute files missing for delay_us, like a line udev
+ * has not got to yet, 0 creates them with the export as before
+ */
+int gpio_sim_set_udev_delay(uint32_t delay_us);
+
+/* drive an input from outside, an edge is raised when the edge attribute asks for it */
+int gpio_sim_set_input(unsigned int gpio_nr, enum gpio_value value);
+/* level last written to a line */
+int gpio_sim_get_output(unsigned int gpio_nr, enum gpio_value *value);
+
+/* one input change, delay_us after the previous one */
+struct gpio_sim_step {
+    uint32_t delay_us;
+    unsigned int gpio_nr;
+    enum gpio_value value;
+};
+
+/* plays the steps from a helper thread, one script at a time */
+int gpio_sim_play(const struct gpio_sim_step *steps, unsigned int count);
+/* waits for the script to finish */
+void gpio_sim_join(void);
+
+/*
+ * DS1302 on three lines: commands and data shift in on rising clk and read
+ * data is driven onto dat on falling clk while rst is high. The clock runs
+ * from the host's monotonic clock starting at now, 24 hour mode only,
+ * years map onto RTC_YEAR_BASE + 0..99 like the driver expects.
+ */
+int gpio_sim_ds1302_attach(unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr, time_t now);
+/* the same chip on the lines of the cdev mock, which must be installed */
+int gpio_sim_ds1302_attach_cdev(unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr, time_t now);
+void gpio_sim_ds1302_detach(void);
+
+struct gpio_sim_ds1302_stats {
+    uint64_t commands;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t clock_sets;
+};
+
+void gpio_sim_ds1302_stats(struct gpio_sim_ds1302_stats *stats);
+
+#endif
@@ -0,0 +1,449 @@
+/*
+ * Latency histograms behind -DGPIO_STATS. Every thread records into its own
+ * block of counters, found through a thread local pointer and linked into
+ * a list once, so the hot path is two clock reads and a relaxed store with
+ * no lock and no shared cache line. Lines get their row on first sight
+ * through a byte per line number, the only time the row lock is taken. Snapshots walk the list and sum; reset
+ * only moves a baseline the snapshots subtract, so writers never stop.
+ * The backends are timed from outside: get_gpio_ops() hands out a copy of
+ * the backend's table with the timed entries pointing at forwarders here.
+ */
+#include "gpio_stats.h"
+#include "gpio_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+static const char *op_names[GPIO_STATS_OP_MAX] = {
+    [GPIO_STATS_OPEN] = "open",
+    [GPIO_STATS_CLOSE] = "close",
+    [GPIO_STATS_SET_DIRECTION] = "set_direction",
+    [GPIO_STATS_SET_VALUE] = "set_value",
+    [GPIO_STATS_GET_VALUE] = "get_value",
+    [GPIO_STATS_SET_EDGE] = "set_edge",
+    [GPIO_STATS_SET_VALUES] = "set_values",
+    [GPIO_STATS_GET_VALUES] = "get_values",
+    [GPIO_STATS_SET_DIRECTIONS] = "set_directions",
+    [GPIO_STATS_READ_EVENT] = "read_event",
+    [GPIO_STATS_IRQ] = "irq",
+    [GPIO_STATS_DISPATCH] = "dispatch",
+};
+
+const char *gpio_stats_op_name(enum gpio_stats_op op)
+{
+    return op < GPIO_STATS_OP_MAX ? op_names[op] : "unknown";
+}
+
+#ifdef GPIO_STATS
+
+struct stats_block {
+    struct stats_block *next;
+    uint64_t hist[GPIO_STATS_LINES][GPIO_STATS_OP_MAX][GPIO_STATS_BUCKETS];
+};
+
+/* blocks outlive their threads, their counts stay in the sums */
+static __thread struct stats_block *mine = NULL;
+static struct stats_block *blocks = NULL;
+static pthread_mutex_t baseline_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct gpio_stats_snapshot baseline;
+static struct gpio_stats_snapshot scratch;
+
+/* row + 1 per line number, 0 before the line was first recorded */
+#define STATS_NRS 65536
+static uint8_t row_of[STATS_NRS];
+static unsigned int row_nr[GPIO_STATS_OTHER];
+static unsigned int rows;
+static pthread_mutex_t row_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t gpio_stats_clock(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct stats_block *stats_attach(void)
+{
+    struct stats_block *block = (struct stats_block *)gpio_alloc(sizeof(struct stats_block));
+    if (block == NULL) {
+        gpio_err("alloc stats block failed\n");
+        return NULL;
+    }
+    block->next = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&blocks, &block->next, block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    mine = block;
+    return block;
+}
+
+int gpio_stats_attach(void)
+{
+    return mine != NULL || stats_attach() != NULL ? 0 : ENOMEM;
+}
+
+static unsigned int stats_new_row(unsigned int gpio_nr)
+{
+    pthread_mutex_lock(&row_lock);
+    unsigned int row = row_of[gpio_nr];
+    if (row == 0) {
+        row = rows < GPIO_STATS_OTHER ? rows++ : GPIO_STATS_OTHER;
+        if (row != GPIO_STATS_OTHER) {
+            row_nr[row] = gpio_nr;
+        }
+        __atomic_store_n(&row_of[gpio_nr], (uint8_t)(row + 1), __ATOMIC_RELEASE);
+    } else {
+        --row;
+    }
+    pthread_mutex_unlock(&row_lock);
+    return row;
+}
+
+static unsigned int stats_row(unsigned int gpio_nr)
+{
+    if (gpio_nr >= STATS_NRS) {
+        return GPIO_STATS_OTHER;
+    }
+    unsigned int row = __atomic_load_n(&row_of[gpio_nr], __ATOMIC_ACQUIRE);
+    return __builtin_expect(row != 0, 1) ? row - 1 : stats_new_row(gpio_nr);
+}
+
+static unsigned int stats_bucket(uint64_t ns)
+{
+    unsigned int b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    return b < GPIO_STATS_BUCKETS ? b : GPIO_STATS_BUCKETS - 1;
+}
+
+/* the owning thread is the only writer, the store is atomic only so readers never see it torn */
+void gpio_stats_record(enum gpio_stats_op op, unsigned int gpio_nr, uint64_t ns)
+{
+    struct stats_block *block = mine;
+    if (__builtin_expect(block == NULL, 0)) {
+        block = stats_attach();
+        if (block == NULL) {
+            return;
+        }
+    }
+    uint64_t *slot = &block->hist[stats_row(gpio_nr)][op][stats_bucket(ns)];
+    __atomic_store_n(slot, *slot + 1, __ATOMIC_RELAXED);
+}
+
+static void stats_sum(struct gpio_stats_snapshot *snap)
+{
+    uint64_t *out = &snap->hist[0][0][0];
+    const size_t n = sizeof(snap->hist) / sizeof(uint64_t);
+    memset(snap, 0, sizeof(*snap));
+    for (struct stats_block *b = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+        const uint64_t *in = &b->hist[0][0][0];
+        for (size_t i = 0; i < n; ++i) {
+            out[i] += __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void gpio_stats_snapshot(struct gpio_stats_snapshot *snap)
+{
+    uint64_t *out = &snap->hist[0][0][0];
+    const uint64_t *base = &baseline.hist[0][0][0];
+    stats_sum(snap);
+    /* after the sum, so every row that has counts is named */
+    pthread_mutex_lock(&row_lock);
+    snap->rows = rows;
+    memcpy(snap->gpio_nr, row_nr, sizeof(row_nr));
+    pthread_mutex_unlock(&row_lock);
+    pthread_mutex_lock(&baseline_lock);
+    for (size_t i = 0; i < sizeof(snap->hist) / sizeof(uint64_t); ++i) {
+        out[i] -= base[i];
+    }
+    pthread_mutex_unlock(&baseline_lock);
+}
+
+void gpio_stats_reset(void)
+{
+    pthread_mutex_lock(&baseline_lock);
+    stats_sum(&scratch);
+    baseline = scratch;
+    pthread_mutex_unlock(&baseline_lock);
+}
+
+/* the backend tables being timed, filled once per backend */
+static struct gpio_ops *inner[GPIO_BACKEND_MAX];
+static struct gpio_ops wrapped[GPIO_BACKEND_MAX];
+static bool ready[GPIO_BACKEND_MAX];
+static pthread_mutex_t wrap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct stats_irq {
+    irq_handler handler;
+    void *data;
+    unsigned int gpio_nr;
+};
+
+static int stats_dispatch(enum gpio_value signal, void *data)
+{
+    struct stats_irq *irq = (struct stats_irq *)data;
+    GPIO_STATS_BEGIN(t);
+    int ret = irq->handler(signal, irq->data);
+    GPIO_STATS_END(t, GPIO_STATS_DISPATCH, irq->gpio_nr);
+    return ret;
+}
+
+static unsigned int stats_set_nr(const gpio_set *set)
+{
+    return set->count != 0 ? set->lines[0]->gpio_nr : 0;
+}
+
+static gpio *stats_open(struct gpio_ops *ops, unsigned int gpio_nr)
+{
+    GPIO_STATS_BEGIN(t);
+    gpio *io = ops->open(gpio_nr);
+    GPIO_STATS_END(t, GPIO_STATS_OPEN, gpio_nr);
+    return io;
+}
+
+static void stats_close(struct gpio_ops *ops, gpio *io)
+{
+    unsigned int gpio_nr = io->gpio_nr;
+    GPIO_STATS_BEGIN(t);
+    ops->close(io);
+    GPIO_STATS_END(t, GPIO_STATS_CLOSE, gpio_nr);
+}
+
+#define STATS_TIMED(op, nr, call) \
+    do { \
+        GPIO_STATS_BEGIN(t); \
+        int ret = (call); \
+        GPIO_STATS_END(t, op, nr); \
+        return ret; \
+    } while (0)
+
+static int stats_wait_event(struct gpio_ops *ops, gpio *io, struct gpio_event *event, int timeout_ms)
+{
+    int ret = ops->wait_event(io, event, timeout_ms);
+    if (ret == 0) {
+        GPIO_STATS_SINCE(event->timestamp_ns, GPIO_STATS_IRQ, io->gpio_nr);
+    }
+    return ret;
+}
+
+static int stats_handle_irq(struct gpio_ops *ops, gpio *io, irq_handler handler, void *data)
+{
+    struct stats_irq irq = { .handler = handler, .data = data, .gpio_nr = io->gpio_nr };
+    return ops->handle_irq(io, stats_dispatch, &irq);
+}
+
+/* forwarders bound to one backend, the handles carry no pointer back to their table */
+#define STATS_FORWARDERS(b) \
+static gpio *stats_open_##b(unsigned int gpio_nr) \
+{ \
+    return stats_open(inner[b], gpio_nr); \
+} \
+static void stats_close_##b(gpio *io) \
+{ \
+    stats_close(inner[b], io); \
+} \
+static int stats_set_direction_##b(gpio *io, enum gpio_direction dir) \
+{ \
+    STATS_TIMED(GPIO_STATS_SET_DIRECTION, io->gpio_nr, inner[b]->set_direction(io, dir)); \
+} \
+static int stats_set_value_##b(gpio *io, enum gpio_value value) \
+{ \
+    STATS_TIMED(GPIO_STATS_SET_VALUE, io->gpio_nr, inner[b]->set_value(io, value)); \
+} \
+static int stats_get_value_##b(gpio *io, enum gpio_value *value) \
+{ \
+    STATS_TIMED(GPIO_STATS_GET_VALUE, io->gpio_nr, inner[b]->get_value(io, value)); \
+} \
+static int stats_set_edge_##b(gpio *io, enum gpio_edge edge) \
+{ \
+    STATS_TIMED(GPIO_STATS_SET_EDGE, io->gpio_nr, inner[b]->set_edge(io, edge)); \
+} \
+static int stats_handle_irq_##b(gpio *io, irq_handler handler, void *data) \
+{ \
+    return stats_handle_irq(inner[b], io, handler, data); \
+} \
+static int stats_wait_event_##b(gpio *io, struct gpio_event *event, int timeout_ms) \
+{ \
+    return stats_wait_event(inner[b], io, event, timeout_ms); \
+} \
+static int stats_set_values_##b(gpio_set *set, uint64_t mask, uint64_t bits) \
+{ \
+    STATS_TIMED(GPIO_STATS_SET_VALUES, stats_set_nr(set), inner[b]->set_values(set, mask, bits)); \
+} \
+static int stats_get_values_##b(gpio_set *set, uint64_t *bits) \
+{ \
+    STATS_TIMED(GPIO_STATS_GET_VALUES, stats_set_nr(set), inner[b]->get_values(set, bits)); \
+} \
+static int stats_set_directions_##b(gpio_set *set, uint64_t mask, uint64_t out) \
+{ \
+    STATS_TIMED(GPIO_STATS_SET_DIRECTIONS, stats_set_nr(set), inner[b]->set_directions(set, mask, out)); \
+} \
+static int stats_read_event_##b(gpio *io, struct gpio_event *event) \
+{ \
+    STATS_TIMED(GPIO_STATS_READ_EVENT, io->gpio_nr, inner[b]->read_event(io, event)); \
+} \
+static void stats_override_##b(struct gpio_ops *ops) \
+{ \
+    ops->open = stats_open_##b; \
+    ops->close = stats_close_##b; \
+    ops->set_direction = stats_set_direction_##b; \
+    ops->set_value = stats_set_value_##b; \
+    ops->get_value = stats_get_value_##b; \
+    ops->set_edge = stats_set_edge_##b; \
+    ops->handle_irq = stats_handle_irq_##b; \
+    ops->wait_event = stats_wait_event_##b; \
+    ops->set_values = stats_set_values_##b; \
+    ops->get_values = stats_get_values_##b; \
+    ops->set_directions = stats_set_directions_##b; \
+    ops->read_event = stats_read_event_##b; \
+}
+
+STATS_FORWARDERS(0)
+STATS_FORWARDERS(1)
+STATS_FORWARDERS(2)
+
+_Static_assert(GPIO_BACKEND_MAX == 3, "one STATS_FORWARDERS per backend");
+
+static void (*const overrides[GPIO_BACKEND_MAX])(struct gpio_ops *ops) = {
+    stats_override_0,
+    stats_override_1,
+    stats_override_2,
+};
+
+/* set_open, set_close and the control entries pass straight through */
+struct gpio_ops *gpio_stats_wrap(enum gpio_backend backend, struct gpio_ops *ops)
+{
+    if (__atomic_load_n(&ready[backend], __ATOMIC_ACQUIRE)) {
+        return &wrapped[backend];
+    }
+    pthread_mutex_lock(&wrap_lock);
+    if (!ready[backend]) {
+        inner[backend] = ops;
+        wrapped[backend] = *ops;
+        overrides[backend](&wrapped[backend]);
+        __atomic_store_n(&ready[backend], true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&wrap_lock);
+    return &wrapped[backend];
+}
+
+#else
+
+int gpio_stats_attach(void)
+{
+    return 0;
+}
+
+void gpio_stats_snapshot(struct gpio_stats_snapshot *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+}
+
+void gpio_stats_reset(void)
+{
+}
+
+#endif
+
+uint64_t gpio_stats_percentile(const uint64_t *hist, unsigned int p)
+{
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < GPIO_STATS_BUCKETS; ++b) {
+        total += hist[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (total * p + 99) / 100;
+    for (unsigned int b = 0; b < GPIO_STATS_BUCKETS; ++b) {
+        seen += hist[b];
+        if (seen >= rank && seen != 0) {
+            return 1ull << b;
+        }
+    }
+    return 1ull << (GPIO_STATS_BUCKETS - 1);
+}
+
+static uint64_t stats_count(const uint64_t *hist)
+{
+    uint64_t total = 0;
+    for (unsigned int b = 0; b < GPIO_STATS_BUCKETS; ++b) {
+        total += hist[b];
+    }
+    return total;
+}
+
+/* the named rows, then the other row, by row index */
+static unsigned int stats_next_row(const struct gpio_stats_snapshot *snap, unsigned int row)
+{
+    return row + 1 < snap->rows ? row + 1 : row < GPIO_STATS_OTHER ? GPIO_STATS_OTHER : GPIO_STATS_LINES;
+}
+
+static const char *stats_line_name(const struct gpio_stats_snapshot *snap, unsigned int row, char *buf, size_t len)
+{
+    if (row == GPIO_STATS_OTHER) {
+        return "other";
+    }
+    (void)snprintf(buf, len, "%u", snap->gpio_nr[row]);
+    return buf;
+}
+
+void gpio_stats_print(FILE *out, const struct gpio_stats_snapshot *snap)
+{
+    char name[16];
+    fprintf(out, "%-5s %-14s %10s %10s %10s %10s\n", "line", "op", "count", "p50<ns", "p99<ns", "max<ns");
+    for (unsigned int row = snap->rows != 0 ? 0 : GPIO_STATS_OTHER; row < GPIO_STATS_LINES;
+         row = stats_next_row(snap, row)) {
+        for (int op = 0; op < GPIO_STATS_OP_MAX; ++op) {
+            const uint64_t *hist = snap->hist[row][op];
+            uint64_t count = stats_count(hist);
+            if (count == 0) {
+                continue;
+            }
+            fprintf(out, "%-5s %-14s %10llu %10llu %10llu %10llu\n", stats_line_name(snap, row, name, sizeof(name)),
+                    gpio_stats_op_name(op),
+                    (unsigned long long)count, (unsigned long long)gpio_stats_percentile(hist, 50),
+                    (unsigned long long)gpio_stats_percentile(hist, 99),
+                    (unsigned long long)gpio_stats_percentile(hist, 100));
+        }
+    }
+}
+
+/* buckets are listed by their upper bound so a reader needs no knowledge of the layout */
+void gpio_stats_print_json(FILE *out, const struct gpio_stats_snapshot *snap)
+{
+    char name[16];
+    bool first = true;
+    fprintf(out, "[");
+    for (unsigned int row = snap->rows != 0 ? 0 : GPIO_STATS_OTHER; row < GPIO_STATS_LINES;
+         row = stats_next_row(snap, row)) {
+        /* the other row is a string, a line number a number */
+        const char *quote = row == GPIO_STATS_OTHER ? "\"" : "";
+        for (int op = 0; op < GPIO_STATS_OP_MAX; ++op) {
+            const uint64_t *hist = snap->hist[row][op];
+            uint64_t count = stats_count(hist);
+            if (count == 0) {
+                continue;
+            }
+            fprintf(out, "%s\n  {\"line\": %s%s%s, \"op\": \"%s\", \"count\": %llu, \"p50\": %llu, \"p90\": %llu, "
+                    "\"p99\": %llu, \"buckets\": {", first ? "" : ",", quote,
+                    stats_line_name(snap, row, name, sizeof(name)), quote, gpio_stats_op_name(op),
+                    (unsigned long long)count, (unsigned long long)gpio_stats_percentile(hist, 50),
+                    (unsigned long long)gpio_stats_percentile(hist, 90),
+                    (unsigned long long)gpio_stats_percentile(hist, 99));
+            bool first_bucket = true;
+            for (unsigned int b = 0; b < GPIO_STATS_BUCKETS; ++b) {
+                if (hist[b] == 0) {
+                    continue;
+                }
+                fprintf(out, "%s\"%llu\": %llu", first_bucket ? "" : ", ", 1ull << b, (unsigned long long)hist[b]);
+                first_bucket = false;
+            }
+            fprintf(out, "}}");
+            first = false;
+        }
+    }
+    fprintf(out, "\n]\n");
+}
@@ -0,0 +1,81 @@
+#ifndef GPIO_STATS_H
+#define GPIO_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "gpio.h"
+
+/*
+ * latency histograms per line and operation, only recorded when built
+ * with -DGPIO_STATS; without it get_gpio_ops() hands out the backends'
+ * own tables, nothing below records and snapshots stay empty
+ */
+
+/*
+ * rows are handed to lines in the order they are first recorded, whatever
+ * their numbers, the last row counts every line that came after the others
+ */
+#define GPIO_STATS_LINES 64
+#define GPIO_STATS_OTHER (GPIO_STATS_LINES - 1)
+/* bucket b counts latencies in [2^(b-1), 2^b) ns, the last one everything above */
+#define GPIO_STATS_BUCKETS 24
+
+enum gpio_stats_op {
+    GPIO_STATS_OPEN = 0,
+    GPIO_STATS_CLOSE = 1,
+    GPIO_STATS_SET_DIRECTION = 2,
+    GPIO_STATS_SET_VALUE = 3,
+    GPIO_STATS_GET_VALUE = 4,
+    GPIO_STATS_SET_EDGE = 5,
+    GPIO_STATS_SET_VALUES = 6,      /* set ops count under their first line */
+    GPIO_STATS_GET_VALUES = 7,
+    GPIO_STATS_SET_DIRECTIONS = 8,
+    GPIO_STATS_READ_EVENT = 9,
+    GPIO_STATS_IRQ = 10,            /* edge timestamp to the event reaching its consumer */
+    GPIO_STATS_DISPATCH = 11,       /* irq handler run time */
+    GPIO_STATS_OP_MAX,
+};
+
+struct gpio_stats_snapshot {
+    unsigned int rows;                          /* rows naming a line, GPIO_STATS_OTHER comes on top */
+    unsigned int gpio_nr[GPIO_STATS_OTHER];     /* line counted by each of them */
+    uint64_t hist[GPIO_STATS_LINES][GPIO_STATS_OP_MAX][GPIO_STATS_BUCKETS];
+};
+
+#ifdef GPIO_STATS
+uint64_t gpio_stats_clock(void);
+void gpio_stats_record(enum gpio_stats_op op, unsigned int gpio_nr, uint64_t ns);
+/* wraps a backend's table, every entry point records into the histograms */
+struct gpio_ops *gpio_stats_wrap(enum gpio_backend backend, struct gpio_ops *ops);
+
+#define GPIO_STATS_BEGIN(t) uint64_t t = gpio_stats_clock()
+#define GPIO_STATS_END(t, op, nr) gpio_stats_record(op, nr, gpio_stats_clock() - (t))
+#define GPIO_STATS_SINCE(ts, op, nr) gpio_stats_record(op, nr, gpio_stats_clock() - (ts))
+#else
+#define GPIO_STATS_BEGIN(t) do { } while (0)
+#define GPIO_STATS_END(t, op, nr) do { } while (0)
+#define GPIO_STATS_SINCE(ts, op, nr) do { } while (0)
+#endif
+
+/*
+ * allocates the calling thread's counters now, 0 or ENOMEM. A thread that
+ * records without it allocates them on its first record instead, off the
+ * arena but on that call's path. Threads the library starts attach
+ * themselves; without -DGPIO_STATS it does nothing
+ */
+int gpio_stats_attach(void);
+
+/* sums every thread's counters since the last reset, writers are never stopped */
+void gpio_stats_snapshot(struct gpio_stats_snapshot *snap);
+void gpio_stats_reset(void);
+
+const char *gpio_stats_op_name(enum gpio_stats_op op);
+/* upper bound in ns of the bucket holding the p-th percentile, 0 when empty */
+uint64_t gpio_stats_percentile(const uint64_t *hist, unsigned int p);
+
+/* one row per line and operation that saw calls */
+void gpio_stats_print(FILE *out, const struct gpio_stats_snapshot *snap);
+void gpio_stats_print_json(FILE *out, const struct gpio_stats_snapshot *snap);
+
+#endif
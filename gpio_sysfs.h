@@ -0,0 +1,51 @@
+#ifndef GPIO_SYSFS_H
+#define GPIO_SYSFS_H
+
+#include <stddef.h>
+
+#include "gpio.h"
+#include "gpio_pool.h"
+#include "gpio_registry.h"
+
+/* where the sysfs backend finds its files */
+struct gpio_sysfs_layout {
+    const char *class_root;     /* holds export and unexport */
+    const char *line_root;      /* holds the gpioN directories */
+    unsigned int settle_ms;     /* how long opens wait for udev to finish a fresh export */
+};
+
+/* BCM2711 (raspberry pi 4) */
+#define GPIO_SYSFS_BCM2711 { \
+    .class_root = "/sys/class/gpio", \
+    .line_root = "/sys/devices/platform/soc/fe200000.gpio/gpiochip0/gpio", \
+    .settle_ms = 2000, \
+}
+
+/* releases idle pooled lines, then fails with EBUSY while any are open, the strings must outlive the layout */
+int gpio_sysfs_configure(const struct gpio_sysfs_layout *layout);
+
+/*
+ * lets an in-process model play the kernel side of a tree of plain files,
+ * written runs synchronously after every export, unexport and attribute
+ * write went through, irq_fd hands out an fd that turns readable on edges
+ * because a plain value file never raises POLLPRI
+ */
+struct gpio_sysfs_hooks {
+    void (*written)(unsigned int gpio_nr, const char *attr, const char *buf, size_t len);
+    int (*irq_fd)(unsigned int gpio_nr);
+};
+
+/* NULL restores the kernel */
+void gpio_sysfs_set_hooks(const struct gpio_sysfs_hooks *hooks);
+
+/*
+ * closed lines stay exported with their attribute fds open for the next open,
+ * tune or disable through the pool policy and flush before exit so nothing is
+ * left exported
+ */
+struct gpio_pool *gpio_sysfs_pool(void);
+
+/* the chips lines are opened on, scanned once per layout, NULL when none is found */
+const struct gpio_registry *gpio_sysfs_registry(void);
+
+#endif
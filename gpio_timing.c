@@ -0,0 +1,157 @@
+/*
+ * Bit-bang timing. A wait sleeps with an absolute clock_nanosleep until
+ * slack before its deadline and spins on CLOCK_MONOTONIC for the rest,
+ * slack being the wakeup latency measured at calibration. Short waits
+ * never sleep at all, since a wakeup alone costs more than they last.
+ */
+#include "gpio_timing.h"
+#include "gpio.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#define NSEC_PER_SEC 1000000000ull
+/* sleep length used to measure the wakeup latency */
+#define CALIBRATE_SLEEP_NS 200000
+
+#if defined(__aarch64__)
+#define cpu_relax() __asm__ volatile("yield" ::: "memory")
+#elif defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ volatile("" ::: "memory")
+#endif
+
+static pthread_once_t calibrated = PTHREAD_ONCE_INIT;
+static uint64_t slack_ns;
+static struct gpio_timing_stats timing_stats;
+
+uint64_t gpio_timing_now(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void gpio_timing_sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts = { .tv_sec = deadline_ns / NSEC_PER_SEC, .tv_nsec = deadline_ns % NSEC_PER_SEC };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static int gpio_timing_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* the 90th percentile, the rare later wakeup is caught by the spin being late */
+static void gpio_timing_measure(void)
+{
+    uint64_t late[GPIO_TIMING_SAMPLES];
+    for (int i = 0; i < GPIO_TIMING_SAMPLES; ++i) {
+        uint64_t deadline = gpio_timing_now() + CALIBRATE_SLEEP_NS;
+        gpio_timing_sleep_until(deadline);
+        uint64_t now = gpio_timing_now();
+        late[i] = now > deadline ? now - deadline : 0;
+    }
+    qsort(late, GPIO_TIMING_SAMPLES, sizeof(late[0]), gpio_timing_cmp);
+    __atomic_store_n(&slack_ns, late[GPIO_TIMING_SAMPLES * 9 / 10], __ATOMIC_RELAXED);
+}
+
+void gpio_timing_calibrate(void)
+{
+    (void)pthread_once(&calibrated, gpio_timing_measure);
+}
+
+uint64_t gpio_timing_slack(void)
+{
+    gpio_timing_calibrate();
+    return __atomic_load_n(&slack_ns, __ATOMIC_RELAXED);
+}
+
+static void gpio_timing_account(uint64_t deadline_ns, uint64_t now, bool slept)
+{
+    uint64_t late = now > deadline_ns ? now - deadline_ns : 0;
+    uint64_t late_us = late / 1000;
+    (void)__atomic_fetch_add(&timing_stats.waits, 1, __ATOMIC_RELAXED);
+    (void)__atomic_fetch_add(&timing_stats.slept, slept ? 1 : 0, __ATOMIC_RELAXED);
+    (void)__atomic_fetch_add(&timing_stats.late_sum_ns, late, __ATOMIC_RELAXED);
+    (void)__atomic_fetch_add(&timing_stats.late_sq_sum, late_us * late_us, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&timing_stats.late_max_ns, __ATOMIC_RELAXED);
+    while (late > max && !__atomic_compare_exchange_n(&timing_stats.late_max_ns, &max, late, true,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void gpio_timing_wait_until(uint64_t deadline_ns)
+{
+    uint64_t slack = gpio_timing_slack();
+    uint64_t now = gpio_timing_now();
+    bool slept = false;
+    if (deadline_ns > now && deadline_ns - now > slack + GPIO_TIMING_SPIN_NS) {
+        gpio_timing_sleep_until(deadline_ns - slack);
+        slept = true;
+        now = gpio_timing_now();
+    }
+    while (now < deadline_ns) {
+        cpu_relax();
+        now = gpio_timing_now();
+    }
+    gpio_timing_account(deadline_ns, now, slept);
+}
+
+void gpio_period_start(struct gpio_period *period, uint64_t period_ns)
+{
+    gpio_timing_calibrate();
+    period->period_ns = period_ns;
+    period->deadline_ns = gpio_timing_now();
+}
+
+void gpio_period_wait(struct gpio_period *period)
+{
+    period->deadline_ns += period->period_ns;
+    uint64_t now = gpio_timing_now();
+    /* preempted past a whole period, catching up would only run the edges together */
+    if (now > period->deadline_ns + period->period_ns) {
+        (void)__atomic_fetch_add(&timing_stats.overruns, 1, __ATOMIC_RELAXED);
+        period->deadline_ns = now;
+    }
+    gpio_timing_wait_until(period->deadline_ns);
+}
+
+void gpio_timing_stats(struct gpio_timing_stats *stats)
+{
+    stats->waits = __atomic_load_n(&timing_stats.waits, __ATOMIC_RELAXED);
+    stats->slept = __atomic_load_n(&timing_stats.slept, __ATOMIC_RELAXED);
+    stats->overruns = __atomic_load_n(&timing_stats.overruns, __ATOMIC_RELAXED);
+    stats->late_sum_ns = __atomic_load_n(&timing_stats.late_sum_ns, __ATOMIC_RELAXED);
+    stats->late_sq_sum = __atomic_load_n(&timing_stats.late_sq_sum, __ATOMIC_RELAXED);
+    stats->late_max_ns = __atomic_load_n(&timing_stats.late_max_ns, __ATOMIC_RELAXED);
+}
+
+void gpio_timing_reset_stats(void)
+{
+    __atomic_store_n(&timing_stats.waits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&timing_stats.slept, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&timing_stats.overruns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&timing_stats.late_sum_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&timing_stats.late_sq_sum, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&timing_stats.late_max_ns, 0, __ATOMIC_RELAXED);
+}
+
+void gpio_timing_stats_print(FILE *out, const struct gpio_timing_stats *stats)
+{
+    double mean = stats->waits == 0 ? 0.0 : (double)stats->late_sum_ns / stats->waits / 1000;
+    double sq = stats->waits == 0 ? 0.0 : (double)stats->late_sq_sum / stats->waits;
+    double dev = sq > mean * mean ? sqrt(sq - mean * mean) : 0.0;
+    fprintf(out, "waits %llu slept %llu overruns %llu slack %.1fus late mean %.2fus dev %.2fus max %.2fus\n",
+            (unsigned long long)stats->waits, (unsigned long long)stats->slept,
+            (unsigned long long)stats->overruns, gpio_timing_slack() / 1000.0,
+            mean, dev, stats->late_max_ns / 1000.0);
+}
@@ -0,0 +1,51 @@
+#ifndef GPIO_TIMING_H
+#define GPIO_TIMING_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* waits at most this long are spun outright instead of sleeping first */
+#define GPIO_TIMING_SPIN_NS 100000
+/* sleeps measured by the calibration */
+#define GPIO_TIMING_SAMPLES 64
+
+/*
+ * measure how late clock_nanosleep wakes up on this machine, runs once,
+ * later calls return at once, waits calibrate on first use if nobody did
+ */
+void gpio_timing_calibrate(void);
+/* sleep overshoot the calibration settled on, waits wake this early and spin the rest */
+uint64_t gpio_timing_slack(void);
+
+uint64_t gpio_timing_now(void);   /* CLOCK_MONOTONIC */
+
+/* absolute deadline, sleeps through the bulk of the wait and spins the tail */
+void gpio_timing_wait_until(uint64_t deadline_ns);
+
+/*
+ * fixed rate schedule, each wait ends one period after the previous
+ * deadline rather than after the caller woke up, so lateness never adds up
+ */
+struct gpio_period {
+    uint64_t deadline_ns;
+    uint64_t period_ns;
+};
+
+void gpio_period_start(struct gpio_period *period, uint64_t period_ns);
+void gpio_period_wait(struct gpio_period *period);
+
+/* lateness of every wait against its deadline */
+struct gpio_timing_stats {
+    uint64_t waits;
+    uint64_t slept;         /* waits that went through clock_nanosleep */
+    uint64_t overruns;      /* period waits whose deadline had passed a whole period */
+    uint64_t late_sum_ns;
+    uint64_t late_sq_sum;   /* in us^2, for the deviation */
+    uint64_t late_max_ns;
+};
+
+void gpio_timing_stats(struct gpio_timing_stats *stats);
+void gpio_timing_reset_stats(void);
+void gpio_timing_stats_print(FILE *out, const struct gpio_timing_stats *stats);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Timers hash onto slot expires % GPIO_WHEEL_SLOTS and stay in one
+ * unsorted list per slot. Advancing visits one slot per elapsed tick and
+ * keeps timers that are whole revolutions away for a later pass.
+ */
+#include "gpio_wheel.h"
+
+#include <string.h>
+
+void gpio_wheel_init(struct gpio_wheel *wheel, uint64_t tick_ns, uint64_t now_ns)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick_ns = tick_ns;
+    wheel->now = now_ns / tick_ns;
+}
+
+void gpio_timer_cancel(struct gpio_wheel *wheel, struct gpio_timer *timer)
+{
+    if (!gpio_timer_armed(timer)) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    --wheel->armed;
+}
+
+void gpio_timer_arm(struct gpio_wheel *wheel, struct gpio_timer *timer, uint64_t deadline_ns)
+{
+    gpio_timer_cancel(wheel, timer);
+    uint64_t expires = (deadline_ns + wheel->tick_ns - 1) / wheel->tick_ns;
+    /* already due, fire on the next advance */
+    if (expires <= wheel->now) {
+        expires = wheel->now + 1;
+    }
+    struct gpio_timer **slot = &wheel->slots[expires % GPIO_WHEEL_SLOTS];
+    timer->expires = expires;
+    timer->next = *slot;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+    ++wheel->armed;
+}
+
+struct gpio_timer *gpio_wheel_expire(struct gpio_wheel *wheel, uint64_t now_ns)
+{
+    struct gpio_timer *due = NULL;
+    uint64_t target = now_ns / wheel->tick_ns;
+    if (target <= wheel->now) {
+        goto end;
+    }
+    /* past one revolution every slot is visited once */
+    uint64_t ticks = target - wheel->now;
+    if (ticks > GPIO_WHEEL_SLOTS) {
+        ticks = GPIO_WHEEL_SLOTS;
+    }
+    for (uint64_t t = target - ticks + 1; t <= target && wheel->armed != 0; ++t) {
+        struct gpio_timer *timer = wheel->slots[t % GPIO_WHEEL_SLOTS];
+        while (timer != NULL) {
+            struct gpio_timer *next = timer->next;
+            if (timer->expires <= target) {
+                gpio_timer_cancel(wheel, timer);
+                timer->next = due;
+                due = timer;
+            }
+            timer = next;
+        }
+    }
+    wheel->now = target;
+end:
+    return due;
+}
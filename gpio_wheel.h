@@ -0,0 +1,45 @@
+#ifndef GPIO_WHEEL_H
+#define GPIO_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPIO_WHEEL_SLOTS 256
+
+/* embedded in its owner, never allocated by the wheel */
+struct gpio_timer {
+    struct gpio_timer *next;
+    struct gpio_timer **pprev;  /* NULL while not armed */
+    uint64_t expires;           /* in ticks */
+};
+
+/*
+ * hashed timing wheel shared by every timer of one thread, arming and
+ * cancelling are O(1) whatever the number of lines, not thread safe
+ */
+struct gpio_wheel {
+    uint64_t tick_ns;
+    uint64_t now;       /* last tick processed */
+    unsigned int armed;
+    struct gpio_timer *slots[GPIO_WHEEL_SLOTS];
+};
+
+void gpio_wheel_init(struct gpio_wheel *wheel, uint64_t tick_ns, uint64_t now_ns);
+
+/* deadline is CLOCK_MONOTONIC, rounded up to the next tick, re-arming moves the timer */
+void gpio_timer_arm(struct gpio_wheel *wheel, struct gpio_timer *timer, uint64_t deadline_ns);
+void gpio_timer_cancel(struct gpio_wheel *wheel, struct gpio_timer *timer);
+
+static inline bool gpio_timer_armed(const struct gpio_timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/*
+ * unlink every timer due by now_ns and return them chained through next,
+ * read next before re-arming a timer from the list
+ */
+struct gpio_timer *gpio_wheel_expire(struct gpio_wheel *wheel, uint64_t now_ns);
+
+#endif
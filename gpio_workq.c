@@ -0,0 +1,281 @@
+/*
+ * Fixed pool of worker threads running irq handlers off the loop thread.
+ * Each line hashes onto a strand holding its pending events in order; a
+ * strand with work sits on exactly one worker's deque at a time, so one line
+ * never runs on two workers while different lines spread across all of them.
+ * Idle workers steal ready strands from the back of other workers' deques.
+ */
+#include "gpio_workq.h"
+#include "gpio_arena.h"
+#include "gpio_stats.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* events a worker runs from one strand before giving others a turn */
+#define WORKQ_BUDGET 16
+
+struct workq_task {
+    struct gpio_event event;
+    gpio_workq_fn fn;
+    void *data;
+};
+
+struct workq_strand {
+    pthread_mutex_t lock;
+    pthread_cond_t idle;        /* scheduled went false */
+    bool scheduled;
+    unsigned int head;
+    unsigned int count;
+    struct workq_task tasks[GPIO_WORKQ_DEPTH];
+};
+
+/* every strand is queued at most once, so a deque never holds more than all of them */
+struct workq_worker {
+    pthread_t thread;
+    struct gpio_workq *wq;
+    unsigned int id;
+    pthread_mutex_t lock;
+    unsigned int head;
+    unsigned int count;
+    unsigned short strands[GPIO_WORKQ_STRANDS];
+};
+
+struct gpio_workq {
+    unsigned int workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int ready;  /* strands on all deques, may dip below 0 while a push is in flight */
+    bool stopping;
+    struct gpio_workq_stats stats;
+    struct workq_strand strands[GPIO_WORKQ_STRANDS];
+    struct workq_worker worker[GPIO_WORKQ_MAX_WORKERS];
+};
+
+#define workq_count(wq, field) (void)__atomic_fetch_add(&(wq)->stats.field, 1, __ATOMIC_RELAXED)
+
+static void workq_push(struct gpio_workq *wq, struct workq_worker *worker, unsigned short strand)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->strands[(worker->head + worker->count) % GPIO_WORKQ_STRANDS] = strand;
+    ++worker->count;
+    pthread_mutex_unlock(&worker->lock);
+    pthread_mutex_lock(&wq->lock);
+    __atomic_fetch_add(&wq->ready, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&wq->wake);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+static bool workq_pop_front(struct workq_worker *worker, unsigned short *strand)
+{
+    bool ret = false;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count != 0) {
+        *strand = worker->strands[worker->head];
+        worker->head = (worker->head + 1) % GPIO_WORKQ_STRANDS;
+        --worker->count;
+        ret = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return ret;
+}
+
+static bool workq_steal_back(struct workq_worker *victim, unsigned short *strand)
+{
+    bool ret = false;
+    pthread_mutex_lock(&victim->lock);
+    if (victim->count != 0) {
+        --victim->count;
+        *strand = victim->strands[(victim->head + victim->count) % GPIO_WORKQ_STRANDS];
+        ret = true;
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return ret;
+}
+
+static bool workq_take(struct gpio_workq *wq, struct workq_worker *self, unsigned short *strand)
+{
+    if (workq_pop_front(self, strand)) {
+        goto found;
+    }
+    for (unsigned int i = 1; i < wq->workers; ++i) {
+        if (workq_steal_back(&wq->worker[(self->id + i) % wq->workers], strand)) {
+            workq_count(wq, stolen);
+            goto found;
+        }
+    }
+    return false;
+found:
+    __atomic_fetch_sub(&wq->ready, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void workq_run_strand(struct gpio_workq *wq, struct workq_worker *self, unsigned short idx)
+{
+    struct workq_strand *strand = &wq->strands[idx];
+    struct workq_task task;
+    for (int budget = WORKQ_BUDGET; budget > 0; --budget) {
+        pthread_mutex_lock(&strand->lock);
+        if (strand->count == 0) {
+            strand->scheduled = false;
+            pthread_cond_broadcast(&strand->idle);
+            pthread_mutex_unlock(&strand->lock);
+            return;
+        }
+        task = strand->tasks[strand->head];
+        strand->head = (strand->head + 1) % GPIO_WORKQ_DEPTH;
+        --strand->count;
+        pthread_mutex_unlock(&strand->lock);
+        if (task.fn(&task.event, task.data) != 0) {
+            gpio_err("handle event of gpio %u failed\n", task.event.gpio_nr);
+            workq_count(wq, failed);
+        }
+        workq_count(wq, completed);
+    }
+    pthread_mutex_lock(&strand->lock);
+    if (strand->count == 0) {
+        strand->scheduled = false;
+        pthread_cond_broadcast(&strand->idle);
+        pthread_mutex_unlock(&strand->lock);
+        return;
+    }
+    pthread_mutex_unlock(&strand->lock);
+    /* still scheduled, back of our own deque */
+    workq_push(wq, self, idx);
+}
+
+static void *workq_main(void *arg)
+{
+    struct workq_worker *self = (struct workq_worker *)arg;
+    struct gpio_workq *wq = self->wq;
+    unsigned short strand;
+    (void)gpio_stats_attach();
+    while (true) {
+        if (workq_take(wq, self, &strand)) {
+            workq_run_strand(wq, self, strand);
+            continue;
+        }
+        pthread_mutex_lock(&wq->lock);
+        while (__atomic_load_n(&wq->ready, __ATOMIC_RELAXED) <= 0 && !wq->stopping) {
+            pthread_cond_wait(&wq->wake, &wq->lock);
+        }
+        bool done = wq->stopping && __atomic_load_n(&wq->ready, __ATOMIC_RELAXED) <= 0;
+        pthread_mutex_unlock(&wq->lock);
+        if (done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct gpio_workq *gpio_workq_create(unsigned int workers)
+{
+    unsigned int started = 0;
+    struct gpio_workq *wq = NULL;
+    if (workers == 0 || workers > GPIO_WORKQ_MAX_WORKERS) {
+        gpio_err("worker count %u is beyond range\n", workers);
+        goto end;
+    }
+    wq = (struct gpio_workq *)gpio_alloc(sizeof(struct gpio_workq));
+    if (wq == NULL) {
+        gpio_err("alloc workq failed\n");
+        goto end;
+    }
+    wq->workers = workers;
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->wake, NULL);
+    for (unsigned int i = 0; i < GPIO_WORKQ_STRANDS; ++i) {
+        pthread_mutex_init(&wq->strands[i].lock, NULL);
+        pthread_cond_init(&wq->strands[i].idle, NULL);
+    }
+    for (unsigned int i = 0; i < workers; ++i) {
+        wq->worker[i].wq = wq;
+        wq->worker[i].id = i;
+        pthread_mutex_init(&wq->worker[i].lock, NULL);
+    }
+    for (started = 0; started < workers; ++started) {
+        if (pthread_create(&wq->worker[started].thread, NULL, workq_main, &wq->worker[started]) != 0) {
+            gpio_err("start worker %u failed\n", started);
+            goto stop_workers;
+        }
+    }
+    goto end;
+stop_workers:
+    pthread_mutex_lock(&wq->lock);
+    wq->stopping = true;
+    pthread_cond_broadcast(&wq->wake);
+    pthread_mutex_unlock(&wq->lock);
+    while (started-- > 0) {
+        pthread_join(wq->worker[started].thread, NULL);
+    }
+    gpio_free(wq, sizeof(struct gpio_workq));
+    wq = NULL;
+end:
+    return wq;
+}
+
+void gpio_workq_destroy(struct gpio_workq *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    wq->stopping = true;
+    pthread_cond_broadcast(&wq->wake);
+    pthread_mutex_unlock(&wq->lock);
+    for (unsigned int i = 0; i < wq->workers; ++i) {
+        pthread_join(wq->worker[i].thread, NULL);
+    }
+    gpio_free(wq, sizeof(struct gpio_workq));
+}
+
+int gpio_workq_submit(struct gpio_workq *wq, const struct gpio_event *event, gpio_workq_fn fn, void *data)
+{
+    int ret = 0;
+    unsigned short idx = event->gpio_nr % GPIO_WORKQ_STRANDS;
+    struct workq_strand *strand = &wq->strands[idx];
+    bool schedule = false;
+    pthread_mutex_lock(&strand->lock);
+    if (strand->count == GPIO_WORKQ_DEPTH) {
+        pthread_mutex_unlock(&strand->lock);
+        workq_count(wq, overflow);
+        ret = EAGAIN;
+        goto end;
+    }
+    struct workq_task *task = &strand->tasks[(strand->head + strand->count) % GPIO_WORKQ_DEPTH];
+    task->event = *event;
+    task->fn = fn;
+    task->data = data;
+    ++strand->count;
+    if (!strand->scheduled) {
+        strand->scheduled = true;
+        schedule = true;
+    }
+    pthread_mutex_unlock(&strand->lock);
+    workq_count(wq, submitted);
+    if (schedule) {
+        workq_push(wq, &wq->worker[idx % wq->workers], idx);
+    }
+end:
+    return ret;
+}
+
+/* the strand goes idle once everything on it ran, including events of lines sharing it */
+void gpio_workq_fence(struct gpio_workq *wq, unsigned int gpio_nr)
+{
+    struct workq_strand *strand = &wq->strands[gpio_nr % GPIO_WORKQ_STRANDS];
+    pthread_mutex_lock(&strand->lock);
+    while (strand->scheduled) {
+        pthread_cond_wait(&strand->idle, &strand->lock);
+    }
+    pthread_mutex_unlock(&strand->lock);
+}
+
+void gpio_workq_stats(struct gpio_workq *wq, struct gpio_workq_stats *stats)
+{
+    stats->submitted = __atomic_load_n(&wq->stats.submitted, __ATOMIC_RELAXED);
+    stats->completed = __atomic_load_n(&wq->stats.completed, __ATOMIC_RELAXED);
+    stats->stolen = __atomic_load_n(&wq->stats.stolen, __ATOMIC_RELAXED);
+    stats->overflow = __atomic_load_n(&wq->stats.overflow, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&wq->stats.failed, __ATOMIC_RELAXED);
+}
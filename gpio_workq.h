@@ -0,0 +1,39 @@
+#ifndef GPIO_WORKQ_H
+#define GPIO_WORKQ_H
+
+#include "gpio.h"
+
+#define GPIO_WORKQ_MAX_WORKERS 32
+/* lines hash onto strands, one strand never runs on two workers at once */
+#define GPIO_WORKQ_STRANDS 256
+/* events a strand buffers before submit fails with EAGAIN */
+#define GPIO_WORKQ_DEPTH 64
+
+typedef int (*gpio_workq_fn)(const struct gpio_event *event, void *data);
+
+struct gpio_workq_stats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t stolen;
+    uint64_t overflow;
+    uint64_t failed;
+};
+
+struct gpio_workq;
+
+struct gpio_workq *gpio_workq_create(unsigned int workers);
+/* runs what is already queued, then joins the workers */
+void gpio_workq_destroy(struct gpio_workq *wq);
+
+/* events of the same line run in submit order, different lines run in parallel */
+int gpio_workq_submit(struct gpio_workq *wq, const struct gpio_event *event, gpio_workq_fn fn, void *data);
+
+/*
+ * waits until every event of gpio_nr submitted so far has run, from the
+ * submitting thread only, a handler on the pool would wait on itself
+ */
+void gpio_workq_fence(struct gpio_workq *wq, unsigned int gpio_nr);
+
+void gpio_workq_stats(struct gpio_workq *wq, struct gpio_workq_stats *stats);
+
+#endif
@@ -1,12 +1,26 @@
 #include "led_flash.h"
 
-#include <unistd.h>
-
 #include "gpio.h"
+#include "gpio_pwm.h"
+#include "gpio_timing.h"
+
+#include <errno.h>
+#include <stdint.h>
 
 int led_flash(int times, float hz)
 {
     int ret;
+    unsigned int channel;
+    if (times <= 0) {
+        return 0;
+    }
+    /* a pwm period holds hours, rates past 1 GHz flash as fast as the pwm goes */
+    double ns = hz > 0 ? 1e9 / hz : 0;
+    if (!(ns > 0 && ns <= GPIO_PWM_PERIOD_MAX)) {
+        gpio_err("flash rate %f hz is out of range\n", hz);
+        return EINVAL;
+    }
+    uint64_t period = ns < 1 ? 1 : (uint64_t)ns;
     struct gpio_ops *ops = get_gpio_ops();
     gpio *io = ops->open(26);
     if (io == NULL) {
@@ -15,20 +29,24 @@ int led_flash(int times, float hz)
         goto end;
     }
     ops->set_direction(io, GPIO_OUT);
+    struct gpio_pwm *pwm = gpio_pwm_create();
+    if (pwm == NULL) {
+        ret = -1;
+        goto close_gpio;
+    }
+    ret = gpio_pwm_add(pwm, io, period, GPIO_PWM_DUTY_MAX / 2, &channel);
+    if (ret != 0) {
+        gpio_err("start flashing failed\n");
+        goto destroy_pwm;
+    }
+    /* the pwm thread drives the edges, we only wait out the flashes, one at a time so no sum overflows */
+    uint64_t deadline = gpio_timing_now();
     for (int i = 0; i < times; ++i) {
-        ret = ops->set_value(io, GPIO_HIGH);
-        if (ret != 0) {
-            gpio_err("send high signal failed: %s\n");
-            goto close_gpio;
-        }
-        (void)usleep(500000/hz); 
-        ret = ops->set_value(io, GPIO_LOW);
-        if (ret != 0) {
-            gpio_err("send low signal failed: %s\n");
-            goto close_gpio;
-        }
-        (void)usleep(500000/hz); 
+        deadline += period;
+        gpio_timing_wait_until(deadline);
     }
+destroy_pwm:
+    gpio_pwm_destroy(pwm);
 close_gpio:
     ops->close(io);
 end:
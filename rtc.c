@@ -0,0 +1,451 @@
+#include "rtc.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "gpio.h"
+#include "rtc_clock.h"
+#include "gpio_seq.h"
+#include "gpio_arena.h"
+
+enum rtc_line {
+    RTC_LINE_CLK = 0,
+    RTC_LINE_DAT = 1,
+    RTC_LINE_RST = 2,
+    RTC_LINE_POWER = 3,
+    RTC_LINE_MAX,
+};
+
+#define RTC_LINE_BIT(line) (1ull << (line))
+
+/* longest transfer after the command byte, a clock burst */
+#define RTC_BURST_MAX 8
+
+struct rtc_gpio {
+    gpio_set *lines;
+    gpio *clk;
+    gpio *dat;
+    gpio *rst;
+    gpio *power;
+    struct gpio_ops *ops;
+    struct gpio_seq *write_seq[RTC_BURST_MAX + 1];  /* by data length */
+    struct gpio_seq *read_seq[RTC_BURST_MAX + 1];
+};
+
+struct rtc_gpio *rtc_init(unsigned int power_nr, unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr)
+{
+    struct rtc_gpio *rtc = (struct rtc_gpio *)gpio_alloc(sizeof(struct rtc_gpio));
+    if (rtc == NULL) {
+        gpio_err("malloc rtc failed\n");
+        goto end;
+    }
+    struct gpio_ops *ops = get_gpio_ops();
+    const unsigned int nrs[RTC_LINE_MAX] = {
+        [RTC_LINE_CLK] = clk_nr,
+        [RTC_LINE_DAT] = dat_nr,
+        [RTC_LINE_RST] = rst_nr,
+        [RTC_LINE_POWER] = power_nr,
+    };
+    rtc->ops = ops;
+    rtc->lines = ops->set_open(nrs, RTC_LINE_MAX);
+    if (rtc->lines == NULL) {
+        gpio_err("open rtc gpios failed\n");
+        goto free_rtc;
+    }
+    rtc->clk = rtc->lines->lines[RTC_LINE_CLK];
+    rtc->dat = rtc->lines->lines[RTC_LINE_DAT];
+    rtc->rst = rtc->lines->lines[RTC_LINE_RST];
+    rtc->power = rtc->lines->lines[RTC_LINE_POWER];
+    uint64_t outputs = RTC_LINE_BIT(RTC_LINE_CLK) | RTC_LINE_BIT(RTC_LINE_RST) | RTC_LINE_BIT(RTC_LINE_POWER);
+    if (ops->set_directions(rtc->lines, outputs, outputs) != 0) {
+        gpio_err("set clk/rst/power direction failed\n");
+        goto close_lines;
+    }
+    if (ops->set_value(rtc->power, GPIO_HIGH) != 0) {
+        gpio_err("set power value failed\n");
+        goto close_lines;
+    }
+    goto end;
+close_lines:
+    ops->set_close(rtc->lines);
+free_rtc:
+    gpio_free(rtc, sizeof(struct rtc_gpio));
+    rtc = NULL;
+end:
+    return rtc;
+}
+
+void rtc_finalize(struct rtc_gpio *rtc)
+{
+    for (unsigned int i = 0; i <= RTC_BURST_MAX; ++i) {
+        if (rtc->write_seq[i] != NULL) {
+            gpio_seq_destroy(rtc->write_seq[i]);
+        }
+        if (rtc->read_seq[i] != NULL) {
+            gpio_seq_destroy(rtc->read_seq[i]);
+        }
+    }
+    rtc->ops->set_close(rtc->lines);
+    gpio_free(rtc, sizeof(struct rtc_gpio));
+}
+
+#define RTC_CLK_PERIOD_USEC 50
+
+/* rst up with clk low, then the command byte and the data bytes lsb first */
+static struct gpio_seq *rtc_build(struct rtc_gpio *rtc, bool read, unsigned int len)
+{
+    uint32_t half = RTC_CLK_PERIOD_USEC * 1000;
+    unsigned int out_bits = 8 * (read ? 1 : 1 + len);
+    unsigned int in_bits = read ? 8 * len : 0;
+    struct gpio_seq *seq = gpio_seq_create(rtc->ops, rtc->lines, 5 + 5 * out_bits + 1 + 5 * in_bits);
+    if (seq == NULL) {
+        goto end;
+    }
+    (void)gpio_seq_add(seq, GPIO_SEQ_CLR, RTC_LINE_CLK, 0);
+    (void)gpio_seq_add(seq, GPIO_SEQ_DIR, RTC_LINE_DAT, GPIO_OUT);
+    (void)gpio_seq_add(seq, GPIO_SEQ_SET, RTC_LINE_RST, 0);
+    (void)gpio_seq_add(seq, GPIO_SEQ_WAIT, 0, half);
+    /* the chip latches dat on the rising edge, so it changes while clk is low */
+    for (unsigned int bit = 0; bit < out_bits; ++bit) {
+        (void)gpio_seq_add(seq, GPIO_SEQ_CLR, RTC_LINE_CLK, 0);
+        (void)gpio_seq_add(seq, GPIO_SEQ_PUT, RTC_LINE_DAT, bit);
+        (void)gpio_seq_add(seq, GPIO_SEQ_WAIT, 0, half);
+        (void)gpio_seq_add(seq, GPIO_SEQ_SET, RTC_LINE_CLK, 0);
+        (void)gpio_seq_add(seq, GPIO_SEQ_WAIT, 0, half);
+    }
+    if (read) {
+        (void)gpio_seq_add(seq, GPIO_SEQ_DIR, RTC_LINE_DAT, GPIO_IN);
+    }
+    /* and drives each bit out on the falling edge */
+    for (unsigned int bit = 0; bit < in_bits; ++bit) {
+        (void)gpio_seq_add(seq, GPIO_SEQ_CLR, RTC_LINE_CLK, 0);
+        (void)gpio_seq_add(seq, GPIO_SEQ_WAIT, 0, half);
+        (void)gpio_seq_add(seq, GPIO_SEQ_SAMPLE, RTC_LINE_DAT, bit);
+        (void)gpio_seq_add(seq, GPIO_SEQ_SET, RTC_LINE_CLK, 0);
+        (void)gpio_seq_add(seq, GPIO_SEQ_WAIT, 0, half);
+    }
+    (void)gpio_seq_add(seq, GPIO_SEQ_CLR, RTC_LINE_RST, 0);
+    if (gpio_seq_compile(seq) != 0) {
+        gpio_err("build rtc sequence failed\n");
+        gpio_seq_destroy(seq);
+        seq = NULL;
+    }
+end:
+    return seq;
+}
+
+/* sequences are built on first use and replayed from then on */
+static int rtc_transfer(struct rtc_gpio *rtc, bool read, const unsigned char *in, unsigned char *out, unsigned int len)
+{
+    int ret;
+    if (len > RTC_BURST_MAX) {
+        gpio_err("rtc transfer of %u bytes is too long\n", len);
+        return EINVAL;
+    }
+    struct gpio_seq **seq = read ? &rtc->read_seq[len] : &rtc->write_seq[len];
+    if (*seq == NULL) {
+        *seq = rtc_build(rtc, read, len);
+        if (*seq == NULL) {
+            return ENOMEM;
+        }
+    }
+    ret = gpio_seq_run(*seq, in, out);
+    if (ret != 0) {
+        /* never leave the chip selected */
+        (void)rtc->ops->set_value(rtc->rst, GPIO_LOW);
+    }
+    return ret;
+}
+
+/* command byte, then len data bytes, all under one RST cycle */
+static int rtc_write(struct rtc_gpio *rtc, unsigned char cmd, const unsigned char *input, unsigned int len)
+{
+    unsigned char buf[1 + RTC_BURST_MAX];
+    if (len > RTC_BURST_MAX) {
+        gpio_err("rtc transfer of %u bytes is too long\n", len);
+        return EINVAL;
+    }
+    buf[0] = cmd;
+    memcpy(&buf[1], input, len);
+    return rtc_transfer(rtc, false, buf, NULL, len);
+}
+
+/* command byte out, then len data bytes clocked in on the same RST cycle */
+static int rtc_read(struct rtc_gpio *rtc, unsigned char cmd, unsigned char *output, unsigned int len)
+{
+    return rtc_transfer(rtc, true, &cmd, output, len);
+}
+
+typedef union tag_rtc_reg {
+    union {
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 3;
+            unsigned char ch            : 1;
+        } sec;
+
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 3;
+            unsigned char resv          : 1;
+        } min;
+
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 2;
+            unsigned char resv          : 1;
+            unsigned char is_12         : 1;
+        } hour;
+
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 1;
+            unsigned char pm            : 1;
+            unsigned char resv          : 1;
+            unsigned char is_12         : 1;
+        } hour_12;
+
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 2;
+            unsigned char resv          : 2;
+        } date;
+
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 1;
+            unsigned char resv          : 3;
+        } month;
+
+        struct {
+            unsigned char one           : 4;
+            unsigned char ten           : 4;
+        } year;
+
+        struct {
+            unsigned char one           : 3;
+            unsigned char resv          : 5;
+        } day;
+
+        struct {
+            unsigned char resv          : 7;
+            unsigned char write_protect : 1;
+        } wp;
+    } regs;
+    unsigned char val; 
+} rtc_reg;
+
+/* bursts are moved as plain bytes, every register view has to fit in one */
+_Static_assert(sizeof(rtc_reg) == 1, "rtc_reg must be one byte");
+
+struct rtc_cmd {
+    unsigned char read;
+    unsigned char write;
+};
+
+/* in register order, which is also the order of a clock burst */
+enum RTC_CMDS {
+    RTC_SECOND  = 0,
+    RTC_MINUTE  = 1,
+    RTC_HOUR    = 2,
+    RTC_DATE    = 3,
+    RTC_MONTH   = 4,
+    RTC_DAY     = 5,
+    RTC_YEAR    = 6,
+    RTC_WP      = 7,
+    RTC_CLOCK_REGS,
+};
+
+#define RTC_DEF_CMD(R, W) { .read = R, .write = W }
+
+struct rtc_cmd rtc_cmds[] = {
+    [RTC_SECOND]    = RTC_DEF_CMD(0x81, 0x80),
+    [RTC_MINUTE]    = RTC_DEF_CMD(0x83, 0x82),
+    [RTC_HOUR]      = RTC_DEF_CMD(0x85, 0x84),
+    [RTC_DATE]      = RTC_DEF_CMD(0x87, 0x86),
+    [RTC_MONTH]     = RTC_DEF_CMD(0x89, 0x88),
+    [RTC_DAY]       = RTC_DEF_CMD(0x8B, 0x8A),
+    [RTC_YEAR]      = RTC_DEF_CMD(0x8D, 0x8C),
+    [RTC_WP]        = RTC_DEF_CMD(0x8F, 0x8E),
+};
+
+#define RTC_CMD(rtc_enum) rtc_cmds[rtc_enum]
+
+/* all eight clock registers, a burst write only latches once the eighth byte arrived */
+#define RTC_CLOCK_BURST RTC_DEF_CMD(0xBF, 0xBE)
+
+static const struct rtc_cmd rtc_clock_burst = RTC_CLOCK_BURST;
+
+/* the anchor is trusted while the chip's second lands this close to the prediction */
+#define RTC_MAX_DRIFT_MS 20
+
+#define RTC_TRICKLE_CHARGE_WRITE 0x90
+#define RTC_RAM_WRITE 0xc0
+
+static void rtc_decode(const rtc_reg *regs, struct rtc_time *time)
+{
+    time->second = regs[RTC_SECOND].regs.sec.one + regs[RTC_SECOND].regs.sec.ten * 10;
+    time->minute = regs[RTC_MINUTE].regs.min.one + regs[RTC_MINUTE].regs.min.ten * 10;
+    if (regs[RTC_HOUR].regs.hour.is_12) {
+        time->hour = (regs[RTC_HOUR].regs.hour_12.one + regs[RTC_HOUR].regs.hour_12.ten * 10) % 12 +
+                     (regs[RTC_HOUR].regs.hour_12.pm ? 12 : 0);
+    } else {
+        time->hour = regs[RTC_HOUR].regs.hour.one + regs[RTC_HOUR].regs.hour.ten * 10;
+    }
+    time->date = regs[RTC_DATE].regs.date.one + regs[RTC_DATE].regs.date.ten * 10;
+    time->month = regs[RTC_MONTH].regs.month.one + regs[RTC_MONTH].regs.month.ten * 10;
+    time->year = RTC_YEAR_BASE + regs[RTC_YEAR].regs.year.one + regs[RTC_YEAR].regs.year.ten * 10;
+    time->day = regs[RTC_DAY].regs.day.one;
+}
+
+/* always 24 hour mode with the clock running */
+static int rtc_encode(const struct rtc_time *time, rtc_reg *regs)
+{
+    if (time->year < RTC_YEAR_BASE || time->year > RTC_YEAR_BASE + 99 ||
+        time->month < 1 || time->month > 12 || time->date < 1 || time->date > 31 ||
+        time->hour > 23 || time->minute > 59 || time->second > 59 || time->day < 1 || time->day > 7) {
+        gpio_err("rtc time is beyond range\n");
+        return EINVAL;
+    }
+    unsigned int year = time->year - RTC_YEAR_BASE;
+    memset(regs, 0, sizeof(rtc_reg) * RTC_CLOCK_REGS);
+    regs[RTC_SECOND].regs.sec.one = time->second % 10;
+    regs[RTC_SECOND].regs.sec.ten = time->second / 10;
+    regs[RTC_MINUTE].regs.min.one = time->minute % 10;
+    regs[RTC_MINUTE].regs.min.ten = time->minute / 10;
+    regs[RTC_HOUR].regs.hour.one = time->hour % 10;
+    regs[RTC_HOUR].regs.hour.ten = time->hour / 10;
+    regs[RTC_DATE].regs.date.one = time->date % 10;
+    regs[RTC_DATE].regs.date.ten = time->date / 10;
+    regs[RTC_MONTH].regs.month.one = time->month % 10;
+    regs[RTC_MONTH].regs.month.ten = time->month / 10;
+    regs[RTC_DAY].regs.day.one = time->day;
+    regs[RTC_YEAR].regs.year.one = year % 10;
+    regs[RTC_YEAR].regs.year.ten = year / 10;
+    return 0;
+}
+
+/* leaves write protect off, the caller decides when to set it again */
+int rtc_set_timer(struct rtc_gpio *rtc, const struct rtc_time *time)
+{
+    int ret;
+    rtc_reg regs[RTC_CLOCK_REGS];
+    ret = rtc_encode(time, regs);
+    if (ret != 0) {
+        goto end;
+    }
+    rtc_reg wp = { .regs = { .wp = { .write_protect = 0 } } };
+    ret = rtc_write(rtc, RTC_CMD(RTC_WP).write, &wp.val, 1);
+    if (ret != 0) {
+        gpio_err("rtc write wp register failed\n");
+        goto end;
+    }
+    regs[RTC_WP] = wp;
+    ret = rtc_write(rtc, rtc_clock_burst.write, &regs[0].val, RTC_CLOCK_REGS);
+    if (ret != 0) {
+        gpio_err("rtc write clock burst failed\n");
+        goto end;
+    }
+end:
+    return ret;
+}
+
+int rtc_reset_timer(struct rtc_gpio *rtc)
+{
+    int ret;
+    const struct rtc_time start = {
+        .year = RTC_YEAR_BASE + 26,
+        .month = 1,
+        .date = 13,
+        .hour = 0,
+        .minute = 0,
+        .second = 0,
+        .day = 3,
+    };
+    ret = rtc_set_timer(rtc, &start);
+    if (ret != 0) {
+        gpio_err("rtc set timer failed\n");
+        goto end;
+    }
+    unsigned char charge = 0x1;
+    ret = rtc_write(rtc, RTC_TRICKLE_CHARGE_WRITE, &charge, 1);
+    if (ret != 0) {
+        gpio_err("rtc write charge register failed\n");
+        goto end;
+    }
+    unsigned char init = 0xf0;
+    ret = rtc_write(rtc, RTC_RAM_WRITE, &init, 1);
+    if (ret != 0) {
+        gpio_err("rtc write init register failed\n");
+        goto end;
+    }
+    rtc_reg wp = { .regs = { .wp = { .write_protect = 1 } } };
+    ret = rtc_write(rtc, RTC_CMD(RTC_WP).write, &wp.val, 1);
+    if (ret != 0) {
+        gpio_err("rtc write wp register failed\n");
+        goto end;
+    }
+end:
+    return ret;
+}
+
+int rtc_read_timer(struct rtc_gpio *rtc, struct rtc_time *time)
+{
+    int ret;
+    rtc_reg regs[RTC_CLOCK_REGS];
+    ret = rtc_read(rtc, rtc_clock_burst.read, &regs[0].val, RTC_CLOCK_REGS);
+    if (ret != 0) {
+        gpio_err("rtc read clock burst failed\n");
+        goto end;
+    }
+    rtc_decode(regs, time);
+end:
+    return ret;
+}
+
+static void rtc_print_time(const struct rtc_time *time)
+{
+    printf("%04u-%02u-%02u %02u:%02u:%02u %uth\n",
+           time->year, time->month, time->date,
+           time->hour, time->minute, time->second,
+           time->day);
+}
+
+/* the chip is read at startup and on resync only, every print below comes from memory */
+int real_time_clock(void)
+{
+    int ret;
+    struct rtc_time now;
+    struct rtc_gpio *rtc = rtc_init(18, 23, 24, 25);
+    ret = rtc == NULL;
+    if (ret != 0) {
+        gpio_err("init rtc failed\n");
+        goto end;
+    }
+    ret = rtc_reset_timer(rtc);
+    if (ret != 0) {
+        gpio_err("reset timer failed\n");
+        goto finalize;
+    }
+    struct rtc_clock *clock = rtc_clock_create(rtc, RTC_CLOCK_RESYNC_SEC, RTC_MAX_DRIFT_MS);
+    ret = clock == NULL;
+    if (ret != 0) {
+        gpio_err("start rtc clock failed\n");
+        goto finalize;
+    }
+    for (int i = 0; i < 10; ++i) {
+        (void)sleep(1);
+        rtc_clock_now(clock, &now);
+        rtc_print_time(&now);
+    }
+    rtc_clock_destroy(clock);
+    goto end;
+finalize:
+    rtc_finalize(rtc);
+end:
+    return ret;    
+}
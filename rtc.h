@@ -0,0 +1,32 @@
+#ifndef RTC_H
+#define RTC_H
+
+/* DS1302 wired to four gpio lines */
+struct rtc_gpio;
+
+/* calendar time as kept by the chip, hour is always 0-23 */
+struct rtc_time {
+    unsigned int year;      /* RTC_YEAR_BASE + 0..99 */
+    unsigned int month;     /* 1-12 */
+    unsigned int date;      /* 1-31 */
+    unsigned int hour;
+    unsigned int minute;
+    unsigned int second;
+    unsigned int day;       /* day of week 1-7 */
+};
+
+#define RTC_YEAR_BASE 1970
+
+struct rtc_gpio *rtc_init(unsigned int power_nr, unsigned int clk_nr, unsigned int dat_nr, unsigned int rst_nr);
+void rtc_finalize(struct rtc_gpio *rtc);
+
+/* all clock registers in one burst transaction, so no field can roll over in between */
+int rtc_read_timer(struct rtc_gpio *rtc, struct rtc_time *time);
+int rtc_set_timer(struct rtc_gpio *rtc, const struct rtc_time *time);
+
+/* start the clock from a fixed date, charge the backup cell and write protect */
+int rtc_reset_timer(struct rtc_gpio *rtc);
+
+int real_time_clock(void);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Cached DS1302 time. The anchor (chip seconds, monotonic instant of that
+ * second's start, weekday) is published through a seqlock: the writer makes
+ * seq odd, stores, makes it even again, and readers retry until they saw the
+ * same even seq on both sides of their copy. Readers never block the
+ * resync thread and never touch the chip.
+ */
+#include "rtc_clock.h"
+#include "gpio.h"
+#include "gpio_arena.h"
+#include "gpio_stats.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define NSEC_PER_SEC 1000000000ll
+#define DAY_SEC 86400
+/* wake this long before the predicted second boundary and poll from there */
+#define RTC_CLOCK_GUARD_NS 20000000ll
+/* a boundary shows up within one second, give up well after that */
+#define RTC_CLOCK_EDGE_NS (2 * NSEC_PER_SEC)
+
+struct rtc_clock {
+    /* seqlock protected anchor */
+    uint32_t seq;
+    int64_t seconds;
+    int64_t mono_ns;
+    unsigned int day;
+    /* resync side */
+    struct rtc_gpio *rtc;
+    pthread_mutex_t lock;       /* chip access, stats */
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool stopping;
+    bool anchored;
+    unsigned int resync_sec;
+    unsigned int interval_sec;
+    int64_t max_drift_ns;
+    struct rtc_clock_stats stats;
+};
+
+static int64_t rtc_clock_mono(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* days since 1970-01-01 of a proleptic gregorian date */
+static int64_t rtc_clock_days(unsigned int year, unsigned int month, unsigned int date)
+{
+    int64_t y = (int64_t)year - (month <= 2);
+    int64_t era = y / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static int64_t rtc_clock_to_seconds(const struct rtc_time *time)
+{
+    int64_t days = rtc_clock_days(time->year, time->month, time->date) - rtc_clock_days(RTC_YEAR_BASE, 1, 1);
+    return days * DAY_SEC + time->hour * 3600 + time->minute * 60 + time->second;
+}
+
+static void rtc_clock_from_seconds(int64_t seconds, struct rtc_time *time)
+{
+    int64_t days = seconds / DAY_SEC;
+    int64_t rem = seconds % DAY_SEC;
+    int64_t z = days + rtc_clock_days(RTC_YEAR_BASE, 1, 1) + 719468;
+    int64_t era = z / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    time->date = doy - (153 * mp + 2) / 5 + 1;
+    time->month = mp < 10 ? mp + 3 : mp - 9;
+    time->year = yoe + era * 400 + (time->month <= 2);
+    time->hour = rem / 3600;
+    time->minute = rem / 60 % 60;
+    time->second = rem % 60;
+}
+
+static void rtc_clock_publish(struct rtc_clock *clock, int64_t seconds, int64_t mono_ns, unsigned int day)
+{
+    uint32_t seq = __atomic_load_n(&clock->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&clock->seconds, seconds, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->mono_ns, mono_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->day, day, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void rtc_clock_load(struct rtc_clock *clock, int64_t *seconds, int64_t *mono_ns, unsigned int *day)
+{
+    uint32_t begin;
+    uint32_t end;
+    do {
+        begin = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+        *seconds = __atomic_load_n(&clock->seconds, __ATOMIC_RELAXED);
+        *mono_ns = __atomic_load_n(&clock->mono_ns, __ATOMIC_RELAXED);
+        *day = __atomic_load_n(&clock->day, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&clock->seq, __ATOMIC_RELAXED);
+    } while ((begin & 1) != 0 || begin != end);
+}
+
+static void rtc_clock_sleep_until(int64_t mono_ns)
+{
+    struct timespec ts = { .tv_sec = mono_ns / NSEC_PER_SEC, .tv_nsec = mono_ns % NSEC_PER_SEC };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/*
+ * the chip only counts whole seconds, so poll until it ticks over and take
+ * the midpoint between the last two reads as the start of the new second,
+ * with an anchor in place sleep through most of the wait
+ */
+static int rtc_clock_sync(struct rtc_clock *clock)
+{
+    int ret;
+    struct rtc_time time;
+    int64_t last = rtc_clock_mono();
+    ret = rtc_read_timer(clock->rtc, &time);
+    if (ret != 0) {
+        goto end;
+    }
+    int64_t first = rtc_clock_to_seconds(&time);
+    if (clock->anchored) {
+        int64_t edge = clock->mono_ns + (first + 1 - clock->seconds) * NSEC_PER_SEC;
+        if (edge - RTC_CLOCK_GUARD_NS > rtc_clock_mono()) {
+            rtc_clock_sleep_until(edge - RTC_CLOCK_GUARD_NS);
+            /* the second may have ticked while asleep, start from a fresh reading */
+            last = rtc_clock_mono();
+            ret = rtc_read_timer(clock->rtc, &time);
+            if (ret != 0) {
+                goto end;
+            }
+            first = rtc_clock_to_seconds(&time);
+        }
+    }
+    int64_t start = last;
+    int64_t before;
+    int64_t seconds;
+    while (true) {
+        before = rtc_clock_mono();
+        if (before - start > RTC_CLOCK_EDGE_NS) {
+            ret = ETIMEDOUT;
+            gpio_err("rtc seconds did not advance\n");
+            goto end;
+        }
+        ret = rtc_read_timer(clock->rtc, &time);
+        if (ret != 0) {
+            goto end;
+        }
+        seconds = rtc_clock_to_seconds(&time);
+        if (seconds != first) {
+            break;
+        }
+        last = before;
+    }
+    int64_t mono_ns = last + (before - last) / 2;
+    if (clock->anchored) {
+        int64_t drift = mono_ns - (clock->mono_ns + (seconds - clock->seconds) * NSEC_PER_SEC);
+        int64_t size = drift < 0 ? -drift : drift;
+        clock->stats.last_drift_ns = drift;
+        if (size > clock->stats.max_drift_ns) {
+            clock->stats.max_drift_ns = size;
+        }
+        /* come back sooner until the chip and the anchor agree again */
+        if (size > clock->max_drift_ns) {
+            clock->interval_sec = clock->interval_sec > 1 ? clock->interval_sec / 2 : 1;
+        } else {
+            clock->interval_sec = clock->resync_sec;
+        }
+    }
+    rtc_clock_publish(clock, seconds, mono_ns, time.day);
+    clock->anchored = true;
+    ++clock->stats.resyncs;
+end:
+    if (ret != 0) {
+        ++clock->stats.failures;
+    }
+    return ret;
+}
+
+int rtc_clock_resync(struct rtc_clock *clock)
+{
+    int ret;
+    pthread_mutex_lock(&clock->lock);
+    ret = rtc_clock_sync(clock);
+    pthread_mutex_unlock(&clock->lock);
+    return ret;
+}
+
+static void *rtc_clock_main(void *arg)
+{
+    struct rtc_clock *clock = (struct rtc_clock *)arg;
+    struct timespec deadline;
+    (void)gpio_stats_attach();
+    pthread_mutex_lock(&clock->lock);
+    while (!clock->stopping) {
+        (void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += clock->interval_sec;
+        int err = 0;
+        while (!clock->stopping && err != ETIMEDOUT) {
+            err = pthread_cond_timedwait(&clock->wake, &clock->lock, &deadline);
+        }
+        if (clock->stopping) {
+            break;
+        }
+        /* a failed read keeps the old anchor, extrapolation carries on */
+        if (rtc_clock_sync(clock) != 0) {
+            gpio_err("rtc resync failed\n");
+        }
+    }
+    pthread_mutex_unlock(&clock->lock);
+    return NULL;
+}
+
+struct rtc_clock *rtc_clock_create(struct rtc_gpio *rtc, unsigned int resync_sec, unsigned int max_drift_ms)
+{
+    pthread_condattr_t attr;
+    struct rtc_clock *clock = (struct rtc_clock *)gpio_alloc(sizeof(struct rtc_clock));
+    if (clock == NULL) {
+        gpio_err("alloc rtc clock failed\n");
+        goto end;
+    }
+    clock->rtc = rtc;
+    clock->resync_sec = resync_sec == 0 ? RTC_CLOCK_RESYNC_SEC : resync_sec;
+    clock->interval_sec = clock->resync_sec;
+    clock->max_drift_ns = (int64_t)max_drift_ms * 1000000;
+    pthread_mutex_init(&clock->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&clock->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (rtc_clock_sync(clock) != 0) {
+        gpio_err("first rtc sync failed\n");
+        goto free_clock;
+    }
+    if (pthread_create(&clock->thread, NULL, rtc_clock_main, clock) != 0) {
+        gpio_err("start rtc resync thread failed\n");
+        goto free_clock;
+    }
+    goto end;
+free_clock:
+    pthread_cond_destroy(&clock->wake);
+    pthread_mutex_destroy(&clock->lock);
+    gpio_free(clock, sizeof(struct rtc_clock));
+    clock = NULL;
+end:
+    return clock;
+}
+
+void rtc_clock_destroy(struct rtc_clock *clock)
+{
+    pthread_mutex_lock(&clock->lock);
+    clock->stopping = true;
+    pthread_cond_signal(&clock->wake);
+    pthread_mutex_unlock(&clock->lock);
+    pthread_join(clock->thread, NULL);
+    pthread_cond_destroy(&clock->wake);
+    pthread_mutex_destroy(&clock->lock);
+    rtc_finalize(clock->rtc);
+    gpio_free(clock, sizeof(struct rtc_clock));
+}
+
+void rtc_clock_gettime(struct rtc_clock *clock, struct timespec *ts)
+{
+    int64_t seconds;
+    int64_t mono_ns;
+    unsigned int day;
+    rtc_clock_load(clock, &seconds, &mono_ns, &day);
+    int64_t elapsed = rtc_clock_mono() - mono_ns;
+    ts->tv_sec = seconds + elapsed / NSEC_PER_SEC;
+    ts->tv_nsec = elapsed % NSEC_PER_SEC;
+}
+
+void rtc_clock_now(struct rtc_clock *clock, struct rtc_time *time)
+{
+    int64_t seconds;
+    int64_t mono_ns;
+    unsigned int day;
+    rtc_clock_load(clock, &seconds, &mono_ns, &day);
+    int64_t now = seconds + (rtc_clock_mono() - mono_ns) / NSEC_PER_SEC;
+    rtc_clock_from_seconds(now, time);
+    /* the weekday register runs on its own numbering, carry it from the anchor */
+    int64_t days = now / DAY_SEC - seconds / DAY_SEC;
+    time->day = (day + 6 + days % 7) % 7 + 1;
+}
+
+void rtc_clock_stats(struct rtc_clock *clock, struct rtc_clock_stats *stats)
+{
+    pthread_mutex_lock(&clock->lock);
+    *stats = clock->stats;
+    pthread_mutex_unlock(&clock->lock);
+}
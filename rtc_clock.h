@@ -0,0 +1,43 @@
+#ifndef RTC_CLOCK_H
+#define RTC_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "rtc.h"
+
+/* default spacing of chip reads once the clock is anchored */
+#define RTC_CLOCK_RESYNC_SEC 60
+
+struct rtc_clock_stats {
+    uint64_t resyncs;
+    uint64_t failures;
+    int64_t last_drift_ns;  /* where the chip's second ticked vs. where it was extrapolated to */
+    int64_t max_drift_ns;   /* largest magnitude seen */
+};
+
+/*
+ * time service over a DS1302: the chip is read at one second boundary and
+ * that reading anchored to CLOCK_MONOTONIC, queries extrapolate from the
+ * anchor in memory, a background thread re-anchors every resync_sec and
+ * sooner while the drift exceeds max_drift_ms
+ */
+struct rtc_clock;
+
+/* owns rtc once created, the first sync is done before returning */
+struct rtc_clock *rtc_clock_create(struct rtc_gpio *rtc, unsigned int resync_sec, unsigned int max_drift_ms);
+void rtc_clock_destroy(struct rtc_clock *clock);
+
+/*
+ * lock-free, safe from any thread, re-anchoring may step the time back by
+ * the drift, ts counts from RTC_YEAR_BASE-01-01 in the chip's local time
+ */
+void rtc_clock_gettime(struct rtc_clock *clock, struct timespec *ts);
+void rtc_clock_now(struct rtc_clock *clock, struct rtc_time *time);
+
+/* read the chip right away instead of waiting for the next interval */
+int rtc_clock_resync(struct rtc_clock *clock);
+
+void rtc_clock_stats(struct rtc_clock *clock, struct rtc_clock_stats *stats);
+
+#endif
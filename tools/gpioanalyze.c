@@ -0,0 +1,156 @@
+/*
+ * Host tool over capture files: per line edge counts, time high, pulse
+ * widths, frequency, duty histogram and glitches, and optionally the
+ * DS1302 transactions on three of the captured lines with their clock
+ * timing held against the datasheet minimums at 2 V.
+ *
+ *   gpioanalyze [-t threads] [-g glitch_ns] [-d clk,dat,rst] file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpio_analyze.h"
+
+/* DS1302 at 2 V, the slowest grade: clock high or low, and ce to clock setup */
+#define DS1302_CLK_MIN_NS 1000
+#define DS1302_SETUP_MIN_NS 4000
+
+static const char *ds1302_regs[] = { "sec", "min", "hour", "date", "month", "day", "year", "wp", "trickle" };
+
+static double us(uint64_t ticks, uint64_t tick_ns)
+{
+    return (double)ticks * tick_ns / 1e3;
+}
+
+static void print_lines(const struct gpio_analyze_result *res)
+{
+    double span = (double)(res->last_tick - res->first_tick + 1) * res->tick_ns / 1e9;
+    printf("%u lines, %llu blocks (%llu raw), %.3f s, %llu edges, %u threads\n", res->lines,
+           (unsigned long long)res->blocks, (unsigned long long)res->raw_blocks, span,
+           (unsigned long long)res->transitions, res->threads);
+    printf("gpio   rising  falling  high %%    freq Hz   high us min/mean/max       low us min/mean/max  glitches\n");
+    for (unsigned int i = 0; i < res->lines; ++i) {
+        const struct gpio_analyze_line *l = &res->line[i];
+        uint64_t total = l->high_ticks + l->low_ticks;
+        double freq = l->period.count == 0 ? 0 : 1e9 * l->period.count / ((double)l->period.sum * res->tick_ns);
+        printf("%4u %8llu %8llu %6.2f %10.2f", l->gpio_nr, (unsigned long long)l->rising,
+               (unsigned long long)l->falling, total == 0 ? 0 : 100.0 * l->high_ticks / total, freq);
+        const struct gpio_analyze_pulses *p[2] = { &l->high, &l->low };
+        for (int k = 0; k < 2; ++k) {
+            if (p[k]->count == 0) {
+                printf(" %25s", "-");
+            } else {
+                printf(" %7.1f/%8.1f/%8.1f", us(p[k]->min, res->tick_ns),
+                       us(p[k]->sum, res->tick_ns) / p[k]->count, us(p[k]->max, res->tick_ns));
+            }
+        }
+        printf(" %9llu\n", (unsigned long long)l->glitches);
+    }
+    printf("duty %%");
+    for (unsigned int b = 0; b < GPIO_ANALYZE_DUTY_BINS; ++b) {
+        printf(" %5u-", b * 100 / GPIO_ANALYZE_DUTY_BINS);
+    }
+    printf("\n");
+    for (unsigned int i = 0; i < res->lines; ++i) {
+        printf("%6u", res->line[i].gpio_nr);
+        for (unsigned int b = 0; b < GPIO_ANALYZE_DUTY_BINS; ++b) {
+            printf(" %6llu", (unsigned long long)res->line[i].duty[b]);
+        }
+        printf("\n");
+    }
+}
+
+struct ds1302_print {
+    uint64_t tick_ns;
+    uint64_t start_tick;
+    unsigned int count;
+    unsigned int slow;          /* transactions breaking a timing minimum */
+};
+
+static int print_ds1302(const struct gpio_analyze_ds1302 *xfer, void *data)
+{
+    struct ds1302_print *p = (struct ds1302_print *)data;
+    unsigned int addr = (xfer->cmd >> 1) & 0x1f;
+    char reg[16];
+    if (addr == 31) {
+        (void)snprintf(reg, sizeof(reg), "burst");
+    } else if ((xfer->cmd & 0x40) == 0 && addr < sizeof(ds1302_regs) / sizeof(ds1302_regs[0])) {
+        (void)snprintf(reg, sizeof(reg), "%s", ds1302_regs[addr]);
+    } else {
+        (void)snprintf(reg, sizeof(reg), "%u", addr);
+    }
+    uint64_t ns = p->tick_ns;
+    bool slow = xfer->bits != 0 && (xfer->setup_ticks * ns < DS1302_SETUP_MIN_NS ||
+                                   xfer->clk_high_ticks * ns < DS1302_CLK_MIN_NS ||
+                                   xfer->clk_low_ticks * ns < DS1302_CLK_MIN_NS);
+    printf("%12.1f %3s %-5s %-7s", us(xfer->start_tick - p->start_tick, ns),
+           (xfer->cmd & 0x80) == 0 ? "bad" : (xfer->cmd & 1) ? "rd" : "wr", (xfer->cmd & 0x40) ? "ram" : "clock",
+           reg);
+    unsigned int kept = xfer->bytes < GPIO_ANALYZE_DS1302_DATA ? xfer->bytes : GPIO_ANALYZE_DS1302_DATA;
+    for (unsigned int i = 0; i < kept; ++i) {
+        printf(" %02x", xfer->data[i]);
+    }
+    printf("%s  setup %.1f us clk %.1f/%.1f us%s\n", xfer->bits % 8 != 0 ? " (partial byte)" : "",
+           us(xfer->setup_ticks, ns), us(xfer->clk_high_ticks, ns), us(xfer->clk_low_ticks, ns),
+           slow ? "  too fast" : "");
+    ++p->count;
+    p->slow += slow ? 1 : 0;
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-g glitch_ns] [-d clk,dat,rst] file\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    unsigned int threads = 0;
+    uint64_t glitch_ns = 0;
+    unsigned int ds[3];
+    bool decode = false;
+    struct gpio_capture_file file;
+    static struct gpio_analyze_result res;
+    while ((opt = getopt(argc, argv, "t:g:d:")) != -1) {
+        switch (opt) {
+            case 't':
+                threads = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'g':
+                glitch_ns = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                decode = sscanf(optarg, "%u,%u,%u", &ds[0], &ds[1], &ds[2]) == 3;
+                if (!decode) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (gpio_capture_map(argv[optind], &file) != 0) {
+        return 1;
+    }
+    int ret = gpio_analyze_lines(&file, threads, glitch_ns, &res);
+    if (ret == 0) {
+        print_lines(&res);
+    }
+    if (ret == 0 && decode) {
+        struct ds1302_print p = { .tick_ns = res.tick_ns, .start_tick = res.first_tick };
+        printf("ds1302 on clk %u dat %u rst %u\n", ds[0], ds[1], ds[2]);
+        ret = gpio_analyze_ds1302(&file, ds[0], ds[1], ds[2], print_ds1302, &p);
+        printf("%u transactions, %u too fast\n", p.count, p.slow);
+    }
+    gpio_capture_unmap(&file);
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+/*
+ * Plays a capture file back onto the lines it was taken from, through the
+ * first backend that opens them of mmio, cdev and sysfs unless one is
+ * named. Prints the lateness of the run and, with -v, of every event.
+ *
+ *   gpioplay [-b mmio|cdev|sysfs] [-l loops] [-v] file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpio_play.h"
+
+static const char *backends[GPIO_BACKEND_MAX] = { "sysfs", "cdev", "mmio" };
+
+static int cmp_late(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* the lines of the capture as outputs, on the backend asked for or the fastest that has them */
+static gpio_set *open_lines(const struct gpio_capture_file *file, int backend, struct gpio_ops **ops)
+{
+    for (int b = GPIO_BACKEND_MAX - 1; b >= 0; --b) {
+        if (backend >= 0 && b != backend) {
+            continue;
+        }
+        gpio_set_backend((enum gpio_backend)b);
+        *ops = get_gpio_ops();
+        gpio_set *set = (*ops)->set_open(file->header->gpio_nr, file->header->lines);
+        if (set == NULL) {
+            continue;
+        }
+        uint64_t all = file->header->lines == GPIO_SET_MAX ? ~0ull : (1ull << file->header->lines) - 1;
+        if ((*ops)->set_directions(set, all, all) == 0) {
+            printf("%u lines on %s\n", file->header->lines, backends[b]);
+            return set;
+        }
+        (*ops)->set_close(set);
+    }
+    return NULL;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-b mmio|cdev|sysfs] [-l loops] [-v] file\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    int backend = -1;
+    unsigned int loops = 1;
+    bool verbose = false;
+    struct gpio_capture_file file;
+    struct gpio_play_stats stats;
+    struct gpio_ops *ops;
+    while ((opt = getopt(argc, argv, "b:l:v")) != -1) {
+        switch (opt) {
+            case 'b':
+                for (backend = GPIO_BACKEND_MAX - 1; backend >= 0 && strcmp(optarg, backends[backend]) != 0;) {
+                    --backend;
+                }
+                if (backend < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+                loops = (unsigned int)strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (gpio_capture_map(argv[optind], &file) != 0) {
+        return 1;
+    }
+    int ret = 1;
+    uint32_t *late = NULL;
+    unsigned int count = 0;
+    struct gpio_play *play = NULL;
+    gpio_set *set = open_lines(&file, backend, &ops);
+    if (set == NULL) {
+        fprintf(stderr, "no backend opens the captured lines\n");
+        goto unmap;
+    }
+    play = gpio_play_from_capture(ops, set, &file);
+    if (play == NULL) {
+        goto close;
+    }
+    const struct gpio_play_event *events = gpio_play_events(play, &count);
+    late = (uint32_t *)malloc(sizeof(*late) * count);
+    if (late == NULL || gpio_play_run(play, loops, late, &stats) != 0) {
+        goto close;
+    }
+    if (verbose) {
+        for (unsigned int i = 0; i < count; ++i) {
+            printf("%14.3f us %016llx %016llx late %.1f us\n", events[i].at_ns / 1e3,
+                   (unsigned long long)events[i].mask, (unsigned long long)events[i].bits, late[i] / 1e3);
+        }
+    }
+    qsort(late, count, sizeof(*late), cmp_late);
+    printf("%llu events in %llu loops, %.3f s, %.0f events/s\n", (unsigned long long)stats.events,
+           (unsigned long long)stats.loops, stats.elapsed_ns / 1e9, stats.events * 1e9 / stats.elapsed_ns);
+    printf("late us mean %.1f p50 %.1f p99 %.1f max %.1f\n", stats.late_sum_ns / 1e3 / stats.events,
+           late[count / 2] / 1e3, late[count * 99 / 100] / 1e3, stats.late_max_ns / 1e3);
+    ret = 0;
+close:
+    free(late);
+    if (play != NULL) {
+        gpio_play_destroy(play);
+    }
+    ops->set_close(set);
+unmap:
+    gpio_capture_unmap(&file);
+    return ret;
+}
@@ -1,5 +1,9 @@
 #include "touch.h"
 #include "gpio.h"
+#include "gpio_loop.h"
+
+/* contact bounce of the touch pad dies out well within this */
+#define TOUCH_SETTLE_US 10000
 
 static int control_light(enum gpio_value signal, void *data)
 {
@@ -30,9 +34,10 @@ int touch(void)
         gpio_err("set io direction failed\n/");
         goto close_irq;
     }
-    ret = ops->set_edge(irq_input, GPIO_BOTH);
+    struct gpio_debounce debounce = { .mode = GPIO_DEBOUNCE_SETTLE, .period_us = TOUCH_SETTLE_US };
+    ret = ops->set_debounce(irq_input, &debounce);
     if (ret != 0) {
-        gpio_err("set irq edge failed\n");
+        gpio_err("set debounce failed\n");
         goto close_irq;
     }
     gpio *led = ops->open(26);
@@ -46,11 +51,24 @@ int touch(void)
         gpio_err("set io direction failed\n");
         goto close_led;
     }
-    ret = ops->handle_irq(irq_input, control_light, led);
+    struct gpio_loop *loop = gpio_loop_create();
+    ret = loop == NULL;
     if (ret != 0) {
-        gpio_err("handle irq failed\n");
+        gpio_err("create irq loop failed\n");
         goto close_led;
     }
+    ret = gpio_loop_add(loop, irq_input, GPIO_BOTH, control_light, led);
+    if (ret != 0) {
+        gpio_err("set irq edge failed\n");
+        goto destroy_loop;
+    }
+    ret = gpio_loop_run(loop);
+    if (ret != 0) {
+        gpio_err("handle irq failed\n");
+        goto destroy_loop;
+    }
+destroy_loop:
+    gpio_loop_destroy(loop);
 close_led:
     ops->close(led);
 close_irq: